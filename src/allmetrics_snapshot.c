@@ -0,0 +1,224 @@
+#include "common.h"
+
+#define ALLMETRICS_SNAPSHOT_FORMATS 2
+
+struct allmetrics_snapshot {
+    int format;
+    time_t tick;                                    // the tick the snapshot was rendered at
+
+    int rendering;                                  // set while the snapshot is being rendered
+    int current;                                    // set while the snapshot is the current one of its format
+    size_t refcount;                                // the number of requests using the snapshot
+
+    char *data;
+    size_t len;
+
+    char *gzip;                                     // the gzipped data, NULL when they could not be compressed
+    size_t gzip_len;
+};
+
+static struct allmetrics_snapshots {
+    int seconds;                                    // the duration of a tick, 0 = snapshots are disabled
+
+    struct allmetrics_snapshot *current[ALLMETRICS_SNAPSHOT_FORMATS];
+
+    struct allmetrics_snapshot_statistics stats;
+} allmetrics_snapshots = {
+        .seconds = 0,
+        .current = { NULL, NULL }
+};
+
+static pthread_mutex_t allmetrics_snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t allmetrics_snapshot_cond = PTHREAD_COND_INITIALIZER;
+
+void allmetrics_snapshot_init(void) {
+    long long n = config_get_number("global", "web api allmetrics snapshot seconds", rrd_update_every);
+    if(n < 0) {
+        error("Invalid web api allmetrics snapshot seconds %lld. Disabling the snapshots.", n);
+        n = 0;
+    }
+
+    allmetrics_snapshots.seconds = (int)n;
+}
+
+int allmetrics_snapshot_enabled(void) {
+    return (allmetrics_snapshots.seconds)?1:0;
+}
+
+void allmetrics_snapshot_statistics(struct allmetrics_snapshot_statistics *ass) {
+    pthread_mutex_lock(&allmetrics_snapshot_mutex);
+    memcpy(ass, &allmetrics_snapshots.stats, sizeof(struct allmetrics_snapshot_statistics));
+    pthread_mutex_unlock(&allmetrics_snapshot_mutex);
+}
+
+// ----------------------------------------------------------------------------
+// snapshots management
+// all of these have to be called with the mutex locked
+
+static inline void allmetrics_snapshot_free(struct allmetrics_snapshot *s) {
+    freez(s->data);
+    freez(s->gzip);
+    freez(s);
+}
+
+// stop serving a snapshot
+// it is freed when the last request using it releases it
+static inline void allmetrics_snapshot_retire(struct allmetrics_snapshot *s) {
+    if(unlikely(!s->current)) return;
+
+    allmetrics_snapshots.current[s->format - 1] = NULL;
+    s->current = 0;
+
+    if(!s->refcount)
+        allmetrics_snapshot_free(s);
+}
+
+static inline void allmetrics_snapshot_release(struct allmetrics_snapshot *s) {
+    s->refcount--;
+
+    if(!s->current && !s->refcount)
+        allmetrics_snapshot_free(s);
+}
+
+// ----------------------------------------------------------------------------
+// rendering
+
+static void allmetrics_snapshot_render(struct allmetrics_snapshot *s) {
+    BUFFER *wb = buffer_create(16384);
+
+    if(s->format == ALLMETRICS_PROMETHEUS)
+        rrd_stats_api_v1_charts_allmetrics_prometheus(wb);
+    else
+        rrd_stats_api_v1_charts_allmetrics_shell(wb);
+
+    s->len = buffer_strlen(wb);
+    s->data = mallocz(s->len + 1);
+    memcpy(s->data, buffer_tostring(wb), s->len + 1);
+
+    buffer_free(wb);
+
+#ifdef NETDATA_WITH_ZLIB
+    if(!web_enable_gzip) return;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(z_stream));
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+
+    // Select GZIP compression: windowbits = 15 + 16 = 31
+    if(deflateInit2(&zs, web_gzip_level, Z_DEFLATED, 15 + 16, 8, web_gzip_strategy) != Z_OK) {
+        error("ALLMETRICS: Failed to initialize zlib. The snapshot will not be compressed.");
+        return;
+    }
+
+    size_t size = deflateBound(&zs, (uLong)s->len);
+    s->gzip = mallocz(size);
+
+    zs.next_in = (Bytef *)s->data;
+    zs.avail_in = (uInt)s->len;
+    zs.next_out = (Bytef *)s->gzip;
+    zs.avail_out = (uInt)size;
+
+    if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        error("ALLMETRICS: Failed to compress the snapshot.");
+        freez(s->gzip);
+        s->gzip = NULL;
+    }
+    else
+        s->gzip_len = (size_t)zs.total_out;
+
+    deflateEnd(&zs);
+#endif /* NETDATA_WITH_ZLIB */
+}
+
+// ----------------------------------------------------------------------------
+// requests
+
+static inline int allmetrics_snapshot_to_buffer(struct allmetrics_snapshot *s, BUFFER *wb, int gzip) {
+    const char *data = s->data;
+    size_t len = s->len;
+
+    gzip = (gzip && s->gzip)?1:0;
+    if(gzip) {
+        data = s->gzip;
+        len = s->gzip_len;
+    }
+
+    buffer_need_bytes(wb, len + 1);
+    memcpy(&wb->buffer[wb->len], data, len);
+    wb->len += len;
+    wb->buffer[wb->len] = '\0';
+
+    return gzip;
+}
+
+int allmetrics_snapshot(BUFFER *wb, int format, int gzip)
+{
+    if(unlikely(!allmetrics_snapshots.seconds || format < 1 || format > ALLMETRICS_SNAPSHOT_FORMATS)) {
+        if(format == ALLMETRICS_PROMETHEUS)
+            rrd_stats_api_v1_charts_allmetrics_prometheus(wb);
+        else
+            rrd_stats_api_v1_charts_allmetrics_shell(wb);
+
+        return 0;
+    }
+
+    time_t tick = now_realtime_sec() / allmetrics_snapshots.seconds;
+
+    pthread_mutex_lock(&allmetrics_snapshot_mutex);
+
+    struct allmetrics_snapshot *s = allmetrics_snapshots.current[format - 1];
+    if(s && !s->rendering && s->tick != tick) {
+        debug(D_WEB_CLIENT, "ALLMETRICS: the snapshot of format %d is obsolete.", format);
+        allmetrics_snapshot_retire(s);
+        s = NULL;
+    }
+
+    if(s) {
+        s->refcount++;
+
+        if(s->rendering) {
+            // another request is rendering it - wait for it
+            allmetrics_snapshots.stats.shared++;
+            while(s->rendering)
+                pthread_cond_wait(&allmetrics_snapshot_cond, &allmetrics_snapshot_mutex);
+        }
+        else
+            allmetrics_snapshots.stats.hits++;
+    }
+    else {
+        allmetrics_snapshots.stats.renders++;
+
+        s = callocz(1, sizeof(struct allmetrics_snapshot));
+        s->format = format;
+        s->tick = tick;
+        s->rendering = 1;
+        s->current = 1;
+        s->refcount = 1;
+        allmetrics_snapshots.current[format - 1] = s;
+
+        pthread_mutex_unlock(&allmetrics_snapshot_mutex);
+
+        allmetrics_snapshot_render(s);
+
+        pthread_mutex_lock(&allmetrics_snapshot_mutex);
+        s->rendering = 0;
+        pthread_cond_broadcast(&allmetrics_snapshot_cond);
+    }
+
+    if(gzip && s->gzip)
+        allmetrics_snapshots.stats.gzipped++;
+
+    pthread_mutex_unlock(&allmetrics_snapshot_mutex);
+
+    // the snapshot is not modified after it has been rendered
+    // and it cannot be freed while we hold a reference to it
+    int ret = allmetrics_snapshot_to_buffer(s, wb, gzip);
+
+    pthread_mutex_lock(&allmetrics_snapshot_mutex);
+    allmetrics_snapshot_release(s);
+    pthread_mutex_unlock(&allmetrics_snapshot_mutex);
+
+    return ret;
+}
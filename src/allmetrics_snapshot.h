@@ -0,0 +1,29 @@
+#ifndef NETDATA_ALLMETRICS_SNAPSHOT_H
+#define NETDATA_ALLMETRICS_SNAPSHOT_H 1
+
+// ----------------------------------------------------------------------------
+// /api/v1/allmetrics snapshots
+//
+// the output of each allmetrics format is rendered once per tick (the data
+// collection frequency, by default) and all the requests of the same tick
+// share it. Snapshots are immutable - a new one replaces the current one on
+// the next tick and the old one is freed when its last request releases it.
+// A gzipped copy of each snapshot is kept for the clients that accept it.
+
+struct allmetrics_snapshot_statistics {
+    unsigned long long renders;                     // the snapshots rendered
+    unsigned long long hits;                        // the requests served from a snapshot already rendered
+    unsigned long long shared;                      // the requests that waited for another request to render the snapshot
+    unsigned long long gzipped;                     // the requests served with the gzipped copy of a snapshot
+};
+
+extern void allmetrics_snapshot_init(void);
+extern int allmetrics_snapshot_enabled(void);
+extern void allmetrics_snapshot_statistics(struct allmetrics_snapshot_statistics *ass);
+
+// append the allmetrics output of format (ALLMETRICS_SHELL or ALLMETRICS_PROMETHEUS) to wb
+// when gzip is set, the gzipped copy of the snapshot is appended, if there is one.
+// returns 1 when the data appended are gzipped, 0 otherwise.
+extern int allmetrics_snapshot(BUFFER *wb, int format, int gzip);
+
+#endif /* NETDATA_ALLMETRICS_SNAPSHOT_H */
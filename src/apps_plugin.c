@@ -2341,7 +2341,7 @@ static void calculate_netdata_statistics(void) {
 // ----------------------------------------------------------------------------
 // update chart dimensions
 
-int print_calculated_number(char *str, calculated_number value) { (void)str; (void)value; return 0; }
+int print_calculated_number_decimals(char *str, calculated_number value, int decimals) { (void)str; (void)value; (void)decimals; return 0; }
 
 static inline void send_BEGIN(const char *type, const char *id, usec_t usec) {
     fprintf(stdout, "BEGIN %s.%s %llu\n", type, id, usec);
@@ -4,6 +4,9 @@
 #define BACKEND_SOURCE_DATA_AVERAGE      0x00000002
 #define BACKEND_SOURCE_DATA_SUM          0x00000004
 
+// the decimal digits of the values sent, trailing zeros are not sent
+#define BACKEND_VALUE_DECIMALS 7
+
 static inline calculated_number backend_calculate_value_from_stored_data(RRDSET *st, RRDDIM *rd, time_t after, time_t before, uint32_t options) {
     time_t first_t = rrdset_first_entry_t(st);
     time_t last_t = rrdset_last_entry_t(st);
@@ -31,21 +34,19 @@ static inline calculated_number backend_calculate_value_from_stored_data(RRDSET
     size_t counter = 0;
     calculated_number sum = 0;
 
-    long    start_at_slot = rrdset_time2slot(st, before),
-            stop_at_slot  = rrdset_time2slot(st, after),
-            slot, stop_now = 0;
-
-    for(slot = start_at_slot; !stop_now ; slot--) {
-        if(unlikely(slot < 0)) slot = st->entries - 1;
-        if(unlikely(slot == stop_at_slot)) stop_now = 1;
+    RRDDIM_QUERY_HANDLE handle;
+    size_t i, count;
 
-        storage_number n = rd->values[slot];
-        if(unlikely(!does_storage_number_exist(n))) continue;
+    rrddim_query_init(rd, &handle, after, before);
+    while((count = rrddim_query_next(&handle))) {
+        for(i = 0; i < count ; i++) {
+            if(unlikely(!does_storage_number_exist(handle.flags[i]))) continue;
 
-        calculated_number value = unpack_storage_number(n);
-        sum += value;
-        counter++;
+            sum += handle.v[i];
+            counter++;
+        }
     }
+    rrddim_query_finalize(&handle);
 
     if(unlikely(!counter))
         return NAN;
@@ -61,7 +62,11 @@ static inline int format_dimension_collected_graphite_plaintext(BUFFER *b, const
     (void)after;
     (void)before;
     (void)options;
-    buffer_sprintf(b, "%s.%s.%s.%s " COLLECTED_NUMBER_FORMAT " %u\n", prefix, hostname, st->id, rd->id, rd->last_collected_value, (uint32_t)rd->last_collected_time.tv_sec);
+    buffer_sprintf(b, "%s.%s.%s.%s ", prefix, hostname, st->id, rd->id);
+    buffer_print_ll(b, rd->last_collected_value);
+    buffer_strcat(b, " ");
+    buffer_print_llu(b, (uint32_t)rd->last_collected_time.tv_sec);
+    buffer_strcat(b, "\n");
     return 1;
 }
 
@@ -69,7 +74,11 @@ static inline int format_dimension_stored_graphite_plaintext(BUFFER *b, const ch
     (void)host;
     calculated_number value = backend_calculate_value_from_stored_data(st, rd, after, before, options);
     if(!isnan(value)) {
-        buffer_sprintf(b, "%s.%s.%s.%s " CALCULATED_NUMBER_FORMAT " %u\n", prefix, hostname, st->id, rd->id, value, (uint32_t) before);
+        buffer_sprintf(b, "%s.%s.%s.%s ", prefix, hostname, st->id, rd->id);
+        buffer_rrd_value_decimals(b, value, BACKEND_VALUE_DECIMALS);
+        buffer_strcat(b, " ");
+        buffer_print_llu(b, (uint32_t) before);
+        buffer_strcat(b, "\n");
         return 1;
     }
     return 0;
@@ -80,7 +89,9 @@ static inline int format_dimension_collected_opentsdb_telnet(BUFFER *b, const ch
     (void)after;
     (void)before;
     (void)options;
-    buffer_sprintf(b, "put %s.%s.%s %u " COLLECTED_NUMBER_FORMAT " host=%s\n", prefix, st->id, rd->id, (uint32_t)rd->last_collected_time.tv_sec, rd->last_collected_value, hostname);
+    buffer_sprintf(b, "put %s.%s.%s %u ", prefix, st->id, rd->id, (uint32_t)rd->last_collected_time.tv_sec);
+    buffer_print_ll(b, rd->last_collected_value);
+    buffer_sprintf(b, " host=%s\n", hostname);
     return 1;
 }
 
@@ -88,7 +99,9 @@ static inline int format_dimension_stored_opentsdb_telnet(BUFFER *b, const char
     (void)host;
     calculated_number value = backend_calculate_value_from_stored_data(st, rd, after, before, options);
     if(!isnan(value)) {
-        buffer_sprintf(b, "put %s.%s.%s %u " CALCULATED_NUMBER_FORMAT " host=%s\n", prefix, st->id, rd->id, (uint32_t) before, value, hostname);
+        buffer_sprintf(b, "put %s.%s.%s %u ", prefix, st->id, rd->id, (uint32_t) before);
+        buffer_rrd_value_decimals(b, value, BACKEND_VALUE_DECIMALS);
+        buffer_sprintf(b, " host=%s\n", hostname);
         return 1;
     }
     return 0;
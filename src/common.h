@@ -71,6 +71,11 @@
 #include <sys/prctl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -205,7 +210,13 @@
 #include "eval.h"
 #include "health.h"
 #include "rrd.h"
+#include "storage_engine.h"
+#include "percentile.h"
 #include "rrd2json.h"
+#include "query_cache.h"
+#include "query_pool.h"
+#include "query_cost.h"
+#include "allmetrics_snapshot.h"
 #include "web_client.h"
 #include "web_server.h"
 #include "registry.h"
@@ -38,7 +38,7 @@ void finished_web_request_statistics(uint64_t dt,
     __atomic_fetch_add(&global_statistics.compressed_content_size, compressed_content_size, __ATOMIC_SEQ_CST);
 #else
 #warning NOT using atomic operations - using locks for global statistics
-    if (web_server_mode == WEB_SERVER_MODE_MULTI_THREADED)
+    if (web_server_mode != WEB_SERVER_MODE_SINGLE_THREADED)
         global_statistics_lock();
 
     if (dt > global_statistics.web_usec_max)
@@ -51,7 +51,7 @@ void finished_web_request_statistics(uint64_t dt,
     global_statistics.content_size += content_size;
     global_statistics.compressed_content_size += compressed_content_size;
 
-    if (web_server_mode == WEB_SERVER_MODE_MULTI_THREADED)
+    if (web_server_mode != WEB_SERVER_MODE_SINGLE_THREADED)
         global_statistics_unlock();
 #endif
 }
@@ -60,12 +60,12 @@ void web_client_connected(void) {
 #if defined(HAVE_C___ATOMIC) && !defined(NETDATA_NO_ATOMIC_INSTRUCTIONS)
     __atomic_fetch_add(&global_statistics.connected_clients, 1, __ATOMIC_SEQ_CST);
 #else
-    if (web_server_mode == WEB_SERVER_MODE_MULTI_THREADED)
+    if (web_server_mode != WEB_SERVER_MODE_SINGLE_THREADED)
         global_statistics_lock();
 
     global_statistics.connected_clients++;
 
-    if (web_server_mode == WEB_SERVER_MODE_MULTI_THREADED)
+    if (web_server_mode != WEB_SERVER_MODE_SINGLE_THREADED)
         global_statistics_unlock();
 #endif
 }
@@ -74,12 +74,12 @@ void web_client_disconnected(void) {
 #if defined(HAVE_C___ATOMIC) && !defined(NETDATA_NO_ATOMIC_INSTRUCTIONS)
     __atomic_fetch_sub(&global_statistics.connected_clients, 1, __ATOMIC_SEQ_CST);
 #else
-    if (web_server_mode == WEB_SERVER_MODE_MULTI_THREADED)
+    if (web_server_mode != WEB_SERVER_MODE_SINGLE_THREADED)
         global_statistics_lock();
 
     global_statistics.connected_clients--;
 
-    if (web_server_mode == WEB_SERVER_MODE_MULTI_THREADED)
+    if (web_server_mode != WEB_SERVER_MODE_SINGLE_THREADED)
         global_statistics_unlock();
 #endif
 }
@@ -120,7 +120,10 @@ void global_statistics_charts(void) {
     static collected_number compression_ratio = -1, average_response_time = -1;
 
     static RRDSET *stcpu = NULL, *stcpu_thread = NULL, *stclients = NULL, *streqs = NULL, *stbytes = NULL, *stduration = NULL,
-            *stcompression = NULL;
+            *stcompression = NULL, *stcache = NULL, *stcache_memory = NULL,
+            *starena = NULL, *starena_memory = NULL,
+            *stqueries = NULL, *stquery_scan = NULL, *stquery_cpu = NULL, *stquery_output = NULL,
+            *stallmetrics = NULL;
 
     struct global_statistics gs;
     struct rusage me, thread;
@@ -259,4 +262,174 @@ void global_statistics_charts(void) {
         rrddim_set(stcompression, "savings", compression_ratio);
 
     rrdset_done(stcompression);
+
+    // ----------------------------------------------------------------
+
+    if(query_cache_enabled()) {
+        struct query_cache_statistics qcs;
+        query_cache_statistics(&qcs);
+
+        if (!stcache) stcache = rrdset_find("netdata.api_data_cache");
+        if (!stcache) {
+            stcache = rrdset_create("netdata", "api_data_cache", NULL, "netdata", NULL,
+                                    "NetData API Data Cache", "queries/s", 130600,
+                                    rrd_update_every, RRDSET_TYPE_STACKED);
+
+            rrddim_add(stcache, "hits", NULL, 1, 1, RRDDIM_INCREMENTAL);
+            rrddim_add(stcache, "shared", NULL, 1, 1, RRDDIM_INCREMENTAL);
+            rrddim_add(stcache, "misses", NULL, 1, 1, RRDDIM_INCREMENTAL);
+            rrddim_add(stcache, "evictions", NULL, -1, 1, RRDDIM_INCREMENTAL);
+        } else rrdset_next(stcache);
+
+        rrddim_set(stcache, "hits", (collected_number) qcs.hits);
+        rrddim_set(stcache, "shared", (collected_number) qcs.shared);
+        rrddim_set(stcache, "misses", (collected_number) qcs.misses);
+        rrddim_set(stcache, "evictions", (collected_number) qcs.evictions);
+        rrdset_done(stcache);
+
+        // ----------------------------------------------------------------
+
+        if (!stcache_memory) stcache_memory = rrdset_find("netdata.api_data_cache_memory");
+        if (!stcache_memory) {
+            stcache_memory = rrdset_create("netdata", "api_data_cache_memory", NULL, "netdata", NULL,
+                                           "NetData API Data Cache Memory", "KB", 130700,
+                                           rrd_update_every, RRDSET_TYPE_AREA);
+
+            rrddim_add(stcache_memory, "used", NULL, 1, 1024, RRDDIM_ABSOLUTE);
+        } else rrdset_next(stcache_memory);
+
+        rrddim_set(stcache_memory, "used", (collected_number) qcs.memory);
+        rrdset_done(stcache_memory);
+    }
+
+    // ----------------------------------------------------------------
+
+    struct rrdr_arena_statistics ras;
+    rrdr_arena_statistics(&ras);
+
+    if (!starena) starena = rrdset_find("netdata.api_query_arena");
+    if (!starena) {
+        starena = rrdset_create("netdata", "api_query_arena", NULL, "netdata", NULL,
+                                "NetData API Query Memory Reuse", "queries/s", 130800,
+                                rrd_update_every, RRDSET_TYPE_LINE);
+
+        rrddim_add(starena, "queries", NULL, 1, 1, RRDDIM_INCREMENTAL);
+        rrddim_add(starena, "reused", NULL, 1, 1, RRDDIM_INCREMENTAL);
+        rrddim_add(starena, "allocations", NULL, 1, 1, RRDDIM_INCREMENTAL);
+    } else rrdset_next(starena);
+
+    rrddim_set(starena, "queries", (collected_number) ras.queries);
+    rrddim_set(starena, "reused", (collected_number) ras.reused);
+    rrddim_set(starena, "allocations", (collected_number) ras.allocations);
+    rrdset_done(starena);
+
+    // ----------------------------------------------------------------
+
+    if (!starena_memory) starena_memory = rrdset_find("netdata.api_query_arena_memory");
+    if (!starena_memory) {
+        starena_memory = rrdset_create("netdata", "api_query_arena_memory", NULL, "netdata", NULL,
+                                       "NetData API Query Memory", "KB", 130900,
+                                       rrd_update_every, RRDSET_TYPE_AREA);
+
+        rrddim_add(starena_memory, "kept", NULL, 1, 1024, RRDDIM_ABSOLUTE);
+    } else rrdset_next(starena_memory);
+
+    rrddim_set(starena_memory, "kept", (collected_number) ras.memory);
+    rrdset_done(starena_memory);
+
+    // ----------------------------------------------------------------
+
+    struct query_cost_statistics qcost;
+    query_cost_statistics(&qcost);
+
+    if (!stqueries) stqueries = rrdset_find("netdata.api_queries");
+    if (!stqueries) {
+        stqueries = rrdset_create("netdata", "api_queries", NULL, "netdata", NULL,
+                                  "NetData API Queries", "queries/s", 131000,
+                                  rrd_update_every, RRDSET_TYPE_LINE);
+
+        rrddim_add(stqueries, "queries", NULL, 1, 1, RRDDIM_INCREMENTAL);
+        rrddim_add(stqueries, "expensive", NULL, 1, 1, RRDDIM_INCREMENTAL);
+        rrddim_add(stqueries, "queued", NULL, 1, 1, RRDDIM_INCREMENTAL);
+        rrddim_add(stqueries, "rejected", NULL, -1, 1, RRDDIM_INCREMENTAL);
+        rrddim_add(stqueries, "cancelled", NULL, -1, 1, RRDDIM_INCREMENTAL);
+    } else rrdset_next(stqueries);
+
+    rrddim_set(stqueries, "queries", (collected_number) qcost.queries);
+    rrddim_set(stqueries, "expensive", (collected_number) qcost.expensive);
+    rrddim_set(stqueries, "queued", (collected_number) qcost.queued);
+    rrddim_set(stqueries, "rejected", (collected_number) qcost.rejected);
+    rrddim_set(stqueries, "cancelled", (collected_number) qcost.cancelled);
+    rrdset_done(stqueries);
+
+    // ----------------------------------------------------------------
+
+    if (!stquery_scan) stquery_scan = rrdset_find("netdata.api_query_scan");
+    if (!stquery_scan) {
+        stquery_scan = rrdset_create("netdata", "api_query_scan", NULL, "netdata", NULL,
+                                     "NetData API Queries Scanned Database", "values/s", 131100,
+                                     rrd_update_every, RRDSET_TYPE_LINE);
+
+        rrddim_add(stquery_scan, "slots", NULL, 1, 1, RRDDIM_INCREMENTAL);
+        rrddim_add(stquery_scan, "dimensions", NULL, 1, 1, RRDDIM_INCREMENTAL);
+        rrddim_add(stquery_scan, "saved", NULL, -1, 1, RRDDIM_INCREMENTAL);
+    } else rrdset_next(stquery_scan);
+
+    rrddim_set(stquery_scan, "slots", (collected_number) qcost.slots);
+    rrddim_set(stquery_scan, "dimensions", (collected_number) qcost.dimensions);
+    rrddim_set(stquery_scan, "saved", (collected_number) qcost.saved);
+    rrdset_done(stquery_scan);
+
+    // ----------------------------------------------------------------
+
+    if (!stquery_cpu) stquery_cpu = rrdset_find("netdata.api_query_cpu");
+    if (!stquery_cpu) {
+        stquery_cpu = rrdset_create("netdata", "api_query_cpu", NULL, "netdata", NULL,
+                                    "NetData API Queries CPU Time", "milliseconds/s", 131200,
+                                    rrd_update_every, RRDSET_TYPE_AREA);
+
+        rrddim_add(stquery_cpu, "cpu", NULL, 1, 1000, RRDDIM_INCREMENTAL);
+    } else rrdset_next(stquery_cpu);
+
+    rrddim_set(stquery_cpu, "cpu", (collected_number) qcost.cpu_usec);
+    rrdset_done(stquery_cpu);
+
+    // ----------------------------------------------------------------
+
+    if (!stquery_output) stquery_output = rrdset_find("netdata.api_query_output");
+    if (!stquery_output) {
+        stquery_output = rrdset_create("netdata", "api_query_output", NULL, "netdata", NULL,
+                                       "NetData API Queries Output", "kilobytes/s", 131300,
+                                       rrd_update_every, RRDSET_TYPE_AREA);
+
+        rrddim_add(stquery_output, "output", NULL, 1, 1024, RRDDIM_INCREMENTAL);
+    } else rrdset_next(stquery_output);
+
+    rrddim_set(stquery_output, "output", (collected_number) qcost.bytes);
+    rrdset_done(stquery_output);
+
+    // ----------------------------------------------------------------
+
+    if(allmetrics_snapshot_enabled()) {
+        struct allmetrics_snapshot_statistics ass;
+        allmetrics_snapshot_statistics(&ass);
+
+        if (!stallmetrics) stallmetrics = rrdset_find("netdata.api_allmetrics");
+        if (!stallmetrics) {
+            stallmetrics = rrdset_create("netdata", "api_allmetrics", NULL, "netdata", NULL,
+                                         "NetData API Allmetrics Snapshots", "requests/s", 131400,
+                                         rrd_update_every, RRDSET_TYPE_STACKED);
+
+            rrddim_add(stallmetrics, "hits", NULL, 1, 1, RRDDIM_INCREMENTAL);
+            rrddim_add(stallmetrics, "shared", NULL, 1, 1, RRDDIM_INCREMENTAL);
+            rrddim_add(stallmetrics, "renders", NULL, 1, 1, RRDDIM_INCREMENTAL);
+            rrddim_add(stallmetrics, "gzipped", NULL, -1, 1, RRDDIM_INCREMENTAL);
+        } else rrdset_next(stallmetrics);
+
+        rrddim_set(stallmetrics, "hits", (collected_number) ass.hits);
+        rrddim_set(stallmetrics, "shared", (collected_number) ass.shared);
+        rrddim_set(stallmetrics, "renders", (collected_number) ass.renders);
+        rrddim_set(stallmetrics, "gzipped", (collected_number) ass.gzipped);
+        rrdset_done(stallmetrics);
+    }
 }
@@ -54,19 +54,33 @@ struct netdata_static_thread static_threads[] = {
     {"plugins.d",           NULL,       NULL,         1, NULL, NULL, pluginsd_main},
     {"web",                 NULL,       NULL,         1, NULL, NULL, socket_listen_main_multi_threaded},
     {"web-single-threaded", NULL,       NULL,         0, NULL, NULL, socket_listen_main_single_threaded},
+#ifdef HAVE_SYS_EPOLL_H
+    {"web-epoll",           NULL,       NULL,         0, NULL, NULL, socket_listen_main_epoll},
+#endif /* HAVE_SYS_EPOLL_H */
     {NULL,                  NULL,       NULL,         0, NULL, NULL, NULL}
 };
 
 void web_server_threading_selection(void) {
-    int threaded = config_get_boolean("global", "multi threaded web server", 1);
+    // the configurations that set 'multi threaded web server', the option
+    // before 'web server mode', keep the web server they asked for
+    int mode = WEB_SERVER_MODE_DEFAULT;
+    if(config_exists("global", "multi threaded web server"))
+        mode = (config_get_boolean("global", "multi threaded web server", 1))?WEB_SERVER_MODE_MULTI_THREADED:WEB_SERVER_MODE_SINGLE_THREADED;
+
+    mode = web_server_mode_id(config_get("global", "web server mode", web_server_mode_name(mode)));
 
     int i;
     for(i = 0; static_threads[i].name ; i++) {
         if(static_threads[i].start_routine == socket_listen_main_multi_threaded)
-            static_threads[i].enabled = threaded?1:0;
+            static_threads[i].enabled = (mode == WEB_SERVER_MODE_MULTI_THREADED)?1:0;
 
         if(static_threads[i].start_routine == socket_listen_main_single_threaded)
-            static_threads[i].enabled = threaded?0:1;
+            static_threads[i].enabled = (mode == WEB_SERVER_MODE_SINGLE_THREADED)?1:0;
+
+#ifdef HAVE_SYS_EPOLL_H
+        if(static_threads[i].start_routine == socket_listen_main_epoll)
+            static_threads[i].enabled = (mode == WEB_SERVER_MODE_EPOLL)?1:0;
+#endif /* HAVE_SYS_EPOLL_H */
     }
 
     web_client_timeout = (int) config_get_number("global", "disconnect idle web clients after seconds", DEFAULT_DISCONNECT_IDLE_WEB_CLIENTS_AFTER_SECONDS);
@@ -158,7 +172,10 @@ void kill_childs()
     struct web_client *w;
     for(w = web_clients; w ; w = w->next) {
         info("Stopping web client %s", w->client_ip);
-        pthread_cancel(w->thread);
+
+        // only the multi-threaded web server has a thread per client
+        if(web_server_mode == WEB_SERVER_MODE_MULTI_THREADED)
+            pthread_cancel(w->thread);
         // it is detached
         // pthread_join(w->thread, NULL);
 
@@ -819,6 +836,11 @@ int main(int argc, char **argv) {
     // spawn the threads
 
     web_server_threading_selection();
+    query_cache_init();
+    rrdr_arena_init();
+    query_pool_init();
+    query_cost_init();
+    allmetrics_snapshot_init();
 
     for (i = 0; static_threads[i].name != NULL ; i++) {
         struct netdata_static_thread *st = &static_threads[i];
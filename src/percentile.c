@@ -0,0 +1,140 @@
+#include "common.h"
+
+static int percentile_compare(const void *a, const void *b) {
+    calculated_number x = *(const calculated_number *)a, y = *(const calculated_number *)b;
+    return (x < y)?-1:(x > y)?1:0;
+}
+
+// move the k-th smallest value to values[k]
+// smaller values are moved before it and larger after it
+static void percentile_select(calculated_number *values, long count, long k) {
+    long left = 0, right = count - 1;
+
+    while(right > left) {
+        calculated_number pivot = values[(left + right) / 2], tmp;
+        long i = left, j = right;
+
+        while(i <= j) {
+            while(values[i] < pivot) i++;
+            while(values[j] > pivot) j--;
+
+            if(i <= j) {
+                tmp = values[i];
+                values[i] = values[j];
+                values[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+
+        if(k <= j) right = j;
+        else if(k >= i) left = i;
+        else break;
+    }
+}
+
+// the desired position of marker i, 1 based
+static inline calculated_number percentile_marker_position(long count, calculated_number p, int i) {
+    switch(i) {
+        case 0: return 1;
+        case 1: return 1 + (count - 1) * p / 2;
+        case 2: return 1 + (count - 1) * p;
+        case 3: return 1 + (count - 1) * (1 + p) / 2;
+        default: return count;
+    }
+}
+
+void percentile_sketch_add_to_markers(PERCENTILE_SKETCH *s, calculated_number p, calculated_number value)
+{
+    long *n = s->n;
+    calculated_number *q = s->q;
+    int i, k;
+
+    if(unlikely(s->count == PERCENTILE_SKETCH_VALUES)) {
+        // place the markers at their desired positions of the values kept
+        qsort(s->values, PERCENTILE_SKETCH_VALUES, sizeof(calculated_number), percentile_compare);
+
+        for(i = 0; i < PERCENTILE_SKETCH_MARKERS ; i++)
+            n[i] = (long)roundl(percentile_marker_position(s->count, p, i));
+
+        // the markers have to be on different values
+        for(i = PERCENTILE_SKETCH_MARKERS - 2; i > 0 ; i--)
+            if(n[i] >= n[i + 1]) n[i] = n[i + 1] - 1;
+
+        for(i = 1; i < PERCENTILE_SKETCH_MARKERS - 1 ; i++)
+            if(n[i] <= n[i - 1]) n[i] = n[i - 1] + 1;
+
+        for(i = 0; i < PERCENTILE_SKETCH_MARKERS ; i++)
+            q[i] = s->values[n[i] - 1];
+    }
+
+    // find the cell the value falls in: q[k] <= value < q[k + 1]
+    // the minimum and the maximum are kept at the first and the last marker
+    if(unlikely(value < q[0])) {
+        q[0] = value;
+        k = 0;
+    }
+    else if(unlikely(value >= q[4])) {
+        q[4] = value;
+        k = 3;
+    }
+    else
+        for(k = 0; value >= q[k + 1] ; k++) ;
+
+    for(i = k + 1; i < PERCENTILE_SKETCH_MARKERS ; i++)
+        n[i]++;
+
+    long count = ++s->count;
+
+    // move the middle markers that are off their desired positions
+    for(i = 1; i < PERCENTILE_SKETCH_MARKERS - 1 ; i++) {
+        calculated_number d = percentile_marker_position(count, p, i) - n[i];
+
+        if((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+            int ds = (d > 0)?1:-1;
+
+            // try the piecewise parabolic prediction
+            calculated_number qp = q[i] + (calculated_number)ds / (n[i + 1] - n[i - 1]) * (
+                      (n[i] - n[i - 1] + ds) * (q[i + 1] - q[i]) / (n[i + 1] - n[i])
+                    + (n[i + 1] - n[i] - ds) * (q[i] - q[i - 1]) / (n[i] - n[i - 1])
+                    );
+
+            // fall back to a linear one, if the markers would not be ordered
+            if(likely(q[i - 1] < qp && qp < q[i + 1]))
+                q[i] = qp;
+            else
+                q[i] += ds * (q[i + ds] - q[i]) / (n[i + ds] - n[i]);
+
+            n[i] += ds;
+        }
+    }
+}
+
+calculated_number percentile_sketch_value(PERCENTILE_SKETCH *s, calculated_number p)
+{
+    if(unlikely(!s->count))
+        return NAN;
+
+    if(unlikely(s->count > PERCENTILE_SKETCH_VALUES))
+        return s->q[2];
+
+    // all the values are available
+    // interpolate between the two closest to the percentile
+    calculated_number position = p * (s->count - 1);
+    long i = (long)position;
+
+    percentile_select(s->values, s->count, i);
+    calculated_number value = s->values[i];
+
+    if(i < s->count - 1 && position > i) {
+        // the next one is the smallest of the larger values
+        calculated_number next = s->values[i + 1];
+        long j;
+        for(j = i + 2; j < s->count ; j++)
+            if(s->values[j] < next) next = s->values[j];
+
+        value += (position - i) * (next - value);
+    }
+
+    return value;
+}
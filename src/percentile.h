@@ -0,0 +1,46 @@
+#ifndef NETDATA_PERCENTILE_H
+#define NETDATA_PERCENTILE_H 1
+
+// ----------------------------------------------------------------------------
+// streaming percentiles
+//
+// a sketch keeps the first PERCENTILE_SKETCH_VALUES values it is given, so
+// the percentile of small groups is exact.
+// when more values are added, it switches to the P-square algorithm
+// (R. Jain and I. Chlamtac, 1985), that estimates the percentile without
+// keeping the values: it moves 5 markers towards the positions the minimum,
+// the percentile, the maximum and two points in between would have if the
+// values were sorted.
+// either way, the memory is constant, regardless of the number of values.
+
+#define PERCENTILE_SKETCH_VALUES 64
+#define PERCENTILE_SKETCH_MARKERS 5
+
+struct percentile_sketch {
+    long count;                                     // the number of values added
+
+    // up to PERCENTILE_SKETCH_VALUES values
+    calculated_number values[PERCENTILE_SKETCH_VALUES];
+
+    // after that
+    long n[PERCENTILE_SKETCH_MARKERS];              // the positions of the markers
+    calculated_number q[PERCENTILE_SKETCH_MARKERS]; // the heights of the markers
+};
+typedef struct percentile_sketch PERCENTILE_SKETCH;
+
+#define percentile_sketch_reset(s) (s)->count = 0
+
+extern void percentile_sketch_add_to_markers(PERCENTILE_SKETCH *s, calculated_number p, calculated_number value);
+
+// p is the percentile, 0 to 1, the same for all the values added to a sketch
+static inline void percentile_sketch_add(PERCENTILE_SKETCH *s, calculated_number p, calculated_number value) {
+    if(likely(s->count < PERCENTILE_SKETCH_VALUES))
+        s->values[s->count++] = value;
+    else
+        percentile_sketch_add_to_markers(s, p, value);
+}
+
+// the percentile - NAN when there are no values
+extern calculated_number percentile_sketch_value(PERCENTILE_SKETCH *s, calculated_number p);
+
+#endif /* NETDATA_PERCENTILE_H */
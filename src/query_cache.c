@@ -0,0 +1,342 @@
+#include "common.h"
+
+#define QUERY_CACHE_MAX_KEY 1024
+
+struct query_cache_entry {
+    avl avl;                                        // the index - it has to be first
+
+    uint32_t hash;                                  // a simple hash of the key
+    char *key;                                      // the chart and all the query parameters
+
+    unsigned long version;                          // the version of the chart the result was computed at
+
+    int computing;                                  // set while the result is being computed
+    int linked;                                     // set while the entry is in the index
+    size_t refcount;                                // the number of queries using the entry
+
+    // the result of rrd2format()
+    int ret;
+    uint8_t contenttype;
+    uint8_t options;
+    time_t latest_timestamp;
+    char *data;
+    size_t len;
+
+    size_t memsize;                                 // the memory accounted for this entry
+
+    struct query_cache_entry *prev;                 // LRU list, most recently used first
+    struct query_cache_entry *next;
+};
+
+static struct query_cache {
+    size_t max_memory;                              // 0 = the cache is disabled
+
+    avl_tree index;
+
+    struct query_cache_entry *first;
+    struct query_cache_entry *last;
+
+    struct query_cache_statistics stats;
+} query_cache = {
+        .max_memory = 0,
+        .first = NULL,
+        .last = NULL
+};
+
+static pthread_mutex_t query_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t query_cache_cond = PTHREAD_COND_INITIALIZER;
+
+static int query_cache_compare(void *a, void *b) {
+    if(((struct query_cache_entry *)a)->hash < ((struct query_cache_entry *)b)->hash) return -1;
+    else if(((struct query_cache_entry *)a)->hash > ((struct query_cache_entry *)b)->hash) return 1;
+    else return strcmp(((struct query_cache_entry *)a)->key, ((struct query_cache_entry *)b)->key);
+}
+
+void query_cache_init(void) {
+    avl_init(&query_cache.index, query_cache_compare);
+
+    long mb = config_get_number("global", "web api data cache size MB", 16);
+    if(mb < 0) {
+        error("Invalid web api data cache size %ld MB. Disabling the cache.", mb);
+        mb = 0;
+    }
+
+    query_cache.max_memory = (size_t)mb * 1024 * 1024;
+}
+
+int query_cache_enabled(void) {
+    return (query_cache.max_memory)?1:0;
+}
+
+void query_cache_statistics(struct query_cache_statistics *qcs) {
+    pthread_mutex_lock(&query_cache_mutex);
+    memcpy(qcs, &query_cache.stats, sizeof(struct query_cache_statistics));
+    pthread_mutex_unlock(&query_cache_mutex);
+}
+
+// ----------------------------------------------------------------------------
+// entries management
+// all of these have to be called with the mutex locked
+
+static inline void query_cache_lru_unlink(struct query_cache_entry *e) {
+    if(e->prev) e->prev->next = e->next;
+    else query_cache.first = e->next;
+
+    if(e->next) e->next->prev = e->prev;
+    else query_cache.last = e->prev;
+
+    e->prev = e->next = NULL;
+}
+
+static inline void query_cache_lru_link_first(struct query_cache_entry *e) {
+    e->prev = NULL;
+    e->next = query_cache.first;
+
+    if(query_cache.first) query_cache.first->prev = e;
+    else query_cache.last = e;
+
+    query_cache.first = e;
+}
+
+static inline void query_cache_entry_free(struct query_cache_entry *e) {
+    freez(e->data);
+    freez(e->key);
+    freez(e);
+}
+
+static inline void query_cache_entry_link(struct query_cache_entry *e) {
+    if(unlikely((struct query_cache_entry *)avl_insert(&query_cache.index, (avl *)e) != e)) {
+        error("QUERY CACHE: INTERNAL ERROR: attempt to index duplicate entry '%s'", e->key);
+        return;
+    }
+
+    query_cache_lru_link_first(e);
+    e->linked = 1;
+
+    query_cache.stats.entries++;
+    query_cache.stats.memory += e->memsize;
+}
+
+// remove an entry from the cache
+// it is freed when the last query using it releases it
+static inline void query_cache_entry_unlink(struct query_cache_entry *e) {
+    if(unlikely(!e->linked)) return;
+
+    if(unlikely((struct query_cache_entry *)avl_remove(&query_cache.index, (avl *)e) != e))
+        error("QUERY CACHE: INTERNAL ERROR: attempt to remove from the index entry '%s', removed a different entry.", e->key);
+
+    query_cache_lru_unlink(e);
+    e->linked = 0;
+
+    query_cache.stats.entries--;
+    query_cache.stats.memory -= e->memsize;
+
+    if(!e->refcount)
+        query_cache_entry_free(e);
+}
+
+static inline void query_cache_entry_release(struct query_cache_entry *e) {
+    e->refcount--;
+
+    if(!e->linked && !e->refcount)
+        query_cache_entry_free(e);
+}
+
+static inline void query_cache_evict(void) {
+    struct query_cache_entry *e = query_cache.last, *prev;
+
+    while(e && query_cache.stats.memory > query_cache.max_memory) {
+        prev = e->prev;
+
+        if(!e->computing) {
+            query_cache_entry_unlink(e);
+            query_cache.stats.evictions++;
+        }
+
+        e = prev;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// queries
+
+// rrd2rrdr() rounds relative timestamps to the update frequency of the chart
+// do the same here, so that all the queries returning the same data share
+// the same key. This is idempotent, so rrd2rrdr() gets the same timeframe.
+static inline void query_cache_normalize(RRDSET *st, long long *after, long long *before) {
+    if(*before == 0 && *after == 0)
+        return;
+
+    if(((*before < 0)?-*before:*before) <= API_RELATIVE_TIME_MAX && *before % st->update_every) {
+        if(*before < 0) *before = *before - st->update_every - *before % st->update_every;
+        else            *before = *before + st->update_every - *before % st->update_every;
+    }
+
+    if(((*after < 0)?-*after:*after) <= API_RELATIVE_TIME_MAX) {
+        if(*after == 0) *after = -st->update_every;
+        if(*after % st->update_every) {
+            if(*after < 0) *after = *after - st->update_every - *after % st->update_every;
+            else           *after = *after + st->update_every - *after % st->update_every;
+        }
+    }
+}
+
+// the errors that identical queries would get too, so they can share them
+// the others (rejections, cancellations) depend on the query that computed them
+static inline int query_cache_shared_error(int ret) {
+    return (ret == 400 || ret == 404);
+}
+
+static inline void query_cache_entry_to_buffer(struct query_cache_entry *e, BUFFER *wb, time_t *latest_timestamp) {
+    buffer_need_bytes(wb, e->len + 1);
+    memcpy(&wb->buffer[wb->len], e->data, e->len);
+    wb->len += e->len;
+    wb->buffer[wb->len] = '\0';
+
+    wb->contenttype = e->contenttype;
+
+    if(e->options & WB_CONTENT_NO_CACHEABLE)
+        buffer_no_cacheable(wb);
+    else if(e->options & WB_CONTENT_CACHEABLE)
+        buffer_cacheable(wb);
+
+    if(latest_timestamp && e->latest_timestamp)
+        *latest_timestamp = e->latest_timestamp;
+}
+
+int query_cache_rrd2format(RRDSET *st, BUFFER *wb, BUFFER *dimensions, uint32_t format, long points, long long after, long long before, long long since, int group_method, uint32_t options, long top, time_t *latest_timestamp)
+{
+    if(unlikely(!query_cache.max_memory))
+        return rrd2format(st, wb, dimensions, format, points, after, before, since, group_method, options, top, latest_timestamp);
+
+    query_cache_normalize(st, &after, &before);
+
+    char key[QUERY_CACHE_MAX_KEY + 1];
+    int key_len = snprintf(key, QUERY_CACHE_MAX_KEY + 1, "%s|%u|%lld|%lld|%lld|%ld|%d|%u|%ld|%s"
+                   , st->id
+                   , format
+                   , after
+                   , before
+                   , since
+                   , points
+                   , group_method
+                   , options
+                   , top
+                   , (dimensions)?buffer_tostring(dimensions):""
+                   );
+
+    if(unlikely(key_len < 0 || key_len > QUERY_CACHE_MAX_KEY)) {
+        debug(D_WEB_CLIENT, "QUERY CACHE: query on chart '%s' is too long to be cached.", st->id);
+        return rrd2format(st, wb, dimensions, format, points, after, before, since, group_method, options, top, latest_timestamp);
+    }
+
+    struct query_cache_entry tmp, *e;
+    tmp.hash = simple_hash(key);
+    tmp.key = key;
+
+    unsigned long version;
+
+retry:
+    // read the version before querying the chart
+    // if it is updated while we query it, the entry will be invalidated
+    version = st->version;
+
+    pthread_mutex_lock(&query_cache_mutex);
+
+    e = (struct query_cache_entry *)avl_search(&query_cache.index, (avl *)&tmp);
+    if(e && !e->computing && e->version != version) {
+        debug(D_WEB_CLIENT, "QUERY CACHE: entry '%s' is obsolete.", key);
+        query_cache_entry_unlink(e);
+        e = NULL;
+    }
+
+    if(e) {
+        e->refcount++;
+
+        if(e->computing) {
+            // an identical query is running - wait for its result
+            query_cache.stats.shared++;
+            while(e->computing)
+                pthread_cond_wait(&query_cache_cond, &query_cache_mutex);
+
+            if(unlikely(e->ret != 200 && !query_cache_shared_error(e->ret))) {
+                // it was rejected or cancelled - run it under our own cost
+                debug(D_WEB_CLIENT, "QUERY CACHE: shared query '%s' failed with %d, running it again.", key, e->ret);
+                query_cache_entry_release(e);
+                pthread_mutex_unlock(&query_cache_mutex);
+                goto retry;
+            }
+        }
+        else
+            query_cache.stats.hits++;
+
+        if(e->linked) {
+            query_cache_lru_unlink(e);
+            query_cache_lru_link_first(e);
+        }
+
+        pthread_mutex_unlock(&query_cache_mutex);
+
+        // the result is not modified after it has been computed
+        // and the entry cannot be freed while we hold a reference to it
+        int ret = e->ret;
+        query_cache_entry_to_buffer(e, wb, latest_timestamp);
+
+        pthread_mutex_lock(&query_cache_mutex);
+        query_cache_entry_release(e);
+        pthread_mutex_unlock(&query_cache_mutex);
+
+        return ret;
+    }
+
+    query_cache.stats.misses++;
+
+    e = callocz(1, sizeof(struct query_cache_entry));
+    e->hash = tmp.hash;
+    e->key = strdupz(key);
+    e->version = version;
+    e->computing = 1;
+    e->refcount = 1;
+    e->memsize = sizeof(struct query_cache_entry) + key_len + 1;
+    query_cache_entry_link(e);
+
+    pthread_mutex_unlock(&query_cache_mutex);
+
+    size_t start = wb->len;
+    time_t ts = 0;
+
+    int ret = rrd2format(st, wb, dimensions, format, points, after, before, since, group_method, options, top, &ts);
+    if(latest_timestamp && ts) *latest_timestamp = ts;
+
+    e->ret = ret;
+    e->contenttype = wb->contenttype;
+    e->options = wb->options;
+    e->latest_timestamp = ts;
+    e->len = wb->len - start;
+    e->data = mallocz(e->len + 1);
+    memcpy(e->data, &wb->buffer[start], e->len);
+    e->data[e->len] = '\0';
+
+    pthread_mutex_lock(&query_cache_mutex);
+
+    e->computing = 0;
+    pthread_cond_broadcast(&query_cache_cond);
+
+    if(e->linked) {
+        if(likely(ret == 200)) {
+            e->memsize += e->len + 1;
+            query_cache.stats.memory += e->len + 1;
+            query_cache_evict();
+        }
+        else
+            // errors are not kept - the identical queries waiting share
+            // the ones of query_cache_shared_error() and run again on the others
+            query_cache_entry_unlink(e);
+    }
+
+    query_cache_entry_release(e);
+
+    pthread_mutex_unlock(&query_cache_mutex);
+
+    return ret;
+}
@@ -0,0 +1,29 @@
+#ifndef NETDATA_QUERY_CACHE_H
+#define NETDATA_QUERY_CACHE_H 1
+
+// ----------------------------------------------------------------------------
+// /api/v1/data result cache
+//
+// keeps the formatted output of rrd2format() for identical queries.
+// entries are keyed by the chart and all the query parameters and they are
+// valid as long as the version of the chart has not changed.
+// identical queries that miss the cache concurrently, compute the result once.
+
+struct query_cache_statistics {
+    unsigned long long hits;                        // queries served from the cache
+    unsigned long long misses;                      // queries that had to be computed
+    unsigned long long shared;                      // queries that waited for an identical query to compute the result
+    unsigned long long evictions;                   // entries removed to stay within the memory limit
+
+    size_t entries;                                 // the number of entries in the cache
+    size_t memory;                                  // the memory used by the cache, in bytes
+};
+
+extern void query_cache_init(void);
+extern int query_cache_enabled(void);
+extern void query_cache_statistics(struct query_cache_statistics *qcs);
+
+// a drop-in replacement of rrd2format() that consults the cache
+extern int query_cache_rrd2format(RRDSET *st, BUFFER *wb, BUFFER *dimensions, uint32_t format, long points, long long after, long long before, long long since, int group_method, uint32_t options, long top, time_t *latest_timestamp);
+
+#endif /* NETDATA_QUERY_CACHE_H */
@@ -0,0 +1,270 @@
+#include "common.h"
+
+static struct query_cost_control {
+    size_t expensive_slots;                         // queries scanning more slots are expensive
+    size_t max_slots;                               // queries scanning more slots are rejected, 0 = no limit
+    size_t max_expensive;                           // the requests running expensive queries at the same time, 0 = no limit
+    usec_t queue_usec;                              // the time an expensive query waits for its turn
+    usec_t timeout_usec;                            // the time the queries of a request may run, 0 = no limit
+
+    struct query_cost_statistics stats;
+} query_cost_control = {
+        .expensive_slots = 1000000,
+        .max_slots = 0,
+        .max_expensive = 0,
+        .queue_usec = 5 * USEC_PER_SEC,
+        .timeout_usec = 60 * USEC_PER_SEC
+};
+
+static pthread_mutex_t query_cost_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t query_cost_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_key_t query_cost_key;
+static pthread_once_t query_cost_key_once = PTHREAD_ONCE_INIT;
+
+void query_cost_init(void) {
+    long long n;
+
+    n = config_get_number("global", "web api expensive query slots", (long long)query_cost_control.expensive_slots);
+    if(n <= 0) {
+        error("Invalid web api expensive query slots %lld. Using %zu.", n, query_cost_control.expensive_slots);
+        config_set_number("global", "web api expensive query slots", (long long)query_cost_control.expensive_slots);
+    }
+    else query_cost_control.expensive_slots = (size_t)n;
+
+    n = config_get_number("global", "web api max concurrent expensive queries", processors);
+    if(n < 0) {
+        error("Invalid web api max concurrent expensive queries %lld. Disabling the limit.", n);
+        n = 0;
+    }
+    query_cost_control.max_expensive = (size_t)n;
+
+    n = config_get_number("global", "web api expensive query queue ms", (long long)(query_cost_control.queue_usec / 1000));
+    if(n < 0) {
+        error("Invalid web api expensive query queue %lld ms. Expensive queries will not wait for their turn.", n);
+        n = 0;
+    }
+    query_cost_control.queue_usec = (usec_t)n * 1000;
+
+    n = config_get_number("global", "web api max query slots", (long long)query_cost_control.max_slots);
+    if(n < 0) {
+        error("Invalid web api max query slots %lld. Disabling the limit.", n);
+        n = 0;
+    }
+    query_cost_control.max_slots = (size_t)n;
+
+    n = config_get_number("global", "web api query timeout ms", (long long)(query_cost_control.timeout_usec / 1000));
+    if(n < 0) {
+        error("Invalid web api query timeout %lld ms. Disabling the timeout.", n);
+        n = 0;
+    }
+    query_cost_control.timeout_usec = (usec_t)n * 1000;
+}
+
+void query_cost_statistics(struct query_cost_statistics *qcs) {
+    pthread_mutex_lock(&query_cost_mutex);
+    memcpy(qcs, &query_cost_control.stats, sizeof(struct query_cost_statistics));
+    pthread_mutex_unlock(&query_cost_mutex);
+}
+
+// ----------------------------------------------------------------------------
+// the query_cost of each thread
+
+static void query_cost_key_create(void) {
+    if(pthread_key_create(&query_cost_key, NULL) != 0)
+        fatal("Cannot create the thread key of the query costs.");
+}
+
+static inline usec_t query_cost_thread_cpu_usec(void) {
+    struct rusage thread;
+    getrusage(RUSAGE_THREAD, &thread);
+
+    return (usec_t)thread.ru_utime.tv_sec * USEC_PER_SEC + thread.ru_utime.tv_usec
+         + (usec_t)thread.ru_stime.tv_sec * USEC_PER_SEC + thread.ru_stime.tv_usec;
+}
+
+struct query_cost *query_cost_get(void) {
+    pthread_once(&query_cost_key_once, query_cost_key_create);
+    return pthread_getspecific(query_cost_key);
+}
+
+void query_cost_reset(struct query_cost *qc) {
+    memset(qc, 0, sizeof(struct query_cost));
+    qc->fd = -1;
+}
+
+void query_cost_attach(struct query_cost *qc) {
+    qc->previous = query_cost_get();
+    qc->cpu_attached = query_cost_thread_cpu_usec();
+
+    if(pthread_setspecific(query_cost_key, qc) != 0)
+        error("Cannot set the query cost of the thread.");
+}
+
+void query_cost_detach(struct query_cost *qc) {
+    qc->cpu_usec += query_cost_thread_cpu_usec() - qc->cpu_attached;
+
+    if(pthread_setspecific(query_cost_key, qc->previous) != 0)
+        error("Cannot restore the query cost of the thread.");
+
+    qc->previous = NULL;
+}
+
+// add the cost of a part of a request, computed on another thread
+void query_cost_merge(struct query_cost *qc, struct query_cost *from) {
+    qc->queries    += from->queries;
+    qc->slots      += from->slots;
+    qc->dimensions += from->dimensions;
+    qc->bytes      += from->bytes;
+    qc->cpu_usec   += from->cpu_usec;
+
+    if(from->rejected) qc->rejected = from->rejected;
+    if(from->cancelled) qc->cancelled = from->cancelled;
+}
+
+void query_cost_finished(struct query_cost *qc, size_t bytes) {
+    qc->bytes += bytes;
+
+    pthread_mutex_lock(&query_cost_mutex);
+    query_cost_control.stats.requests++;
+    query_cost_control.stats.queries    += qc->queries;
+    query_cost_control.stats.slots      += qc->slots;
+    query_cost_control.stats.dimensions += qc->dimensions;
+    query_cost_control.stats.bytes      += qc->bytes;
+    query_cost_control.stats.cpu_usec   += qc->cpu_usec;
+    pthread_mutex_unlock(&query_cost_mutex);
+}
+
+int query_cost_rejected(void) {
+    struct query_cost *qc = query_cost_get();
+    return (qc)?qc->rejected:0;
+}
+
+int query_cost_cancelled(void) {
+    struct query_cost *qc = query_cost_get();
+    return (qc)?qc->cancelled:0;
+}
+
+// ----------------------------------------------------------------------------
+// cancellation
+
+usec_t query_cost_deadline(void) {
+    return (query_cost_control.timeout_usec)?now_monotonic_usec() + query_cost_control.timeout_usec:0;
+}
+
+void query_cost_watch(struct query_cost *qc, int fd, usec_t deadline) {
+    qc->fd = fd;
+    qc->deadline = deadline;
+}
+
+// the client has closed the socket, or it has been reset
+static inline int query_cost_client_closed(int fd) {
+    char c;
+    ssize_t ret = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    if(ret == 0) return 1;
+    if(ret == -1 && (errno == ECONNRESET || errno == ENOTCONN || errno == EPIPE)) return 1;
+    return 0;
+}
+
+// the queries of a request may call this from many threads at the same time
+int query_cost_check(struct query_cost *qc) {
+    if(unlikely(qc->cancelled)) return qc->cancelled;
+
+    int code = 0;
+    if(qc->deadline && now_monotonic_usec() > qc->deadline)
+        code = 503;
+    else if(qc->fd != -1 && query_cost_client_closed(qc->fd))
+        code = 499;
+
+    if(unlikely(code)) {
+        qc->rejected = code;
+        qc->cancelled = code;
+    }
+
+    return code;
+}
+
+void query_cost_saved(size_t slots) {
+    pthread_mutex_lock(&query_cost_mutex);
+    query_cost_control.stats.cancelled++;
+    query_cost_control.stats.saved += slots;
+    pthread_mutex_unlock(&query_cost_mutex);
+}
+
+// ----------------------------------------------------------------------------
+// admission control
+
+int query_cost_admit(struct query_cost *qc, const char *id, size_t slots) {
+    if(unlikely(query_cost_control.max_slots && slots > query_cost_control.max_slots)) {
+        info("QUERY COST: rejected the query on chart '%s', it would scan %zu slots, the maximum is %zu.", id, slots, query_cost_control.max_slots);
+
+        pthread_mutex_lock(&query_cost_mutex);
+        query_cost_control.stats.rejected++;
+        pthread_mutex_unlock(&query_cost_mutex);
+
+        qc->rejected = 400;
+        return -1;
+    }
+
+    if(likely(slots <= query_cost_control.expensive_slots))
+        return 0;
+
+    pthread_mutex_lock(&query_cost_mutex);
+
+    // the request already runs an expensive query (e.g. a context query),
+    // it does not wait for another turn
+    if(unlikely(qc->expensive)) {
+        qc->expensive++;
+        query_cost_control.stats.expensive++;
+        pthread_mutex_unlock(&query_cost_mutex);
+        return 1;
+    }
+
+    if(query_cost_control.max_expensive && query_cost_control.stats.running >= query_cost_control.max_expensive) {
+        query_cost_control.stats.queued++;
+
+        // the single threaded web server cannot wait for itself
+        usec_t queue_usec = (web_server_mode != WEB_SERVER_MODE_SINGLE_THREADED)?query_cost_control.queue_usec:0;
+
+        usec_t deadline = now_realtime_usec() + queue_usec;
+        struct timespec ts = {
+                .tv_sec = (time_t)(deadline / USEC_PER_SEC),
+                .tv_nsec = (long)(deadline % USEC_PER_SEC) * 1000
+        };
+
+        int ret = 0;
+        while(query_cost_control.stats.running >= query_cost_control.max_expensive && ret != ETIMEDOUT)
+            ret = pthread_cond_timedwait(&query_cost_cond, &query_cost_mutex, &ts);
+
+        if(query_cost_control.stats.running >= query_cost_control.max_expensive) {
+            query_cost_control.stats.rejected++;
+            pthread_mutex_unlock(&query_cost_mutex);
+
+            info("QUERY COST: rejected the query on chart '%s', %zu expensive queries are running.", id, query_cost_control.max_expensive);
+            qc->rejected = 503;
+            return -1;
+        }
+    }
+
+    query_cost_control.stats.running++;
+    query_cost_control.stats.expensive++;
+    qc->expensive++;
+
+    pthread_mutex_unlock(&query_cost_mutex);
+    return 1;
+}
+
+void query_cost_release(struct query_cost *qc) {
+    pthread_mutex_lock(&query_cost_mutex);
+
+    if(unlikely(!qc->expensive))
+        error("QUERY COST: INTERNAL ERROR: release of an expensive query that has not been admitted.");
+
+    else if(!--qc->expensive) {
+        query_cost_control.stats.running--;
+        pthread_cond_signal(&query_cost_cond);
+    }
+
+    pthread_mutex_unlock(&query_cost_mutex);
+}
@@ -0,0 +1,91 @@
+#ifndef NETDATA_QUERY_COST_H
+#define NETDATA_QUERY_COST_H 1
+
+// ----------------------------------------------------------------------------
+// query cost accounting and admission control
+//
+// the web server attaches the query_cost of a request to its thread, while it
+// works on it. the queries of the thread add to it the database slots they scan
+// and the dimensions they query, the web server the cpu time and the bytes.
+//
+// queries that will scan more than 'web api expensive query slots' are
+// expensive: up to 'web api max concurrent expensive queries' requests run
+// them at the same time and the rest wait up to 'web api expensive query queue ms'
+// for their turn. queries that will scan more than 'web api max query slots'
+// are rejected.
+//
+// the queries of threads without a query_cost (health, backends) are neither
+// accounted, nor controlled.
+//
+// long queries check periodically if their request has been cancelled: when
+// its client has disconnected, or 'web api query timeout ms' have passed since
+// it was received. then they stop, without a result.
+
+struct query_cost {
+    size_t queries;                                 // the queries of the request
+    size_t slots;                                   // the database slots scanned
+    size_t dimensions;                              // the dimensions queried
+    size_t bytes;                                   // the bytes generated
+    usec_t cpu_usec;                                // the cpu time spent on the request
+
+    int rejected;                                   // the HTTP code of the last query rejected, 0 = none
+    size_t expensive;                               // the expensive queries of the request still running
+
+    int fd;                                         // the socket of the client of the request, -1 = none
+    usec_t deadline;                                // the monotonic time the queries of the request stop, 0 = none
+    int cancelled;                                  // the HTTP code of the cancellation of the request, 0 = none
+
+    usec_t cpu_attached;                            // the cpu time of the thread when this was attached
+    struct query_cost *previous;                    // the query_cost of the thread before this was attached
+};
+
+struct query_cost_statistics {
+    unsigned long long requests;                    // the requests accounted
+    unsigned long long queries;
+    unsigned long long slots;
+    unsigned long long dimensions;
+    unsigned long long bytes;
+    unsigned long long cpu_usec;
+
+    unsigned long long expensive;                   // the expensive queries admitted
+    unsigned long long queued;                      // the expensive queries that waited for their turn
+    unsigned long long rejected;                    // the queries rejected
+    unsigned long long cancelled;                   // the queries cancelled
+    unsigned long long saved;                       // the slots the cancelled queries did not scan
+
+    size_t running;                                 // the requests running expensive queries now
+};
+
+extern void query_cost_init(void);
+extern void query_cost_statistics(struct query_cost_statistics *qcs);
+
+// the web server
+extern void query_cost_reset(struct query_cost *qc);
+extern void query_cost_attach(struct query_cost *qc);
+extern void query_cost_detach(struct query_cost *qc);
+extern void query_cost_merge(struct query_cost *qc, struct query_cost *from);
+extern void query_cost_finished(struct query_cost *qc, size_t bytes);
+
+// cancel the queries of the request when the client disconnects from fd, or at its deadline
+extern usec_t query_cost_deadline(void);
+extern void query_cost_watch(struct query_cost *qc, int fd, usec_t deadline);
+
+// the HTTP code of the last query of the thread that has been rejected, 0 = none
+extern int query_cost_rejected(void);
+
+// the HTTP code of the cancellation of the request of the thread, 0 = none
+extern int query_cost_cancelled(void);
+
+// the queries
+// query_cost_admit() returns -1 when the query is rejected, 1 when it is expensive
+// and query_cost_release() has to be called when it finishes, 0 otherwise
+extern struct query_cost *query_cost_get(void);
+extern int query_cost_admit(struct query_cost *qc, const char *id, size_t slots);
+extern void query_cost_release(struct query_cost *qc);
+
+// query_cost_check() returns the HTTP code of the cancellation of the request, 0 = none
+// query_cost_saved() counts a cancelled query, with the slots it did not scan
+extern int query_cost_check(struct query_cost *qc);
+extern void query_cost_saved(size_t slots);
+
+#endif /* NETDATA_QUERY_COST_H */
@@ -0,0 +1,185 @@
+#include "common.h"
+
+struct query_pool_batch {
+    query_pool_callback callback;
+
+    char *items;
+    size_t item_size;
+    size_t count;
+
+    size_t next;                                    // the next item to be picked
+    size_t done;                                    // the number of items completed
+
+    struct query_pool_batch *next_batch;
+};
+
+static struct query_pool {
+    int threads;                                    // the number of worker threads
+    size_t partition_slots;                         // the minimum slots of each part of a partitioned query, 0 = disabled
+
+    // the batches that still have items to be picked
+    struct query_pool_batch *first;
+    struct query_pool_batch *last;
+} query_pool = {
+        .threads = 0,
+        .partition_slots = 1000000,
+        .first = NULL,
+        .last = NULL
+};
+
+static pthread_mutex_t query_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t query_pool_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t query_pool_done_cond = PTHREAD_COND_INITIALIZER;
+
+// these have to be called with the mutex locked
+
+static inline void query_pool_dequeue(struct query_pool_batch *b) {
+    struct query_pool_batch *prev = NULL, *t;
+    for(t = query_pool.first; t && t != b; prev = t, t = t->next_batch) ;
+
+    if(unlikely(!t)) {
+        error("QUERY POOL: INTERNAL ERROR: attempt to dequeue a batch that is not queued.");
+        return;
+    }
+
+    if(prev) prev->next_batch = b->next_batch;
+    else query_pool.first = b->next_batch;
+
+    if(query_pool.last == b) query_pool.last = prev;
+    b->next_batch = NULL;
+}
+
+// pick the next item of a batch
+// when all its items have been picked, the batch is removed from the queue
+static inline void *query_pool_pick(struct query_pool_batch *b) {
+    void *item = &b->items[b->next * b->item_size];
+    b->next++;
+
+    if(b->next == b->count)
+        query_pool_dequeue(b);
+
+    return item;
+}
+
+static void *query_pool_worker(void *ptr) {
+    (void)ptr;
+
+    info("QUERY POOL: worker thread created with task id %d", gettid());
+
+    if(pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL) != 0)
+        error("Cannot set pthread cancel type to DEFERRED.");
+
+    if(pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) != 0)
+        error("Cannot set pthread cancel state to ENABLE.");
+
+    pthread_mutex_lock(&query_pool_mutex);
+
+    for(;;) {
+        while(!query_pool.first)
+            pthread_cond_wait(&query_pool_work_cond, &query_pool_mutex);
+
+        struct query_pool_batch *b = query_pool.first;
+        void *item = query_pool_pick(b);
+
+        pthread_mutex_unlock(&query_pool_mutex);
+        b->callback(item);
+        pthread_mutex_lock(&query_pool_mutex);
+
+        b->done++;
+        if(b->done == b->count)
+            pthread_cond_broadcast(&query_pool_done_cond);
+    }
+
+    // never reached
+    pthread_mutex_unlock(&query_pool_mutex);
+    return NULL;
+}
+
+void query_pool_init(void) {
+    int threads = (int)config_get_number("global", "web api query threads", processors);
+    if(threads < 0) {
+        error("Invalid number of web api query threads %d. Disabling the query pool.", threads);
+        threads = 0;
+    }
+
+    int i;
+    for(i = 0; i < threads ; i++) {
+        pthread_t thread;
+
+        if(pthread_create(&thread, NULL, query_pool_worker, NULL) != 0) {
+            error("QUERY POOL: failed to create worker thread No %d.", i + 1);
+            break;
+        }
+
+        if(pthread_detach(thread) != 0)
+            error("QUERY POOL: cannot detach worker thread No %d.", i + 1);
+    }
+
+    query_pool.threads = i;
+    info("QUERY POOL: %d worker threads started.", query_pool.threads);
+
+    long long n = config_get_number("global", "web api parallel query slots", (long long)query_pool.partition_slots);
+    if(n < 0) {
+        error("Invalid web api parallel query slots %lld. Queries will not be partitioned.", n);
+        n = 0;
+    }
+    query_pool.partition_slots = (size_t)n;
+}
+
+size_t query_pool_partitions(size_t slots) {
+    if(unlikely(!query_pool.threads || !query_pool.partition_slots))
+        return 1;
+
+    // the thread submitting the query works on it too
+    size_t partitions = slots / query_pool.partition_slots;
+    if(partitions > (size_t)query_pool.threads + 1)
+        partitions = (size_t)query_pool.threads + 1;
+
+    return (partitions)?partitions:1;
+}
+
+void query_pool_run(query_pool_callback callback, void *items, size_t item_size, size_t count) {
+    size_t i;
+
+    if(unlikely(!count)) return;
+
+    if(unlikely(!query_pool.threads || count == 1)) {
+        for(i = 0; i < count ; i++)
+            callback(&((char *)items)[i * item_size]);
+        return;
+    }
+
+    struct query_pool_batch b = {
+            .callback = callback,
+            .items = items,
+            .item_size = item_size,
+            .count = count,
+            .next = 0,
+            .done = 0,
+            .next_batch = NULL
+    };
+
+    pthread_mutex_lock(&query_pool_mutex);
+
+    if(query_pool.last) query_pool.last->next_batch = &b;
+    else query_pool.first = &b;
+    query_pool.last = &b;
+
+    pthread_cond_broadcast(&query_pool_work_cond);
+
+    // work on our own batch too
+    while(b.next < b.count) {
+        void *item = query_pool_pick(&b);
+
+        pthread_mutex_unlock(&query_pool_mutex);
+        callback(item);
+        pthread_mutex_lock(&query_pool_mutex);
+
+        b.done++;
+    }
+
+    while(b.done < b.count)
+        pthread_cond_wait(&query_pool_done_cond, &query_pool_mutex);
+
+    pthread_mutex_unlock(&query_pool_mutex);
+}
@@ -0,0 +1,23 @@
+#ifndef NETDATA_QUERY_POOL_H
+#define NETDATA_QUERY_POOL_H 1
+
+// ----------------------------------------------------------------------------
+// query worker pool
+//
+// runs the items of a batch of queries in parallel, on a pool of threads.
+// the thread submitting the batch works on it too, so batches progress even
+// when all the workers are busy, or the pool is disabled.
+
+typedef void (*query_pool_callback)(void *item);
+
+extern void query_pool_init(void);
+
+// call callback() for each of the count items of size item_size at items
+// it returns when all of them have been completed
+extern void query_pool_run(query_pool_callback callback, void *items, size_t item_size, size_t count);
+
+// the number of parts a query scanning 'slots' database slots should be split to,
+// so that each part scans at least 'web api parallel query slots' - 1 = do not split it
+extern size_t query_pool_partitions(size_t slots);
+
+#endif /* NETDATA_QUERY_POOL_H */
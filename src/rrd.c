@@ -369,6 +369,8 @@ void rrdset_set_name(RRDSET *st, const char *name)
         st->name = config_set_default(st->id, "name", b);
         st->hash_name = simple_hash(st->name);
         rrdsetvar_rename_all(st);
+        st->version++;
+        rrdset_generation_bump(st);
     }
     else {
         st->name = config_get(st->id, "name", b);
@@ -428,8 +430,10 @@ void rrdset_reset(RRDSET *st)
         rd->last_collected_time.tv_sec = 0;
         rd->last_collected_time.tv_usec = 0;
         rd->counter = 0;
-        memset(rd->values, 0, rd->entries * sizeof(storage_number));
+        rrddim_storage_reset(rd);
     }
+
+    st->version++;
 }
 static inline long align_entries_to_pagesize(long entries) {
     if(entries < 5) entries = 5;
@@ -539,8 +543,10 @@ RRDSET *rrdset_create(const char *type, const char *id, const char *name, const
         st->dimensions = NULL;
         st->next = NULL;
         st->mapped = rrd_memory_mode;
+        st->storage_engine = NULL;
         st->variables = NULL;
         st->alarms = NULL;
+        st->charts_json = NULL;
         memset(&st->rwlock, 0, sizeof(pthread_rwlock_t));
         memset(&st->avl, 0, sizeof(avl));
         memset(&st->avlname, 0, sizeof(avl));
@@ -555,6 +561,7 @@ RRDSET *rrdset_create(const char *type, const char *id, const char *name, const
     st->memsize = size;
     st->entries = entries;
     st->update_every = update_every;
+    st->storage_engine = storage_engine_find(config_get(fullid, "storage engine", STORAGE_ENGINE_RING_NAME));
 
     if(st->current_entry >= st->entries) st->current_entry = 0;
 
@@ -592,6 +599,7 @@ RRDSET *rrdset_create(const char *type, const char *id, const char *name, const
     st->last_collected_time.tv_sec = 0;
     st->last_collected_time.tv_usec = 0;
     st->counter_done = 0;
+    st->version = 0;
 
     st->gap_when_lost_iterations_above = (int) (
             config_get_number(st->id, "gap when lost iterations above", RRD_DEFAULT_GAP_INTERPOLATIONS) + 2);
@@ -618,6 +626,7 @@ RRDSET *rrdset_create(const char *type, const char *id, const char *name, const
 
     st->next = localhost.rrdset_root;
     localhost.rrdset_root = st;
+    rrdset_generation_bump(st);
 
     if(health_enabled) {
         rrdsetvar_create(st, "last_collected_t", RRDVAR_TYPE_TIME_T, &st->last_collected_time.tv_sec, 0);
@@ -650,7 +659,7 @@ RRDDIM *rrddim_add(RRDSET *st, const char *id, const char *name, long multiplier
     char fullfilename[FILENAME_MAX + 1];
 
     char varname[CONFIG_MAX_NAME + 1];
-    unsigned long size = sizeof(RRDDIM) + (st->entries * sizeof(storage_number));
+    unsigned long size = rrddim_memsize(st);
 
     debug(D_RRD_CALLS, "Adding dimension '%s/%s'.", st->id, id);
 
@@ -664,7 +673,7 @@ RRDDIM *rrddim_add(RRDSET *st, const char *id, const char *name, long multiplier
         struct timeval now;
         now_realtime_timeval(&now);
 
-        if(strcmp(rd->magic, RRDDIMENSION_MAGIC) != 0) {
+        if(strcmp(rd->magic, st->storage_engine->magic) != 0) {
             errno = 0;
             info("Initializing file %s.", fullfilename);
             memset(rd, 0, size);
@@ -713,20 +722,24 @@ RRDDIM *rrddim_add(RRDSET *st, const char *id, const char *name, long multiplier
         rd->variables = NULL;
         rd->next = NULL;
         rd->name = NULL;
+        rd->chunks = NULL;
         memset(&rd->avl, 0, sizeof(avl));
+        rd->memsize = size;
     }
     else {
         // if we didn't manage to get a mmap'd dimension, just create one
+        // the storage engine will allocate its values as they are stored
 
-        rd = callocz(1, size);
+        rd = callocz(1, sizeof(RRDDIM));
         rd->mapped = RRD_MEMORY_MODE_RAM;
+        rd->memsize = sizeof(RRDDIM);
     }
-    rd->memsize = size;
 
-    strcpy(rd->magic, RRDDIMENSION_MAGIC);
+    strcpy(rd->magic, st->storage_engine->magic);
     strcpy(rd->cache_filename, fullfilename);
     strncpyz(rd->id, id, RRD_ID_LENGTH_MAX);
     rd->hash = simple_hash(rd->id);
+    rrd_stats_api_v1_allmetrics_names(st, rd);
 
     snprintfz(varname, CONFIG_MAX_NAME, "dim %s name", rd->id);
     rd->name = config_get(st->id, varname, (name && *name)?name:rd->id);
@@ -754,10 +767,11 @@ RRDDIM *rrddim_add(RRDSET *st, const char *id, const char *name, long multiplier
     rd->collected_volume = 0;
     rd->stored_volume = 0;
     rd->last_stored_value = 0;
-    rd->values[st->current_entry] = pack_storage_number(0, SN_NOT_EXISTS);
     rd->last_collected_time.tv_sec = 0;
     rd->last_collected_time.tv_usec = 0;
     rd->rrdset = st;
+    rrddim_storage_init(rd);
+    rrddim_store(rd, rrdset_last_entry_t(st), 0, SN_NOT_EXISTS);
 
     // append this dimension
     pthread_rwlock_wrlock(&st->rwlock);
@@ -768,6 +782,8 @@ RRDDIM *rrddim_add(RRDSET *st, const char *id, const char *name, long multiplier
         for(; td->next; td = td->next) ;
         td->next = rd;
     }
+    st->version++;
+    rrdset_generation_bump(st);
 
     if(health_enabled) {
         rrddimvar_create(rd, RRDVAR_TYPE_CALCULATED, NULL, NULL, &rd->last_stored_value, 0);
@@ -795,6 +811,8 @@ void rrddim_set_name(RRDSET *st, RRDDIM *rd, const char *name)
     rd->name = config_set_default(st->id, varname, name);
 
     rrddimvar_rename_all(rd);
+    st->version++;
+    rrdset_generation_bump(st);
 }
 
 void rrddim_free(RRDSET *st, RRDDIM *rd)
@@ -813,13 +831,20 @@ void rrddim_free(RRDSET *st, RRDDIM *rd)
             error("Request to free dimension '%s.%s' but it is not linked.", st->id, rd->name);
     }
     rd->next = NULL;
+    st->version++;
+    rrdset_generation_bump(st);
 
     while(rd->variables)
         rrddimvar_free(rd->variables);
 
+    freez(rd->prometheus_name);
+    freez(rd->shell_name);
+
     if(unlikely(rrddim_index_del(st, rd) != rd))
         error("RRDDIM: INTERNAL ERROR: attempt to remove from index dimension '%s' on chart '%s', removed a different dimension.", rd->id, st->id);
 
+    rrddim_storage_free(rd);
+
     // free(rd->annotations);
     if(rd->mapped == RRD_MEMORY_MODE_SAVE) {
         debug(D_RRD_CALLS, "Saving dimension '%s' to '%s'.", rd->name, rd->cache_filename);
@@ -863,6 +888,7 @@ void rrdset_free_all(void)
             error("RRDSET: INTERNAL ERROR: attempt to remove from index chart '%s', removed a different chart.", st->id);
 
         rrdset_index_del_name(&localhost, st);
+        rrd_stats_api_v1_chart_json_free(st);
 
         st->rrdfamily->use_count--;
         if(!st->rrdfamily->use_count)
@@ -966,6 +992,8 @@ int rrddim_hide(RRDSET *st, const char *id)
     }
 
     rd->flags |= RRDDIM_FLAG_HIDDEN;
+    st->version++;
+    rrdset_generation_bump(st);
     return 0;
 }
 
@@ -980,6 +1008,8 @@ int rrddim_unhide(RRDSET *st, const char *id)
     }
 
     if(rd->flags & RRDDIM_FLAG_HIDDEN) rd->flags ^= RRDDIM_FLAG_HIDDEN;
+    st->version++;
+    rrdset_generation_bump(st);
     return 0;
 }
 
@@ -1392,7 +1422,8 @@ usec_t rrdset_done(RRDSET *st)
             debug(D_RRD_STATS, "%s: next_store_ut  = %0.3Lf (next interpolation point)", st->name, (long double)next_store_ut/1000000.0);
         }
 
-        st->last_updated.tv_sec = (time_t) (next_store_ut / USEC_PER_SEC);
+        time_t next_store_t = (time_t) (next_store_ut / USEC_PER_SEC);
+        st->last_updated.tv_sec = next_store_t;
         st->last_updated.tv_usec = 0;
 
         for( rd = st->dimensions ; likely(rd) ; rd = rd->next ) {
@@ -1474,12 +1505,16 @@ usec_t rrdset_done(RRDSET *st)
             }
 
             if(unlikely(!store_this_entry)) {
-                rd->values[st->current_entry] = pack_storage_number(0, SN_NOT_EXISTS);
+                rrddim_store(rd, next_store_t, 0, SN_NOT_EXISTS);
                 continue;
             }
 
+            calculated_number stored_value;
+            uint32_t stored_flags;
+
             if(likely(rd->updated && rd->counter > 1 && iterations < st->gap_when_lost_iterations_above)) {
-                rd->values[st->current_entry] = pack_storage_number(new_value, storage_flags );
+                stored_flags = storage_flags;
+                stored_value = rrddim_store(rd, next_store_t, new_value, stored_flags);
                 rd->last_stored_value = new_value;
 
                 if(unlikely(st->debug))
@@ -1487,7 +1522,7 @@ usec_t rrdset_done(RRDSET *st)
                         CALCULATED_NUMBER_FORMAT " = " CALCULATED_NUMBER_FORMAT
                         , st->id, rd->name
                         , st->current_entry
-                        , unpack_storage_number(rd->values[st->current_entry]), new_value
+                        , stored_value, new_value
                         );
             }
             else {
@@ -1495,7 +1530,8 @@ usec_t rrdset_done(RRDSET *st)
                         , st->id, rd->name
                         , st->current_entry
                         );
-                rd->values[st->current_entry] = pack_storage_number(0, SN_NOT_EXISTS);
+                stored_flags = SN_NOT_EXISTS;
+                stored_value = rrddim_store(rd, next_store_t, 0, stored_flags);
                 rd->last_stored_value = NAN;
             }
 
@@ -1503,13 +1539,13 @@ usec_t rrdset_done(RRDSET *st)
 
             if(unlikely(st->debug)) {
                 calculated_number t1 = new_value * (calculated_number)rd->multiplier / (calculated_number)rd->divisor;
-                calculated_number t2 = unpack_storage_number(rd->values[st->current_entry]);
+                calculated_number t2 = stored_value;
                 calculated_number accuracy = accuracy_loss(t1, t2);
                 debug(D_RRD_STATS, "%s/%s: UNPACK[%ld] = " CALCULATED_NUMBER_FORMAT " FLAGS=0x%08x (original = " CALCULATED_NUMBER_FORMAT ", accuracy loss = " CALCULATED_NUMBER_FORMAT "%%%s)"
                         , st->id, rd->name
                         , st->current_entry
                         , t2
-                        , get_storage_number_flags(rd->values[st->current_entry])
+                        , stored_flags
                         , t1
                         , accuracy
                         , (accuracy > ACCURACY_LOSS) ? " **TOO BIG** " : ""
@@ -1633,6 +1669,9 @@ usec_t rrdset_done(RRDSET *st)
     }
 */
 
+    // invalidate the cached queries of this chart
+    st->version++;
+
     pthread_rwlock_unlock(&st->rwlock);
 
     if(unlikely(pthread_setcancelstate(pthreadoldcancelstate, NULL) != 0))
@@ -17,6 +17,7 @@ extern int rrd_delete_unupdated_dimensions;
 
 #define RRDSET_MAGIC        "NETDATA RRD SET FILE V018"
 #define RRDDIMENSION_MAGIC  "NETDATA RRD DIMENSION FILE V018"
+#define RRDDIMENSION_MAGIC_WIDE "NETDATA RRD DIMENSION WIDE V018"
 
 typedef long long total_number;
 #define TOTAL_NUMBER_FORMAT "%lld"
@@ -170,8 +171,17 @@ struct rrddim {
 
     struct rrddimvar *variables;
 
+    char *prometheus_name;                          // the name of the dimension in allmetrics, sanitized once
+    char *shell_name;                               // when the dimension is added (chart_dimension, CHART_DIMENSION)
+
     // ------------------------------------------------------------------------
     // the values stored in this dimension, using our floating point numbers
+    // these are managed by the storage engine of the chart - use the
+    // rrddim_store() and rrddim_query_*() functions to access them
+
+    void **chunks;                                  // the values, in chunks of a page
+                                                    // when mapped, these point to values[] below
+                                                    // otherwise they are allocated the first time they are written
 
     storage_number values[];                        // the array of values - THIS HAS TO BE THE LAST MEMBER
 };
@@ -230,6 +240,8 @@ struct rrdset {
 
     int mapped;                                     // if set to 1, this is memory mapped
 
+    struct storage_engine *storage_engine;          // the engine storing the values of the dimensions
+
     int debug;
 
     char *cache_dir;                                // the directory to store dimensions
@@ -240,6 +252,13 @@ struct rrdset {
     unsigned long counter;                          // the number of times we added values to this rrd
     unsigned long counter_done;                     // the number of times we added values to this rrd
 
+    volatile unsigned long version;                 // incremented every time the data or the definition of the chart change
+    volatile unsigned long generation;              // incremented every time the definition of the chart changes
+                                                    // (its name, its dimensions, their names or visibility, its thresholds)
+    time_t generation_t;                            // the time the generation was last incremented
+
+    struct rrdset_charts_json *charts_json;         // the JSON of the chart in /api/v1/charts, at its generation
+
     uint32_t hash;                                  // a simple hash on the id, to speed up searching
                                                     // we first compare hashes, and only if the hashes are equal we do string comparisons
 
@@ -308,9 +327,19 @@ struct rrdhost {
     ALARM_LOG health_log;
 
     RRDCALCTEMPLATE *templates;
+
+    volatile unsigned long generation;              // incremented every time a chart is created or its definition changes
+    time_t generation_t;                            // the time the generation was last incremented
 };
 typedef struct rrdhost RRDHOST;
 extern RRDHOST localhost;
+
+// the definition of a chart has changed
+static inline void rrdset_generation_bump(RRDSET *st) {
+    __atomic_fetch_add(&st->generation, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&localhost.generation, 1, __ATOMIC_SEQ_CST);
+    st->generation_t = localhost.generation_t = now_realtime_sec();
+}
 extern void rrdhost_init(char *hostname);
 
 #ifdef NETDATA_INTERNAL_CHECKS
@@ -1,9 +1,8 @@
 #include "common.h"
 
-void rrd_stats_api_v1_chart_with_data(RRDSET *st, BUFFER *wb, size_t *dimensions_count, size_t *memory_used)
+// the JSON of a chart, up to the value of its first entry
+static inline void rrd_stats_api_v1_chart_head(RRDSET *st, BUFFER *wb)
 {
-    pthread_rwlock_rdlock(&st->rwlock);
-
     buffer_sprintf(wb,
         "\t\t{\n"
         "\t\t\t\"id\": \"%s\",\n"
@@ -18,10 +17,7 @@ void rrd_stats_api_v1_chart_with_data(RRDSET *st, BUFFER *wb, size_t *dimensions
         "\t\t\t\"data_url\": \"/api/v1/data?chart=%s\",\n"
         "\t\t\t\"chart_type\": \"%s\",\n"
         "\t\t\t\"duration\": %ld,\n"
-        "\t\t\t\"first_entry\": %ld,\n"
-        "\t\t\t\"last_entry\": %ld,\n"
-        "\t\t\t\"update_every\": %d,\n"
-        "\t\t\t\"dimensions\": {\n"
+        "\t\t\t\"first_entry\": "
         , st->id
         , st->name
         , st->type
@@ -34,20 +30,49 @@ void rrd_stats_api_v1_chart_with_data(RRDSET *st, BUFFER *wb, size_t *dimensions
         , st->name
         , rrdset_type_name(st->chart_type)
         , st->entries * st->update_every
+        );
+}
+
+// the first and the last entry of a chart - these change on every update
+static inline void rrd_stats_api_v1_chart_entries(RRDSET *st, BUFFER *wb)
+{
+    buffer_sprintf(wb,
+        "%ld,\n"
+        "\t\t\t\"last_entry\": %ld"
         , rrdset_first_entry_t(st)
         , rrdset_last_entry_t(st)
-        , st->update_every
         );
+}
 
-    unsigned long memory = st->memsize;
+// the memory of a chart and its visible dimensions
+// it changes while the chart is collected, in memory mode ram
+static inline size_t rrd_stats_api_v1_chart_memory(RRDSET *st)
+{
+    size_t memory = st->memsize;
+
+    RRDDIM *rd;
+    for(rd = st->dimensions; rd ; rd = rd->next)
+        if(!(rd->flags & RRDDIM_FLAG_HIDDEN))
+            memory += rd->memsize;
+
+    return memory;
+}
+
+// the JSON of a chart, after the value of its last entry
+static inline void rrd_stats_api_v1_chart_tail(RRDSET *st, BUFFER *wb, size_t *dimensions_count)
+{
+    buffer_sprintf(wb,
+        ",\n"
+        "\t\t\t\"update_every\": %d,\n"
+        "\t\t\t\"dimensions\": {\n"
+        , st->update_every
+        );
 
     size_t dimensions = 0;
     RRDDIM *rd;
     for(rd = st->dimensions; rd ; rd = rd->next) {
         if(rd->flags & RRDDIM_FLAG_HIDDEN) continue;
 
-        memory += rd->memsize;
-
         buffer_sprintf(wb,
             "%s"
             "\t\t\t\t\"%s\": { \"name\": \"%s\" }"
@@ -60,7 +85,6 @@ void rrd_stats_api_v1_chart_with_data(RRDSET *st, BUFFER *wb, size_t *dimensions
     }
 
     if(dimensions_count) *dimensions_count += dimensions;
-    if(memory_used) *memory_used += memory;
 
     buffer_strcat(wb, "\n\t\t\t},\n\t\t\t\"green\": ");
     buffer_rrd_value(wb, st->green);
@@ -70,6 +94,16 @@ void rrd_stats_api_v1_chart_with_data(RRDSET *st, BUFFER *wb, size_t *dimensions
     buffer_sprintf(wb,
         "\n\t\t}"
         );
+}
+
+void rrd_stats_api_v1_chart_with_data(RRDSET *st, BUFFER *wb, size_t *dimensions_count, size_t *memory_used)
+{
+    pthread_rwlock_rdlock(&st->rwlock);
+
+    rrd_stats_api_v1_chart_head(st, wb);
+    rrd_stats_api_v1_chart_entries(st, wb);
+    rrd_stats_api_v1_chart_tail(st, wb, dimensions_count);
+    if(memory_used) *memory_used += rrd_stats_api_v1_chart_memory(st);
 
     pthread_rwlock_unlock(&st->rwlock);
 }
@@ -78,6 +112,68 @@ void rrd_stats_api_v1_chart(RRDSET *st, BUFFER *wb) {
     rrd_stats_api_v1_chart_with_data(st, wb, NULL, NULL);
 }
 
+// ----------------------------------------------------------------------------
+// /api/v1/charts
+// the JSON of each chart is kept until its definition changes, and the list
+// of the charts until a chart is created or its definition changes, so that
+// the response is assembled from them, adding only the first and last entry
+// of each chart, which change on every update.
+
+static struct rrd_stats_charts_cache {
+    int valid;
+    unsigned long generation;                       // the generation of the host the list was made at
+
+    RRDSET **charts;                                // the charts of the response
+    size_t count;
+    size_t size;
+} rrd_stats_charts_cache = {
+        .valid = 0,
+        .generation = 0,
+        .charts = NULL,
+        .count = 0,
+        .size = 0
+};
+
+static pthread_mutex_t rrd_stats_charts_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void rrd_stats_api_v1_chart_json_free(RRDSET *st)
+{
+    if(!st->charts_json) return;
+
+    buffer_free(st->charts_json->wb);
+    freez(st->charts_json);
+    st->charts_json = NULL;
+}
+
+// has to be called with the chart read locked
+static inline struct rrdset_charts_json *rrd_stats_api_v1_chart_json(RRDSET *st)
+{
+    struct rrdset_charts_json *j = st->charts_json;
+    unsigned long generation = __atomic_load_n(&st->generation, __ATOMIC_SEQ_CST);
+
+    if(likely(j && j->generation == generation))
+        return j;
+
+    if(!j) {
+        j = st->charts_json = callocz(1, sizeof(struct rrdset_charts_json));
+        j->wb = buffer_create(1024);
+    }
+    else
+        buffer_flush(j->wb);
+
+    j->generation = generation;
+    j->dimensions = 0;
+
+    buffer_strcat(j->wb, "\n\t\t\"");
+    buffer_strcat(j->wb, st->id);
+    buffer_strcat(j->wb, "\": ");
+    rrd_stats_api_v1_chart_head(st, j->wb);
+    j->head = buffer_strlen(j->wb);
+    rrd_stats_api_v1_chart_tail(st, j->wb, &j->dimensions);
+
+    return j;
+}
+
 void rrd_stats_api_v1_charts(BUFFER *wb)
 {
     size_t c, dimensions = 0, memory = 0, alarms = 0;
@@ -97,16 +193,55 @@ void rrd_stats_api_v1_charts(BUFFER *wb)
         , rrd_default_history_entries
         );
 
+    // the mutex protects the cache and the JSON of the charts
+    pthread_mutex_lock(&rrd_stats_charts_cache_mutex);
     pthread_rwlock_rdlock(&localhost.rrdset_root_rwlock);
-    for(st = localhost.rrdset_root, c = 0; st ; st = st->next) {
-        if(st->enabled && st->dimensions) {
-            if(c) buffer_strcat(wb, ",");
-            buffer_strcat(wb, "\n\t\t\"");
-            buffer_strcat(wb, st->id);
-            buffer_strcat(wb, "\": ");
-            rrd_stats_api_v1_chart_with_data(st, wb, &dimensions, &memory);
-            c++;
+
+    struct rrd_stats_charts_cache *cache = &rrd_stats_charts_cache;
+    unsigned long generation = __atomic_load_n(&localhost.generation, __ATOMIC_SEQ_CST);
+
+    if(unlikely(!cache->valid || cache->generation != generation)) {
+        cache->count = 0;
+
+        for(st = localhost.rrdset_root; st ; st = st->next) {
+            if(st->enabled && st->dimensions) {
+                if(cache->count == cache->size) {
+                    cache->size = (cache->size)?cache->size * 2:256;
+                    cache->charts = reallocz(cache->charts, cache->size * sizeof(RRDSET *));
+                }
+                cache->charts[cache->count++] = st;
+            }
         }
+
+        cache->generation = generation;
+        cache->valid = 1;
+    }
+
+    for(c = 0; c < cache->count ; c++) {
+        st = cache->charts[c];
+
+        pthread_rwlock_rdlock(&st->rwlock);
+
+        struct rrdset_charts_json *j = rrd_stats_api_v1_chart_json(st);
+
+        if(c) buffer_strcat(wb, ",");
+        buffer_need_bytes(wb, buffer_strlen(j->wb) + 1);
+        memcpy(&wb->buffer[wb->len], j->wb->buffer, j->head);
+        wb->len += j->head;
+
+        rrd_stats_api_v1_chart_entries(st, wb);
+
+        buffer_need_bytes(wb, buffer_strlen(j->wb) - j->head + 1);
+        memcpy(&wb->buffer[wb->len], &j->wb->buffer[j->head], buffer_strlen(j->wb) - j->head);
+        wb->len += buffer_strlen(j->wb) - j->head;
+        wb->buffer[wb->len] = '\0';
+
+        dimensions += j->dimensions;
+
+        // not kept in the JSON of the chart, it grows without a new generation
+        memory += rrd_stats_api_v1_chart_memory(st);
+
+        pthread_rwlock_unlock(&st->rwlock);
     }
 
     RRDCALC *rc;
@@ -114,7 +249,9 @@ void rrd_stats_api_v1_charts(BUFFER *wb)
         if(rc->rrdset)
             alarms++;
     }
+
     pthread_rwlock_unlock(&localhost.rrdset_root_rwlock);
+    pthread_mutex_unlock(&rrd_stats_charts_cache_mutex);
 
     buffer_sprintf(wb, "\n\t}"
                     ",\n\t\"charts_count\": %zu"
@@ -159,9 +296,6 @@ void rrd_stats_api_v1_charts_allmetrics_prometheus(BUFFER *wb)
     // for each chart
     RRDSET *st;
     for(st = localhost.rrdset_root; st ; st = st->next) {
-        char chart[PROMETHEUS_ELEMENT_MAX + 1];
-        prometheus_name_copy(chart, st->id, PROMETHEUS_ELEMENT_MAX);
-
         buffer_strcat(wb, "\n");
         if(st->enabled && st->dimensions) {
             pthread_rwlock_rdlock(&st->rwlock);
@@ -170,19 +304,19 @@ void rrd_stats_api_v1_charts_allmetrics_prometheus(BUFFER *wb)
             RRDDIM *rd;
             for(rd = st->dimensions; rd ; rd = rd->next) {
                 if(rd->counter) {
-                    char dimension[PROMETHEUS_ELEMENT_MAX + 1];
-                    prometheus_name_copy(dimension, rd->id, PROMETHEUS_ELEMENT_MAX);
-
                     // buffer_sprintf(wb, "# HELP %s.%s %s\n", st->id, rd->id, st->units);
 
+                    buffer_strcat(wb, "# TYPE ");
+                    buffer_strcat(wb, rd->prometheus_name);
+
                     switch(rd->algorithm) {
                         case RRDDIM_INCREMENTAL:
                         case RRDDIM_PCENT_OVER_DIFF_TOTAL:
-                            buffer_sprintf(wb, "# TYPE %s_%s counter\n", chart, dimension);
+                            buffer_strcat(wb, " counter\n");
                             break;
 
                         default:
-                            buffer_sprintf(wb, "# TYPE %s_%s gauge\n", chart, dimension);
+                            buffer_strcat(wb, " gauge\n");
                             break;
                     }
 
@@ -190,9 +324,14 @@ void rrd_stats_api_v1_charts_allmetrics_prometheus(BUFFER *wb)
                     // buffer_sprintf(wb, "%s.%s " CALCULATED_NUMBER_FORMAT " %llu\n", st->id, rd->id, n,
                     //        (unsigned long long)((rd->last_collected_time.tv_sec * 1000) + (rd->last_collected_time.tv_usec / 1000)));
 
-                    buffer_sprintf(wb, "%s_%s{instance=\"%s\"} " COLLECTED_NUMBER_FORMAT " %llu\n",
-                            chart, dimension, host, rd->last_collected_value,
-                            (unsigned long long)((rd->last_collected_time.tv_sec * 1000) + (rd->last_collected_time.tv_usec / 1000)));
+                    buffer_strcat(wb, rd->prometheus_name);
+                    buffer_strcat(wb, "{instance=\"");
+                    buffer_strcat(wb, host);
+                    buffer_strcat(wb, "\"} ");
+                    buffer_print_ll(wb, rd->last_collected_value);
+                    buffer_strcat(wb, " ");
+                    buffer_print_llu(wb, (unsigned long long)((rd->last_collected_time.tv_sec * 1000) + (rd->last_collected_time.tv_usec / 1000)));
+                    buffer_strcat(wb, "\n");
 
                 }
             }
@@ -246,24 +385,31 @@ void rrd_stats_api_v1_charts_allmetrics_shell(BUFFER *wb)
             RRDDIM *rd;
             for(rd = st->dimensions; rd ; rd = rd->next) {
                 if(rd->counter) {
-                    char dimension[SHELL_ELEMENT_MAX + 1];
-                    shell_name_copy(dimension, rd->id, SHELL_ELEMENT_MAX);
-
                     calculated_number n = rd->last_stored_value;
 
+                    buffer_strcat(wb, "NETDATA_");
+                    buffer_strcat(wb, rd->shell_name);
+
                     if(isnan(n) || isinf(n))
-                        buffer_sprintf(wb, "NETDATA_%s_%s=\"\"      # %s\n", chart, dimension, st->units);
+                        buffer_strcat(wb, "=\"\"      # ");
                     else {
                         if(rd->multiplier < 0 || rd->divisor < 0) n = -n;
                         n = roundl(n);
                         if(!(rd->flags & RRDDIM_FLAG_HIDDEN)) total += n;
-                        buffer_sprintf(wb, "NETDATA_%s_%s=\"%0.0Lf\"      # %s\n", chart, dimension, n, st->units);
+                        buffer_strcat(wb, "=\"");
+                        buffer_rrd_value_decimals(wb, n, 0);
+                        buffer_strcat(wb, "\"      # ");
                     }
+
+                    buffer_strcat(wb, st->units);
+                    buffer_strcat(wb, "\n");
                 }
             }
 
             total = roundl(total);
-            buffer_sprintf(wb, "NETDATA_%s_VISIBLETOTAL=\"%0.0Lf\"      # %s\n", chart, total, st->units);
+            buffer_sprintf(wb, "NETDATA_%s_VISIBLETOTAL=\"", chart);
+            buffer_rrd_value_decimals(wb, total, 0);
+            buffer_sprintf(wb, "\"      # %s\n", st->units);
             pthread_rwlock_unlock(&st->rwlock);
         }
     }
@@ -286,7 +432,9 @@ void rrd_stats_api_v1_charts_allmetrics_shell(BUFFER *wb)
             buffer_sprintf(wb, "NETDATA_ALARM_%s_%s_VALUE=\"\"      # %s\n", chart, alarm, rc->units);
         else {
             n = roundl(n);
-            buffer_sprintf(wb, "NETDATA_ALARM_%s_%s_VALUE=\"%0.0Lf\"      # %s\n", chart, alarm, n, rc->units);
+            buffer_sprintf(wb, "NETDATA_ALARM_%s_%s_VALUE=\"", chart, alarm);
+            buffer_rrd_value_decimals(wb, n, 0);
+            buffer_sprintf(wb, "\"      # %s\n", rc->units);
         }
 
         buffer_sprintf(wb, "NETDATA_ALARM_%s_%s_STATUS=\"%s\"\n", chart, alarm, rrdcalc_status2string(rc->status));
@@ -295,6 +443,23 @@ void rrd_stats_api_v1_charts_allmetrics_shell(BUFFER *wb)
     pthread_rwlock_unlock(&localhost.rrdset_root_rwlock);
 }
 
+// the names of a dimension in allmetrics, sanitized once when it is added
+void rrd_stats_api_v1_allmetrics_names(RRDSET *st, RRDDIM *rd)
+{
+    char chart[PROMETHEUS_ELEMENT_MAX + 1], dimension[PROMETHEUS_ELEMENT_MAX + 1];
+    char name[PROMETHEUS_ELEMENT_MAX * 2 + 2];
+
+    prometheus_name_copy(chart, st->id, PROMETHEUS_ELEMENT_MAX);
+    prometheus_name_copy(dimension, rd->id, PROMETHEUS_ELEMENT_MAX);
+    snprintfz(name, PROMETHEUS_ELEMENT_MAX * 2 + 1, "%s_%s", chart, dimension);
+    rd->prometheus_name = strdupz(name);
+
+    shell_name_copy(chart, st->id, SHELL_ELEMENT_MAX);
+    shell_name_copy(dimension, rd->id, SHELL_ELEMENT_MAX);
+    snprintfz(name, SHELL_ELEMENT_MAX * 2 + 1, "%s_%s", chart, dimension);
+    rd->shell_name = strdupz(name);
+}
+
 // ----------------------------------------------------------------------------
 
 unsigned long rrd_stats_one_json(RRDSET *st, char *options, BUFFER *wb)
@@ -454,11 +619,35 @@ void rrd_stats_all_json(BUFFER *wb)
 #define RRDR_HIDDEN     0x04 // the dimension contains / the value is hidden
 #define RRDR_NONZERO    0x08 // the dimension contains / the value is non-zero
 #define RRDR_SELECTED   0x10 // the dimension is selected
+#define RRDR_OTHER      0x20 // the dimension is not in the top ones, it is added to the others
 
 // RRDR result options
 #define RRDR_RESULT_OPTION_ABSOLUTE 0x00000001
 #define RRDR_RESULT_OPTION_RELATIVE 0x00000002
 
+// RRDR memory slots
+#define RRDR_MEMORY_T               0
+#define RRDR_MEMORY_V               1
+#define RRDR_MEMORY_O               2
+#define RRDR_MEMORY_OD              3
+#define RRDR_MEMORY_QUERY           4
+#define RRDR_MEMORY_LAST_VALUES     5
+#define RRDR_MEMORY_GROUP_VALUES    6
+#define RRDR_MEMORY_GROUP_COUNTS    7
+#define RRDR_MEMORY_GROUP_OPTIONS   8
+#define RRDR_MEMORY_FOUND_NON_ZERO  9
+#define RRDR_MEMORY_SKETCHES        10
+#define RRDR_MEMORY_HANDLES         11
+#define RRDR_MEMORY_DIMS            12
+#define RRDR_MEMORY_TOP             13
+#define RRDR_MEMORY_TOP_ROW         14
+#define RRDR_MEMORY_OTHERS          15
+#define RRDR_MEMORY_LTTB            16
+#define RRDR_MEMORY_LTTB_VALUES     17
+#define RRDR_MEMORY_LTTB_COUNTS     18
+#define RRDR_MEMORY_LTTB_OPTIONS    19
+#define RRDR_MEMORY_SLOTS           20
+
 typedef struct rrdresult {
     RRDSET *st;         // the chart this result refers to
 
@@ -468,6 +657,9 @@ typedef struct rrdresult {
     long n;                 // the number of values in the arrays
     long rows;              // the number of rows used
 
+    RRDDIM **dims;          // the dimensions, in the order of the columns - only the selected ones are queried
+    RRDDIM *others;         // the column of the dimensions that are not in the top ones, if any (it is not a real dimension)
+    calculated_number others_last_stored_value;
     uint8_t *od;            // the options for the dimensions
 
     time_t *t;              // array of n timestamps
@@ -486,10 +678,39 @@ typedef struct rrdresult {
     time_t after;
 
     int has_st_lock;        // if st is read locked by us
+
+    // streaming
+    // the rows of a streamed query are generated in batches of n rows
+    // and every batch is serialized before the next is generated
+    struct rrdr_query *query; // the state of the query, between batches
+    uint8_t parts;          // the parts of the output the serializers will generate (RRDR_PART_*)
+    long rows_before;       // the rows serialized by the previous batches
+
+    // memory
+    // the arrays above and the state of the query are allocated in these slots
+    // they survive rrdr_free() in the arena of the thread, for its next queries
+    // so, this has to be the last member - rrdr_create() clears everything before it
+    struct rrdr_memory {
+        void *ptr[RRDR_MEMORY_SLOTS];
+        size_t size[RRDR_MEMORY_SLOTS];
+
+        size_t allocations;     // the arrays allocated by this query
+        size_t allocated;       // the bytes allocated by this query
+    } memory;
 } RRDR;
 
+// RRDR output parts
+#define RRDR_PART_HEADER    0x01 // the labels, before the first row
+#define RRDR_PART_FOOTER    0x02 // the closing, after the last row
+#define RRDR_PART_ALL       (RRDR_PART_HEADER|RRDR_PART_FOOTER)
+
 #define rrdr_rows(r) ((r)->rows)
 
+// the dimension of column c, NULL after the last one
+static inline RRDDIM *rrdr_dim(RRDR *r, long c) {
+    return (c < r->d)?r->dims[c]:NULL;
+}
+
 /*
 static void rrdr_dump(RRDR *r)
 {
@@ -498,7 +719,7 @@ static void rrdr_dump(RRDR *r)
 
     fprintf(stderr, "\nCHART %s (%s)\n", r->st->id, r->st->name);
 
-    for(c = 0, d = r->st->dimensions; d ;c++, d = d->next) {
+    for(c = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c)) {
         fprintf(stderr, "DIMENSION %s (%s), %s%s%s%s\n"
                 , d->id
                 , d->name
@@ -525,7 +746,7 @@ static void rrdr_dump(RRDR *r)
         fprintf(stderr, "%ld %ld ", i + 1, r->t[i]);
 
         // for each dimension
-        for(c = 0, d = r->st->dimensions; d ;c++, d = d->next) {
+        for(c = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c)) {
             if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
             if(unlikely(!(r->od[c] & RRDR_NONZERO))) continue;
 
@@ -546,48 +767,58 @@ static void rrdr_dump(RRDR *r)
 }
 */
 
-void rrdr_disable_not_selected_dimensions(RRDR *r, uint32_t options, const char *dims)
+// the dimensions= parameter of queries, as a simple pattern
+// the ids and names of the dimensions are separated by comma or pipe
+// and they are matched exactly
+static SIMPLE_PATTERN *rrdr_dimensions_pattern(const char *dims)
 {
-    if(unlikely(!dims || !*dims)) return;
-
-    char b[strlen(dims) + 1];
-    char *o = b, *tok;
-    strcpy(o, dims);
-
-    long c, dims_selected = 0, dims_not_hidden_not_zero = 0;
-    RRDDIM *d;
-
-    // disable all of them
-    for(c = 0, d = r->st->dimensions; d ;c++, d = d->next)
-        r->od[c] |= RRDR_HIDDEN;
+    if(unlikely(!dims || !*dims)) return NULL;
+    return simple_pattern_create_words(dims, ",|");
+}
 
-    while(o && *o && (tok = mystrsep(&o, ",|"))) {
-        if(!*tok) continue;
-        
-        uint32_t hash = simple_hash(tok);
+// the charts= and dimensions= parameters of context and correlation queries
+// separated by comma or pipe, they may contain asterisks, or be negated
+// with an exclamation mark
+static SIMPLE_PATTERN *rrdr_names_pattern(const char *names)
+{
+    if(unlikely(!names || !*names)) return NULL;
+    return simple_pattern_create_separated(names, ",|", SIMPLE_PATTERN_EXACT);
+}
 
-        // find it and enable it
-        for(c = 0, d = r->st->dimensions; d ;c++, d = d->next) {
-            if(unlikely((hash == d->hash && !strcmp(d->id, tok)) || !strcmp(d->name, tok))) {
+static inline int rrdr_dimension_selected(SIMPLE_PATTERN *pattern, RRDDIM *rd)
+{
+    return simple_pattern_matches(pattern, rd->id) || simple_pattern_matches(pattern, rd->name);
+}
 
-                if(likely(r->od[c] & RRDR_HIDDEN)) {
-                    r->od[c] |= RRDR_SELECTED;
-                    r->od[c] &= ~RRDR_HIDDEN;
-                    dims_selected++;
-                }
+void rrdr_disable_not_selected_dimensions(RRDR *r, uint32_t options, SIMPLE_PATTERN *pattern)
+{
+    if(unlikely(!pattern)) return;
 
-                // since the user needs this dimension
-                // make it appear as NONZERO, to return it
-                // even if the dimension has only zeros
-                // unless option non_zero is set
-                if(likely(!(options & RRDR_OPTION_NONZERO)))
-                    r->od[c] |= RRDR_NONZERO;
+    long c, dims_selected = 0, dims_not_hidden_not_zero = 0;
+    RRDDIM *d;
 
-                // count the visible dimensions
-                if(likely(r->od[c] & RRDR_NONZERO))
-                    dims_not_hidden_not_zero++;
-            }
+    for(c = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c)) {
+        if(unlikely(!rrdr_dimension_selected(pattern, d))) {
+            // disable it
+            r->od[c] |= RRDR_HIDDEN;
+            continue;
         }
+
+        // enable it
+        r->od[c] |= RRDR_SELECTED;
+        r->od[c] &= ~RRDR_HIDDEN;
+        dims_selected++;
+
+        // since the user needs this dimension
+        // make it appear as NONZERO, to return it
+        // even if the dimension has only zeros
+        // unless option non_zero is set
+        if(likely(!(options & RRDR_OPTION_NONZERO)))
+            r->od[c] |= RRDR_NONZERO;
+
+        // count the visible dimensions
+        if(likely(r->od[c] & RRDR_NONZERO))
+            dims_not_hidden_not_zero++;
     }
 
     // check if all dimensions are hidden
@@ -596,7 +827,7 @@ void rrdr_disable_not_selected_dimensions(RRDR *r, uint32_t options, const char
         // but they are all zero
         // enable the selected ones
         // to avoid returning an empty chart
-        for(c = 0, d = r->st->dimensions; d ;c++, d = d->next)
+        for(c = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c))
             if(unlikely(r->od[c] & RRDR_SELECTED))
                 r->od[c] |= RRDR_NONZERO;
     }
@@ -645,6 +876,10 @@ void rrdr_buffer_print_format(BUFFER *wb, uint32_t format)
         buffer_strcat(wb, DATASOURCE_FORMAT_SSV_COMMA);
         break;
 
+    case DATASOURCE_JSON_DELTA:
+        buffer_strcat(wb, DATASOURCE_FORMAT_JSON_DELTA);
+        break;
+
     default:
         buffer_strcat(wb, "unknown");
         break;
@@ -671,7 +906,7 @@ uint32_t rrdr_check_options(RRDR *r, uint32_t options, const char *dims)
             // find how many dimensions are not zero
             long c;
             RRDDIM *rd;
-            for(c = 0, i = 0, rd = r->st->dimensions; rd && c < r->d ; c++, rd = rd->next) {
+            for(c = 0, i = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
                 if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
                 if(unlikely(!(r->od[c] & RRDR_NONZERO))) continue;
                 i++;
@@ -727,7 +962,7 @@ void rrdr_json_wrapper_begin(RRDR *r, BUFFER *wb, uint32_t format, uint32_t opti
             , kq, kq, (uint32_t)r->after
             , kq, kq);
 
-    for(c = 0, i = 0, rd = r->st->dimensions; rd && c < r->d ;c++, rd = rd->next) {
+    for(c = 0, i = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
         if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
         if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
@@ -751,7 +986,7 @@ void rrdr_json_wrapper_begin(RRDR *r, BUFFER *wb, uint32_t format, uint32_t opti
             "   %sdimension_ids%s: ["
             , kq, kq);
 
-    for(c = 0, i = 0, rd = r->st->dimensions; rd && c < r->d ;c++, rd = rd->next) {
+    for(c = 0, i = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
         if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
         if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
@@ -772,19 +1007,19 @@ void rrdr_json_wrapper_begin(RRDR *r, BUFFER *wb, uint32_t format, uint32_t opti
             "   %slatest_values%s: ["
             , kq, kq);
 
-    for(c = 0, i = 0, rd = r->st->dimensions; rd && c < r->d ;c++, rd = rd->next) {
+    for(c = 0, i = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
         if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
         if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
         if(i) buffer_strcat(wb, ", ");
         i++;
 
-        storage_number n = rd->values[rrdset_last_slot(r->st)];
+        calculated_number n = (rd == r->others)?r->others_last_stored_value:rrddim_last_stored_value(rd);
 
-        if(!does_storage_number_exist(n))
+        if(isnan(n))
             buffer_strcat(wb, "null");
         else
-            buffer_rrd_value(wb, unpack_storage_number(n));
+            buffer_rrd_value(wb, n);
     }
     if(!i) {
         rows = 0;
@@ -797,7 +1032,7 @@ void rrdr_json_wrapper_begin(RRDR *r, BUFFER *wb, uint32_t format, uint32_t opti
 
     i = 0;
     if(rows) {
-        for(c = 0, i = 0, rd = r->st->dimensions; rd && c < r->d ;c++, rd = rd->next) {
+        for(c = 0, i = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
             if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
             if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
@@ -909,10 +1144,12 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
         snprintfz(overflow_annotation, 200, ",{%sv%s:%sRESET OR OVERFLOW%s},{%sv%s:%sThe counters have been wrapped.%s}", kq, kq, sq, sq, kq, kq, sq, sq);
         snprintfz(normal_annotation,   200, ",{%sv%s:null},{%sv%s:null}", kq, kq, kq, kq);
 
-        buffer_sprintf(wb, "{\n %scols%s:\n [\n", kq, kq);
-        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%stime%s,%spattern%s:%s%s,%stype%s:%sdatetime%s},\n", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq);
-        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%s%s,%spattern%s:%s%s,%stype%s:%sstring%s,%sp%s:{%srole%s:%sannotation%s}},\n", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, kq, kq, sq, sq);
-        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%s%s,%spattern%s:%s%s,%stype%s:%sstring%s,%sp%s:{%srole%s:%sannotationText%s}}", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, kq, kq, sq, sq);
+        if(r->parts & RRDR_PART_HEADER) {
+            buffer_sprintf(wb, "{\n %scols%s:\n [\n", kq, kq);
+            buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%stime%s,%spattern%s:%s%s,%stype%s:%sdatetime%s},\n", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq);
+            buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%s%s,%spattern%s:%s%s,%stype%s:%sstring%s,%sp%s:{%srole%s:%sannotation%s}},\n", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, kq, kq, sq, sq);
+            buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%s%s,%spattern%s:%s%s,%stype%s:%sstring%s,%sp%s:{%srole%s:%sannotationText%s}}", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, kq, kq, sq, sq);
+        }
 
         // remove the valueobjects flag
         // google wants its own keys
@@ -944,8 +1181,10 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
         snprintfz(data_begin, 100, "],\n    %sdata%s:\n [\n", kq, kq);
         strcpy(finish,             "\n  ]\n}");
 
-        buffer_sprintf(wb, "{\n %slabels%s: [", kq, kq);
-        buffer_sprintf(wb, "%stime%s", sq, sq);
+        if(r->parts & RRDR_PART_HEADER) {
+            buffer_sprintf(wb, "{\n %slabels%s: [", kq, kq);
+            buffer_sprintf(wb, "%stime%s", sq, sq);
+        }
     }
 
     // -------------------------------------------------------------------------
@@ -955,27 +1194,33 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
     RRDDIM *rd;
 
     // print the header lines
-    for(c = 0, i = 0, rd = r->st->dimensions; rd && c < r->d ;c++, rd = rd->next) {
+    for(c = 0, i = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
         if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
         if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
-        buffer_strcat(wb, pre_label);
-        buffer_strcat(wb, rd->name);
-        buffer_strcat(wb, post_label);
+        if(r->parts & RRDR_PART_HEADER) {
+            buffer_strcat(wb, pre_label);
+            buffer_strcat(wb, rd->name);
+            buffer_strcat(wb, post_label);
+        }
         i++;
     }
-    if(!i) {
-        buffer_strcat(wb, pre_label);
-        buffer_strcat(wb, "no data");
-        buffer_strcat(wb, post_label);
-    }
 
-    // print the begin of row data
-    buffer_strcat(wb, data_begin);
+    if(r->parts & RRDR_PART_HEADER) {
+        if(!i) {
+            buffer_strcat(wb, pre_label);
+            buffer_strcat(wb, "no data");
+            buffer_strcat(wb, post_label);
+        }
+
+        // print the begin of row data
+        buffer_strcat(wb, data_begin);
+    }
 
     // if all dimensions are hidden, print a null
     if(!i) {
-        buffer_strcat(wb, finish);
+        if(r->parts & RRDR_PART_HEADER)
+            buffer_strcat(wb, finish);
         return;
     }
 
@@ -999,7 +1244,7 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
             struct tm tmbuf, *tm = localtime_r(&now, &tmbuf);
             if(!tm) { error("localtime_r() failed."); continue; }
 
-            if(likely(i != start)) buffer_strcat(wb, ",\n");
+            if(likely(i != start || r->rows_before)) buffer_strcat(wb, ",\n");
             buffer_strcat(wb, pre_date);
 
             if( options & RRDR_OPTION_OBJECTSROWS )
@@ -1015,7 +1260,7 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
             if(row_annotations) {
                 // google supports one annotation per row
                 int annotation_found = 0;
-                for(c = 0, rd = r->st->dimensions; rd ;c++, rd = rd->next) {
+                for(c = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
                     if(co[c] & RRDR_RESET) {
                         buffer_strcat(wb, overflow_annotation);
                         annotation_found = 1;
@@ -1028,13 +1273,13 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
         }
         else {
             // print the timestamp of the line
-            if(likely(i != start)) buffer_strcat(wb, ",\n");
+            if(likely(i != start || r->rows_before)) buffer_strcat(wb, ",\n");
             buffer_strcat(wb, pre_date);
 
             if( options & RRDR_OPTION_OBJECTSROWS )
                 buffer_sprintf(wb, "%stime%s: ", kq, kq);
 
-            buffer_rrd_value(wb, (calculated_number)r->t[i]);
+            buffer_print_ll(wb, (long long)r->t[i]);
             // in ms
             if(options & RRDR_OPTION_MILLISECONDS) buffer_strcat(wb, "000");
 
@@ -1043,7 +1288,7 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
 
         if(unlikely(options & RRDR_OPTION_PERCENTAGE)) {
             total = 0;
-            for(c = 0, rd = r->st->dimensions; rd && c < r->d ;c++, rd = rd->next) {
+            for(c = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
                 calculated_number n = cn[c];
 
                 if(likely((options & RRDR_OPTION_ABSOLUTE) && n < 0))
@@ -1056,7 +1301,7 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
         }
 
         // for each dimension
-        for(c = 0, rd = r->st->dimensions; rd && c < r->d ;c++, rd = rd->next) {
+        for(c = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
             if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
             if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
@@ -1089,7 +1334,8 @@ static void rrdr2json(RRDR *r, BUFFER *wb, uint32_t options, int datatable)
         buffer_strcat(wb, post_line);
     }
 
-    buffer_strcat(wb, finish);
+    if(r->parts & RRDR_PART_FOOTER)
+        buffer_strcat(wb, finish);
     //info("RRD2JSON(): %s: END", r->st->id);
 }
 
@@ -1100,23 +1346,26 @@ static void rrdr2csv(RRDR *r, BUFFER *wb, uint32_t options, const char *startlin
     RRDDIM *d;
 
     // print the csv header
-    for(c = 0, i = 0, d = r->st->dimensions; d && c < r->d ;c++, d = d->next) {
+    for(c = 0, i = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c)) {
         if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
         if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
-        if(!i) {
-            buffer_strcat(wb, startline);
+        if(r->parts & RRDR_PART_HEADER) {
+            if(!i) {
+                buffer_strcat(wb, startline);
+                if(options & RRDR_OPTION_LABEL_QUOTES) buffer_strcat(wb, "\"");
+                buffer_strcat(wb, "time");
+                if(options & RRDR_OPTION_LABEL_QUOTES) buffer_strcat(wb, "\"");
+            }
+            buffer_strcat(wb, separator);
             if(options & RRDR_OPTION_LABEL_QUOTES) buffer_strcat(wb, "\"");
-            buffer_strcat(wb, "time");
+            buffer_strcat(wb, d->name);
             if(options & RRDR_OPTION_LABEL_QUOTES) buffer_strcat(wb, "\"");
         }
-        buffer_strcat(wb, separator);
-        if(options & RRDR_OPTION_LABEL_QUOTES) buffer_strcat(wb, "\"");
-        buffer_strcat(wb, d->name);
-        if(options & RRDR_OPTION_LABEL_QUOTES) buffer_strcat(wb, "\"");
         i++;
     }
-    buffer_strcat(wb, endline);
+    if(r->parts & RRDR_PART_HEADER)
+        buffer_strcat(wb, endline);
 
     if(!i) {
         // no dimensions present
@@ -1143,7 +1392,7 @@ static void rrdr2csv(RRDR *r, BUFFER *wb, uint32_t options, const char *startlin
 
         if((options & RRDR_OPTION_SECONDS) || (options & RRDR_OPTION_MILLISECONDS)) {
             // print the timestamp of the line
-            buffer_rrd_value(wb, (calculated_number)now);
+            buffer_print_ll(wb, (long long)now);
             // in ms
             if(options & RRDR_OPTION_MILLISECONDS) buffer_strcat(wb, "000");
         }
@@ -1156,7 +1405,7 @@ static void rrdr2csv(RRDR *r, BUFFER *wb, uint32_t options, const char *startlin
 
         if(unlikely(options & RRDR_OPTION_PERCENTAGE)) {
             total = 0;
-            for(c = 0, d = r->st->dimensions; d && c < r->d ;c++, d = d->next) {
+            for(c = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c)) {
                 calculated_number n = cn[c];
 
                 if(likely((options & RRDR_OPTION_ABSOLUTE) && n < 0))
@@ -1169,7 +1418,7 @@ static void rrdr2csv(RRDR *r, BUFFER *wb, uint32_t options, const char *startlin
         }
 
         // for each dimension
-        for(c = 0, d = r->st->dimensions; d && c < r->d ;c++, d = d->next) {
+        for(c = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c)) {
             if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
             if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
@@ -1212,7 +1461,7 @@ inline static calculated_number rrdr2value(RRDR *r, long i, uint32_t options, in
     calculated_number total = 1;
     if(unlikely(options & RRDR_OPTION_PERCENTAGE)) {
         total = 0;
-        for(c = 0, d = r->st->dimensions; d && c < r->d ;c++, d = d->next) {
+        for(c = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c)) {
             calculated_number n = cn[c];
 
             if(likely((options & RRDR_OPTION_ABSOLUTE) && n < 0))
@@ -1225,7 +1474,7 @@ inline static calculated_number rrdr2value(RRDR *r, long i, uint32_t options, in
     }
 
     // for each dimension
-    for(c = 0, d = r->st->dimensions; d && c < r->d ;c++, d = d->next) {
+    for(c = 0, d = rrdr_dim(r, 0); d ;c++, d = rrdr_dim(r, c)) {
         if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
         if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
 
@@ -1281,7 +1530,9 @@ static void rrdr2ssv(RRDR *r, BUFFER *wb, uint32_t options, const char *prefix,
     //info("RRD2SSV(): %s: BEGIN", r->st->id);
     long i;
 
-    buffer_strcat(wb, prefix);
+    if(r->parts & RRDR_PART_HEADER)
+        buffer_strcat(wb, prefix);
+
     long start = 0, end = rrdr_rows(r), step = 1;
     if((options & RRDR_OPTION_REVERSED)) {
         start = rrdr_rows(r) - 1;
@@ -1294,7 +1545,7 @@ static void rrdr2ssv(RRDR *r, BUFFER *wb, uint32_t options, const char *prefix,
         int all_values_are_null = 0;
         calculated_number v = rrdr2value(r, i, options, &all_values_are_null);
 
-        if(likely(i != start)) {
+        if(likely(i != start || r->rows_before)) {
             if(r->min > v) r->min = v;
             if(r->max < v) r->max = v;
         }
@@ -1303,7 +1554,7 @@ static void rrdr2ssv(RRDR *r, BUFFER *wb, uint32_t options, const char *prefix,
             r->max = v;
         }
 
-        if(likely(i != start))
+        if(likely(i != start || r->rows_before))
             buffer_strcat(wb, separator);
 
         if(all_values_are_null) {
@@ -1315,10 +1566,316 @@ static void rrdr2ssv(RRDR *r, BUFFER *wb, uint32_t options, const char *prefix,
         else
             buffer_rrd_value(wb, v);
     }
-    buffer_strcat(wb, suffix);
+    if(r->parts & RRDR_PART_FOOTER)
+        buffer_strcat(wb, suffix);
     //info("RRD2SSV(): %s: END", r->st->id);
 }
 
+// ----------------------------------------------------------------------------
+// columnar output
+
+// the totals of the rows, for percentages
+// it returns NULL when they are not needed
+static calculated_number *rrdr_percentage_totals(RRDR *r, uint32_t options)
+{
+    long c, i, rows = rrdr_rows(r);
+
+    if(likely(!(options & RRDR_OPTION_PERCENTAGE) || !rows))
+        return NULL;
+
+    calculated_number *totals = mallocz(rows * sizeof(calculated_number));
+
+    for(i = 0; i < rows ;i++) {
+        calculated_number *cn = &r->v[ i * r->d ], total = 0;
+
+        for(c = 0; c < r->d ;c++) {
+            calculated_number n = cn[c];
+
+            if(likely((options & RRDR_OPTION_ABSOLUTE) && n < 0))
+                n = -n;
+
+            total += n;
+        }
+        // prevent a division by zero
+        totals[i] = (total == 0)?1:total;
+    }
+
+    return totals;
+}
+
+// a non-empty value of row i, as the row formats give it
+static inline calculated_number rrdr_column_value(calculated_number n, uint32_t options, calculated_number *totals, long i)
+{
+    if(unlikely((options & RRDR_OPTION_ABSOLUTE) && n < 0))
+        n = -n;
+
+    if(unlikely(totals))
+        n = n * 100 / totals[i];
+
+    return n;
+}
+
+// ----------------------------------------------------------------------------
+// binary output
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define binary_le16(x) __builtin_bswap16(x)
+#define binary_le32(x) __builtin_bswap32(x)
+#define binary_le64(x) __builtin_bswap64(x)
+#else
+#define binary_le16(x) (x)
+#define binary_le32(x) (x)
+#define binary_le64(x) (x)
+#endif
+
+#define binary_padding(size) ((8 - ((size) & 7)) & 7)
+
+static inline char *binary_put_u16(char *s, uint16_t v) { v = binary_le16(v); memcpy(s, &v, sizeof(v)); return s + sizeof(v); }
+static inline char *binary_put_u32(char *s, uint32_t v) { v = binary_le32(v); memcpy(s, &v, sizeof(v)); return s + sizeof(v); }
+static inline char *binary_put_u64(char *s, uint64_t v) { v = binary_le64(v); memcpy(s, &v, sizeof(v)); return s + sizeof(v); }
+
+static inline char *binary_put_float32(char *s, calculated_number n) {
+    float f = (float)n;
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    return binary_put_u32(s, v);
+}
+
+static inline char *binary_put_float64(char *s, calculated_number n) {
+    double d = (double)n;
+    uint64_t v;
+    memcpy(&v, &d, sizeof(v));
+    return binary_put_u64(s, v);
+}
+
+static void rrdr2binary(RRDR *r, BUFFER *wb, uint32_t options)
+{
+    long c, i, rows = rrdr_rows(r);
+    RRDDIM *rd;
+
+    // find the dimensions to be sent and the size of their labels
+    uint32_t dimensions = 0;
+    size_t labels = 0;
+    for(c = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
+        if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
+        if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
+
+        labels += strlen(rd->name) + 1;
+        dimensions++;
+    }
+    labels += binary_padding(labels);
+
+    size_t value_size = (options & RRDR_OPTION_FLOAT32)?sizeof(uint32_t):sizeof(uint64_t);
+    size_t flags = dimensions + binary_padding(dimensions);
+    size_t timestamps = rows * sizeof(uint32_t);
+    timestamps += binary_padding(timestamps);
+
+    size_t size = DATASOURCE_BINARY_HEADER_SIZE + labels + flags + timestamps + dimensions * rows * value_size;
+    buffer_need_bytes(wb, size + 1);
+
+    char *s = &wb->buffer[wb->len];
+    memset(s, 0, size);
+
+    // the header
+    memcpy(s, DATASOURCE_BINARY_MAGIC, 4);
+    binary_put_u16(&s[4], DATASOURCE_BINARY_VERSION);
+    binary_put_u16(&s[6], (uint16_t)value_size);
+    binary_put_u32(&s[8], options);
+    binary_put_u32(&s[12], (uint32_t)r->update_every);
+    binary_put_u64(&s[16], (uint64_t)((rows)?r->t[rows - 1]:r->after));
+    binary_put_u64(&s[24], (uint64_t)((rows)?r->t[0]:r->before));
+    binary_put_u32(&s[32], (uint32_t)rows);
+    binary_put_u32(&s[36], dimensions);
+    binary_put_u32(&s[40], (uint32_t)labels);
+
+    char *label = &s[DATASOURCE_BINARY_HEADER_SIZE];
+    char *flag = &label[labels];
+    char *ts = &flag[flags];
+    char *v = &ts[timestamps];
+
+    long start = 0, end = rows, step = 1;
+    if((options & RRDR_OPTION_REVERSED)) {
+        start = rows - 1;
+        end = -1;
+        step = -1;
+    }
+
+    for(i = start; i != end ;i += step)
+        ts = binary_put_u32(ts, (uint32_t)r->t[i]);
+
+    calculated_number *totals = rrdr_percentage_totals(r, options);
+    calculated_number null_value = (options & RRDR_OPTION_NULL2ZERO)?0:NAN;
+
+    for(c = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
+        if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
+        if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
+
+        size_t len = strlen(rd->name) + 1;
+        memcpy(label, rd->name, len);
+        label += len;
+
+        // the dimension flags are the point options of all its rows
+        uint8_t dimension_options = (uint8_t)(r->od[c] & RRDR_NONZERO);
+
+        for(i = start; i != end ;i += step) {
+            calculated_number n = r->v[ i * r->d + c ];
+            uint8_t o = r->o[ i * r->d + c ];
+
+            dimension_options |= o;
+
+            if(unlikely(o & RRDR_EMPTY))
+                n = null_value;
+            else
+                n = rrdr_column_value(n, options, totals, i);
+
+            if(value_size == sizeof(uint32_t))
+                v = binary_put_float32(v, n);
+            else
+                v = binary_put_float64(v, n);
+        }
+
+        *flag++ = (char)(dimension_options & (DATASOURCE_BINARY_DIMENSION_EMPTY | DATASOURCE_BINARY_DIMENSION_RESET | DATASOURCE_BINARY_DIMENSION_NONZERO));
+    }
+
+    freez(totals);
+
+    wb->len += size;
+    wb->buffer[wb->len] = '\0';
+}
+
+// ----------------------------------------------------------------------------
+// json delta output
+
+#define JSON_DELTA_MAX_DECIMALS 5           // the precision of buffer_rrd_value()
+#define JSON_DELTA_MAX_SAFE 9007199254740992.0 // 2^53, the integers javascript numbers represent exactly
+
+static const calculated_number json_delta_powers[JSON_DELTA_MAX_DECIMALS + 1] = { 1, 10, 100, 1000, 10000, 100000 };
+
+static inline void json_delta_print(BUFFER *wb, calculated_number delta)
+{
+    if(likely(delta > -9e18 && delta < 9e18))
+        buffer_print_ll(wb, (long long)delta);
+    else
+        buffer_rrd_value_decimals(wb, delta, 0);
+}
+
+static void rrdr2json_delta(RRDR *r, BUFFER *wb, uint32_t options)
+{
+    long c, i, rows = rrdr_rows(r);
+    RRDDIM *rd;
+
+    long start = 0, end = rows, step = 1;
+    if((options & RRDR_OPTION_REVERSED)) {
+        start = rows - 1;
+        end = -1;
+        step = -1;
+    }
+
+    calculated_number *totals = rrdr_percentage_totals(r, options);
+
+    // find the fewest decimals that give all the values at the precision of the other formats
+    // and the largest value, to keep the integers within the range of javascript numbers
+    int decimals = 0;
+    calculated_number max = 0;
+    long dimensions = 0;
+
+    buffer_strcat(wb, "{\n   \"labels\": [");
+    for(c = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
+        if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
+        if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
+
+        buffer_strcat(wb, (dimensions)?", \"":"\"");
+        buffer_strcat_jsonescape(wb, rd->name);
+        buffer_strcat(wb, "\"");
+        dimensions++;
+
+        for(i = 0; i < rows ;i++) {
+            if(unlikely(r->o[ i * r->d + c ] & RRDR_EMPTY)) continue;
+
+            calculated_number n = rrdr_column_value(r->v[ i * r->d + c ], options, totals, i);
+            if(n < 0) n = -n;
+            if(n > max) max = n;
+
+            if(decimals < JSON_DELTA_MAX_DECIMALS) {
+                calculated_number precise = roundl(n * json_delta_powers[JSON_DELTA_MAX_DECIMALS]);
+                while(decimals < JSON_DELTA_MAX_DECIMALS && roundl(n * json_delta_powers[decimals]) * json_delta_powers[JSON_DELTA_MAX_DECIMALS - decimals] != precise)
+                    decimals++;
+            }
+        }
+    }
+
+    while(decimals > 0 && max * json_delta_powers[decimals] >= JSON_DELTA_MAX_SAFE)
+        decimals--;
+
+    calculated_number power = json_delta_powers[decimals];
+
+    // timestamps are given as the first one and the update frequency
+    // unless there are gaps between the rows
+    int uniform = 1;
+    for(i = 1; i < rows ;i++) {
+        if(unlikely(r->t[i - 1] - r->t[i] != r->update_every)) {
+            uniform = 0;
+            break;
+        }
+    }
+
+    long long multiplier = (options & RRDR_OPTION_MILLISECONDS)?1000:1;
+
+    buffer_strcat(wb, "],\n   \"first_t\": ");
+    buffer_print_ll(wb, (long long)((rows)?r->t[start]:r->after) * multiplier);
+    buffer_strcat(wb, ",\n   \"last_t\": ");
+    buffer_print_ll(wb, (long long)((rows)?r->t[end - step]:r->before) * multiplier);
+    buffer_sprintf(wb, ",\n   \"update_every\": %d,\n   \"points\": %ld,\n   \"scale\": ", r->update_every, rows);
+    buffer_print_llu(wb, (unsigned long long)power);
+
+    if(unlikely(!uniform)) {
+        // the differences of the timestamps from the previous row
+        buffer_strcat(wb, ",\n   \"time\": [");
+        for(i = start; i != end ;i += step) {
+            if(i != start) buffer_strcat(wb, ",");
+            buffer_print_ll(wb, (long long)((i == start)?r->t[i]:r->t[i] - r->t[i - step]) * multiplier);
+        }
+        buffer_strcat(wb, "]");
+    }
+
+    buffer_strcat(wb, ",\n   \"data\": [");
+
+    // every dimension is an array of the differences of its values from the previous non-null value
+    // multiplied by scale
+    long d = 0;
+    for(c = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c)) {
+        if(unlikely(r->od[c] & RRDR_HIDDEN)) continue;
+        if(unlikely((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO))) continue;
+
+        buffer_strcat(wb, (d++)?",\n      [":"\n      [");
+
+        calculated_number last = 0;
+        for(i = start; i != end ;i += step) {
+            if(likely(i != start)) buffer_strcat(wb, ",");
+
+            if(unlikely(r->o[ i * r->d + c ] & RRDR_EMPTY)) {
+                if(options & RRDR_OPTION_NULL2ZERO) {
+                    json_delta_print(wb, -last);
+                    last = 0;
+                }
+                else
+                    buffer_strcat(wb, "null");
+                continue;
+            }
+
+            calculated_number n = roundl(rrdr_column_value(r->v[ i * r->d + c ], options, totals, i) * power);
+            json_delta_print(wb, n - last);
+            last = n;
+        }
+
+        buffer_strcat(wb, "]");
+    }
+
+    buffer_strcat(wb, (d)?"\n   ]\n}":"]\n}");
+
+    freez(totals);
+}
+
 inline static calculated_number *rrdr_line_values(RRDR *r)
 {
     return &r->v[ r->c * r->d ];
@@ -1366,52 +1923,362 @@ inline static void rrdr_unlock_rrdset(RRDR *r) {
     }
 }
 
-inline static void rrdr_free(RRDR *r)
-{
-    if(unlikely(!r)) {
-        error("NULL value given!");
-        return;
-    }
+// ----------------------------------------------------------------------------
+// the state of a query, kept between the batches of rows of streamed queries
+
+// the percentile of the percentile group methods
+// 0 for the rest
+static inline calculated_number group_method_percentile(int group_method) {
+    switch(group_method) {
+        case GROUP_MEDIAN:
+            return 0.5;
+
+        case GROUP_PERCENTILE95:
+            return 0.95;
+
+        case GROUP_PERCENTILE99:
+            return 0.99;
+
+        default:
+            return 0;
+    }
+}
+
+// LTTB (largest triangle three buckets) selects one collected point per group and dimension:
+// the one that makes the largest triangle with the point selected for the previous group
+// and the average of the next group.
+// so, the row of a group is generated when the next group has been read.
+// the points are not kept: only the sums of the groups are, and the points of
+// the pending group are read again from the database when its row is generated.
+struct rrdr_lttb {
+    long bucket;                            // the number of the pending group
+    int pending;                            // set when there is a pending group
+    time_t pending_start_t;                 // the newest point of the pending group
+    time_t pending_after;                   // the oldest point of the pending group
+
+    long *pending_counts;                   // the points of each dimension in the pending group
+    uint8_t *pending_options;
+    calculated_number *pending_sums;
+
+    calculated_number *selected_x;          // the point selected for the previous group of each dimension
+    calculated_number *selected_y;          // NAN when there is none
+};
+
+// the slots queries scan between their checks for the cancellation of their request
+#define RRDR_QUERY_CHECK_SLOTS 65536
+
+struct rrdr_query {
+    int group_method;
+
+    long points;                            // the number of rows to generate
+    long group;                             // the number of source points grouped in each row
+    time_t after;
+    time_t before;
+
+    calculated_number *last_values;         // keep the last value of each dimension
+    calculated_number *group_values;        // keep sums when grouping
+    long *group_counts;                     // keep the number of values added to group_values
+    uint8_t *group_options;
+    uint8_t *found_non_zero;
+
+    calculated_number percentile;           // the percentile of the percentile group methods, 0 to 1
+    PERCENTILE_SKETCH *sketches;            // keep the percentile of each dimension, when grouping
+
+    struct rrdr_lttb *lttb;                 // the state of GROUP_LTTB
+
+    RRDDIM_QUERY_HANDLE *handles;           // a cursor on each dimension
+
+    struct query_cost *cost;                // the cost of the request of the query, NULL when not accounted
+    int expensive;                          // set when the query has been admitted as expensive
+    size_t check_slots;                     // the request is checked for cancellation when this many slots have been scanned
+    int cancelled;                          // set when the query has been stopped, because its request has been cancelled
+
+    long counter;                           // the source points examined
+    size_t scanned;                         // the slots of the previous dimensions, of the single value queries
+    long added;                             // the rows generated
+    long group_count;                       // the source points added to the current row
+    long add_this;
+    time_t group_start_t;
+
+    size_t i;                               // the current point of the batch of the cursors
+    size_t count;                           // the points in the batch of the cursors
+
+    int finished;                           // set when all the rows have been generated
+};
+
+// check if the request of the query has been cancelled, when it has scanned
+// RRDR_QUERY_CHECK_SLOTS slots since the last check
+// returns 1 when the query has to stop
+static inline int rrdr_query_check(struct rrdr_query *q, size_t scanned)
+{
+    if(likely(!q->cost || scanned < q->check_slots)) return 0;
+
+    q->check_slots = scanned + RRDR_QUERY_CHECK_SLOTS;
+
+    if(unlikely(query_cost_check(q->cost))) {
+        q->cancelled = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void rrdr_query_free(RRDR *r)
+{
+    struct rrdr_query *q = r->query;
+    if(unlikely(!q)) return;
+
+    long c;
+    for(c = 0 ; c < r->d ; c++)
+        rrddim_query_finalize(&q->handles[c]);
+
+    if(q->cost) {
+        // queries that have not scanned the database (e.g. not streamed) are not accounted
+        if(q->counter) {
+            q->cost->queries++;
+            q->cost->dimensions += r->d;
+            q->cost->slots += (size_t)q->counter * r->d;
+        }
+
+        if(q->expensive) query_cost_release(q->cost);
+
+        if(unlikely(q->cancelled)) {
+            size_t slots = (size_t)((q->before - q->after) / r->st->update_every + 1) * r->d;
+            size_t scanned = (size_t)q->counter * r->d;
+            query_cost_saved((slots > scanned)?slots - scanned:0);
+        }
+    }
+
+    // the arrays of the query are kept in the memory slots of the RRDR
+
+    r->query = NULL;
+}
+
+// ----------------------------------------------------------------------------
+// query arenas
+// the memory of freed RRDRs is kept per thread, for the next queries of the thread
+// a thread may have a few RRDRs at the same time (e.g. streamed queries in the
+// single threaded web server), so the arena keeps up to RRDR_ARENA_ENTRIES of them
+
+#define RRDR_ARENA_ENTRIES 4
+
+struct rrdr_arena {
+    int count;
+    size_t memory;                                  // the bytes kept by the entries
+    RRDR *entries[RRDR_ARENA_ENTRIES];
+};
+
+static size_t rrdr_arena_max_memory = 1024 * 1024;  // per thread
+static struct rrdr_arena_statistics rrdr_arena_stats;   // updated atomically, so that queries do not serialize on it
+
+static pthread_key_t rrdr_arena_key;
+static pthread_once_t rrdr_arena_key_once = PTHREAD_ONCE_INIT;
+
+void rrdr_arena_init(void) {
+    long kb = config_get_number("global", "web api query arena KB per thread", (long)(rrdr_arena_max_memory / 1024));
+    if(kb < 0) {
+        error("Invalid web api query arena size %ld KB. Disabling the arenas.", kb);
+        kb = 0;
+    }
+
+    rrdr_arena_max_memory = (size_t)kb * 1024;
+}
+
+void rrdr_arena_statistics(struct rrdr_arena_statistics *ras) {
+    ras->queries     = __atomic_fetch_add(&rrdr_arena_stats.queries, 0, __ATOMIC_SEQ_CST);
+    ras->reused      = __atomic_fetch_add(&rrdr_arena_stats.reused, 0, __ATOMIC_SEQ_CST);
+    ras->allocations = __atomic_fetch_add(&rrdr_arena_stats.allocations, 0, __ATOMIC_SEQ_CST);
+    ras->allocated   = __atomic_fetch_add(&rrdr_arena_stats.allocated, 0, __ATOMIC_SEQ_CST);
+    ras->memory      = __atomic_fetch_add(&rrdr_arena_stats.memory, 0, __ATOMIC_SEQ_CST);
+}
+
+static inline size_t rrdr_memory_size(RRDR *r) {
+    size_t size = sizeof(RRDR);
+
+    int i;
+    for(i = 0; i < RRDR_MEMORY_SLOTS ; i++)
+        size += r->memory.size[i];
+
+    return size;
+}
+
+static void rrdr_memory_free(RRDR *r) {
+    int i;
+    for(i = 0; i < RRDR_MEMORY_SLOTS ; i++)
+        freez(r->memory.ptr[i]);
 
-    rrdr_unlock_rrdset(r);
-    freez(r->t);
-    freez(r->v);
-    freez(r->o);
-    freez(r->od);
     freez(r);
 }
 
+// the array of a slot, of at least size bytes
+// its contents are not initialized
+static inline void *rrdr_memory_get(RRDR *r, int slot, size_t size) {
+    if(unlikely(size > r->memory.size[slot])) {
+        freez(r->memory.ptr[slot]);
+        r->memory.ptr[slot] = mallocz(size);
+        r->memory.size[slot] = size;
+
+        r->memory.allocations++;
+        r->memory.allocated += size;
+    }
+
+    return r->memory.ptr[slot];
+}
+
+// called by pthreads when a thread that used an arena exits
+static void rrdr_arena_destroy(void *ptr) {
+    struct rrdr_arena *arena = ptr;
+
+    __atomic_fetch_sub(&rrdr_arena_stats.memory, arena->memory, __ATOMIC_SEQ_CST);
+
+    int i;
+    for(i = 0; i < arena->count ; i++)
+        rrdr_memory_free(arena->entries[i]);
+
+    freez(arena);
+}
+
+static void rrdr_arena_key_create(void) {
+    if(pthread_key_create(&rrdr_arena_key, rrdr_arena_destroy) != 0)
+        fatal("Cannot create the thread key of the query arenas.");
+}
+
+static inline struct rrdr_arena *rrdr_arena_get(void) {
+    pthread_once(&rrdr_arena_key_once, rrdr_arena_key_create);
+
+    struct rrdr_arena *arena = pthread_getspecific(rrdr_arena_key);
+    if(unlikely(!arena)) {
+        arena = callocz(1, sizeof(struct rrdr_arena));
+        if(pthread_setspecific(rrdr_arena_key, arena) != 0) {
+            error("Cannot set the query arena of the thread.");
+            freez(arena);
+            return NULL;
+        }
+    }
+
+    return arena;
+}
+
+// an RRDR with cleared members and the memory of a previous query of this thread, if any
+static inline RRDR *rrdr_arena_pop(void) {
+    struct rrdr_arena *arena = rrdr_arena_get();
+
+    if(unlikely(!arena || !arena->count))
+        return callocz(1, sizeof(RRDR));
+
+    // the most recently freed, it is probably in the cpu caches
+    RRDR *r = arena->entries[--arena->count];
+    size_t size = rrdr_memory_size(r);
+    arena->memory -= size;
+
+    __atomic_fetch_add(&rrdr_arena_stats.reused, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_sub(&rrdr_arena_stats.memory, size, __ATOMIC_SEQ_CST);
+
+    memset(r, 0, offsetof(RRDR, memory));
+    r->memory.allocations = 0;
+    r->memory.allocated = 0;
+    return r;
+}
+
+static inline void rrdr_arena_push(RRDR *r) {
+    struct rrdr_arena *arena = rrdr_arena_get();
+    size_t size = rrdr_memory_size(r);
+
+    int keep = (arena && arena->count < RRDR_ARENA_ENTRIES && arena->memory + size <= rrdr_arena_max_memory);
+
+    __atomic_fetch_add(&rrdr_arena_stats.queries, 1, __ATOMIC_SEQ_CST);
+    if(r->memory.allocations) {
+        __atomic_fetch_add(&rrdr_arena_stats.allocations, r->memory.allocations, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&rrdr_arena_stats.allocated, r->memory.allocated, __ATOMIC_SEQ_CST);
+    }
+    if(keep) __atomic_fetch_add(&rrdr_arena_stats.memory, size, __ATOMIC_SEQ_CST);
+
+    if(likely(keep)) {
+        arena->entries[arena->count++] = r;
+        arena->memory += size;
+    }
+    else
+        rrdr_memory_free(r);
+}
+
+inline static void rrdr_free(RRDR *r)
+{
+    if(unlikely(!r)) {
+        error("NULL value given!");
+        return;
+    }
+
+    if(unlikely(r->st->debug)) debug(D_RRD_STATS, "FREE %s: the query allocated %zu arrays, %zu bytes", r->st->id, r->memory.allocations, r->memory.allocated);
+
+    rrdr_query_free(r);
+    rrdr_unlock_rrdset(r);
+    rrdr_arena_push(r);
+}
+
 static inline void rrdr_done(RRDR *r)
 {
     r->rows = r->c + 1;
     r->c = 0;
 }
 
-static RRDR *rrdr_create(RRDSET *st, long n)
+// the number of dimensions rrdr_create() will query
+// the chart lock is held only while counting, so that it can be called
+// before admission control, which may wait
+static long rrdr_selected_dimensions(RRDSET *st, SIMPLE_PATTERN *pattern)
+{
+    long selected = 0, all = 0;
+    RRDDIM *rd;
+
+    pthread_rwlock_rdlock(&st->rwlock);
+    for(rd = st->dimensions ; rd ; rd = rd->next) {
+        all++;
+        if(pattern && rrdr_dimension_selected(pattern, rd)) selected++;
+    }
+    pthread_rwlock_unlock(&st->rwlock);
+
+    return (selected)?selected:all;
+}
+
+// only the dimensions matching the pattern are queried, when given
+// when none matches, all of them are, so that the result has the columns
+// rrdr_disable_not_selected_dimensions() will hide
+static RRDR *rrdr_create(RRDSET *st, long n, SIMPLE_PATTERN *pattern)
 {
     if(unlikely(!st)) {
         error("NULL value given!");
         return NULL;
     }
 
-    RRDR *r = callocz(1, sizeof(RRDR));
+    RRDR *r = rrdr_arena_pop();
     r->st = st;
 
     rrdr_lock_rrdset(r);
 
     RRDDIM *rd;
-    for(rd = st->dimensions ; rd ; rd = rd->next) r->d++;
+    long all = 0;
+    for(rd = st->dimensions ; rd ; rd = rd->next) {
+        all++;
+        if(pattern && rrdr_dimension_selected(pattern, rd)) r->d++;
+    }
+    if(!r->d) {
+        pattern = NULL;
+        r->d = all;
+    }
+
+    r->dims = rrdr_memory_get(r, RRDR_MEMORY_DIMS, r->d * sizeof(RRDDIM *));
+    for(all = 0, rd = st->dimensions ; rd ; rd = rd->next)
+        if(!pattern || rrdr_dimension_selected(pattern, rd)) r->dims[all++] = rd;
 
     r->n = n;
 
-    r->t = mallocz(n * sizeof(time_t));
-    r->v = mallocz(n * r->d * sizeof(calculated_number));
-    r->o = mallocz(n * r->d * sizeof(uint8_t));
-    r->od = mallocz(r->d * sizeof(uint8_t));
+    r->t  = rrdr_memory_get(r, RRDR_MEMORY_T,  n * sizeof(time_t));
+    r->v  = rrdr_memory_get(r, RRDR_MEMORY_V,  n * r->d * sizeof(calculated_number));
+    r->o  = rrdr_memory_get(r, RRDR_MEMORY_O,  n * r->d * sizeof(uint8_t));
+    r->od = rrdr_memory_get(r, RRDR_MEMORY_OD, r->d * sizeof(uint8_t));
 
     // set the hidden flag on hidden dimensions
     int c;
-    for(c = 0, rd = st->dimensions ; rd ; c++, rd = rd->next) {
+    for(c = 0, rd = rrdr_dim(r, 0) ; rd ; c++, rd = rrdr_dim(r, c)) {
         if(unlikely(rd->flags & RRDDIM_FLAG_HIDDEN)) r->od[c] = RRDR_HIDDEN;
         else r->od[c] = 0;
     }
@@ -1419,13 +2286,108 @@ static RRDR *rrdr_create(RRDSET *st, long n)
     r->c = -1;
     r->group = 1;
     r->update_every = 1;
+    r->parts = RRDR_PART_ALL;
 
     return r;
 }
 
-RRDR *rrd2rrdr(RRDSET *st, long points, long long after, long long before, int group_method, int aligned)
+// the state of a query of the rows of r, from before back to after
+// the dimensions, the arrays of the rows and st of r have to be set
+static void rrdr_query_init(RRDR *r, int group_method, long points, long group, time_t after, time_t before)
+{
+    RRDSET *st = r->st;
+    long dimensions = r->d;
+
+    // temp arrays for keeping values per dimension
+
+    struct rrdr_query *q = rrdr_memory_get(r, RRDR_MEMORY_QUERY, sizeof(struct rrdr_query));
+    memset(q, 0, sizeof(struct rrdr_query));
+    q->group_method = group_method;
+    q->points = points;
+    q->group = group;
+    q->after = after;
+    q->before = before;
+
+    q->last_values    = rrdr_memory_get(r, RRDR_MEMORY_LAST_VALUES,    dimensions * sizeof(calculated_number));
+    q->group_values   = rrdr_memory_get(r, RRDR_MEMORY_GROUP_VALUES,   dimensions * sizeof(calculated_number));
+    q->group_counts   = rrdr_memory_get(r, RRDR_MEMORY_GROUP_COUNTS,   dimensions * sizeof(long));
+    q->group_options  = rrdr_memory_get(r, RRDR_MEMORY_GROUP_OPTIONS,  dimensions * sizeof(uint8_t));
+    q->found_non_zero = rrdr_memory_get(r, RRDR_MEMORY_FOUND_NON_ZERO, dimensions * sizeof(uint8_t));
+
+    // initialize them
+    RRDDIM *rd;
+    long c;
+    for(c = 0, rd = rrdr_dim(r, 0) ; rd ; c++, rd = rrdr_dim(r, c)) {
+        q->last_values[c] = 0;
+        q->group_values[c] = (group_method == GROUP_MAX || group_method == GROUP_MIN)?NAN:0;
+        q->group_counts[c] = 0;
+        q->group_options[c] = 0;
+        q->found_non_zero[c] = 0;
+    }
+
+    q->percentile = group_method_percentile(group_method);
+    if(q->percentile) {
+        q->sketches = rrdr_memory_get(r, RRDR_MEMORY_SKETCHES, dimensions * sizeof(PERCENTILE_SKETCH));
+        for(c = 0; c < dimensions ; c++)
+            percentile_sketch_reset(&q->sketches[c]);
+    }
+
+    if(group_method == GROUP_LTTB) {
+        struct rrdr_lttb *l = q->lttb = rrdr_memory_get(r, RRDR_MEMORY_LTTB, sizeof(struct rrdr_lttb));
+        memset(l, 0, sizeof(struct rrdr_lttb));
+
+        calculated_number *values = rrdr_memory_get(r, RRDR_MEMORY_LTTB_VALUES, 3 * dimensions * sizeof(calculated_number));
+        l->pending_sums    = &values[0];
+        l->selected_x      = &values[dimensions];
+        l->selected_y      = &values[2 * dimensions];
+        l->pending_counts  = rrdr_memory_get(r, RRDR_MEMORY_LTTB_COUNTS, dimensions * sizeof(long));
+        l->pending_options = rrdr_memory_get(r, RRDR_MEMORY_LTTB_OPTIONS, dimensions * sizeof(uint8_t));
+
+        for(c = 0; c < dimensions ; c++) {
+            l->pending_sums[c] = 0;
+            l->pending_counts[c] = 0;
+            l->pending_options[c] = 0;
+            l->selected_x[c] = 0;
+            l->selected_y[c] = NAN;
+        }
+    }
+
+
+    // open a cursor on each dimension
+
+    q->handles = rrdr_memory_get(r, RRDR_MEMORY_HANDLES, dimensions * sizeof(RRDDIM_QUERY_HANDLE));
+    for(c = 0, rd = rrdr_dim(r, 0) ; rd ; c++, rd = rrdr_dim(r, c))
+        rrddim_query_init(rd, &q->handles[c], after, before);
+
+    r->query = q;
+
+    if(unlikely(st->debug)) debug(D_RRD_STATS, "BEGIN %s after_t: %u (stop_at_t: %u), before_t: %u (start_at_t: %u), start_t(now): %u, current_entry: %ld, entries: %ld"
+            , st->id
+            , (uint32_t)after
+            , (uint32_t)q->handles[0].end_t
+            , (uint32_t)before
+            , (uint32_t)q->handles[0].start_t
+            , (uint32_t)q->handles[0].start_t
+            , st->current_entry
+            , st->entries
+            );
+
+    r->group = group;
+    r->update_every = group * st->update_every;
+    r->before = q->handles[0].start_t;
+    r->after = q->handles[0].start_t;
+}
+
+// the timeframe of a query
+// after and before are resolved to absolute timestamps, aligned to the groups when
+// 'aligned' is set, and points is set to the number of rows of 'group' points each.
+// returns 0 when the chart has no points in the timeframe.
+static int rrdr_timeframe(RRDSET *st, long *points_wanted, long long *after_wanted, long long *before_wanted, long long since, int aligned, long *group_wanted, int *absolute_period_wanted)
 {
     int debug = st->debug;
+    long long after = *after_wanted, before = *before_wanted;
+    long points = *points_wanted;
+
     int absolute_period_requested = -1;
 
     time_t first_entry_t = rrdset_first_entry_t(st);
@@ -1484,7 +2446,7 @@ RRDR *rrd2rrdr(RRDSET *st, long points, long long after, long long before, int g
     long available_points = duration / st->update_every;
 
     if(duration <= 0 || available_points <= 0)
-        return rrdr_create(st, 1);
+        return 0;
 
     // check the wanted points
     if(points < 0) points = -points;
@@ -1502,10 +2464,6 @@ RRDR *rrd2rrdr(RRDSET *st, long points, long long after, long long before, int g
     time_t before_new = (aligned) ? (before - (before % (group * st->update_every))) : before;
     long points_new   = (before_new - after_new) / st->update_every / group;
 
-    // find the starting and ending slots in our round robin db
-    long    start_at_slot = rrdset_time2slot(st, before_new),
-            stop_at_slot  = rrdset_time2slot(st, after_new);
-
 #ifdef NETDATA_INTERNAL_CHECKS
     if(after_new < first_entry_t) {
         error("after_new %u is too small, minimum %u", (uint32_t)after_new, (uint32_t)first_entry_t);
@@ -1519,12 +2477,6 @@ RRDR *rrd2rrdr(RRDSET *st, long points, long long after, long long before, int g
     if(before_new > last_entry_t) {
         error("before_new %u is too big, maximum %u", (uint32_t)before_new, (uint32_t)last_entry_t);
     }
-    if(start_at_slot < 0 || start_at_slot >= st->entries) {
-        error("start_at_slot is invalid %ld, expected 0 to %ld", start_at_slot, st->entries - 1);
-    }
-    if(stop_at_slot < 0 || stop_at_slot >= st->entries) {
-        error("stop_at_slot is invalid %ld, expected 0 to %ld", stop_at_slot, st->entries - 1);
-    }
     if(points_new > (before_new - after_new) / group / st->update_every + 1) {
         error("points_new %ld is more than points %ld", points_new, (before_new - after_new) / group / st->update_every + 1);
     }
@@ -1537,6 +2489,57 @@ RRDR *rrd2rrdr(RRDSET *st, long points, long long after, long long before, int g
     duration = before - after;
     points = points_new;
 
+    // incremental queries
+    // the client has the rows up to the one at 'since' - it may have been generated
+    // before its group was complete, so it is given again, with all the newer ones.
+    // the grouping of the full timeframe is kept, so the rows are the same (but the
+    // oldest row of GROUP_LTTB, which has no next group) and the scan stops at the
+    // first point of the group of 'since'.
+    if(since > 0) {
+        if(since > before) since = before;
+
+        time_t since_after = since - (group - 1) * st->update_every;
+        if(since_after > after) {
+            after = since_after;
+            duration = before - after;
+
+            long since_points = duration / st->update_every / group + 1;
+            if(since_points < points) points = since_points;
+        }
+    }
+
+    // checks for debugging
+
+    if(debug) debug(D_RRD_STATS, "INFO %s first_t: %u, last_t: %u, all_duration: %u, after: %u, before: %u, duration: %u, points: %ld, group: %ld"
+            , st->id
+            , (uint32_t)first_entry_t
+            , (uint32_t)last_entry_t
+            , (uint32_t)(last_entry_t - first_entry_t)
+            , (uint32_t)after
+            , (uint32_t)before
+            , (uint32_t)duration
+            , points
+            , group
+            );
+
+    *after_wanted = after;
+    *before_wanted = before;
+    *points_wanted = points;
+    *group_wanted = group;
+    *absolute_period_wanted = absolute_period_requested;
+    return 1;
+}
+
+static RRDR *rrd2rrdr_prepare(RRDSET *st, long points, long long after, long long before, long long since, int group_method, int aligned, long rows, SIMPLE_PATTERN *pattern)
+{
+    long group;
+    int absolute_period_requested;
+
+    if(!rrdr_timeframe(st, &points, &after, &before, since, aligned, &group, &absolute_period_requested))
+        return rrdr_create(st, 1, pattern);
+
+    time_t duration = before - after;
+
     // Now we have:
     // before = the end time of the calculation
     // after = the start time of the calculation
@@ -1546,20 +2549,37 @@ RRDR *rrd2rrdr(RRDSET *st, long points, long long after, long long before, int g
     // points = the number of points to generate
 
 
+    // -------------------------------------------------------------------------
+    // admission control
+    // before locking the chart, since admission may wait for a slot
+
+    struct query_cost *cost = query_cost_get();
+    int expensive = 0;
+    if(cost) {
+        expensive = query_cost_admit(cost, st->id, (size_t)(duration / st->update_every + 1) * rrdr_selected_dimensions(st, pattern));
+        if(expensive == -1)
+            return NULL;
+    }
+
+
     // -------------------------------------------------------------------------
     // initialize our result set
+    // it holds at most 'rows' rows at a time, when streamed
 
-    RRDR *r = rrdr_create(st, points);
+    // GROUP_LTTB needs a spare row, for the last group
+    RRDR *r = rrdr_create(st, ((rows > 0 && rows < points)?rows:points) + ((group_method == GROUP_LTTB)?1:0), pattern);
     if(!r) {
 #ifdef NETDATA_INTERNAL_CHECKS
         error("Cannot create RRDR for %s, after=%u, before=%u, duration=%u, points=%ld", st->id, (uint32_t)after, (uint32_t)before, (uint32_t)duration, points);
 #endif
+        if(expensive) query_cost_release(cost);
         return NULL;
     }
     if(!r->d) {
 #ifdef NETDATA_INTERNAL_CHECKS
         error("Returning empty RRDR (no dimensions in RRDSET) for %s, after=%u, before=%u, duration=%u, points=%ld", st->id, (uint32_t)after, (uint32_t)before, (uint32_t)duration, points);
 #endif
+        if(expensive) query_cost_release(cost);
         return r;
     }
 
@@ -1568,228 +2588,796 @@ RRDR *rrd2rrdr(RRDSET *st, long points, long long after, long long before, int g
     else
         r->result_options |= RRDR_RESULT_OPTION_RELATIVE;
 
-    // find how many dimensions we have
-    long dimensions = r->d;
+    rrdr_query_init(r, group_method, points, group, after, before);
+    r->query->cost = cost;
+    r->query->expensive = expensive;
 
+    return r;
+}
 
-    // -------------------------------------------------------------------------
-    // checks for debugging
+// generate the row of the pending LTTB group
+// the current group is used as the next one, when 'next' is set
+// otherwise the average of the pending group is used
+static void rrdr_lttb_row(RRDR *r, int next)
+{
+    struct rrdr_query *q = r->query;
+    struct rrdr_lttb *l = q->lttb;
+    long c, i, group = q->group;
 
-    if(debug) debug(D_RRD_STATS, "INFO %s first_t: %u, last_t: %u, all_duration: %u, after: %u, before: %u, duration: %u, points: %ld, group: %ld"
-            , st->id
-            , (uint32_t)first_entry_t
-            , (uint32_t)last_entry_t
-            , (uint32_t)(last_entry_t - first_entry_t)
-            , (uint32_t)after
-            , (uint32_t)before
-            , (uint32_t)duration
-            , points
-            , group
-            );
+    calculated_number *cn = rrdr_line_values(r);
+    uint8_t *co = rrdr_line_options(r);
 
+    // the points overwritten since the pending group has been read are not selected
+    time_t after = l->pending_after, first_t = rrdset_first_entry_t(r->st);
+    if(unlikely(after < first_t)) after = first_t;
 
-    // -------------------------------------------------------------------------
-    // temp arrays for keeping values per dimension
+    RRDDIM_QUERY_HANDLE handle;
 
-    calculated_number   last_values[dimensions]; // keep the last value of each dimension
-    calculated_number   group_values[dimensions]; // keep sums when grouping
-    long                group_counts[dimensions]; // keep the number of values added to group_values
-    uint8_t             group_options[dimensions];
-    uint8_t             found_non_zero[dimensions];
+    for(c = 0; c < r->d ; c++) {
+        if(likely(q->found_non_zero[c])) r->od[c] |= RRDR_NONZERO;
 
+        co[c] = l->pending_options[c];
 
-    // initialize them
-    RRDDIM *rd;
-    long c;
-    for( rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
-        last_values[c] = 0;
-        group_values[c] = (group_method == GROUP_MAX || group_method == GROUP_MIN)?NAN:0;
-        group_counts[c] = 0;
-        group_options[c] = 0;
-        found_non_zero[c] = 0;
-    }
+        if(unlikely(!l->pending_counts[c])) {
+            cn[c] = 0.0;
+            co[c] |= RRDR_EMPTY;
+            continue;
+        }
 
+        // the third point of the triangles
+        calculated_number next_x, next_y;
+        if(likely(next && q->group_counts[c])) {
+            next_x = (l->bucket + 1) * group + (group - 1) / 2.0;
+            next_y = q->group_values[c] / q->group_counts[c];
+        }
+        else {
+            next_x = l->bucket * group + (group - 1) / 2.0;
+            next_y = l->pending_sums[c] / l->pending_counts[c];
+        }
 
-    // -------------------------------------------------------------------------
-    // the main loop
+        // the first point of the triangles
+        calculated_number previous_x = l->selected_x[c], previous_y = l->selected_y[c];
+        if(unlikely(isnan(previous_y))) {
+            previous_x = next_x;
+            previous_y = next_y;
+        }
 
-    time_t  now = rrdset_slot2time(st, start_at_slot),
-            dt = st->update_every,
-            group_start_t = 0;
+        // the average of the group, when none of its points can be read again
+        calculated_number max_area = -1, selected_x = l->bucket * group + (group - 1) / 2.0, selected_y = l->pending_sums[c] / l->pending_counts[c];
 
-    if(unlikely(debug)) debug(D_RRD_STATS, "BEGIN %s after_t: %u (stop_at_t: %ld), before_t: %u (start_at_t: %ld), start_t(now): %u, current_entry: %ld, entries: %ld"
-            , st->id
-            , (uint32_t)after
-            , stop_at_slot
-            , (uint32_t)before
-            , start_at_slot
-            , (uint32_t)now
-            , st->current_entry
-            , st->entries
-            );
+        if(likely(after <= l->pending_start_t)) {
+            rrddim_query_init(rrdr_dim(r, c), &handle, after, l->pending_start_t);
 
-    r->group = group;
-    r->update_every = group * st->update_every;
-    r->before = now;
-    r->after = now;
+            size_t count, b;
+            for(i = 0; i < group && (count = rrddim_query_next(&handle)) ; ) {
+                for(b = 0; b < count && i < group ; b++, i++) {
+                    if(unlikely(!does_storage_number_exist(handle.flags[b]))) continue;
 
-    //info("RRD2RRDR(): %s: STARTING", st->id);
+                    calculated_number x = l->bucket * group + i, y = handle.v[b];
+                    calculated_number area = fabsl((previous_x - next_x) * (y - previous_y) - (previous_x - x) * (next_y - previous_y));
+                    if(area > max_area) {
+                        max_area = area;
+                        selected_x = x;
+                        selected_y = y;
+                    }
+                }
+            }
 
-    long slot = start_at_slot, counter = 0, stop_now = 0, added = 0, group_count = 0, add_this = 0;
-    for(; !stop_now ; now -= dt, slot--, counter++) {
-        if(unlikely(slot < 0)) slot = st->entries - 1;
-        if(unlikely(slot == stop_at_slot)) stop_now = counter;
+            rrddim_query_finalize(&handle);
+        }
 
-        if(unlikely(debug)) debug(D_RRD_STATS, "ROW %s slot: %ld, entries_counter: %ld, group_count: %ld, added: %ld, now: %ld, %s %s"
-                , st->id
-                , slot
-                , counter
-                , group_count + 1
-                , added
-                , now
-                , (group_count + 1 == group)?"PRINT":"  -  "
-                , (now >= after && now <= before)?"RANGE":"  -  "
-                );
+        cn[c] = selected_y;
+        l->selected_x[c] = selected_x;
+        l->selected_y[c] = selected_y;
 
-        // make sure we return data in the proper time range
-        if(unlikely(now > before)) continue;
-        if(unlikely(now < after)) break;
+        if(cn[c] < r->min) r->min = cn[c];
+        if(cn[c] > r->max) r->max = cn[c];
+    }
+}
 
-        if(unlikely(group_count == 0)) {
-            group_start_t = now;
-        }
-        group_count++;
+// a group of GROUP_LTTB has been read
+// generate the row of the previous one and keep this one pending
+// returns 0 when the result set is full
+static int rrdr_lttb_group_done(RRDR *r, time_t now)
+{
+    struct rrdr_query *q = r->query;
+    struct rrdr_lttb *l = q->lttb;
+    long c;
 
-        if(unlikely(group_count == group)) {
-            if(unlikely(added >= points)) break;
-            add_this = 1;
-        }
+    if(likely(l->pending)) {
+        if(unlikely(!rrdr_line_init(r, l->pending_start_t))) return 0;
+        r->after = l->pending_after;
+        rrdr_lttb_row(r, 1);
+        l->bucket++;
+    }
 
-        // do the calculations
-        for(rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
-            storage_number n = rd->values[slot];
-            if(unlikely(!does_storage_number_exist(n))) continue;
+    l->pending = 1;
+    l->pending_start_t = q->group_start_t;
+    l->pending_after = now;
 
-            group_counts[c]++;
+    for(c = 0; c < r->d ; c++) {
+        l->pending_counts[c] = q->group_counts[c];
+        l->pending_options[c] = q->group_options[c];
+        l->pending_sums[c] = q->group_values[c];
 
-            calculated_number value = unpack_storage_number(n);
-            if(likely(value != 0.0)) {
-                group_options[c] |= RRDR_NONZERO;
-                found_non_zero[c] = 1;
-            }
+        q->group_counts[c] = 0;
+        q->group_options[c] = 0;
+        q->group_values[c] = 0;
+    }
 
-            if(unlikely(did_storage_number_reset(n)))
-                group_options[c] |= RRDR_RESET;
+    return 1;
+}
 
-            switch(group_method) {
-                case GROUP_MIN:
-                    if(unlikely(isnan(group_values[c])) ||
-                            fabsl(value) < fabsl(group_values[c]))
-                        group_values[c] = value;
-                    break;
+// ----------------------------------------------------------------------------
+// the grouping of the points of a dimension to the values of the rows
+// shared by the queries of all the rows and the single value queries
 
-                case GROUP_MAX:
-                    if(unlikely(isnan(group_values[c])) ||
-                            fabsl(value) > fabsl(group_values[c]))
-                        group_values[c] = value;
-                    break;
+// add the point of dimension c to the current group
+static inline void rrdr_group_add(struct rrdr_query *q, long c, uint32_t flags, calculated_number value)
+{
+    if(unlikely(!does_storage_number_exist(flags))) return;
 
-                default:
-                case GROUP_SUM:
-                case GROUP_AVERAGE:
-                case GROUP_UNDEFINED:
-                    group_values[c] += value;
-                    break;
+    q->group_counts[c]++;
 
-                case GROUP_INCREMENTAL_SUM:
-                    if(unlikely(slot == start_at_slot))
-                        last_values[c] = value;
+    if(likely(value != 0.0)) {
+        q->group_options[c] |= RRDR_NONZERO;
+        q->found_non_zero[c] = 1;
+    }
 
-                    group_values[c] += last_values[c] - value;
-                    last_values[c] = value;
-                    break;
-            }
-        }
+    if(unlikely(did_storage_number_reset(flags)))
+        q->group_options[c] |= RRDR_RESET;
 
-        // added it
-        if(unlikely(add_this)) {
-            if(unlikely(!rrdr_line_init(r, group_start_t))) break;
+    calculated_number *group_value = &q->group_values[c];
 
-            r->after = now;
+    switch(q->group_method) {
+        case GROUP_MIN:
+            if(unlikely(isnan(*group_value)) ||
+                    fabsl(value) < fabsl(*group_value))
+                *group_value = value;
+            break;
 
-            calculated_number *cn = rrdr_line_values(r);
-            uint8_t *co = rrdr_line_options(r);
+        case GROUP_MAX:
+            if(unlikely(isnan(*group_value)) ||
+                    fabsl(value) > fabsl(*group_value))
+                *group_value = value;
+            break;
 
-            for(rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
+        default:
+        case GROUP_SUM:
+        case GROUP_AVERAGE:
+        case GROUP_UNDEFINED:
+        case GROUP_LTTB:
+            *group_value += value;
+            break;
 
-                // update the dimension options
-                if(likely(found_non_zero[c])) r->od[c] |= RRDR_NONZERO;
+        case GROUP_INCREMENTAL_SUM:
+            if(unlikely(q->counter == 0))
+                q->last_values[c] = value;
 
-                // store the specific point options
-                co[c] = group_options[c];
+            *group_value += q->last_values[c] - value;
+            q->last_values[c] = value;
+            break;
 
-                // store the value
-                if(unlikely(group_counts[c] == 0)) {
-                    cn[c] = 0.0;
-                    co[c] |= RRDR_EMPTY;
-                    group_values[c] = (group_method == GROUP_MAX || group_method == GROUP_MIN)?NAN:0;
-                }
+        case GROUP_MEDIAN:
+        case GROUP_PERCENTILE95:
+        case GROUP_PERCENTILE99:
+            percentile_sketch_add(&q->sketches[c], q->percentile, value);
+            break;
+
+    }
+}
+
+// the value of the current group of dimension c, and its options (RRDR_EMPTY when it has no points)
+// the group is reset for the next one
+static inline calculated_number rrdr_group_value(struct rrdr_query *q, long c, uint8_t *options)
+{
+    calculated_number n;
+    int group_method = q->group_method;
+    calculated_number *group_value = &q->group_values[c];
+
+    *options = q->group_options[c];
+
+    if(unlikely(q->group_counts[c] == 0)) {
+        n = 0.0;
+        *options |= RRDR_EMPTY;
+        *group_value = (group_method == GROUP_MAX || group_method == GROUP_MIN)?NAN:0;
+        if(q->sketches) percentile_sketch_reset(&q->sketches[c]);
+    }
+    else {
+        switch(group_method) {
+            case GROUP_MIN:
+            case GROUP_MAX:
+                if(unlikely(isnan(*group_value)))
+                    n = 0;
                 else {
-                    switch(group_method) {
-                        case GROUP_MIN:
-                        case GROUP_MAX:
-                            if(unlikely(isnan(group_values[c])))
-                                cn[c] = 0;
-                            else {
-                                cn[c] = group_values[c];
-                                group_values[c] = NAN;
-                            }
-                            break;
+                    n = *group_value;
+                    *group_value = NAN;
+                }
+                break;
+
+            case GROUP_SUM:
+            case GROUP_INCREMENTAL_SUM:
+                n = *group_value;
+                *group_value = 0;
+                break;
+
+            case GROUP_MEDIAN:
+            case GROUP_PERCENTILE95:
+            case GROUP_PERCENTILE99:
+                n = percentile_sketch_value(&q->sketches[c], q->percentile);
+                percentile_sketch_reset(&q->sketches[c]);
+                break;
+
+            default:
+            case GROUP_AVERAGE:
+            case GROUP_UNDEFINED:
+                n = *group_value / q->group_counts[c];
+                *group_value = 0;
+                break;
+        }
+    }
 
-                        case GROUP_SUM:
-                        case GROUP_INCREMENTAL_SUM:
-                            cn[c] = group_values[c];
-                            group_values[c] = 0;
-                            break;
+    // reset for the next group
+    q->group_counts[c] = 0;
+    q->group_options[c] = 0;
 
-                        default:
-                        case GROUP_AVERAGE:
-                        case GROUP_UNDEFINED:
-                            cn[c] = group_values[c] / group_counts[c];
-                            group_values[c] = 0;
-                            break;
-                    }
+    return n;
+}
+
+// generate the next rows of a query
+// the rows generated replace the rows of the previous call
+// returns the number of rows generated
+static long rrdr_query_rows(RRDR *r)
+{
+    struct rrdr_query *q = r->query;
+    if(unlikely(!q)) return 0;
+
+    r->c = -1;
+
+    if(unlikely(q->finished)) {
+        rrdr_done(r);
+        return 0;
+    }
+
+    RRDSET *st = r->st;
+    int debug = st->debug;
+    long dimensions = r->d;
+
+    long points = q->points;
+    long group = q->group;
+    time_t after = q->after;
+    time_t before = q->before;
+
+    uint8_t *found_non_zero = q->found_non_zero;
+    RRDDIM_QUERY_HANDLE *handles = q->handles;
+
+    RRDDIM *rd;
+    long c;
+    time_t now;
+
+    //info("RRD2RRDR(): %s: STARTING", st->id);
+
+    for(; ; q->i++, q->counter++) {
+        // stop when the result set is full
+        // this is always at the boundary of a row, so the query can continue from here
+        // GROUP_LTTB keeps a spare row, for its last group
+        if(unlikely(r->c + 1 + ((q->lttb)?1:0) >= r->n)) break;
+
+        if(unlikely(q->i >= q->count)) {
+            // stop when the request has been cancelled
+            if(unlikely(rrdr_query_check(q, (size_t)q->counter * dimensions))) {
+                q->finished = 1;
+                break;
+            }
+
+            // all the cursors move together, so they return the same number of points
+            for(c = 0 ; c < dimensions ; c++)
+                q->count = rrddim_query_next(&handles[c]);
+
+            if(unlikely(!q->count)) {
+                q->finished = 1;
+                break;
+            }
+            q->i = 0;
+        }
+
+        size_t i = q->i;
+        now = handles[0].t[i];
+
+        if(unlikely(debug)) debug(D_RRD_STATS, "ROW %s entries_counter: %ld, group_count: %ld, added: %ld, now: %ld, %s %s"
+                , st->id
+                , q->counter
+                , q->group_count + 1
+                , q->added
+                , now
+                , (q->group_count + 1 == group)?"PRINT":"  -  "
+                , (now >= after && now <= before)?"RANGE":"  -  "
+                );
+
+        // make sure we return data in the proper time range
+        if(unlikely(now > before)) continue;
+        if(unlikely(now < after)) {
+            q->finished = 1;
+            break;
+        }
+
+        if(unlikely(q->group_count == 0))
+            q->group_start_t = now;
+        q->group_count++;
+
+        if(unlikely(q->group_count == group)) {
+            if(unlikely(q->added >= points)) {
+                q->finished = 1;
+                break;
+            }
+            q->add_this = 1;
+        }
+
+        // do the calculations
+        for(c = 0 ; c < dimensions ; c++)
+            rrdr_group_add(q, c, handles[c].flags[i], handles[c].v[i]);
+
+        // added it
+        if(unlikely(q->add_this && q->lttb)) {
+            if(unlikely(!rrdr_lttb_group_done(r, now))) break;
+
+            q->added++;
+            q->group_count = 0;
+            q->add_this = 0;
+        }
+        else if(unlikely(q->add_this)) {
+            if(unlikely(!rrdr_line_init(r, q->group_start_t))) break;
+
+            r->after = now;
+
+            calculated_number *cn = rrdr_line_values(r);
+            uint8_t *co = rrdr_line_options(r);
+
+            for(c = 0, rd = rrdr_dim(r, 0) ; rd ; c++, rd = rrdr_dim(r, c)) {
+
+                // update the dimension options
+                if(likely(found_non_zero[c])) r->od[c] |= RRDR_NONZERO;
 
+                // store the value and the specific point options
+                cn[c] = rrdr_group_value(q, c, &co[c]);
+
+                if(likely(!(co[c] & RRDR_EMPTY))) {
                     if(cn[c] < r->min) r->min = cn[c];
                     if(cn[c] > r->max) r->max = cn[c];
                 }
-
-                // reset for the next loop
-                group_counts[c] = 0;
-                group_options[c] = 0;
             }
 
-            added++;
-            group_count = 0;
-            add_this = 0;
+            q->added++;
+            q->group_count = 0;
+            q->add_this = 0;
+        }
+    }
+
+    // the last group of GROUP_LTTB has no next one
+    if(unlikely(q->finished && q->lttb && q->lttb->pending)) {
+        if(likely(rrdr_line_init(r, q->lttb->pending_start_t))) {
+            r->after = q->lttb->pending_after;
+            rrdr_lttb_row(r, 0);
+        }
+        q->lttb->pending = 0;
+    }
+
+    rrdr_done(r);
+    //info("RRD2RRDR(): %s: END %ld loops made, %ld points generated", st->id, q->counter, rrdr_rows(r));
+    return rrdr_rows(r);
+}
+
+// the pattern of the dimensions to query
+// percentages are of the total of all the dimensions, so all of them are queried then
+static inline SIMPLE_PATTERN *rrdr_query_pattern(SIMPLE_PATTERN *pattern, uint32_t options)
+{
+    return (options & RRDR_OPTION_PERCENTAGE)?NULL:pattern;
+}
+
+// ----------------------------------------------------------------------------
+// partitioned queries
+// the rows of a large query are split in consecutive ranges, each one queried
+// on the query pool with its own cursors, directly into the rows of the result.
+// rows are independent of each other, but those of GROUP_INCREMENTAL_SUM and
+// GROUP_LTTB, so these are always queried serially.
+
+struct rrdr_partition {
+    RRDR *r;                                // the result the partition is part of
+
+    long first;                             // the first row of the partition in r
+    long points;                            // the rows of the partition
+    time_t after;
+    time_t before;
+
+    uint8_t *od;                            // the dimension options of the partition
+    struct query_cost cost;                 // the cpu time of the partition, on the thread that ran it
+
+    // the result of the partition
+    long rows;
+    long counter;
+    int cancelled;
+    time_t r_after;
+    time_t r_before;
+    calculated_number min;
+    calculated_number max;
+};
+
+static size_t rrdr_query_partitions(RRDR *r)
+{
+    struct rrdr_query *q = r->query;
+    if(unlikely(!q || q->lttb || q->group_method == GROUP_INCREMENTAL_SUM))
+        return 1;
+
+    size_t partitions = query_pool_partitions((size_t)((q->before - q->after) / r->st->update_every + 1) * r->d);
+    if(partitions > (size_t)q->points) partitions = (size_t)q->points;
+
+    return (partitions)?partitions:1;
+}
+
+static void rrdr_partition_query(void *ptr)
+{
+    struct rrdr_partition *pt = ptr;
+    RRDR *r = pt->r;
+
+    // the cpu time of the thread of the query is accounted to its request
+    int worker = (query_cost_get() == NULL);
+    query_cost_attach(&pt->cost);
+
+    RRDR *p = rrdr_arena_pop();
+    p->st = r->st;
+    p->d = r->d;
+    p->dims = r->dims;
+    p->od = pt->od;
+
+    p->n = pt->points;
+    p->t = &r->t[pt->first];
+    p->v = &r->v[pt->first * r->d];
+    p->o = &r->o[pt->first * r->d];
+    p->c = -1;
+
+    rrdr_query_init(p, r->query->group_method, pt->points, r->query->group, pt->after, pt->before);
+
+    // the partition stops when the request of the query is cancelled,
+    // but it is accounted by the query it is part of
+    p->query->cost = r->query->cost;
+    rrdr_query_rows(p);
+    p->query->cost = NULL;
+
+    pt->rows = rrdr_rows(p);
+    pt->counter = p->query->counter;
+    pt->cancelled = p->query->cancelled;
+    pt->r_after = p->after;
+    pt->r_before = p->before;
+    pt->min = p->min;
+    pt->max = p->max;
+
+    rrdr_query_free(p);
+    rrdr_arena_push(p);
+
+    query_cost_detach(&pt->cost);
+    if(!worker) pt->cost.cpu_usec = 0;
+}
+
+static void rrdr_query_parallel(RRDR *r, size_t partitions)
+{
+    struct rrdr_query *q = r->query;
+    time_t step = q->group * r->st->update_every;
+
+    struct rrdr_partition *pts = callocz(partitions, sizeof(struct rrdr_partition));
+    uint8_t *od = mallocz(partitions * r->d * sizeof(uint8_t));
+
+    // partition i has the rows first to first + points - 1
+    // each one starts at the group boundary the previous one stops at
+    // and the last one has the remaining rows, down to the after of the query
+    size_t i;
+    for(i = 0; i < partitions ; i++) {
+        struct rrdr_partition *pt = &pts[i];
+        pt->r = r;
+        pt->first = (long)(q->points * i / partitions);
+        pt->points = (long)(q->points * (i + 1) / partitions) - pt->first;
+        pt->before = q->before - pt->first * step;
+        pt->after = (i == partitions - 1)?q->after:(pt->before - pt->points * step + 1);
+        pt->od = &od[i * r->d];
+        memcpy(pt->od, r->od, r->d * sizeof(uint8_t));
+        query_cost_reset(&pt->cost);
+    }
+
+    query_pool_run(rrdr_partition_query, pts, sizeof(struct rrdr_partition), partitions);
+
+    // merge them in order
+    long rows = 0, c;
+    for(i = 0; i < partitions ; i++) {
+        struct rrdr_partition *pt = &pts[i];
+        q->counter += pt->counter;
+        if(q->cost) query_cost_merge(q->cost, &pt->cost);
+        if(pt->cancelled) q->cancelled = 1;
+
+        for(c = 0; c < r->d ; c++)
+            r->od[c] |= pt->od[c];
+
+        if(!pt->rows) continue;
+
+        if(rows != pt->first) {
+            memmove(&r->t[rows], &r->t[pt->first], pt->rows * sizeof(time_t));
+            memmove(&r->v[rows * r->d], &r->v[pt->first * r->d], pt->rows * r->d * sizeof(calculated_number));
+            memmove(&r->o[rows * r->d], &r->o[pt->first * r->d], pt->rows * r->d * sizeof(uint8_t));
         }
+
+        if(!rows) r->before = pt->r_before;
+        r->after = pt->r_after;
+
+        if(pt->min < r->min) r->min = pt->min;
+        if(pt->max > r->max) r->max = pt->max;
+
+        rows += pt->rows;
     }
 
+    freez(od);
+    freez(pts);
+
+    q->finished = 1;
+    r->c = rows - 1;
     rrdr_done(r);
-    //info("RRD2RRDR(): %s: END %ld loops made, %ld points generated", st->id, counter, rrdr_rows(r));
+}
+
+RRDR *rrd2rrdr(RRDSET *st, long points, long long after, long long before, long long since, int group_method, int aligned, SIMPLE_PATTERN *pattern)
+{
+    RRDR *r = rrd2rrdr_prepare(st, points, after, before, since, group_method, aligned, 0, pattern);
+    if(unlikely(!r)) return NULL;
+
+    size_t partitions = rrdr_query_partitions(r);
+    if(unlikely(partitions > 1))
+        rrdr_query_parallel(r, partitions);
+    else
+        rrdr_query_rows(r);
+
+    // cancelled queries have no result
+    int cancelled = (r->query && r->query->cancelled);
+    rrdr_query_free(r);
+
+    if(unlikely(cancelled)) {
+        rrdr_free(r);
+        return NULL;
+    }
+
     //error("SHIFT: %s: wanted %ld points, got %ld", st->id, points, rrdr_rows(r));
     return r;
 }
 
+// ----------------------------------------------------------------------------
+// single value queries
+// the value of a query of one row (health alarms, badges) is reduced without an RRDR:
+// the dimensions are scanned one after the other, with the grouping of the queries
+// of rows, into a result of one row on the stack.
+
+#define RRDR_REDUCE_MAX_DIMENSIONS 1000
+
+// the result of queries without rows
+static inline int rrdr_reduce_empty(time_t *db_after, time_t *db_before, int *value_is_null)
+{
+    if(db_after)  *db_after  = 0;
+    if(db_before) *db_before = 0;
+    if(value_is_null) *value_is_null = 1;
+    return 400;
+}
+
+// returns the HTTP code of the query, or 0 when it has to be run as a query of rows
+static int rrdr_reduce(RRDSET *st, BUFFER *wb, calculated_number *n, SIMPLE_PATTERN *pattern, long points, long long after, long long before, int group_method, uint32_t options, time_t *db_after, time_t *db_before, int *value_is_null)
+{
+    if(group_method == GROUP_LTTB) return 0;
+
+    long group;
+    int absolute_period_requested;
+
+    if(!rrdr_timeframe(st, &points, &after, &before, 0, !(options & RRDR_OPTION_NOT_ALIGNED), &group, &absolute_period_requested))
+        return rrdr_reduce_empty(db_after, db_before, value_is_null);
+
+    if(points != 1) return 0;
+
+    // the dimensions to query, as rrdr_create() selects them
+    SIMPLE_PATTERN *query_pattern = rrdr_query_pattern(pattern, options);
+    long d = rrdr_selected_dimensions(st, query_pattern);
+    if(unlikely(d > RRDR_REDUCE_MAX_DIMENSIONS)) return 0;
+
+    // admission may wait for a slot, so it is done before locking the chart
+    struct query_cost *cost = query_cost_get();
+    int expensive = 0;
+    if(cost) {
+        expensive = query_cost_admit(cost, st->id, (size_t)((before - after) / st->update_every + 1) * d);
+        if(expensive == -1) {
+            if(value_is_null) *value_is_null = 1;
+            return 500;
+        }
+    }
+
+    pthread_rwlock_rdlock(&st->rwlock);
+
+    // dimensions may have been added meanwhile
+    RRDDIM *rd;
+    long all = 0, c;
+    for(d = 0, rd = st->dimensions ; rd ; rd = rd->next) {
+        all++;
+        if(query_pattern && rrdr_dimension_selected(query_pattern, rd)) d++;
+    }
+    if(!d) {
+        query_pattern = NULL;
+        d = all;
+    }
+
+    if(unlikely(!d || d > RRDR_REDUCE_MAX_DIMENSIONS)) {
+        pthread_rwlock_unlock(&st->rwlock);
+        if(expensive) query_cost_release(cost);
+        return (d)?0:rrdr_reduce_empty(db_after, db_before, value_is_null);
+    }
+
+    RRDDIM *dims[d];
+    calculated_number values[d];
+    uint8_t o[d], od[d];
+    time_t t = 0;
+
+    for(c = 0, rd = st->dimensions ; rd ; rd = rd->next) {
+        if(query_pattern && !rrdr_dimension_selected(query_pattern, rd)) continue;
+
+        dims[c] = rd;
+        od[c] = (unlikely(rd->flags & RRDDIM_FLAG_HIDDEN))?RRDR_HIDDEN:0;
+        c++;
+    }
+
+    RRDR r;
+    memset(&r, 0, sizeof(RRDR));
+    r.st = st;
+    r.d = (int)d;
+    r.n = 1;
+    r.dims = dims;
+    r.t = &t;
+    r.v = values;
+    r.o = o;
+    r.od = od;
+
+    // the state of the grouping of one dimension
+    calculated_number last_value, group_value;
+    long group_counts;
+    uint8_t group_options, found_non_zero;
+    PERCENTILE_SKETCH sketch;
+    RRDDIM_QUERY_HANDLE handle;
+
+    struct rrdr_query q;
+    memset(&q, 0, sizeof(struct rrdr_query));
+    q.group_method = group_method;
+    q.points = points;
+    q.group = group;
+    q.after = after;
+    q.before = before;
+    q.last_values = &last_value;
+    q.group_values = &group_value;
+    q.group_counts = &group_counts;
+    q.group_options = &group_options;
+    q.found_non_zero = &found_non_zero;
+    q.percentile = group_method_percentile(group_method);
+    if(q.percentile) q.sketches = &sketch;
+    q.cost = cost;
+
+    for(c = 0 ; c < d ; c++) {
+        last_value = 0;
+        group_value = (group_method == GROUP_MAX || group_method == GROUP_MIN)?NAN:0;
+        group_counts = 0;
+        group_options = 0;
+        found_non_zero = 0;
+        percentile_sketch_reset(&sketch);
+
+        q.counter = 0;
+        q.group_count = 0;
+        q.added = 0;
+
+        rrddim_query_init(dims[c], &handle, after, before);
+        if(!c) r.before = r.after = handle.start_t;
+
+        size_t i, count = 0;
+        for(i = 0; ; i++, q.counter++) {
+            if(unlikely(i >= count)) {
+                // stop when the request has been cancelled
+                if(unlikely(rrdr_query_check(&q, q.scanned + (size_t)q.counter))) break;
+
+                count = rrddim_query_next(&handle);
+                if(unlikely(!count)) break;
+                i = 0;
+            }
+
+            time_t now = handle.t[i];
+            if(unlikely(now > before)) continue;
+            if(unlikely(now < after)) break;
+
+            if(unlikely(q.group_count == 0)) q.group_start_t = now;
+            q.group_count++;
+
+            rrdr_group_add(&q, 0, handle.flags[i], handle.v[i]);
+
+            if(unlikely(q.group_count == group)) {
+                t = q.group_start_t;
+                r.after = now;
+
+                if(likely(found_non_zero)) od[c] |= RRDR_NONZERO;
+                values[c] = rrdr_group_value(&q, 0, &o[c]);
+
+                q.added++;
+                break;
+            }
+        }
+
+        rrddim_query_finalize(&handle);
+        q.scanned += (size_t)q.counter;
+
+        // all the dimensions have the same points, so they have the row, or none has
+        if(!q.added || q.cancelled) break;
+    }
+
+    if(cost) {
+        if(q.scanned) {
+            cost->queries++;
+            cost->dimensions += d;
+            cost->slots += (q.cancelled)?q.scanned:(size_t)q.counter * d;
+        }
+
+        if(expensive) query_cost_release(cost);
+    }
+
+    // cancelled queries have no result
+    if(unlikely(q.cancelled)) {
+        pthread_rwlock_unlock(&st->rwlock);
+
+        size_t slots = (size_t)((before - after) / st->update_every + 1) * d;
+        query_cost_saved((slots > q.scanned)?slots - q.scanned:0);
+
+        if(value_is_null) *value_is_null = 1;
+        return cost->cancelled;
+    }
+
+    if(!q.added) {
+        pthread_rwlock_unlock(&st->rwlock);
+        return rrdr_reduce_empty(db_after, db_before, value_is_null);
+    }
+
+    r.rows = 1;
+
+    if(absolute_period_requested == 1)
+        buffer_cacheable(wb);
+    else
+        buffer_no_cacheable(wb);
+
+    options = rrdr_check_options(&r, options, NULL);
+    if(pattern) rrdr_disable_not_selected_dimensions(&r, options, pattern);
+
+    if(db_after)  *db_after  = r.after;
+    if(db_before) *db_before = r.before;
+
+    *n = rrdr2value(&r, 0, options, value_is_null);
+
+    pthread_rwlock_unlock(&st->rwlock);
+    return 200;
+
+}
+
 int rrd2value(RRDSET *st, BUFFER *wb, calculated_number *n, const char *dimensions, long points, long long after, long long before, int group_method, uint32_t options, time_t *db_after, time_t *db_before, int *value_is_null)
 {
-    RRDR *r = rrd2rrdr(st, points, after, before, group_method, !(options & RRDR_OPTION_NOT_ALIGNED));
+    SIMPLE_PATTERN *pattern = rrdr_dimensions_pattern(dimensions);
+
+    int ret = rrdr_reduce(st, wb, n, pattern, points, after, before, group_method, options, db_after, db_before, value_is_null);
+    if(ret) {
+        simple_pattern_free(pattern);
+        return ret;
+    }
+
+    RRDR *r = rrd2rrdr(st, points, after, before, 0, group_method, !(options & RRDR_OPTION_NOT_ALIGNED), rrdr_query_pattern(pattern, options));
     if(!r) {
+        simple_pattern_free(pattern);
         if(value_is_null) *value_is_null = 1;
-        return 500;
+
+        int rejected = query_cost_rejected();
+        return (rejected)?rejected:500;
     }
 
     if(rrdr_rows(r) == 0) {
+        simple_pattern_free(pattern);
         rrdr_free(r);
 
         if(db_after)  *db_after  = 0;
@@ -1806,8 +3394,10 @@ int rrd2value(RRDSET *st, BUFFER *wb, calculated_number *n, const char *dimensio
 
     options = rrdr_check_options(r, options, dimensions);
 
-    if(dimensions)
-        rrdr_disable_not_selected_dimensions(r, options, dimensions);
+    if(pattern) {
+        rrdr_disable_not_selected_dimensions(r, options, pattern);
+        simple_pattern_free(pattern);
+    }
 
     if(db_after)  *db_after  = r->after;
     if(db_before) *db_before = r->before;
@@ -1819,55 +3409,245 @@ int rrd2value(RRDSET *st, BUFFER *wb, calculated_number *n, const char *dimensio
     return 200;
 }
 
-int rrd2format(RRDSET *st, BUFFER *wb, BUFFER *dimensions, uint32_t format, long points, long long after, long long before, int group_method, uint32_t options, time_t *latest_timestamp)
+// ----------------------------------------------------------------------------
+// top dimensions
+// the dimensions are ranked by the average of their absolute values in the
+// timeframe of the query. The top ones are moved first, in rank order, and the
+// rest are hidden - or summed in a column named "others", with RRDR_OPTION_OTHERS.
+
+struct rrdr_top_column {
+    calculated_number score;
+    long c;
+};
+
+// move the top largest scores first, in no particular order
+static void rrdr_top_select(struct rrdr_top_column *columns, long count, long top)
 {
-    RRDR *r = rrd2rrdr(st, points, after, before, group_method, !(options & RRDR_OPTION_NOT_ALIGNED));
-    if(!r) {
-        buffer_strcat(wb, "Cannot generate output with these parameters on this chart.");
-        return 500;
+    long left = 0, right = count - 1, k = top - 1;
+
+    while(right > left) {
+        calculated_number pivot = columns[(left + right) / 2].score;
+        struct rrdr_top_column tmp;
+        long i = left, j = right;
+
+        while(i <= j) {
+            while(columns[i].score > pivot) i++;
+            while(columns[j].score < pivot) j--;
+
+            if(i <= j) {
+                tmp = columns[i];
+                columns[i] = columns[j];
+                columns[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+
+        if(k <= j) right = j;
+        else if(k >= i) left = i;
+        else break;
     }
+}
 
-    if(r->result_options & RRDR_RESULT_OPTION_RELATIVE)
-        buffer_no_cacheable(wb);
-    else if(r->result_options & RRDR_RESULT_OPTION_ABSOLUTE)
-        buffer_cacheable(wb);
+static int rrdr_top_compare(const void *a, const void *b)
+{
+    const struct rrdr_top_column *x = a, *y = b;
 
-    options = rrdr_check_options(r, options, (dimensions)?buffer_tostring(dimensions):NULL);
+    if(x->score > y->score) return -1;
+    if(x->score < y->score) return 1;
+    return (x->c < y->c)?-1:(x->c > y->c)?1:0;
+}
 
-    if(dimensions)
-        rrdr_disable_not_selected_dimensions(r, options, buffer_tostring(dimensions));
+static void rrdr_top(RRDR *r, uint32_t options, long top)
+{
+    long c, i, visible = 0, rows = rrdr_rows(r), d = r->d;
 
-    if(latest_timestamp && rrdr_rows(r) > 0)
-        *latest_timestamp = r->before;
+    struct rrdr_top_column *columns = rrdr_memory_get(r, RRDR_MEMORY_TOP, d * sizeof(struct rrdr_top_column));
 
-    switch(format) {
-    case DATASOURCE_SSV:
-        if(options & RRDR_OPTION_JSON_WRAP) {
-            wb->contenttype = CT_APPLICATION_JSON;
-            rrdr_json_wrapper_begin(r, wb, format, options, 1);
-            rrdr2ssv(r, wb, options, "", " ", "");
-            rrdr_json_wrapper_end(r, wb, format, options, 1);
-        }
-        else {
-            wb->contenttype = CT_TEXT_PLAIN;
-            rrdr2ssv(r, wb, options, "", " ", "");
-        }
-        break;
+    // rank the visible dimensions first
+    for(c = 0; c < d ; c++) {
+        if(unlikely((r->od[c] & RRDR_HIDDEN) || ((options & RRDR_OPTION_NONZERO) && !(r->od[c] & RRDR_NONZERO)))) continue;
 
-    case DATASOURCE_SSV_COMMA:
-        if(options & RRDR_OPTION_JSON_WRAP) {
-            wb->contenttype = CT_APPLICATION_JSON;
-            rrdr_json_wrapper_begin(r, wb, format, options, 1);
-            rrdr2ssv(r, wb, options, "", ",", "");
-            rrdr_json_wrapper_end(r, wb, format, options, 1);
-        }
-        else {
-            wb->contenttype = CT_TEXT_PLAIN;
-            rrdr2ssv(r, wb, options, "", ",", "");
+        calculated_number sum = 0;
+        long count = 0;
+
+        for(i = 0; i < rows ; i++) {
+            if(unlikely(r->o[ i * d + c ] & RRDR_EMPTY)) continue;
+
+            calculated_number n = r->v[ i * d + c ];
+            sum += (n < 0)?-n:n;
+            count++;
         }
-        break;
 
-    case DATASOURCE_JS_ARRAY:
+        columns[visible].score = (count)?sum / count:-1;
+        columns[visible].c = c;
+        visible++;
+    }
+
+    if(visible <= top) return;
+
+    rrdr_top_select(columns, visible, top);
+    qsort(columns, top, sizeof(struct rrdr_top_column), rrdr_top_compare);
+
+    long others = -1;
+    for(i = top; i < visible ; i++) {
+        c = columns[i].c;
+        r->od[c] |= RRDR_HIDDEN | RRDR_OTHER;
+        if(others == -1 || c < others) others = c;
+    }
+
+    if(options & RRDR_OPTION_OTHERS) {
+        // the column of the first of the others is reused for their sum
+        // the rest are zeroed, so that the totals of percentages do not change
+        RRDDIM *rd = rrdr_memory_get(r, RRDR_MEMORY_OTHERS, sizeof(RRDDIM));
+        memset(rd, 0, sizeof(RRDDIM));
+        strcpy(rd->id, "others");
+        rd->name = rd->id;
+        rd->hash = simple_hash(rd->id);
+        rd->rrdset = r->st;
+
+        r->others_last_stored_value = NAN;
+        for(c = 0; c < d ; c++) {
+            if(likely(!(r->od[c] & RRDR_OTHER))) continue;
+
+            calculated_number n = rrddim_last_stored_value(r->dims[c]);
+            if(!isnan(n)) r->others_last_stored_value = (isnan(r->others_last_stored_value))?n:r->others_last_stored_value + n;
+        }
+
+        uint8_t od = 0;
+
+        for(i = 0; i < rows ; i++) {
+            calculated_number *cn = &r->v[ i * d ];
+            uint8_t *co = &r->o[ i * d ];
+            calculated_number sum = 0;
+            uint8_t o = RRDR_EMPTY;
+
+            for(c = 0; c < d ; c++) {
+                if(likely(!(r->od[c] & RRDR_OTHER))) continue;
+
+                if(likely(!(co[c] & RRDR_EMPTY))) {
+                    sum += cn[c];
+                    o &= ~RRDR_EMPTY;
+                }
+                o |= co[c] & RRDR_RESET;
+                cn[c] = 0;
+            }
+
+            cn[others] = sum;
+            co[others] = o;
+            od |= o;
+            if(sum != 0) od |= RRDR_NONZERO;
+        }
+
+        r->others = r->dims[others] = rd;
+        r->od[others] = od | RRDR_SELECTED;
+
+        columns[top].c = others;
+        top++;
+    }
+
+    // move the top columns first, in rank order, then the rest as they were
+    long *order = rrdr_memory_get(r, RRDR_MEMORY_TOP_ROW, d * (sizeof(long) + sizeof(RRDDIM *) + sizeof(calculated_number) + 2 * sizeof(uint8_t)));
+    RRDDIM **dims = (RRDDIM **)&order[d];
+    calculated_number *row_v = (calculated_number *)&dims[d];
+    uint8_t *row_o = (uint8_t *)&row_v[d], *od = &row_o[d];
+
+    // mark the top ones in od, to find the rest
+    long k;
+    memset(od, 0, d * sizeof(uint8_t));
+    for(k = 0; k < top ; k++) {
+        order[k] = columns[k].c;
+        od[order[k]] = 1;
+    }
+    for(c = 0; c < d ; c++)
+        if(!od[c]) order[k++] = c;
+
+    for(c = 0; c < d ; c++) {
+        dims[c] = r->dims[order[c]];
+        od[c] = r->od[order[c]];
+    }
+
+    memcpy(r->dims, dims, d * sizeof(RRDDIM *));
+    memcpy(r->od, od, d * sizeof(uint8_t));
+
+    for(i = 0; i < rows ; i++) {
+        calculated_number *cn = &r->v[ i * d ];
+        uint8_t *co = &r->o[ i * d ];
+
+        for(c = 0; c < d ; c++) {
+            row_v[c] = cn[order[c]];
+            row_o[c] = co[order[c]];
+        }
+
+        memcpy(cn, row_v, d * sizeof(calculated_number));
+        memcpy(co, row_o, d * sizeof(uint8_t));
+    }
+}
+
+int rrd2format(RRDSET *st, BUFFER *wb, BUFFER *dimensions, uint32_t format, long points, long long after, long long before, long long since, int group_method, uint32_t options, long top, time_t *latest_timestamp)
+{
+    SIMPLE_PATTERN *pattern = rrdr_dimensions_pattern((dimensions)?buffer_tostring(dimensions):NULL);
+
+    RRDR *r = rrd2rrdr(st, points, after, before, since, group_method, !(options & RRDR_OPTION_NOT_ALIGNED), rrdr_query_pattern(pattern, options));
+    if(!r) {
+        simple_pattern_free(pattern);
+
+        int rejected = query_cost_rejected();
+        if(rejected) {
+            buffer_strcat(wb, (query_cost_cancelled())?"The query has been cancelled.":"The query is too expensive to run now.");
+            return rejected;
+        }
+
+        buffer_strcat(wb, "Cannot generate output with these parameters on this chart.");
+        return 500;
+    }
+
+    if(r->result_options & RRDR_RESULT_OPTION_RELATIVE)
+        buffer_no_cacheable(wb);
+    else if(r->result_options & RRDR_RESULT_OPTION_ABSOLUTE)
+        buffer_cacheable(wb);
+
+    options = rrdr_check_options(r, options, (dimensions)?buffer_tostring(dimensions):NULL);
+
+    if(pattern) {
+        rrdr_disable_not_selected_dimensions(r, options, pattern);
+        simple_pattern_free(pattern);
+    }
+
+    if(top > 0)
+        rrdr_top(r, options, top);
+
+    if(latest_timestamp && rrdr_rows(r) > 0)
+        *latest_timestamp = r->before;
+
+    switch(format) {
+    case DATASOURCE_SSV:
+        if(options & RRDR_OPTION_JSON_WRAP) {
+            wb->contenttype = CT_APPLICATION_JSON;
+            rrdr_json_wrapper_begin(r, wb, format, options, 1);
+            rrdr2ssv(r, wb, options, "", " ", "");
+            rrdr_json_wrapper_end(r, wb, format, options, 1);
+        }
+        else {
+            wb->contenttype = CT_TEXT_PLAIN;
+            rrdr2ssv(r, wb, options, "", " ", "");
+        }
+        break;
+
+    case DATASOURCE_SSV_COMMA:
+        if(options & RRDR_OPTION_JSON_WRAP) {
+            wb->contenttype = CT_APPLICATION_JSON;
+            rrdr_json_wrapper_begin(r, wb, format, options, 1);
+            rrdr2ssv(r, wb, options, "", ",", "");
+            rrdr_json_wrapper_end(r, wb, format, options, 1);
+        }
+        else {
+            wb->contenttype = CT_TEXT_PLAIN;
+            rrdr2ssv(r, wb, options, "", ",", "");
+        }
+        break;
+
+    case DATASOURCE_JS_ARRAY:
         if(options & RRDR_OPTION_JSON_WRAP) {
             wb->contenttype = CT_APPLICATION_JSON;
             rrdr_json_wrapper_begin(r, wb, format, options, 0);
@@ -1940,6 +3720,24 @@ int rrd2format(RRDSET *st, BUFFER *wb, BUFFER *dimensions, uint32_t format, long
         }
         break;
 
+    case DATASOURCE_JSON_DELTA:
+        wb->contenttype = CT_APPLICATION_JSON;
+
+        if(options & RRDR_OPTION_JSON_WRAP)
+            rrdr_json_wrapper_begin(r, wb, format, options, 0);
+
+        rrdr2json_delta(r, wb, options);
+
+        if(options & RRDR_OPTION_JSON_WRAP)
+            rrdr_json_wrapper_end(r, wb, format, options, 0);
+        break;
+
+    case DATASOURCE_BINARY:
+        // it cannot be wrapped in JSON
+        wb->contenttype = CT_APPLICATION_OCTET_STREAM;
+        rrdr2binary(r, wb, options & ~RRDR_OPTION_JSON_WRAP);
+        break;
+
     case DATASOURCE_DATATABLE_JSONP:
         wb->contenttype = CT_APPLICATION_X_JAVASCRIPT;
 
@@ -2026,291 +3824,1233 @@ time_t rrd_stats_json(int type, RRDSET *st, BUFFER *wb, long points, long group,
     if(before == 0 || before > rrdset_last_entry_t(st)) before = rrdset_last_entry_t(st);
     if(after  == 0 || after < rrdset_first_entry_t(st)) after = rrdset_first_entry_t(st);
 
-    // ---
+    // ---
+
+    // our return value (the last timestamp printed)
+    // this is required to detect re-transmit in google JSONP
+    time_t last_timestamp = 0;
+
+
+    // -------------------------------------------------------------------------
+    // find how many dimensions we have
+
+    int dimensions = 0;
+    RRDDIM *rd;
+    for( rd = st->dimensions ; rd ; rd = rd->next) dimensions++;
+    if(!dimensions) {
+        pthread_rwlock_unlock(&st->rwlock);
+        buffer_strcat(wb, "No dimensions yet.");
+        return 0;
+    }
+
+
+    // -------------------------------------------------------------------------
+    // prepare various strings, to speed up the loop
+
+    char overflow_annotation[201]; snprintfz(overflow_annotation, 200, ",{%sv%s:%sRESET OR OVERFLOW%s},{%sv%s:%sThe counters have been wrapped.%s}", kq, kq, sq, sq, kq, kq, sq, sq);
+    char normal_annotation[201];   snprintfz(normal_annotation,   200, ",{%sv%s:null},{%sv%s:null}", kq, kq, kq, kq);
+    char pre_date[51];             snprintfz(pre_date,             50, "        {%sc%s:[{%sv%s:%s", kq, kq, kq, kq, sq);
+    char post_date[21];            snprintfz(post_date,            20, "%s}", sq);
+    char pre_value[21];            snprintfz(pre_value,            20, ",{%sv%s:", kq, kq);
+    char post_value[21];           strcpy(post_value,                  "}");
+
+
+    // -------------------------------------------------------------------------
+    // checks for debugging
+
+    if(st->debug) {
+        debug(D_RRD_STATS, "%s first_entry_t = %ld, last_entry_t = %ld, duration = %ld, after = %ld, before = %ld, duration = %ld, entries_to_show = %ld, group = %ld"
+            , st->id
+            , rrdset_first_entry_t(st)
+            , rrdset_last_entry_t(st)
+            , rrdset_last_entry_t(st) - rrdset_first_entry_t(st)
+            , after
+            , before
+            , before - after
+            , points
+            , group
+            );
+
+        if(before < after)
+            debug(D_RRD_STATS, "WARNING: %s The newest value in the database (%ld) is earlier than the oldest (%ld)", st->name, before, after);
+
+        if((before - after) > st->entries * st->update_every)
+            debug(D_RRD_STATS, "WARNING: %s The time difference between the oldest and the newest entries (%ld) is higher than the capacity of the database (%ld)", st->name, before - after, st->entries * st->update_every);
+    }
+
+
+    // -------------------------------------------------------------------------
+    // temp arrays for keeping values per dimension
+
+    calculated_number group_values[dimensions]; // keep sums when grouping
+    int               print_hidden[dimensions]; // keep hidden flags
+    int               found_non_zero[dimensions];
+    int               found_non_existing[dimensions];
+
+    // initialize them
+    for( rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
+        group_values[c] = 0;
+        print_hidden[c] = (rd->flags & RRDDIM_FLAG_HIDDEN)?1:0;
+        found_non_zero[c] = 0;
+        found_non_existing[c] = 0;
+    }
+
+
+    // error("OLD: points=%d after=%d before=%d group=%d, duration=%d", entries_to_show, before - (st->update_every * group * entries_to_show), before, group, before - after + 1);
+    // rrd2array(st, entries_to_show, before - (st->update_every * group * entries_to_show), before, group_method, only_non_zero);
+    // rrd2rrdr(st, entries_to_show, before - (st->update_every * group * entries_to_show), before, group_method);
+
+    // -------------------------------------------------------------------------
+    // remove dimensions that contain only zeros
+
+    int max_loop = 1;
+    if(only_non_zero) max_loop = 2;
+
+    for(; max_loop ; max_loop--) {
+
+        // -------------------------------------------------------------------------
+        // print the JSON header
+
+        buffer_sprintf(wb, "{\n %scols%s:\n [\n", kq, kq);
+        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%stime%s,%spattern%s:%s%s,%stype%s:%sdatetime%s},\n", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq);
+        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%s%s,%spattern%s:%s%s,%stype%s:%sstring%s,%sp%s:{%srole%s:%sannotation%s}},\n", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, kq, kq, sq, sq);
+        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%s%s,%spattern%s:%s%s,%stype%s:%sstring%s,%sp%s:{%srole%s:%sannotationText%s}}", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, kq, kq, sq, sq);
+
+        // print the header for each dimension
+        // and update the print_hidden array for the dimensions that should be hidden
+        int pc = 0;
+        for( rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
+            if(!print_hidden[c]) {
+                pc++;
+                buffer_sprintf(wb, ",\n     {%sid%s:%s%s,%slabel%s:%s%s%s,%spattern%s:%s%s,%stype%s:%snumber%s}", kq, kq, sq, sq, kq, kq, sq, rd->name, sq, kq, kq, sq, sq, kq, kq, sq, sq);
+            }
+        }
+        if(!pc) {
+            buffer_sprintf(wb, ",\n     {%sid%s:%s%s,%slabel%s:%s%s%s,%spattern%s:%s%s,%stype%s:%snumber%s}", kq, kq, sq, sq, kq, kq, sq, "no data", sq, kq, kq, sq, sq, kq, kq, sq, sq);
+        }
+
+        // print the begin of row data
+        buffer_sprintf(wb, "\n  ],\n    %srows%s:\n [\n", kq, kq);
+
+
+        // -------------------------------------------------------------------------
+        // the main loop
+
+        int annotate_reset = 0;
+        int annotation_count = 0;
+
+        long    t = rrdset_time2slot(st, before),
+                stop_at_t = rrdset_time2slot(st, after);
+
+        t -= t % group;
+
+        time_t  now = rrdset_slot2time(st, t);
+
+        RRDDIM_QUERY_HANDLE *handles = mallocz(dimensions * sizeof(RRDDIM_QUERY_HANDLE));
+        for(rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++)
+            rrddim_query_init(rd, &handles[c], after, now);
+
+        long count = 0, printed = 0, group_count = 0;
+        last_timestamp = 0;
+
+        if(st->debug) debug(D_RRD_STATS, "%s: REQUEST after:%u before:%u, points:%ld, group:%ld, CHART cur:%ld first: %u last:%u, CALC start_t:%ld, stop_t:%ld"
+                    , st->id
+                    , (uint32_t)after
+                    , (uint32_t)before
+                    , points
+                    , group
+                    , st->current_entry
+                    , (uint32_t)rrdset_first_entry_t(st)
+                    , (uint32_t)rrdset_last_entry_t(st)
+                    , t
+                    , stop_at_t
+                    );
+
+        size_t i = 0, batch = 0;
+        for(; ; i++) {
+            if(i >= batch) {
+                for(c = 0 ; c < dimensions ; c++)
+                    batch = rrddim_query_next(&handles[c]);
+
+                if(!batch) break;
+                i = 0;
+            }
+
+            now = handles[0].t[i];
+
+            int print_this = 0;
+
+            if(st->debug) debug(D_RRD_STATS, "%s count = %ld, group_count = %ld, printed = %ld, now = %ld, %s %s"
+                    , st->id
+                    , count + 1
+                    , group_count + 1
+                    , printed
+                    , now
+                    , (group_count + 1 == group)?"PRINT":"  -  "
+                    , (now >= after && now <= before)?"RANGE":"  -  "
+                    );
+
+
+            // make sure we return data in the proper time range
+            if(now > before) continue;
+            if(now < after) break;
+
+            count++;
+            group_count++;
+
+            // check if we have to print this now
+            if(group_count == group) {
+                if(printed >= points) {
+                    // debug(D_RRD_STATS, "Already printed all rows. Stopping.");
+                    break;
+                }
+
+                // generate the local date time
+                struct tm tmbuf, *tm = localtime_r(&now, &tmbuf);
+                if(!tm) { error("localtime() failed."); continue; }
+                if(now > last_timestamp) last_timestamp = now;
+
+                if(printed) buffer_strcat(wb, "]},\n");
+                buffer_strcat(wb, pre_date);
+                buffer_jsdate(wb, tm->tm_year + 1900, tm->tm_mon, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+                buffer_strcat(wb, post_date);
+
+                print_this = 1;
+            }
+
+            // do the calculations
+            for(c = 0 ; c < dimensions ; c++) {
+                uint32_t flags = handles[c].flags[i];
+                calculated_number value = handles[c].v[i];
+
+                if(!does_storage_number_exist(flags)) {
+                    value = 0.0;
+                    found_non_existing[c]++;
+                }
+                if(did_storage_number_reset(flags)) annotate_reset = 1;
+
+                switch(group_method) {
+                    case GROUP_MAX:
+                        if(abs(value) > abs(group_values[c])) group_values[c] = value;
+                        break;
+
+                    case GROUP_SUM:
+                        group_values[c] += value;
+                        break;
+
+                    default:
+                    case GROUP_AVERAGE:
+                        group_values[c] += value;
+                        if(print_this) group_values[c] /= ( group_count - found_non_existing[c] );
+                        break;
+                }
+            }
+
+            if(print_this) {
+                if(annotate_reset) {
+                    annotation_count++;
+                    buffer_strcat(wb, overflow_annotation);
+                    annotate_reset = 0;
+                }
+                else
+                    buffer_strcat(wb, normal_annotation);
+
+                pc = 0;
+                for(c = 0 ; c < dimensions ; c++) {
+                    if(found_non_existing[c] == group_count) {
+                        // all entries are non-existing
+                        pc++;
+                        buffer_strcat(wb, pre_value);
+                        buffer_strcat(wb, "null");
+                        buffer_strcat(wb, post_value);
+                    }
+                    else if(!print_hidden[c]) {
+                        pc++;
+                        buffer_strcat(wb, pre_value);
+                        buffer_rrd_value(wb, group_values[c]);
+                        buffer_strcat(wb, post_value);
+
+                        if(group_values[c]) found_non_zero[c]++;
+                    }
+
+                    // reset them for the next loop
+                    group_values[c] = 0;
+                    found_non_existing[c] = 0;
+                }
+
+                // if all dimensions are hidden, print a null
+                if(!pc) {
+                    buffer_strcat(wb, pre_value);
+                    buffer_strcat(wb, "null");
+                    buffer_strcat(wb, post_value);
+                }
+
+                printed++;
+                group_count = 0;
+            }
+        }
+
+        for(c = 0 ; c < dimensions ; c++)
+            rrddim_query_finalize(&handles[c]);
+        freez(handles);
+
+        if(printed) buffer_strcat(wb, "]}");
+        buffer_strcat(wb, "\n   ]\n}\n");
+
+        if(only_non_zero && max_loop > 1) {
+            int changed = 0;
+            for(rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
+                group_values[c] = 0;
+                found_non_existing[c] = 0;
+
+                if(!print_hidden[c] && !found_non_zero[c]) {
+                    changed = 1;
+                    print_hidden[c] = 1;
+                }
+            }
+
+            if(changed) buffer_flush(wb);
+            else break;
+        }
+        else break;
+
+    } // max_loop
+
+    debug(D_RRD_STATS, "RRD_STATS_JSON: %s total %zu bytes", st->name, wb->len);
+
+    pthread_rwlock_unlock(&st->rwlock);
+    return last_timestamp;
+}
+
+// ----------------------------------------------------------------------------
+// streamed queries
+// the rows are generated and serialized in batches, so the memory needed
+// does not depend on the number of points requested. The chart is locked
+// only while a batch is generated.
+
+#define RRDR_STREAM_ROWS 256                        // the rows of each batch
+#define RRDR_STREAM_MIN_VALUES 65536                // smaller queries are not streamed
+
+struct rrdr_stream {
+    RRDR *r;
+    uint32_t format;
+    uint32_t options;
+};
+
+static void rrdr2format_parts(RRDR *r, BUFFER *wb, uint32_t format, uint32_t options)
+{
+    switch(format) {
+    case DATASOURCE_SSV:
+        rrdr2ssv(r, wb, options, "", " ", "");
+        break;
+
+    case DATASOURCE_SSV_COMMA:
+        rrdr2ssv(r, wb, options, "", ",", "");
+        break;
+
+    case DATASOURCE_JS_ARRAY:
+        rrdr2ssv(r, wb, options, "[", ",", "]");
+        break;
+
+    case DATASOURCE_CSV:
+        rrdr2csv(r, wb, options, "", ",", "\r\n", "");
+        break;
+
+    case DATASOURCE_CSV_JSON_ARRAY:
+        if(r->parts & RRDR_PART_HEADER) buffer_strcat(wb, "[\n");
+        rrdr2csv(r, wb, options + RRDR_OPTION_LABEL_QUOTES, "[", ",", "]", ",\n");
+        if(r->parts & RRDR_PART_FOOTER) buffer_strcat(wb, "\n]");
+        break;
+
+    case DATASOURCE_TSV:
+        rrdr2csv(r, wb, options, "", "\t", "\r\n", "");
+        break;
+
+    case DATASOURCE_HTML:
+        if(r->parts & RRDR_PART_HEADER) buffer_strcat(wb, "<html>\n<center>\n<table border=\"0\" cellpadding=\"5\" cellspacing=\"5\">\n");
+        rrdr2csv(r, wb, options, "<tr><td>", "</td><td>", "</td></tr>\n", "");
+        if(r->parts & RRDR_PART_FOOTER) buffer_strcat(wb, "</table>\n</center>\n</html>\n");
+        break;
+
+    case DATASOURCE_DATATABLE_JSON:
+        rrdr2json(r, wb, options, 1);
+        break;
+
+    case DATASOURCE_JSON:
+    default:
+        rrdr2json(r, wb, options, 0);
+        break;
+    }
+}
+
+// generate and serialize batches of rows, until there are at least 'size' bytes in wb
+// the chart has to be locked
+// returns 1 when there are more rows to be serialized
+static int rrdr_stream_batches(RRDR_STREAM *s, BUFFER *wb, size_t size)
+{
+    RRDR *r = s->r;
+
+    while(r->query) {
+        rrdr_query_rows(r);
+
+        if(unlikely(r->query->cancelled)) {
+            rrdr_query_free(r);
+            return -1;
+        }
+
+        int finished = r->query->finished;
+        if(finished) r->parts |= RRDR_PART_FOOTER;
+
+        rrdr2format_parts(r, wb, s->format, s->options);
+
+        r->rows_before += rrdr_rows(r);
+        r->parts = 0;
+
+        if(finished) rrdr_query_free(r);
+        else if(wb->len >= size) return 1;
+    }
+
+    return 0;
+}
+
+RRDR_STREAM *rrd2format_stream_create(RRDSET *st, BUFFER *wb, BUFFER *dimensions, uint32_t format, long points, long long after, long long before, int group_method, uint32_t options, size_t size)
+{
+    // these need all the rows before the first is serialized
+    if(options & (RRDR_OPTION_JSON_WRAP | RRDR_OPTION_NONZERO | RRDR_OPTION_REVERSED))
+        return NULL;
+
+    uint8_t contenttype;
+    switch(format) {
+        case DATASOURCE_SSV:
+        case DATASOURCE_SSV_COMMA:
+        case DATASOURCE_CSV:
+        case DATASOURCE_CSV_JSON_ARRAY:
+        case DATASOURCE_TSV:
+            contenttype = CT_TEXT_PLAIN;
+            break;
+
+        case DATASOURCE_HTML:
+            contenttype = CT_TEXT_HTML;
+            break;
+
+        case DATASOURCE_JS_ARRAY:
+        case DATASOURCE_DATATABLE_JSON:
+        case DATASOURCE_JSON:
+            contenttype = CT_APPLICATION_JSON;
+            break;
+
+        default:
+            return NULL;
+    }
+
+    SIMPLE_PATTERN *pattern = rrdr_dimensions_pattern((dimensions)?buffer_tostring(dimensions):NULL);
+
+    RRDR *r = rrd2rrdr_prepare(st, points, after, before, 0, group_method, !(options & RRDR_OPTION_NOT_ALIGNED), RRDR_STREAM_ROWS, rrdr_query_pattern(pattern, options));
+    if(!r) {
+        simple_pattern_free(pattern);
+        return NULL;
+    }
+
+    if(!r->query || r->query->points * r->d < RRDR_STREAM_MIN_VALUES) {
+        simple_pattern_free(pattern);
+        rrdr_free(r);
+        return NULL;
+    }
+
+    if(r->result_options & RRDR_RESULT_OPTION_RELATIVE)
+        buffer_no_cacheable(wb);
+    else if(r->result_options & RRDR_RESULT_OPTION_ABSOLUTE)
+        buffer_cacheable(wb);
+
+    wb->contenttype = contenttype;
+
+    if(pattern) {
+        rrdr_disable_not_selected_dimensions(r, options, pattern);
+        simple_pattern_free(pattern);
+    }
+
+    RRDR_STREAM *s = callocz(1, sizeof(RRDR_STREAM));
+    s->r = r;
+    s->format = format;
+    s->options = options;
+
+    r->parts = RRDR_PART_HEADER;
+    rrdr_stream_batches(s, wb, size);
+    rrdr_unlock_rrdset(r);
+
+    return s;
+}
+
+int rrd2format_stream_next(RRDR_STREAM *s, BUFFER *wb, size_t size)
+{
+    if(unlikely(!s->r->query)) return 0;
+
+    rrdr_lock_rrdset(s->r);
+    int ret = rrdr_stream_batches(s, wb, size);
+    rrdr_unlock_rrdset(s->r);
+
+    return ret;
+}
+
+void rrd2format_stream_free(RRDR_STREAM *s)
+{
+    rrdr_free(s->r);
+    freez(s);
+}
+
+// ----------------------------------------------------------------------------
+// context queries
+// the charts of a context are queried one after the other, on a common time grid
+// the rows of each chart are averaged per point of the grid and the charts are
+// aggregated per dimension name
+
+// the names are copied, since dimensions may be renamed while the charts are queried
+struct context_dimension {
+    char *name;
+    uint32_t hash;
+};
+
+static void context_dimensions_free(struct context_dimension *dims, long count)
+{
+    long i;
+    for(i = 0; i < count ; i++)
+        freez(dims[i].name);
+
+    freez(dims);
+}
+
+static long context_dimension_find(struct context_dimension *dims, long count, RRDDIM *rd)
+{
+    uint32_t hash = simple_hash(rd->name);
+
+    long i;
+    for(i = 0; i < count ; i++)
+        if(dims[i].hash == hash && !strcmp(dims[i].name, rd->name))
+            return i;
+
+    return -1;
+}
+
+static inline void context_aggregate(calculated_number *v, long *count, calculated_number n, int aggregate)
+{
+    if(likely(*count)) {
+        switch(aggregate) {
+            case GROUP_MIN:
+                if(n < *v) *v = n;
+                break;
+
+            case GROUP_MAX:
+                if(n > *v) *v = n;
+                break;
+
+            default:
+            case GROUP_SUM:
+            case GROUP_AVERAGE:
+                *v += n;
+                break;
+        }
+    }
+    else
+        *v = n;
+
+    (*count)++;
+}
+
+int rrd2context(BUFFER *wb, const char *context, const char *charts, const char *dimensions, uint32_t format, long points, long long after, long long before, int group_method, int aggregate, uint32_t options)
+{
+    SIMPLE_PATTERN *charts_pattern = rrdr_names_pattern(charts);
+    SIMPLE_PATTERN *pattern = rrdr_names_pattern(dimensions);
+    uint32_t hash = simple_hash(context);
+
+    long i, c, k, charts_count = 0, charts_size = 0, dims_count = 0, dims_size = 0;
+    RRDSET **sts = NULL, *st;
+    struct context_dimension *dims = NULL;
+    RRDDIM *rd;
+
+    int update_every = 0;
+    time_t first_entry_t = 0, last_entry_t = 0;
+
+    // -------------------------------------------------------------------------
+    // find the charts and the names of their dimensions
+
+    pthread_rwlock_rdlock(&localhost.rrdset_root_rwlock);
+    for(st = localhost.rrdset_root; st ; st = st->next) {
+        if(st->hash_context != hash || strcmp(st->context, context) || !st->enabled) continue;
+        if(charts_pattern && !simple_pattern_matches(charts_pattern, st->id) && !simple_pattern_matches(charts_pattern, st->name)) continue;
+
+        time_t first_t = rrdset_first_entry_t(st), last_t = rrdset_last_entry_t(st);
+        if(unlikely(!st->counter_done || last_t <= first_t)) continue;
+
+        if(charts_count == charts_size) {
+            charts_size = (charts_size)?charts_size * 2:16;
+            sts = reallocz(sts, charts_size * sizeof(RRDSET *));
+        }
+        sts[charts_count++] = st;
+
+        if(st->update_every > update_every) update_every = st->update_every;
+        if(!first_entry_t || first_t < first_entry_t) first_entry_t = first_t;
+        if(last_t > last_entry_t) last_entry_t = last_t;
+
+        for(rd = st->dimensions; rd ; rd = rd->next) {
+            if(pattern && !rrdr_dimension_selected(pattern, rd)) continue;
+            if(context_dimension_find(dims, dims_count, rd) != -1) continue;
+
+            if(dims_count == dims_size) {
+                dims_size = (dims_size)?dims_size * 2:16;
+                dims = reallocz(dims, dims_size * sizeof(struct context_dimension));
+            }
+            dims[dims_count].name = strdupz(rd->name);
+            dims[dims_count].hash = simple_hash(dims[dims_count].name);
+            dims_count++;
+        }
+    }
+    pthread_rwlock_unlock(&localhost.rrdset_root_rwlock);
+
+    if(!charts_count || !dims_count) {
+        simple_pattern_free(charts_pattern);
+        simple_pattern_free(pattern);
+        freez(sts);
+        context_dimensions_free(dims, dims_count);
+
+        buffer_strcat(wb, "No charts with data found for context: ");
+        buffer_strcat_htmlescape(wb, context);
+        return 404;
+    }
+
+    // -------------------------------------------------------------------------
+    // the timeframe, as rrd2rrdr() resolves it for a single chart
+
+    int relative = 0;
+
+    if(before == 0 && after == 0) {
+        before = last_entry_t;
+        after = first_entry_t;
+        relative = 1;
+    }
+
+    if(((before < 0)?-before:before) <= API_RELATIVE_TIME_MAX) {
+        before = (before > 0)?first_entry_t + before:last_entry_t + before;
+        relative = 1;
+    }
+
+    if(((after < 0)?-after:after) <= API_RELATIVE_TIME_MAX) {
+        if(after == 0) after = -update_every;
+        after = before + after;
+        relative = 1;
+    }
+
+    if(before > last_entry_t)  before = last_entry_t;
+    if(before < first_entry_t) before = first_entry_t;
+    if(after > last_entry_t)  after = last_entry_t;
+    if(after < first_entry_t) after = first_entry_t;
+
+    if(after > before) {
+        time_t tmp = before;
+        before = after;
+        after = tmp;
+    }
+
+    // the grid: rows of 'step' seconds, a multiple of the largest update frequency,
+    // each one ending at a multiple of it
+    long available_points = (before - after) / update_every;
+    if(available_points < 1) available_points = 1;
+
+    if(points < 0) points = -points;
+    if(points == 0 || points > available_points) points = available_points;
+
+    long step = (available_points / points + ((available_points % points)?1:0)) * update_every;
+
+    before -= before % step;
+    long rows = (before - after) / step;
+    if(rows < 1) rows = 1;
+    after = before - rows * step;
+
+    // -------------------------------------------------------------------------
+    // query the charts
+
+    calculated_number *values = mallocz(rows * dims_count * sizeof(calculated_number));
+    long *counts = callocz(rows * dims_count, sizeof(long));
+
+    // the rows of a single chart that fall on each point of the grid
+    calculated_number *chart_values = mallocz(rows * dims_count * sizeof(calculated_number));
+    long *chart_counts = mallocz(rows * dims_count * sizeof(long));
+
+    int chart_aggregate;
+    switch(group_method) {
+        case GROUP_MIN:
+        case GROUP_MAX:
+        case GROUP_SUM:
+            chart_aggregate = group_method;
+            break;
+
+        case GROUP_INCREMENTAL_SUM:
+            chart_aggregate = GROUP_SUM;
+            break;
+
+        default:
+            chart_aggregate = GROUP_AVERAGE;
+            break;
+    }
+
+    long *columns = NULL, columns_size = 0;
+
+    for(k = 0; k < charts_count ; k++) {
+        st = sts[k];
+
+        // when the update frequency of the chart divides the step, every row of it is a point of the grid
+        // otherwise, its rows are grouped per point of the grid here
+        long chart_points = (step % st->update_every)?rows * step / st->update_every:rows;
+
+        RRDR *r = rrd2rrdr(st, chart_points, after, before, 0, group_method, 1, pattern);
+        if(!r) {
+            if(query_cost_cancelled()) break;
+            continue;
+        }
+
+        if(r->d > columns_size) {
+            columns_size = r->d;
+            columns = reallocz(columns, columns_size * sizeof(long));
+        }
+
+        // the dimension names of the columns
+        for(c = 0, rd = rrdr_dim(r, 0); rd ;c++, rd = rrdr_dim(r, c))
+            columns[c] = (pattern && !rrdr_dimension_selected(pattern, rd))?-1:context_dimension_find(dims, dims_count, rd);
+
+        memset(chart_counts, 0, rows * dims_count * sizeof(long));
+
+        for(i = 0; i < rrdr_rows(r) ; i++) {
+            time_t t = r->t[i];
+            if(t <= after || t > before) continue;
+
+            // the point of the grid the row ends in
+            long row = (before - t) / step;
+
+            calculated_number *cn = &r->v[ i * r->d ];
+            uint8_t *co = &r->o[ i * r->d ];
+
+            for(c = 0; c < r->d ; c++) {
+                if(unlikely(columns[c] == -1 || (co[c] & RRDR_EMPTY))) continue;
+
+                long slot = row * dims_count + columns[c];
+                context_aggregate(&chart_values[slot], &chart_counts[slot], cn[c], chart_aggregate);
+            }
+        }
+
+        rrdr_free(r);
+
+        for(i = 0; i < rows * dims_count ; i++)
+            if(chart_counts[i])
+                context_aggregate(&values[i], &counts[i], (chart_aggregate == GROUP_AVERAGE)?chart_values[i] / chart_counts[i]:chart_values[i], aggregate);
+    }
+
+    int ret = query_cost_cancelled();
+    if(unlikely(ret)) {
+        buffer_strcat(wb, "The query has been cancelled.");
+        goto cleanup;
+    }
+    ret = 200;
+
+    if(aggregate == GROUP_AVERAGE)
+        for(i = 0; i < rows * dims_count ; i++)
+            if(counts[i]) values[i] /= counts[i];
+
+    // -------------------------------------------------------------------------
+    // the output
+
+    if(relative)
+        buffer_no_cacheable(wb);
+    else
+        buffer_cacheable(wb);
+
+    long start = 0, end = rows, direction = 1;
+    if(options & RRDR_OPTION_REVERSED) {
+        start = rows - 1;
+        end = -1;
+        direction = -1;
+    }
+
+    if(format == DATASOURCE_CSV) {
+        wb->contenttype = CT_TEXT_PLAIN;
+
+        buffer_strcat(wb, "time");
+        for(c = 0; c < dims_count ; c++) {
+            buffer_strcat(wb, ",");
+            buffer_strcat(wb, dims[c].name);
+        }
+        buffer_strcat(wb, "\r\n");
+    }
+    else {
+        wb->contenttype = CT_APPLICATION_JSON;
+
+        buffer_sprintf(wb, "{\n"
+                "   \"context\": \"%s\",\n"
+                "   \"aggregate\": \"%s\",\n"
+                "   \"group\": \"%s\",\n"
+                "   \"update_every\": %ld,\n"
+                "   \"after\": %u,\n"
+                "   \"before\": %u,\n"
+                "   \"points\": %ld,\n"
+                "   \"charts\": ["
+                , context
+                , group_method2string(aggregate)
+                , group_method2string(group_method)
+                , step
+                , (uint32_t)(after + step)
+                , (uint32_t)before
+                , rows
+                );
+
+        for(k = 0; k < charts_count ; k++)
+            buffer_sprintf(wb, "%s\"%s\"", (k)?", ":"", sts[k]->id);
+
+        buffer_strcat(wb, "],\n   \"labels\": [\"time\"");
+        for(c = 0; c < dims_count ; c++)
+            buffer_sprintf(wb, ", \"%s\"", dims[c].name);
+
+        buffer_strcat(wb, "],\n   \"data\": [");
+    }
+
+    for(i = start; i != end ; i += direction) {
+        time_t t = before - i * step;
+
+        if(format == DATASOURCE_CSV) {
+            if(options & RRDR_OPTION_MILLISECONDS) buffer_sprintf(wb, "%u000", (uint32_t)t);
+            else buffer_sprintf(wb, "%u", (uint32_t)t);
+        }
+        else {
+            buffer_strcat(wb, (i == start)?"\n      [":",\n      [");
+            if(options & RRDR_OPTION_MILLISECONDS) buffer_sprintf(wb, " %u000", (uint32_t)t);
+            else buffer_sprintf(wb, " %u", (uint32_t)t);
+        }
+
+        for(c = 0; c < dims_count ; c++) {
+            buffer_strcat(wb, (format == DATASOURCE_CSV)?",":", ");
+
+            if(counts[i * dims_count + c])
+                buffer_rrd_value(wb, values[i * dims_count + c]);
+            else if(options & RRDR_OPTION_NULL2ZERO)
+                buffer_strcat(wb, "0");
+            else
+                buffer_strcat(wb, "null");
+        }
+
+        buffer_strcat(wb, (format == DATASOURCE_CSV)?"\r\n":"]");
+    }
+
+    if(format != DATASOURCE_CSV)
+        buffer_strcat(wb, "\n   ]\n}\n");
+
+cleanup:
+    freez(columns);
+    freez(chart_values);
+    freez(chart_counts);
+    freez(values);
+    freez(counts);
+    freez(sts);
+    context_dimensions_free(dims, dims_count);
+    simple_pattern_free(charts_pattern);
+    simple_pattern_free(pattern);
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+// metric correlations
+// every dimension of the charts is reduced to one value in a baseline and in a
+// highlighted timeframe, with the grouping of the queries of rows, and the
+// dimensions are ranked by how much these two values differ.
+// the charts are scanned in parallel, by the query pool.
+
+#define CORRELATIONS_DEFAULT_DURATION 300
+#define CORRELATIONS_DEFAULT_BASELINE 4     // the baseline is this many times the highlighted timeframe
+
+struct correlation_dimension {
+    RRDSET *st;
+    RRDDIM *rd;
+
+    calculated_number baseline;
+    calculated_number highlight;
+    calculated_number score;
+};
+
+struct correlation_chart {
+    RRDSET *st;
+    int group_method;
+
+    time_t baseline_after;
+    time_t baseline_before;
+    time_t after;
+    time_t before;
+
+    struct query_cost *request;                     // the cost of the request, NULL when not accounted
+    struct query_cost cost;                         // the cost of this chart, on the thread that scanned it
+    int cancelled;
+
+    long dimensions;                                // the dimensions of the chart, when it was found
+    struct correlation_dimension *dims;             // the dimensions with values in both timeframes
+    long dims_count;
+};
+
+// the value of the points of dimension rd after 'after' and up to 'before', grouped in one,
+// with the grouping of the single dimension query q - returns the points scanned
+// it stops when the request of q is cancelled, setting q->cancelled
+static long rrdr_reduce_window(struct rrdr_query *q, RRDDIM *rd, time_t after, time_t before, calculated_number *value, uint8_t *options)
+{
+    RRDDIM_QUERY_HANDLE handle;
+
+    q->last_values[0] = 0;
+    q->group_values[0] = (q->group_method == GROUP_MAX || q->group_method == GROUP_MIN)?NAN:0;
+    q->group_counts[0] = 0;
+    q->group_options[0] = 0;
+    q->found_non_zero[0] = 0;
+    if(q->sketches) percentile_sketch_reset(&q->sketches[0]);
+    q->counter = 0;
+
+    rrddim_query_init(rd, &handle, after, before);
+
+    size_t i, count = 0;
+    for(i = 0; ; i++) {
+        if(unlikely(i >= count)) {
+            // stop when the request has been cancelled
+            if(unlikely(rrdr_query_check(q, q->scanned + (size_t)q->counter))) break;
+
+            count = rrddim_query_next(&handle);
+            if(unlikely(!count)) break;
+            i = 0;
+        }
+
+        time_t now = handle.t[i];
+        if(unlikely(now > before)) continue;
+        if(unlikely(now <= after)) break;
+
+        rrdr_group_add(q, 0, handle.flags[i], handle.v[i]);
+        q->counter++;
+    }
+
+    rrddim_query_finalize(&handle);
+    q->scanned += (size_t)q->counter;
 
-    // our return value (the last timestamp printed)
-    // this is required to detect re-transmit in google JSONP
-    time_t last_timestamp = 0;
+    *value = rrdr_group_value(q, 0, options);
+    return q->counter;
+}
 
+static void correlation_chart_query(void *ptr)
+{
+    struct correlation_chart *cc = ptr;
+    RRDSET *st = cc->st;
 
-    // -------------------------------------------------------------------------
-    // find how many dimensions we have
+    // the cpu time of the thread of the request is accounted to the request
+    int worker = (query_cost_get() == NULL);
+    query_cost_attach(&cc->cost);
 
-    int dimensions = 0;
-    RRDDIM *rd;
-    for( rd = st->dimensions ; rd ; rd = rd->next) dimensions++;
-    if(!dimensions) {
-        pthread_rwlock_unlock(&st->rwlock);
-        buffer_strcat(wb, "No dimensions yet.");
-        return 0;
+    if(cc->request && query_cost_check(cc->request)) {
+        cc->cancelled = 1;
+        goto done;
     }
 
+    pthread_rwlock_rdlock(&st->rwlock);
 
-    // -------------------------------------------------------------------------
-    // prepare various strings, to speed up the loop
+    RRDDIM *rd;
+    long d = 0;
+    for(rd = st->dimensions; rd ; rd = rd->next) d++;
+
+    if(d) cc->dims = mallocz(d * sizeof(struct correlation_dimension));
+
+    // the state of the grouping of one dimension
+    calculated_number last_value, group_value;
+    long group_counts;
+    uint8_t group_options, found_non_zero;
+    PERCENTILE_SKETCH sketch;
+
+    struct rrdr_query q;
+    memset(&q, 0, sizeof(struct rrdr_query));
+    q.group_method = cc->group_method;
+    q.last_values = &last_value;
+    q.group_values = &group_value;
+    q.group_counts = &group_counts;
+    q.group_options = &group_options;
+    q.found_non_zero = &found_non_zero;
+    q.percentile = group_method_percentile(cc->group_method);
+    if(q.percentile) q.sketches = &sketch;
+    q.cost = cc->request;
+
+    for(rd = st->dimensions; rd && d ; rd = rd->next, d--) {
+        calculated_number baseline, highlight;
+        uint8_t baseline_options, highlight_options;
+
+        rrdr_reduce_window(&q, rd, cc->baseline_after, cc->baseline_before, &baseline, &baseline_options);
+        rrdr_reduce_window(&q, rd, cc->after, cc->before, &highlight, &highlight_options);
+
+        if(unlikely(q.cancelled)) {
+            cc->cancelled = 1;
+            break;
+        }
 
-    char overflow_annotation[201]; snprintfz(overflow_annotation, 200, ",{%sv%s:%sRESET OR OVERFLOW%s},{%sv%s:%sThe counters have been wrapped.%s}", kq, kq, sq, sq, kq, kq, sq, sq);
-    char normal_annotation[201];   snprintfz(normal_annotation,   200, ",{%sv%s:null},{%sv%s:null}", kq, kq, kq, kq);
-    char pre_date[51];             snprintfz(pre_date,             50, "        {%sc%s:[{%sv%s:%s", kq, kq, kq, kq, sq);
-    char post_date[21];            snprintfz(post_date,            20, "%s}", sq);
-    char pre_value[21];            snprintfz(pre_value,            20, ",{%sv%s:", kq, kq);
-    char post_value[21];           strcpy(post_value,                  "}");
+        if((baseline_options | highlight_options) & RRDR_EMPTY) continue;
 
+        // the change, relative to the size of the values: 0 to 1
+        calculated_number total = fabsl(baseline) + fabsl(highlight);
+        if(total == 0.0) continue;
 
-    // -------------------------------------------------------------------------
-    // checks for debugging
+        calculated_number score = fabsl(highlight - baseline) / total;
+        if(score == 0.0) continue;
 
-    if(st->debug) {
-        debug(D_RRD_STATS, "%s first_entry_t = %ld, last_entry_t = %ld, duration = %ld, after = %ld, before = %ld, duration = %ld, entries_to_show = %ld, group = %ld"
-            , st->id
-            , rrdset_first_entry_t(st)
-            , rrdset_last_entry_t(st)
-            , rrdset_last_entry_t(st) - rrdset_first_entry_t(st)
-            , after
-            , before
-            , before - after
-            , points
-            , group
-            );
+        struct correlation_dimension *cd = &cc->dims[cc->dims_count++];
+        cd->st = st;
+        cd->rd = rd;
+        cd->baseline = baseline;
+        cd->highlight = highlight;
+        cd->score = score;
+    }
 
-        if(before < after)
-            debug(D_RRD_STATS, "WARNING: %s The newest value in the database (%ld) is earlier than the oldest (%ld)", st->name, before, after);
+    pthread_rwlock_unlock(&st->rwlock);
 
-        if((before - after) > st->entries * st->update_every)
-            debug(D_RRD_STATS, "WARNING: %s The time difference between the oldest and the newest entries (%ld) is higher than the capacity of the database (%ld)", st->name, before - after, st->entries * st->update_every);
+    if(q.scanned) {
+        cc->cost.queries++;
+        cc->cost.dimensions += cc->dims_count;
+        cc->cost.slots += q.scanned;
     }
 
+done:
+    query_cost_detach(&cc->cost);
+    if(!worker) cc->cost.cpu_usec = 0;
+}
 
-    // -------------------------------------------------------------------------
-    // temp arrays for keeping values per dimension
-
-    calculated_number group_values[dimensions]; // keep sums when grouping
-    int               print_hidden[dimensions]; // keep hidden flags
-    int               found_non_zero[dimensions];
-    int               found_non_existing[dimensions];
+// the most changed first - ties in a stable order, by chart and dimension
+static int correlation_dimension_compare(const void *a, const void *b)
+{
+    const struct correlation_dimension *x = a, *y = b;
 
-    // initialize them
-    for( rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
-        group_values[c] = 0;
-        print_hidden[c] = (rd->flags & RRDDIM_FLAG_HIDDEN)?1:0;
-        found_non_zero[c] = 0;
-        found_non_existing[c] = 0;
-    }
+    if(x->score > y->score) return -1;
+    if(x->score < y->score) return 1;
 
+    calculated_number dx = fabsl(x->highlight - x->baseline), dy = fabsl(y->highlight - y->baseline);
+    if(dx > dy) return -1;
+    if(dx < dy) return 1;
 
-    // error("OLD: points=%d after=%d before=%d group=%d, duration=%d", entries_to_show, before - (st->update_every * group * entries_to_show), before, group, before - after + 1);
-    // rrd2array(st, entries_to_show, before - (st->update_every * group * entries_to_show), before, group_method, only_non_zero);
-    // rrd2rrdr(st, entries_to_show, before - (st->update_every * group * entries_to_show), before, group_method);
+    int ret = strcmp(x->st->id, y->st->id);
+    return (ret)?ret:strcmp(x->rd->id, y->rd->id);
+}
 
-    // -------------------------------------------------------------------------
-    // remove dimensions that contain only zeros
+// resolve a timestamp relative to 'base', like the timeframes of the queries
+static inline long long correlation_time(long long t, long long base)
+{
+    return (((t < 0)?-t:t) <= API_RELATIVE_TIME_MAX)?base + t:t;
+}
 
-    int max_loop = 1;
-    if(only_non_zero) max_loop = 2;
+static inline long long correlation_clamp(long long t, time_t first_entry_t, time_t last_entry_t)
+{
+    if(t > last_entry_t) return last_entry_t;
+    if(t < first_entry_t) return first_entry_t;
+    return t;
+}
 
-    for(; max_loop ; max_loop--) {
+int rrd2correlations(BUFFER *wb, const char *charts, long long baseline_after, long long baseline_before, long long after, long long before, int group_method, long top)
+{
+    if(group_method == GROUP_LTTB) {
+        buffer_strcat(wb, "The lttb group method selects points, it cannot be used to compare timeframes.");
+        return 400;
+    }
 
-        // -------------------------------------------------------------------------
-        // print the JSON header
+    SIMPLE_PATTERN *charts_pattern = rrdr_names_pattern(charts);
 
-        buffer_sprintf(wb, "{\n %scols%s:\n [\n", kq, kq);
-        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%stime%s,%spattern%s:%s%s,%stype%s:%sdatetime%s},\n", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq);
-        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%s%s,%spattern%s:%s%s,%stype%s:%sstring%s,%sp%s:{%srole%s:%sannotation%s}},\n", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, kq, kq, sq, sq);
-        buffer_sprintf(wb, "        {%sid%s:%s%s,%slabel%s:%s%s,%spattern%s:%s%s,%stype%s:%sstring%s,%sp%s:{%srole%s:%sannotationText%s}}", kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, sq, sq, kq, kq, kq, kq, sq, sq);
+    long k, charts_count = 0, charts_size = 0, dims_count = 0;
+    struct correlation_chart *ccs = NULL;
+    struct correlation_dimension *dims = NULL;
+    RRDSET *st;
+    RRDDIM *rd;
 
-        // print the header for each dimension
-        // and update the print_hidden array for the dimensions that should be hidden
-        int pc = 0;
-        for( rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
-            if(!print_hidden[c]) {
-                pc++;
-                buffer_sprintf(wb, ",\n     {%sid%s:%s%s,%slabel%s:%s%s%s,%spattern%s:%s%s,%stype%s:%snumber%s}", kq, kq, sq, sq, kq, kq, sq, rd->name, sq, kq, kq, sq, sq, kq, kq, sq, sq);
-            }
-        }
-        if(!pc) {
-            buffer_sprintf(wb, ",\n     {%sid%s:%s%s,%slabel%s:%s%s%s,%spattern%s:%s%s,%stype%s:%snumber%s}", kq, kq, sq, sq, kq, kq, sq, "no data", sq, kq, kq, sq, sq, kq, kq, sq, sq);
-        }
+    int update_every = 0;
+    time_t first_entry_t = 0, last_entry_t = 0;
+    int ret = 400;
 
-        // print the begin of row data
-        buffer_sprintf(wb, "\n  ],\n    %srows%s:\n [\n", kq, kq);
+    // -------------------------------------------------------------------------
+    // find the charts
 
+    pthread_rwlock_rdlock(&localhost.rrdset_root_rwlock);
+    for(st = localhost.rrdset_root; st ; st = st->next) {
+        if(!st->enabled) continue;
+        if(charts_pattern && !simple_pattern_matches(charts_pattern, st->id) && !simple_pattern_matches(charts_pattern, st->name)) continue;
 
-        // -------------------------------------------------------------------------
-        // the main loop
+        time_t first_t = rrdset_first_entry_t(st), last_t = rrdset_last_entry_t(st);
+        if(unlikely(!st->counter_done || last_t <= first_t)) continue;
 
-        int annotate_reset = 0;
-        int annotation_count = 0;
+        if(charts_count == charts_size) {
+            charts_size = (charts_size)?charts_size * 2:256;
+            ccs = reallocz(ccs, charts_size * sizeof(struct correlation_chart));
+        }
+        struct correlation_chart *cc = &ccs[charts_count++];
+        memset(cc, 0, sizeof(struct correlation_chart));
+        cc->st = st;
+        for(rd = st->dimensions; rd ; rd = rd->next) cc->dimensions++;
+
+        if(st->update_every > update_every) update_every = st->update_every;
+        if(!first_entry_t || first_t < first_entry_t) first_entry_t = first_t;
+        if(last_t > last_entry_t) last_entry_t = last_t;
+    }
+    pthread_rwlock_unlock(&localhost.rrdset_root_rwlock);
 
-        long    t = rrdset_time2slot(st, before),
-                stop_at_t = rrdset_time2slot(st, after),
-                stop_now = 0;
+    if(!charts_count) {
+        buffer_strcat(wb, "No charts with data found.");
+        ret = 404;
+        goto cleanup;
+    }
 
-        t -= t % group;
+    // -------------------------------------------------------------------------
+    // the timeframes
+    // before is relative to the last entry of the charts, after to before,
+    // baseline_before to after and baseline_after to baseline_before
 
-        time_t  now = rrdset_slot2time(st, t),
-                dt = st->update_every;
+    if(before == 0) before = last_entry_t;
+    else before = correlation_time(before, (before > 0)?first_entry_t:last_entry_t);
 
-        long count = 0, printed = 0, group_count = 0;
-        last_timestamp = 0;
+    if(after == 0) after = -CORRELATIONS_DEFAULT_DURATION;
+    after = correlation_time(after, before);
 
-        if(st->debug) debug(D_RRD_STATS, "%s: REQUEST after:%u before:%u, points:%ld, group:%ld, CHART cur:%ld first: %u last:%u, CALC start_t:%ld, stop_t:%ld"
-                    , st->id
-                    , (uint32_t)after
-                    , (uint32_t)before
-                    , points
-                    , group
-                    , st->current_entry
-                    , (uint32_t)rrdset_first_entry_t(st)
-                    , (uint32_t)rrdset_last_entry_t(st)
-                    , t
-                    , stop_at_t
-                    );
+    before = correlation_clamp(before, first_entry_t, last_entry_t);
+    after = correlation_clamp(after, first_entry_t, last_entry_t);
 
-        long counter = 0;
-        for(; !stop_now ; now -= dt, t--, counter++) {
-            if(t < 0) t = st->entries - 1;
-            if(t == stop_at_t) stop_now = counter;
+    baseline_before = correlation_time(baseline_before, after);
 
-            int print_this = 0;
+    if(baseline_after == 0) baseline_after = -CORRELATIONS_DEFAULT_BASELINE * (before - after);
+    baseline_after = correlation_time(baseline_after, baseline_before);
 
-            if(st->debug) debug(D_RRD_STATS, "%s t = %ld, count = %ld, group_count = %ld, printed = %ld, now = %ld, %s %s"
-                    , st->id
-                    , t
-                    , count + 1
-                    , group_count + 1
-                    , printed
-                    , now
-                    , (group_count + 1 == group)?"PRINT":"  -  "
-                    , (now >= after && now <= before)?"RANGE":"  -  "
-                    );
+    baseline_before = correlation_clamp(baseline_before, first_entry_t, last_entry_t);
+    baseline_after = correlation_clamp(baseline_after, first_entry_t, last_entry_t);
 
+    if(before - after < update_every) {
+        buffer_strcat(wb, "The highlighted timeframe has no data.");
+        goto cleanup;
+    }
 
-            // make sure we return data in the proper time range
-            if(now > before) continue;
-            if(now < after) break;
+    if(baseline_before - baseline_after < update_every) {
+        buffer_strcat(wb, "The baseline timeframe has no data.");
+        goto cleanup;
+    }
 
-            //if(rrdset_slot2time(st, t) != now)
-            //  error("%s: slot=%ld, now=%ld, slot2time=%ld, diff=%ld, last_entry_t=%ld, rrdset_last_slot=%ld", st->id, t, now, rrdset_slot2time(st,t), now - rrdset_slot2time(st,t), rrdset_last_entry_t(st), rrdset_last_slot(st));
+    if(baseline_before > after) {
+        buffer_strcat(wb, "The baseline has to end before the highlighted timeframe starts.");
+        goto cleanup;
+    }
 
-            count++;
-            group_count++;
+    // -------------------------------------------------------------------------
+    // query the charts
 
-            // check if we have to print this now
-            if(group_count == group) {
-                if(printed >= points) {
-                    // debug(D_RRD_STATS, "Already printed all rows. Stopping.");
-                    break;
-                }
+    struct query_cost *cost = query_cost_get();
+    int expensive = 0;
+    size_t slots = 0;
 
-                // generate the local date time
-                struct tm tmbuf, *tm = localtime_r(&now, &tmbuf);
-                if(!tm) { error("localtime() failed."); continue; }
-                if(now > last_timestamp) last_timestamp = now;
+    for(k = 0; k < charts_count ; k++) {
+        struct correlation_chart *cc = &ccs[k];
 
-                if(printed) buffer_strcat(wb, "]},\n");
-                buffer_strcat(wb, pre_date);
-                buffer_jsdate(wb, tm->tm_year + 1900, tm->tm_mon, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
-                buffer_strcat(wb, post_date);
+        cc->group_method = group_method;
+        cc->baseline_after = baseline_after;
+        cc->baseline_before = baseline_before;
+        cc->after = after;
+        cc->before = before;
+        cc->request = cost;
+        query_cost_reset(&cc->cost);
 
-                print_this = 1;
-            }
+        slots += (size_t)((before - after + baseline_before - baseline_after) / cc->st->update_every) * cc->dimensions;
+    }
 
-            // do the calculations
-            for(rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
-                storage_number n = rd->values[t];
-                calculated_number value = unpack_storage_number(n);
+    if(cost) {
+        expensive = query_cost_admit(cost, "correlations", slots);
+        if(expensive == -1) {
+            buffer_strcat(wb, "The query is too expensive to run now.");
+            ret = cost->rejected;
+            goto cleanup;
+        }
+    }
 
-                if(!does_storage_number_exist(n)) {
-                    value = 0.0;
-                    found_non_existing[c]++;
-                }
-                if(did_storage_number_reset(n)) annotate_reset = 1;
+    query_pool_run(correlation_chart_query, ccs, sizeof(struct correlation_chart), (size_t)charts_count);
 
-                switch(group_method) {
-                    case GROUP_MAX:
-                        if(abs(value) > abs(group_values[c])) group_values[c] = value;
-                        break;
+    int cancelled = 0;
+    size_t scanned = 0;
+    for(k = 0; k < charts_count ; k++) {
+        dims_count += ccs[k].dims_count;
+        scanned += ccs[k].cost.slots;
+        if(ccs[k].cancelled) cancelled = 1;
 
-                    case GROUP_SUM:
-                        group_values[c] += value;
-                        break;
+        if(cost) query_cost_merge(cost, &ccs[k].cost);
+    }
 
-                    default:
-                    case GROUP_AVERAGE:
-                        group_values[c] += value;
-                        if(print_this) group_values[c] /= ( group_count - found_non_existing[c] );
-                        break;
-                }
-            }
+    if(expensive) query_cost_release(cost);
 
-            if(print_this) {
-                if(annotate_reset) {
-                    annotation_count++;
-                    buffer_strcat(wb, overflow_annotation);
-                    annotate_reset = 0;
-                }
-                else
-                    buffer_strcat(wb, normal_annotation);
+    if(unlikely(cancelled)) {
+        query_cost_saved((slots > scanned)?slots - scanned:0);
 
-                pc = 0;
-                for(c = 0 ; c < dimensions ; c++) {
-                    if(found_non_existing[c] == group_count) {
-                        // all entries are non-existing
-                        pc++;
-                        buffer_strcat(wb, pre_value);
-                        buffer_strcat(wb, "null");
-                        buffer_strcat(wb, post_value);
-                    }
-                    else if(!print_hidden[c]) {
-                        pc++;
-                        buffer_strcat(wb, pre_value);
-                        buffer_rrd_value(wb, group_values[c]);
-                        buffer_strcat(wb, post_value);
+        buffer_strcat(wb, "The query has been cancelled.");
+        ret = cost->cancelled;
+        goto cleanup;
+    }
 
-                        if(group_values[c]) found_non_zero[c]++;
-                    }
+    // -------------------------------------------------------------------------
+    // rank the dimensions
+
+    if(dims_count) {
+        long c = 0;
+        dims = mallocz(dims_count * sizeof(struct correlation_dimension));
+        for(k = 0; k < charts_count ; k++) {
+            if(!ccs[k].dims_count) continue;
+            memcpy(&dims[c], ccs[k].dims, ccs[k].dims_count * sizeof(struct correlation_dimension));
+            c += ccs[k].dims_count;
+        }
 
-                    // reset them for the next loop
-                    group_values[c] = 0;
-                    found_non_existing[c] = 0;
-                }
+        qsort(dims, (size_t)dims_count, sizeof(struct correlation_dimension), correlation_dimension_compare);
+    }
 
-                // if all dimensions are hidden, print a null
-                if(!pc) {
-                    buffer_strcat(wb, pre_value);
-                    buffer_strcat(wb, "null");
-                    buffer_strcat(wb, post_value);
-                }
+    long results = (top > 0 && top < dims_count)?top:dims_count;
 
-                printed++;
-                group_count = 0;
-            }
-        }
+    // -------------------------------------------------------------------------
+    // the output
 
-        if(printed) buffer_strcat(wb, "]}");
-        buffer_strcat(wb, "\n   ]\n}\n");
+    buffer_no_cacheable(wb);
+    wb->contenttype = CT_APPLICATION_JSON;
 
-        if(only_non_zero && max_loop > 1) {
-            int changed = 0;
-            for(rd = st->dimensions, c = 0 ; rd && c < dimensions ; rd = rd->next, c++) {
-                group_values[c] = 0;
-                found_non_existing[c] = 0;
+    buffer_sprintf(wb, "{\n"
+            "   \"group\": \"%s\",\n"
+            "   \"baseline_after\": %u,\n"
+            "   \"baseline_before\": %u,\n"
+            "   \"after\": %u,\n"
+            "   \"before\": %u,\n"
+            "   \"charts\": %ld,\n"
+            "   \"dimensions\": %ld,\n"
+            "   \"correlated\": ["
+            , group_method2string(group_method)
+            , (uint32_t)baseline_after
+            , (uint32_t)baseline_before
+            , (uint32_t)after
+            , (uint32_t)before
+            , charts_count
+            , dims_count
+            );
 
-                if(!print_hidden[c] && !found_non_zero[c]) {
-                    changed = 1;
-                    print_hidden[c] = 1;
-                }
-            }
+    for(k = 0; k < results ; k++) {
+        struct correlation_dimension *cd = &dims[k];
 
-            if(changed) buffer_flush(wb);
-            else break;
-        }
-        else break;
+        buffer_sprintf(wb, "%s\n      { \"chart\": \"%s\", \"dimension\": \"%s\", \"name\": \"%s\", \"score\": "
+                , (k)?",":""
+                , cd->st->id
+                , cd->rd->id
+                , cd->rd->name
+                );
+        buffer_rrd_value(wb, cd->score);
+        buffer_strcat(wb, ", \"baseline\": ");
+        buffer_rrd_value(wb, cd->baseline);
+        buffer_strcat(wb, ", \"highlight\": ");
+        buffer_rrd_value(wb, cd->highlight);
+        buffer_strcat(wb, " }");
+    }
 
-    } // max_loop
+    buffer_strcat(wb, (results)?"\n   ]\n}\n":"]\n}\n");
+    ret = 200;
 
-    debug(D_RRD_STATS, "RRD_STATS_JSON: %s total %zu bytes", st->name, wb->len);
+cleanup:
+    for(k = 0; k < charts_count ; k++)
+        freez(ccs[k].dims);
 
-    pthread_rwlock_unlock(&st->rwlock);
-    return last_timestamp;
+    freez(ccs);
+    freez(dims);
+    simple_pattern_free(charts_pattern);
+    return ret;
 }
@@ -18,6 +18,8 @@
 #define DATASOURCE_JS_ARRAY 8
 #define DATASOURCE_SSV_COMMA 9
 #define DATASOURCE_CSV_JSON_ARRAY 10
+#define DATASOURCE_BINARY 11
+#define DATASOURCE_JSON_DELTA 12
 
 #define DATASOURCE_FORMAT_JSON "json"
 #define DATASOURCE_FORMAT_DATATABLE_JSON "datatable"
@@ -30,6 +32,58 @@
 #define DATASOURCE_FORMAT_JS_ARRAY "array"
 #define DATASOURCE_FORMAT_SSV_COMMA "ssvcomma"
 #define DATASOURCE_FORMAT_CSV_JSON_ARRAY "csvjsonarray"
+#define DATASOURCE_FORMAT_BINARY "binary"
+#define DATASOURCE_FORMAT_JSON_DELTA "jsondelta"
+
+// DATASOURCE_BINARY layout - all numbers are little endian
+//
+// offset  size
+//      0     4  magic "NDRB"
+//      4     2  version (DATASOURCE_BINARY_VERSION)
+//      6     2  the size of each value: 8 = float64, 4 = float32 (RRDR_OPTION_FLOAT32)
+//      8     4  the RRDR_OPTION_* of the query
+//     12     4  update_every, in seconds
+//     16     8  after, the timestamp of the oldest row
+//     24     8  before, the timestamp of the newest row
+//     32     4  the number of rows
+//     36     4  the number of dimensions
+//     40     4  the size of the labels, including their padding
+//     44     4  reserved, zero
+//     48        the labels - the names of the dimensions, each terminated by a zero byte,
+//               padded with zeros to a multiple of 8 bytes
+//               the dimension flags - one byte per dimension (DATASOURCE_BINARY_DIMENSION_*),
+//               padded with zeros to a multiple of 8 bytes
+//               the timestamps - one uint32 per row, padded with zeros to a multiple of 8 bytes
+//               the values - all the rows of the first dimension, then all the rows of the second, etc.
+//               null values are NaN (zero with RRDR_OPTION_NULL2ZERO)
+//
+// rows are ordered newest to oldest, or oldest to newest with RRDR_OPTION_REVERSED.
+// all arrays are aligned to 8 bytes from the beginning of the response.
+#define DATASOURCE_BINARY_MAGIC "NDRB"
+#define DATASOURCE_BINARY_VERSION 1
+#define DATASOURCE_BINARY_HEADER_SIZE 48
+
+#define DATASOURCE_BINARY_DIMENSION_EMPTY   0x01 // the dimension has null values
+#define DATASOURCE_BINARY_DIMENSION_RESET   0x02 // the dimension has values of counter resets or overflows
+#define DATASOURCE_BINARY_DIMENSION_NONZERO 0x08 // the dimension has non-zero values
+
+// DATASOURCE_JSON_DELTA is columnar JSON:
+//
+// {
+//    "labels": [ the names of the dimensions ],
+//    "first_t": the timestamp of the first value of each dimension,
+//    "last_t": the timestamp of the last value of each dimension,
+//    "update_every": the seconds between the rows,
+//    "points": the number of values of each dimension,
+//    "scale": the values are integers, to be divided by this,
+//    "data": [ one array per dimension ]
+// }
+//
+// the first value of each array is the scaled value, each next one is
+// the difference from the previous non-null value of the array.
+// rows are ordered newest to oldest, or oldest to newest with RRDR_OPTION_REVERSED.
+// "time" is added, with the differences of the timestamps, when the rows are not
+// update_every apart.
 
 #define ALLMETRICS_FORMAT_SHELL "shell"
 #define ALLMETRICS_FORMAT_PROMETHEUS "prometheus"
@@ -43,6 +97,10 @@
 #define GROUP_MAX               3
 #define GROUP_SUM               4
 #define GROUP_INCREMENTAL_SUM   5
+#define GROUP_MEDIAN            6
+#define GROUP_PERCENTILE95      7
+#define GROUP_PERCENTILE99      8
+#define GROUP_LTTB              9
 
 #define RRDR_OPTION_NONZERO         0x00000001 // don't output dimensions will just zero values
 #define RRDR_OPTION_REVERSED        0x00000002 // output the rows in reverse order (oldest to newest)
@@ -57,12 +115,28 @@
 #define RRDR_OPTION_LABEL_QUOTES    0x00000400 // in CSV output, wrap header labels in double quotes
 #define RRDR_OPTION_PERCENTAGE      0x00000800 // give values as percentage of total
 #define RRDR_OPTION_NOT_ALIGNED     0x00001000 // do not align charts for persistant timeframes
+#define RRDR_OPTION_FLOAT32         0x00002000 // in binary output, give values as float32, instead of float64
+#define RRDR_OPTION_OTHERS          0x00004000 // with top dimensions, add the rest as a dimension named "others"
 
 extern void rrd_stats_api_v1_chart(RRDSET *st, BUFFER *wb);
 extern void rrd_stats_api_v1_charts(BUFFER *wb);
 
+// the JSON of each chart is kept for /api/v1/charts until the definition of the chart changes
+struct rrdset_charts_json {
+    unsigned long generation;                       // the generation of the chart the JSON was rendered at
+    BUFFER *wb;                                     // the key and the JSON of the chart, without its entries
+    size_t head;                                    // the length of the JSON before its entries
+
+    size_t dimensions;                              // the visible dimensions of the chart
+};
+
+// free the JSON of the chart kept for /api/v1/charts
+// has to be called with the charts of the host write locked
+extern void rrd_stats_api_v1_chart_json_free(RRDSET *st);
+
 extern void rrd_stats_api_v1_charts_allmetrics_shell(BUFFER *wb);
 extern void rrd_stats_api_v1_charts_allmetrics_prometheus(BUFFER *wb);
+extern void rrd_stats_api_v1_allmetrics_names(RRDSET *st, RRDDIM *rd);
 
 extern unsigned long rrd_stats_one_json(RRDSET *st, char *options, BUFFER *wb);
 
@@ -72,7 +146,48 @@ extern void rrd_stats_all_json(BUFFER *wb);
 
 extern time_t rrd_stats_json(int type, RRDSET *st, BUFFER *wb, long entries_to_show, long group, int group_method, time_t after, time_t before, int only_non_zero);
 
-extern int rrd2format(RRDSET *st, BUFFER *out, BUFFER *dimensions, uint32_t format, long points, long long after, long long before, int group_method, uint32_t options, time_t *latest_timestamp);
+// top > 0 returns only the top dimensions, ranked by the average of their absolute values
+// since > 0 returns only the rows at and after the timestamp 'since', grouped as the whole timeframe
+extern int rrd2format(RRDSET *st, BUFFER *out, BUFFER *dimensions, uint32_t format, long points, long long after, long long before, long long since, int group_method, uint32_t options, long top, time_t *latest_timestamp);
 extern int rrd2value(RRDSET *st, BUFFER *wb, calculated_number *n, const char *dimensions, long points, long long after, long long before, int group_method, uint32_t options, time_t *db_before, time_t *db_after, int *value_is_null);
 
+// streamed queries
+// the result is generated in parts of at least 'size' bytes, without keeping all the rows in memory.
+// rrd2format_stream_create() returns NULL when the query is small, or it cannot be streamed
+// (wrapped in JSON, with options that need all the rows, or JSONP formats) - use rrd2format() then.
+// rrd2format_stream_next() returns 1 while there are more parts, -1 when the request has been cancelled.
+typedef struct rrdr_stream RRDR_STREAM;
+extern RRDR_STREAM *rrd2format_stream_create(RRDSET *st, BUFFER *wb, BUFFER *dimensions, uint32_t format, long points, long long after, long long before, int group_method, uint32_t options, size_t size);
+extern int rrd2format_stream_next(RRDR_STREAM *s, BUFFER *wb, size_t size);
+extern void rrd2format_stream_free(RRDR_STREAM *s);
+
+// context queries
+// aggregate the charts of a context (optionally those matching the charts pattern)
+// per dimension name, with GROUP_SUM, GROUP_AVERAGE, GROUP_MIN or GROUP_MAX.
+// the output is DATASOURCE_JSON or DATASOURCE_CSV.
+extern int rrd2context(BUFFER *wb, const char *context, const char *charts, const char *dimensions, uint32_t format, long points, long long after, long long before, int group_method, int aggregate, uint32_t options);
+
+// metric correlations
+// rank the dimensions of all the charts (optionally those matching the charts pattern)
+// by the change of their value (grouped with group_method) from the baseline to the
+// highlighted timeframe: |highlight - baseline| / (|highlight| + |baseline|), 0 to 1.
+// the output is JSON, with the top dimensions (all of them when top is 0).
+extern int rrd2correlations(BUFFER *wb, const char *charts, long long baseline_after, long long baseline_before, long long after, long long before, int group_method, long top);
+
+// query arenas
+// every thread keeps the memory of the results of its last queries and
+// reuses it for its next ones, so that queries allocate memory only when
+// they need more than their thread already has.
+struct rrdr_arena_statistics {
+    unsigned long long queries;                     // the results created
+    unsigned long long reused;                      // the results that reused the memory of a previous query
+    unsigned long long allocations;                 // the arrays allocated by queries
+    unsigned long long allocated;                   // the bytes allocated by queries
+
+    size_t memory;                                  // the memory kept by the arenas of all threads, in bytes
+};
+
+extern void rrdr_arena_init(void);
+extern void rrdr_arena_statistics(struct rrdr_arena_statistics *ras);
+
 #endif /* NETDATA_RRD2JSON_H */
@@ -69,7 +69,14 @@ static inline struct simple_pattern *parse_pattern(const char *str, SIMPLE_PREFI
     return m;
 }
 
-SIMPLE_PATTERN *simple_pattern_create(const char *list, SIMPLE_PREFIX_MODE default_mode) {
+// separators = NULL separates the words with spaces
+static inline int is_separator(char c, const char *separators) {
+    if(likely(!separators)) return isspace(c);
+    return (c && strchr(separators, c))?1:0;
+}
+
+// wildcards = 0 matches the words exactly, with their asterisks and exclamation marks
+static SIMPLE_PATTERN *simple_pattern_create_internal(const char *list, const char *separators, SIMPLE_PREFIX_MODE default_mode, int wildcards) {
     struct simple_pattern *root = NULL, *last = NULL;
 
     if(unlikely(!list || !*list)) return root;
@@ -81,10 +88,10 @@ SIMPLE_PATTERN *simple_pattern_create(const char *list, SIMPLE_PREFIX_MODE defau
         while(s && *s) {
             char negative = 0;
 
-            // skip all spaces
-            while(isspace(*s)) s++;
+            // skip all separators
+            while(is_separator(*s, separators)) s++;
 
-            if(*s == '!') {
+            if(wildcards && *s == '!') {
                 negative = 1;
                 s++;
             }
@@ -92,9 +99,9 @@ SIMPLE_PATTERN *simple_pattern_create(const char *list, SIMPLE_PREFIX_MODE defau
             // empty string
             if(unlikely(!*s)) break;
 
-            // find the next space
+            // find the next separator
             char *c = s;
-            while(*c && !isspace(*c)) c++;
+            while(*c && !is_separator(*c, separators)) c++;
 
             // find the next word
             char *n;
@@ -104,7 +111,15 @@ SIMPLE_PATTERN *simple_pattern_create(const char *list, SIMPLE_PREFIX_MODE defau
             // terminate our string
             *c = '\0';
 
-            struct simple_pattern *m = parse_pattern(s, default_mode);
+            struct simple_pattern *m;
+            if(likely(wildcards))
+                m = parse_pattern(s, default_mode);
+            else {
+                m = callocz(1, sizeof(struct simple_pattern));
+                m->match = strdupz(s);
+                m->len = strlen(m->match);
+                m->mode = SIMPLE_PATTERN_EXACT;
+            }
             m->negative = negative;
 
             if(likely(n)) *c = ' ';
@@ -126,6 +141,18 @@ SIMPLE_PATTERN *simple_pattern_create(const char *list, SIMPLE_PREFIX_MODE defau
     return (SIMPLE_PATTERN *)root;
 }
 
+SIMPLE_PATTERN *simple_pattern_create(const char *list, SIMPLE_PREFIX_MODE default_mode) {
+    return simple_pattern_create_internal(list, NULL, default_mode, 1);
+}
+
+SIMPLE_PATTERN *simple_pattern_create_separated(const char *list, const char *separators, SIMPLE_PREFIX_MODE default_mode) {
+    return simple_pattern_create_internal(list, separators, default_mode, 1);
+}
+
+SIMPLE_PATTERN *simple_pattern_create_words(const char *list, const char *separators) {
+    return simple_pattern_create_internal(list, separators, SIMPLE_PATTERN_EXACT, 0);
+}
+
 static inline int match_pattern(struct simple_pattern *m, const char *str, size_t len) {
     char *s;
 
@@ -193,5 +220,5 @@ static inline void free_pattern(struct simple_pattern *m) {
 void simple_pattern_free(SIMPLE_PATTERN *list) {
     if(!list) return;
 
-    free_pattern(((struct simple_pattern *)list)->next);
+    free_pattern((struct simple_pattern *)list);
 }
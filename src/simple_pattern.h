@@ -15,6 +15,15 @@ typedef void SIMPLE_PATTERN;
 // should be considered PREFIX matches.
 extern SIMPLE_PATTERN *simple_pattern_create(const char *list, SIMPLE_PREFIX_MODE default_mode);
 
+// the same, with the words separated by any of the characters in separators,
+// instead of spaces - spaces are part of the words
+extern SIMPLE_PATTERN *simple_pattern_create_separated(const char *list, const char *separators, SIMPLE_PREFIX_MODE default_mode);
+
+// create a simple_pattern matching exactly the words of the list, separated
+// by any of the characters in separators - asterisks and exclamation marks
+// are part of the words
+extern SIMPLE_PATTERN *simple_pattern_create_words(const char *list, const char *separators);
+
 // test if string str is matched from the pattern
 extern int simple_pattern_matches(SIMPLE_PATTERN *list, const char *str);
 
@@ -0,0 +1,323 @@
+#include "common.h"
+
+// ----------------------------------------------------------------------------
+// chunked values
+// every dimension has st->entries values, indexed by the slots of the chart
+// and kept in chunks of a page.
+// when the dimension is mapped to a file, the chunks are consecutive, right
+// after the RRDDIM header. Otherwise they are allocated the first time a
+// value is stored in them, so charts that do not live long enough to fill
+// their history, do not allocate it.
+// unallocated (and zeroed) values read as non-existing ones.
+
+#define storage_chunk_bits(entry_size) (((entry_size) == 8) ? 9 : 10)
+#define storage_chunk_entries(entry_size) (1L << storage_chunk_bits(entry_size))
+#define storage_chunk_mask(entry_size) (storage_chunk_entries(entry_size) - 1)
+#define storage_chunks(entries, entry_size) (((entries) + storage_chunk_mask(entry_size)) >> storage_chunk_bits(entry_size))
+
+// the mapped values start at the first 8-byte aligned offset after the header
+#define storage_mapped_values(rd) ((char *)(rd) + ((offsetof(RRDDIM, values) + 7) & ~((size_t)7)))
+
+static inline long storage_chunk_size(RRDDIM *rd, long chunk, size_t entry_size) {
+    long entries = rd->entries - (chunk << storage_chunk_bits(entry_size));
+    if(entries > storage_chunk_entries(entry_size)) entries = storage_chunk_entries(entry_size);
+    return entries;
+}
+
+static inline unsigned long storage_chunks_memsize(long entries, size_t entry_size) {
+    return sizeof(RRDDIM) + (entries * entry_size);
+}
+
+static inline void storage_chunks_init(RRDDIM *rd, size_t entry_size) {
+    long c, chunks = storage_chunks(rd->entries, entry_size);
+
+    rd->chunks = callocz((size_t)chunks, sizeof(void *));
+
+    if(rd->mapped != RRD_MEMORY_MODE_RAM) {
+        char *values = storage_mapped_values(rd);
+        for(c = 0; c < chunks ; c++)
+            rd->chunks[c] = &values[(c << storage_chunk_bits(entry_size)) * entry_size];
+    }
+}
+
+// returns the chunk of a slot, allocating it if needed
+// it returns NULL when the chunk has not been allocated and the value
+// to be stored is not existing (gaps do not allocate memory)
+static inline void *storage_chunk_for_write(RRDDIM *rd, long slot, size_t entry_size, uint32_t flags) {
+    long c = slot >> storage_chunk_bits(entry_size);
+
+    if(unlikely(!rd->chunks[c])) {
+        if(!get_storage_number_flags(flags)) return NULL;
+
+        size_t entries = (size_t)storage_chunk_size(rd, c, entry_size);
+        rd->chunks[c] = callocz(entries, entry_size);
+        rd->memsize += entries * entry_size;
+
+        debug(D_RRD_CALLS, "%s/%s: allocated chunk %ld of the round robin database (%zu entries)", rd->rrdset->id, rd->id, c, entries);
+    }
+
+    return rd->chunks[c];
+}
+
+static inline void storage_chunks_reset(RRDDIM *rd, size_t entry_size) {
+    long c, chunks = storage_chunks(rd->entries, entry_size);
+
+    for(c = 0; c < chunks ; c++)
+        if(rd->chunks[c])
+            memset(rd->chunks[c], 0, storage_chunk_size(rd, c, entry_size) * entry_size);
+}
+
+static inline void storage_chunks_free(RRDDIM *rd, size_t entry_size) {
+    if(rd->mapped == RRD_MEMORY_MODE_RAM) {
+        long c, chunks = storage_chunks(rd->entries, entry_size);
+
+        for(c = 0; c < chunks ; c++)
+            freez(rd->chunks[c]);
+    }
+
+    freez(rd->chunks);
+    rd->chunks = NULL;
+}
+
+static void storage_query_init(RRDDIM *rd, RRDDIM_QUERY_HANDLE *handle, time_t after, time_t before) {
+    RRDSET *st = rd->rrdset;
+
+    long start_slot = rrdset_time2slot(st, before),
+         stop_slot = rrdset_time2slot(st, after);
+
+    handle->rd = rd;
+    handle->slot = start_slot;
+    handle->start_t = rrdset_slot2time(st, start_slot);
+    handle->end_t = rrdset_slot2time(st, stop_slot);
+    handle->count = 0;
+    handle->first_t = rrdset_first_entry_t(st);
+
+    // when both ends of the timeframe fall on the same slot, the whole
+    // round robin database is walked, back to the starting slot
+    if(start_slot >= stop_slot)
+        handle->remaining = start_slot - stop_slot + 1;
+    else
+        handle->remaining = start_slot + st->entries - stop_slot + 1;
+
+    if(unlikely(start_slot == stop_slot && after < before))
+        handle->remaining += st->entries;
+}
+
+// new points overwrite the oldest points of the round robin database.
+// streamed queries do not hold the chart locked between batches, so the points
+// that existed when the query started may have been overwritten since then.
+// returns the timestamp before which these points are not valid any more.
+static inline time_t storage_query_overwritten_before(RRDDIM_QUERY_HANDLE *handle) {
+    time_t first_t = rrdset_first_entry_t(handle->rd->rrdset);
+    return (unlikely(first_t > handle->first_t)) ? first_t : 0;
+}
+
+static void storage_query_finalize(RRDDIM_QUERY_HANDLE *handle) {
+    handle->count = 0;
+    handle->remaining = 0;
+}
+
+// ----------------------------------------------------------------------------
+// the round robin engine
+// values are packed in 32-bit storage_numbers
+
+static unsigned long rrddim_ring_memsize(long entries) {
+    return storage_chunks_memsize(entries, sizeof(storage_number));
+}
+
+static void rrddim_ring_init(RRDDIM *rd) {
+    storage_chunks_init(rd, sizeof(storage_number));
+}
+
+static calculated_number rrddim_ring_store(RRDDIM *rd, time_t t, calculated_number value, uint32_t flags) {
+    (void)t;
+
+    long slot = rd->rrdset->current_entry;
+    storage_number *chunk = storage_chunk_for_write(rd, slot, sizeof(storage_number), flags);
+    if(unlikely(!chunk)) return 0;
+
+    storage_number n = pack_storage_number(value, flags);
+    chunk[slot & storage_chunk_mask(sizeof(storage_number))] = n;
+    return unpack_storage_number(n);
+}
+
+static void rrddim_ring_reset(RRDDIM *rd) {
+    storage_chunks_reset(rd, sizeof(storage_number));
+}
+
+static void rrddim_ring_free(RRDDIM *rd) {
+    storage_chunks_free(rd, sizeof(storage_number));
+}
+
+static size_t rrddim_ring_query_next(RRDDIM_QUERY_HANDLE *handle) {
+    RRDDIM *rd = handle->rd;
+    storage_number **chunks = (storage_number **)rd->chunks;
+
+    long slot = handle->slot, entries = rd->entries;
+    time_t t = (handle->count) ? handle->t[handle->count - 1] - rd->update_every : handle->start_t;
+    time_t overwritten_t = storage_query_overwritten_before(handle);
+
+    size_t i, count = (handle->remaining < RRDDIM_QUERY_BATCH_SIZE) ? (size_t)handle->remaining : RRDDIM_QUERY_BATCH_SIZE;
+    for(i = 0; i < count ; i++, t -= rd->update_every) {
+        storage_number *chunk = chunks[slot >> storage_chunk_bits(sizeof(storage_number))];
+        storage_number n = (likely(chunk)) ? chunk[slot & storage_chunk_mask(sizeof(storage_number))] : SN_NOT_EXISTS;
+        if(unlikely(t < overwritten_t && t >= handle->first_t)) n = SN_NOT_EXISTS;
+
+        handle->t[i] = t;
+        handle->v[i] = unpack_storage_number(n);
+        handle->flags[i] = get_storage_number_flags(n);
+
+        if(unlikely(--slot < 0)) slot = entries - 1;
+    }
+
+    handle->slot = slot;
+    handle->remaining -= count;
+    handle->count = count;
+    return count;
+}
+
+STORAGE_ENGINE storage_engine_ring = {
+        .name = STORAGE_ENGINE_RING_NAME,
+        .magic = RRDDIMENSION_MAGIC,
+        .dimension_memsize = rrddim_ring_memsize,
+        .init = rrddim_ring_init,
+        .store = rrddim_ring_store,
+        .reset = rrddim_ring_reset,
+        .free = rrddim_ring_free,
+        .query_init = storage_query_init,
+        .query_next = rrddim_ring_query_next,
+        .query_finalize = storage_query_finalize
+};
+
+// ----------------------------------------------------------------------------
+// the wide round robin engine
+// values are kept as 64-bit doubles (about 15 significant digits, without
+// the range limits of storage_number), for charts with high range counters.
+// the 2 least significant bits of the mantissa hold the flags:
+// 00 = not exists, 01 = exists, 10 = exists and reset
+
+typedef uint64_t storage_number_wide;
+
+#define SNW_FLAGS_MASK  ((storage_number_wide)0x3)
+#define SNW_EXISTS      ((storage_number_wide)0x1)
+#define SNW_RESET       ((storage_number_wide)0x2)
+
+static inline storage_number_wide pack_storage_number_wide(calculated_number value, uint32_t flags) {
+    flags = get_storage_number_flags(flags);
+    if(unlikely(!flags)) return 0;
+
+    double d = (double)value;
+    storage_number_wide n;
+    memcpy(&n, &d, sizeof(n));
+
+    return (n & ~SNW_FLAGS_MASK) | ((flags == SN_EXISTS_RESET) ? SNW_RESET : SNW_EXISTS);
+}
+
+static inline calculated_number unpack_storage_number_wide(storage_number_wide n) {
+    double d;
+    n &= ~SNW_FLAGS_MASK;
+    memcpy(&d, &n, sizeof(d));
+    return (calculated_number)d;
+}
+
+#define get_storage_number_wide_flags(n) ( \
+        (((n) & SNW_FLAGS_MASK) == SNW_EXISTS) ? SN_EXISTS : \
+        (((n) & SNW_FLAGS_MASK) == SNW_RESET)  ? SN_EXISTS_RESET : SN_NOT_EXISTS )
+
+static unsigned long rrddim_wide_memsize(long entries) {
+    return storage_chunks_memsize(entries, sizeof(storage_number_wide));
+}
+
+static void rrddim_wide_init(RRDDIM *rd) {
+    storage_chunks_init(rd, sizeof(storage_number_wide));
+}
+
+static calculated_number rrddim_wide_store(RRDDIM *rd, time_t t, calculated_number value, uint32_t flags) {
+    (void)t;
+
+    long slot = rd->rrdset->current_entry;
+    storage_number_wide *chunk = storage_chunk_for_write(rd, slot, sizeof(storage_number_wide), flags);
+    if(unlikely(!chunk)) return 0;
+
+    storage_number_wide n = pack_storage_number_wide(value, flags);
+    chunk[slot & storage_chunk_mask(sizeof(storage_number_wide))] = n;
+    return unpack_storage_number_wide(n);
+}
+
+static void rrddim_wide_reset(RRDDIM *rd) {
+    storage_chunks_reset(rd, sizeof(storage_number_wide));
+}
+
+static void rrddim_wide_free(RRDDIM *rd) {
+    storage_chunks_free(rd, sizeof(storage_number_wide));
+}
+
+static size_t rrddim_wide_query_next(RRDDIM_QUERY_HANDLE *handle) {
+    RRDDIM *rd = handle->rd;
+    storage_number_wide **chunks = (storage_number_wide **)rd->chunks;
+
+    long slot = handle->slot, entries = rd->entries;
+    time_t t = (handle->count) ? handle->t[handle->count - 1] - rd->update_every : handle->start_t;
+    time_t overwritten_t = storage_query_overwritten_before(handle);
+
+    size_t i, count = (handle->remaining < RRDDIM_QUERY_BATCH_SIZE) ? (size_t)handle->remaining : RRDDIM_QUERY_BATCH_SIZE;
+    for(i = 0; i < count ; i++, t -= rd->update_every) {
+        storage_number_wide *chunk = chunks[slot >> storage_chunk_bits(sizeof(storage_number_wide))];
+        storage_number_wide n = (likely(chunk)) ? chunk[slot & storage_chunk_mask(sizeof(storage_number_wide))] : 0;
+        if(unlikely(t < overwritten_t && t >= handle->first_t)) n = 0;
+
+        handle->t[i] = t;
+        handle->v[i] = unpack_storage_number_wide(n);
+        handle->flags[i] = get_storage_number_wide_flags(n);
+
+        if(unlikely(--slot < 0)) slot = entries - 1;
+    }
+
+    handle->slot = slot;
+    handle->remaining -= count;
+    handle->count = count;
+    return count;
+}
+
+STORAGE_ENGINE storage_engine_wide = {
+        .name = STORAGE_ENGINE_WIDE_NAME,
+        .magic = RRDDIMENSION_MAGIC_WIDE,
+        .dimension_memsize = rrddim_wide_memsize,
+        .init = rrddim_wide_init,
+        .store = rrddim_wide_store,
+        .reset = rrddim_wide_reset,
+        .free = rrddim_wide_free,
+        .query_init = storage_query_init,
+        .query_next = rrddim_wide_query_next,
+        .query_finalize = storage_query_finalize
+};
+
+// ----------------------------------------------------------------------------
+// engine selection
+
+STORAGE_ENGINE *storage_engine_find(const char *name) {
+    if(!strcmp(name, STORAGE_ENGINE_WIDE_NAME))
+        return &storage_engine_wide;
+
+    if(strcmp(name, STORAGE_ENGINE_RING_NAME) != 0)
+        error("Unknown storage engine '%s'. Using '%s'.", name, STORAGE_ENGINE_RING_NAME);
+
+    return &storage_engine_ring;
+}
+
+// ----------------------------------------------------------------------------
+// helpers
+
+calculated_number rrddim_last_stored_value(RRDDIM *rd) {
+    RRDSET *st = rd->rrdset;
+    RRDDIM_QUERY_HANDLE handle;
+    calculated_number value = NAN;
+
+    time_t last_t = rrdset_last_entry_t(st);
+    rrddim_query_init(rd, &handle, last_t, last_t);
+    if(likely(rrddim_query_next(&handle) && does_storage_number_exist(handle.flags[0])))
+        value = handle.v[0];
+    rrddim_query_finalize(&handle);
+
+    return value;
+}
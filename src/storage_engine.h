@@ -0,0 +1,95 @@
+#ifndef NETDATA_STORAGE_ENGINE_H
+#define NETDATA_STORAGE_ENGINE_H 1
+
+// ----------------------------------------------------------------------------
+// storage engines
+//
+// a storage engine owns the layout of the values of a dimension.
+// collectors store values through it (rrdset_done()) and queries read
+// them back through cursors, that return batches of points in
+// reverse chronological order (newest to oldest).
+
+#define RRDDIM_QUERY_BATCH_SIZE 32
+
+struct rrddim_query_handle {
+    RRDDIM *rd;
+
+    time_t start_t;                                 // the timestamp of the first (newest) point of the query
+    time_t end_t;                                   // the timestamp of the last (oldest) point of the query
+
+    // the current batch of points
+    // t[0] is the newest, t[count - 1] is the oldest
+    size_t count;
+    time_t t[RRDDIM_QUERY_BATCH_SIZE];
+    calculated_number v[RRDDIM_QUERY_BATCH_SIZE];
+    uint32_t flags[RRDDIM_QUERY_BATCH_SIZE];        // SN_NOT_EXISTS, SN_EXISTS or SN_EXISTS_RESET
+
+    // private to the storage engine
+    long slot;
+    long remaining;
+    time_t first_t;                                 // the oldest entry of the chart when the query started
+};
+typedef struct rrddim_query_handle RRDDIM_QUERY_HANDLE;
+
+#define STORAGE_ENGINE_RING_NAME "ring"
+#define STORAGE_ENGINE_WIDE_NAME "wide"
+
+struct storage_engine {
+    const char *name;
+    const char *magic;                              // the magic of the files of mapped dimensions
+
+    // ------------------------------------------------------------------------
+    // collection
+
+    // the memory required for a dimension of a chart with this many entries
+    // when it is mapped to a file
+    unsigned long (*dimension_memsize)(long entries);
+
+    // prepare a newly added dimension for collection
+    void (*init)(RRDDIM *rd);
+
+    // store a value at the current entry of the chart
+    // it returns the value as it will be returned to queries
+    calculated_number (*store)(RRDDIM *rd, time_t t, calculated_number value, uint32_t flags);
+
+    // forget all the values of a dimension
+    void (*reset)(RRDDIM *rd);
+
+    // release all the memory the engine allocated for a dimension
+    void (*free)(RRDDIM *rd);
+
+    // ------------------------------------------------------------------------
+    // queries
+
+    // prepare a cursor from 'before' back to 'after'
+    // both have to be within the retention of the chart
+    void (*query_init)(RRDDIM *rd, RRDDIM_QUERY_HANDLE *handle, time_t after, time_t before);
+
+    // fill the next batch of points, returns the number of points in it
+    // 0 means the cursor has been exhausted
+    size_t (*query_next)(RRDDIM_QUERY_HANDLE *handle);
+
+    void (*query_finalize)(RRDDIM_QUERY_HANDLE *handle);
+};
+typedef struct storage_engine STORAGE_ENGINE;
+
+extern STORAGE_ENGINE storage_engine_ring;
+extern STORAGE_ENGINE storage_engine_wide;
+
+extern STORAGE_ENGINE *storage_engine_find(const char *name);
+
+#define rrddim_memsize(st) ((st)->storage_engine->dimension_memsize((st)->entries))
+#define rrddim_storage_init(rd) ((rd)->rrdset->storage_engine->init(rd))
+#define rrddim_storage_free(rd) ((rd)->rrdset->storage_engine->free(rd))
+#define rrddim_store(rd, t, value, flags) ((rd)->rrdset->storage_engine->store(rd, t, value, flags))
+#define rrddim_storage_reset(rd) ((rd)->rrdset->storage_engine->reset(rd))
+
+#define rrddim_query_init(rd, handle, after, before) ((rd)->rrdset->storage_engine->query_init(rd, handle, after, before))
+#define rrddim_query_next(handle) ((handle)->rd->rrdset->storage_engine->query_next(handle))
+#define rrddim_query_finalize(handle) ((handle)->rd->rrdset->storage_engine->query_finalize(handle))
+
+// the last stored value of a dimension
+// returns NAN when it does not exist
+extern calculated_number rrddim_last_stored_value(RRDDIM *rd);
+
+#endif /* NETDATA_STORAGE_ENGINE_H */
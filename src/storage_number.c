@@ -1,8 +1,5 @@
 #include "common.h"
 
-extern char *print_number_lu_r(char *str, unsigned long uvalue);
-extern char *print_number_llu_r(char *str, unsigned long long uvalue);
-
 storage_number pack_storage_number(calculated_number value, uint32_t flags)
 {
     // bit 32 = sign 0:positive, 1:negative
@@ -105,64 +102,159 @@ calculated_number unpack_storage_number(storage_number value)
     return n;
 }
 
-int print_calculated_number(char *str, calculated_number value)
-{
-    char *wstr = str;
+// ----------------------------------------------------------------------------
+// number formatting
+//
+// numbers are printed with a fixed number of decimal digits, rounded to the
+// nearest, without trailing zeros. The digits are generated with integer
+// arithmetic, by print_number_llu(). Only values too big to be scaled to
+// 64 bits are printed with snprintf().
 
-    int sign = (value < 0) ? 1 : 0;
-    if(sign) value = -value;
+static const unsigned long long decimal_powers[PRINT_NUMBER_MAX_DECIMALS + 1] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+// the values below these can be scaled to 64 bits
+static const calculated_number decimal_limits[PRINT_NUMBER_MAX_DECIMALS + 1] = {
+        1.8e19, 1.8e18, 1.8e17, 1.8e16, 1.8e15, 1.8e14, 1.8e13, 1.8e12, 1.8e11, 1.8e10
+};
 
 #ifdef STORAGE_WITH_MATH
-    // without llrint() there are rounding problems
-    // for example 0.9 becomes 0.89
-    unsigned long long uvalue = (unsigned long long int) llrint(value * (calculated_number)100000);
-#else
-    unsigned long long uvalue = value * (calculated_number)100000;
+// round a positive value scaled by power to the nearest integer, the way
+// snprintf() does - the product is checked against the exact one when it
+// is close to half-way, since the multiplication may have moved it to the
+// other side of it
+static unsigned long long round_scaled_number(calculated_number value, unsigned long long power)
+{
+    calculated_number scaled = value * (calculated_number)power;
+    unsigned long long uvalue = (unsigned long long)llrintl(scaled);
+
+    calculated_number distance = scaled - (calculated_number)uvalue;
+    if(distance > 0.49 || distance < -0.49) {
+        calculated_number rounding = fmal(value, (calculated_number)power, -scaled);
+
+        if(distance > 0) {
+            distance -= 0.5;
+            if(distance > -rounding || (distance == -rounding && (uvalue & 1))) uvalue++;
+        }
+        else {
+            distance += 0.5;
+            if(distance < -rounding || (distance == -rounding && (uvalue & 1))) uvalue--;
+        }
+    }
+
+    return uvalue;
+}
 #endif
 
-#ifdef ENVIRONMENT32
-    if(uvalue > (unsigned long long)0xffffffff)
-        wstr = print_number_llu_r(str, uvalue);
+// print a positive value that can be scaled to 64 bits
+// when inlined with a constant number of decimals, the compiler replaces the divisions with multiplications
+static inline __attribute__((always_inline)) char *print_scaled_number(char *wstr, calculated_number value, int sign, const int decimals)
+{
+    const unsigned long long power = decimal_powers[decimals];
+
+#ifdef STORAGE_WITH_MATH
+    unsigned long long uvalue;
+    double fscaled = (double)value * (double)power;
+
+    if(likely(fscaled < 1e14)) {
+        // scaled in double precision, which is a lot faster - the error is
+        // below 2.3e-16 of the product, so adding 0.5 and truncating it rounds
+        // correctly all the values that are not closer than that to half-way
+        uvalue = (unsigned long long)(long long)(fscaled + 0.5);
+
+        double fdistance = fscaled - (double)uvalue;
+        double fslack = 0.5 - fscaled * 2.3e-16;
+        if(unlikely(fdistance >= fslack || fdistance <= -fslack))
+            uvalue = round_scaled_number(value, power);
+    }
+    else if(likely(value >= 2097152.0)) {
+        // big values are scaled in two parts - above 2^21 the fraction has
+        // at most 42 significant bits, so multiplied by a power of 10 up to
+        // 1e9 (21 significant bits and trailing zeros) it is exact
+        unsigned long long integer = (unsigned long long)value;
+        calculated_number fraction = value - (calculated_number)integer;
+
+        if(power == 1)
+            uvalue = (unsigned long long)rintl(value);
+        else
+            uvalue = integer * power + (unsigned long long)llrintl(fraction * (calculated_number)power);
+    }
     else
-        wstr = print_number_lu_r(str, uvalue);
+        uvalue = round_scaled_number(value, power);
 #else
-    do *wstr++ = (char)('0' + (uvalue % 10)); while(uvalue /= 10);
+    unsigned long long uvalue = (unsigned long long)(value * (calculated_number)power);
 #endif
 
-    // make sure we have 6 bytes at least
-    while((wstr - str) < 6) *wstr++ = '0';
+    // values rounded to zero do not have a sign
+    if(sign && uvalue) *wstr++ = '-';
+
+    // integers are printed without a fraction
+    // the fraction has at most 9 digits, so it is printed with 32 bit arithmetic
+    uint32_t fraction = (uint32_t)(uvalue % power);
+    wstr += print_number_llu(wstr, uvalue / power);
+
+    if(fraction) {
+        *wstr++ = '.';
+
+        // all the decimal digits, with their leading zeros
+        char *e = wstr + decimals;
+        int i;
+        for(i = 0; i < decimals - 1; i += 2) {
+            const char *pair = &digit_pairs[(fraction % 100) * 2];
+            fraction /= 100;
+            *--e = pair[1];
+            *--e = pair[0];
+        }
+        if(i < decimals) *--e = (char)('0' + fraction);
+        wstr += decimals;
 
-    // put the sign back
-    if(sign) *wstr++ = '-';
+        // remove the trailing zeros
+        while(wstr[-1] == '0') wstr--;
+    }
+
+    *wstr = '\0';
+    return wstr;
+}
+
+int print_calculated_number_decimals(char *str, calculated_number value, int decimals)
+{
+    char *wstr = str;
+
+    if(unlikely(decimals < 0)) decimals = 0;
+    else if(unlikely(decimals > PRINT_NUMBER_MAX_DECIMALS)) decimals = PRINT_NUMBER_MAX_DECIMALS;
+
+    int sign = (value < 0) ? 1 : 0;
+    if(sign) value = -value;
+
+    if(likely(value < decimal_limits[decimals])) {
+        if(likely(decimals == PRINT_CALCULATED_NUMBER_DECIMALS))
+            return (int)(print_scaled_number(wstr, value, sign, PRINT_CALCULATED_NUMBER_DECIMALS) - str);
 
-    // reverse it
-    char *begin = str, *end = --wstr, aux;
-    while (end > begin) aux = *end, *end-- = *begin, *begin++ = aux;
-    // wstr--;
-    // strreverse(str, wstr);
-
-    // remove trailing zeros
-    int decimal = 5;
-    while(decimal > 0 && *wstr == '0') {
-        *wstr-- = '\0';
-        decimal--;
+        return (int)(print_scaled_number(wstr, value, sign, decimals) - str);
     }
 
-    // terminate it, one position to the right
-    // to let space for a dot
-    wstr[2] = '\0';
+    // too big to be scaled to 64 bits (or not a number)
+
+    if(sign) *wstr++ = '-';
+
+    if(value < 1.8e19 && value == floorl(value))
+        return (int)(wstr - str) + print_number_llu(wstr, (unsigned long long)value);
 
-    // make space for the dot
-    int i;
-    for(i = 0; i < decimal ;i++) {
-        wstr[1] = wstr[0];
-        wstr--;
+    if(value < 1e30) {
+        int len = snprintfz(wstr, PRINT_NUMBER_MAX_LENGTH - 2, "%0.*Lf", decimals, value);
+        char *e = &wstr[len - 1];
+        if(decimals) {
+            while(*e == '0') *e-- = '\0';
+            if(*e == '.') *e-- = '\0';
+        }
+        return (int)(e - str) + 1;
     }
 
-    // put the dot
-    if(wstr[2] == '\0') { wstr[1] = '\0'; decimal--; }
-    else wstr[1] = '.';
+    return (int)(wstr - str) + snprintfz(wstr, PRINT_NUMBER_MAX_LENGTH - 2, "%0.*Le", decimals, value);
+}
 
-    // return the buffer length
-    return (int) ((wstr - str) + 2 + decimal );
+int print_calculated_number(char *str, calculated_number value)
+{
+    return print_calculated_number_decimals(str, value, PRINT_CALCULATED_NUMBER_DECIMALS);
 }
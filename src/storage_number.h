@@ -37,6 +37,13 @@ typedef uint32_t storage_number;
 storage_number pack_storage_number(calculated_number value, uint32_t flags);
 calculated_number unpack_storage_number(storage_number value);
 
+// number formatting
+// all functions return the length of the string printed, without the terminating null
+#define PRINT_NUMBER_MAX_LENGTH 50                  // the buffer size needed to print any number
+#define PRINT_NUMBER_MAX_DECIMALS 9
+#define PRINT_CALCULATED_NUMBER_DECIMALS 5          // the decimal digits of the values of the API
+
+int print_calculated_number_decimals(char *str, calculated_number value, int decimals);
 int print_calculated_number(char *str, calculated_number value);
 
 #define STORAGE_NUMBER_POSITIVE_MAX 167772150000000.0
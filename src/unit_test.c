@@ -173,6 +173,164 @@ void benchmark_storage_number(int loop, int multiplier) {
 
 }
 
+// the number formatting engine is compared with snprintf()
+// rounding half-way cases the same way, and without the sign of values rounded to zero
+static int print_number_reference(char *str, calculated_number value, int decimals) {
+    int len = snprintfz(str, 99, "%0.*Lf", decimals, value);
+    if(decimals) {
+        while(str[len - 1] == '0') str[--len] = '\0';
+        if(str[len - 1] == '.') str[--len] = '\0';
+    }
+    if(!strcmp(str, "-0")) { strcpy(str, "0"); len = 1; }
+    return len;
+}
+
+// the implementation of print_calculated_number() before the number formatting engine
+static int print_calculated_number_old(char *str, calculated_number value) {
+    char *wstr = str;
+
+    int sign = (value < 0) ? 1 : 0;
+    if(sign) value = -value;
+
+    unsigned long long uvalue = (unsigned long long) llrint(value * (calculated_number)100000);
+    do *wstr++ = (char)('0' + (uvalue % 10)); while(uvalue /= 10);
+    while((wstr - str) < 6) *wstr++ = '0';
+    if(sign) *wstr++ = '-';
+
+    char *begin = str, *end = --wstr, aux;
+    while (end > begin) aux = *end, *end-- = *begin, *begin++ = aux;
+
+    int decimal = 5;
+    while(decimal > 0 && *wstr == '0') {
+        *wstr-- = '\0';
+        decimal--;
+    }
+    wstr[2] = '\0';
+
+    int i;
+    for(i = 0; i < decimal ;i++) {
+        wstr[1] = wstr[0];
+        wstr--;
+    }
+
+    if(wstr[2] == '\0') { wstr[1] = '\0'; decimal--; }
+    else wstr[1] = '.';
+
+    return (int) ((wstr - str) + 2 + decimal );
+}
+
+static int check_number_formatting(void) {
+    char buffer[100], expected[100];
+    int decimals, errors = 0, checked = 0;
+    unsigned long long seed = 1;
+
+    fprintf(stderr, "\nChecking number formatting:\n");
+
+    for(decimals = 0; decimals <= PRINT_NUMBER_MAX_DECIMALS ; decimals++) {
+        int i;
+        for(i = 0; i < 100000 ; i++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+            // random digits, at random decimal positions, positive and negative
+            calculated_number n = (calculated_number)(seed >> 20) / powl(10, (int)((seed >> 8) % 20));
+            if(seed & 1) n = -n;
+            if(!(i % 10)) n = roundl(n);
+
+            // big values, close to the limit of 64 bits when scaled
+            if(!(i % 13)) n = (calculated_number)(seed >> 8) / powl(10, (int)((seed >> 3) % 8));
+
+            // half-way values
+            if(!(i % 7)) n = ((calculated_number)(seed >> 40) + 0.5L) / powl(10, decimals);
+
+            int len = print_calculated_number_decimals(buffer, n, decimals);
+            int elen = print_number_reference(expected, n, decimals);
+            checked++;
+
+            if(len != elen || strcmp(buffer, expected) != 0) {
+                if(errors++ < 10)
+                    fprintf(stderr, "    number %0.15Lf with %d decimals printed as '%s' (%d bytes), expected '%s' (%d bytes), ### E R R O R ###\n", n, decimals, buffer, len, expected, elen);
+            }
+        }
+    }
+
+    long long ll[] = { 0, 1, -1, 9, 10, 99, 100, -100, 12345678901234LL, 9223372036854775807LL, -9223372036854775807LL - 1 };
+    size_t i;
+    for(i = 0; i < sizeof(ll) / sizeof(long long) ; i++) {
+        snprintfz(expected, 99, "%lld", ll[i]);
+        int len = print_number_ll(buffer, ll[i]);
+        checked++;
+
+        if(len != (int)strlen(expected) || strcmp(buffer, expected) != 0) {
+            fprintf(stderr, "    integer %s printed as '%s', ### E R R O R ###\n", expected, buffer);
+            errors++;
+        }
+    }
+
+    if(!errors)
+        fprintf(stderr, "    %d numbers printed as snprintf() prints them, OK\n", checked);
+
+    return errors;
+}
+
+static unsigned long long benchmark_number_formatting_run(int (*print)(char *str, calculated_number value), int loop) {
+    char buffer[100];
+    int i, j;
+    struct rusage now, last;
+
+    getrusage(RUSAGE_SELF, &last);
+
+    for(j = 1; j < 11 ;j++) {
+        calculated_number n = STORAGE_NUMBER_POSITIVE_MIN * j;
+
+        for(i = 0; i < loop ;i++) {
+            n *= 1.7;
+            if(n > STORAGE_NUMBER_POSITIVE_MAX) n = STORAGE_NUMBER_POSITIVE_MIN * j;
+            print(buffer, (i & 1)?n:roundl(n));
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &now);
+    return now.ru_utime.tv_sec * 1000000ULL + now.ru_utime.tv_usec - (last.ru_utime.tv_sec * 1000000ULL + last.ru_utime.tv_usec)
+         + now.ru_stime.tv_sec * 1000000ULL + now.ru_stime.tv_usec - (last.ru_stime.tv_sec * 1000000ULL + last.ru_stime.tv_usec);
+}
+
+static int print_number_snprintf(char *str, calculated_number value) {
+    return snprintfz(str, 99, "%0.5Lf", value);
+}
+
+#define BENCHMARK_NUMBER_FORMATTING_ROUNDS 10
+
+// the implementations run in turns and the fastest round of each is compared,
+// so that the other processes of the system do not affect the comparison
+void benchmark_number_formatting(int loop) {
+    int round, rounds = BENCHMARK_NUMBER_FORMATTING_ROUNDS;
+    unsigned long long mine = 0, old = 0, their = 0, t;
+
+    fprintf(stderr, "\nBenchmarking the formatting of %d numbers, half of them integers, the fastest of %d rounds:\n", loop * 10, rounds);
+
+    for(round = 0; round < rounds ; round++) {
+        t = benchmark_number_formatting_run(print_calculated_number, loop);
+        if(!round || t < mine) mine = t;
+
+        t = benchmark_number_formatting_run(print_calculated_number_old, loop);
+        if(!round || t < old) old = t;
+
+        if(round < 2) {
+            t = benchmark_number_formatting_run(print_number_snprintf, loop);
+            if(!round || t < their) their = t;
+        }
+    }
+
+    fprintf(stderr, "    %-30s: %0.5Lf secs\n", "print_calculated_number()", (long double)(mine / 1000000.0));
+    fprintf(stderr, "    %-30s: %0.5Lf secs\n", "previous implementation", (long double)(old / 1000000.0));
+    fprintf(stderr, "    %-30s: %0.5Lf secs\n", "snprintf(\"%0.5Lf\")", (long double)(their / 1000000.0));
+
+    if(!mine) mine = 1;
+    fprintf(stderr, "    print_calculated_number() runs at %0.2Lf of the time of the previous implementation and is %0.2Lf times faster than snprintf(), %s\n",
+            (long double)mine / (long double)(old?old:1), (long double)their / (long double)mine,
+            (mine <= old)?"OK":"### S L O W E R ###");
+}
+
 static int check_storage_number_exists() {
     uint32_t flags = SN_EXISTS;
 
@@ -205,6 +363,9 @@ int unit_test_storage()
 {
     if(check_storage_number_exists()) return 0;
 
+    if(check_number_formatting()) return 1;
+    benchmark_number_formatting(100000);
+
     calculated_number c, a = 0;
     int i, j, g, r = 0;
 
@@ -880,6 +1041,23 @@ struct test test15 = {
 
 // --------------------------------------------------------------------------------------------------------------------
 
+// read back the value stored at a slot of the round robin database
+static uint32_t unit_test_stored_value(RRDDIM *rd, long slot, calculated_number *value) {
+    RRDDIM_QUERY_HANDLE handle;
+    uint32_t flags = SN_NOT_EXISTS;
+    time_t t = rrdset_slot2time(rd->rrdset, slot);
+
+    *value = 0;
+    rrddim_query_init(rd, &handle, t, t);
+    if(rrddim_query_next(&handle)) {
+        *value = handle.v[0];
+        flags = handle.flags[0];
+    }
+    rrddim_query_finalize(&handle);
+
+    return flags;
+}
+
 int run_test(struct test *test)
 {
     fprintf(stderr, "\nRunning test '%s':\n%s\n", test->name, test->description);
@@ -950,7 +1128,8 @@ int run_test(struct test *test)
 
     unsigned long max = (st->counter < test->result_entries)?st->counter:test->result_entries;
     for(c = 0 ; c < max ; c++) {
-        calculated_number v = unpack_storage_number(rd->values[c]);
+        calculated_number v;
+        unit_test_stored_value(rd, c, &v);
         calculated_number n = test->results[c];
         int same = (roundl(v * 10000000.0) == roundl(n * 10000000.0))?1:0;
         fprintf(stderr, "    %s/%s: checking position %lu (at %lu secs), expecting value " CALCULATED_NUMBER_FORMAT ", found " CALCULATED_NUMBER_FORMAT ", %s\n",
@@ -961,7 +1140,7 @@ int run_test(struct test *test)
         if(!same) errors++;
 
         if(rd2) {
-            v = unpack_storage_number(rd2->values[c]);
+            unit_test_stored_value(rd2, c, &v);
             n = test->results2[c];
             same = (roundl(v * 10000000.0) == roundl(n * 10000000.0))?1:0;
             fprintf(stderr, "    %s/%s: checking position %lu (at %lu secs), expecting value " CALCULATED_NUMBER_FORMAT ", found " CALCULATED_NUMBER_FORMAT ", %s\n",
@@ -1019,9 +1198,1579 @@ static int test_variable_renames(void) {
     return 1;
 }
 
-int run_all_mockup_tests(void)
-{
-    if(!test_variable_renames())
+static int test_storage_engine_wide(void) {
+    fprintf(stderr, "\nRunning test 'wide storage engine':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+    config_set("netdata.unittest-wide", "storage engine", STORAGE_ENGINE_WIDE_NAME);
+
+    RRDSET *st = rrdset_create("netdata", "unittest-wide", NULL, "netdata", NULL, "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+    RRDDIM *rd1 = rrddim_add(st, "big", NULL, 1, 1, RRDDIM_ABSOLUTE);
+    RRDDIM *rd2 = rrddim_add(st, "negative", NULL, 1, 1000, RRDDIM_ABSOLUTE);
+
+    if(st->storage_engine != &storage_engine_wide) {
+        fprintf(stderr, "    chart is not using the wide storage engine, ### E R R O R ###\n");
+        return 1;
+    }
+
+    // these cannot be stored in a storage_number without accuracy loss
+    collected_number v1 = 123456789012345LL;
+    collected_number v2 = -98765432109875LL;
+    calculated_number n1 = (calculated_number)v1, n2 = (calculated_number)v2 / (calculated_number)1000;
+
+    long c;
+    for(c = 0; c < 10 ; c++) {
+        if(c) rrdset_next_usec_unfiltered(st, USEC_PER_SEC);
+        rrddim_set_by_pointer(st, rd1, v1);
+        rrddim_set_by_pointer(st, rd2, v2);
+        rrdset_done(st);
+    }
+
+    int errors = 0;
+    for(c = 0; c < (long)st->counter ; c++) {
+        calculated_number v;
+
+        if(!does_storage_number_exist(unit_test_stored_value(rd1, c, &v)) || accuracy_loss(v, n1) > 0.0000000001) {
+            fprintf(stderr, "    %s/%s: position %ld, expected " CALCULATED_NUMBER_FORMAT ", found " CALCULATED_NUMBER_FORMAT " ### E R R O R ###\n", st->id, rd1->name, c, n1, v);
+            errors++;
+        }
+
+        if(!does_storage_number_exist(unit_test_stored_value(rd2, c, &v)) || accuracy_loss(v, n2) > 0.0000000001) {
+            fprintf(stderr, "    %s/%s: position %ld, expected " CALCULATED_NUMBER_FORMAT ", found " CALCULATED_NUMBER_FORMAT " ### E R R O R ###\n", st->id, rd2->name, c, n2, v);
+            errors++;
+        }
+    }
+
+    if(!errors)
+        fprintf(stderr, "    %lu entries of chart %s checked, OK\n", st->counter, st->id);
+
+    return errors;
+}
+
+static int test_query_cache_query(RRDSET *st, BUFFER *wb, const char *expected, const char *what) {
+    buffer_flush(wb);
+    time_t latest_timestamp = 0;
+
+    int ret = query_cache_rrd2format(st, wb, NULL, DATASOURCE_JSON, 0, -10, 0, 0, GROUP_AVERAGE, RRDR_OPTION_JSON_WRAP, 0, &latest_timestamp);
+    if(ret != 200 || strcmp(buffer_tostring(wb), expected) != 0) {
+        fprintf(stderr, "    %s: query returned %d and it does not match rrd2format(), ### E R R O R ###\n", what, ret);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int test_query_cache(void) {
+    fprintf(stderr, "\nRunning test 'api data cache':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+    config_set("global", "web api data cache size MB", "1");
+    query_cache_init();
+
+    RRDSET *st = rrdset_create("netdata", "unittest-cache", NULL, "netdata", NULL, "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+    RRDDIM *rd = rrddim_add(st, "dim", NULL, 1, 1, RRDDIM_ABSOLUTE);
+
+    long c;
+    for(c = 0; c < 20 ; c++) {
+        if(c) rrdset_next_usec_unfiltered(st, USEC_PER_SEC);
+        rrddim_set_by_pointer(st, rd, c);
+        rrdset_done(st);
+    }
+
+    BUFFER *expected = buffer_create(1), *wb = buffer_create(1);
+    struct query_cache_statistics before, after;
+    int errors = 0;
+
+    rrd2format(st, expected, NULL, DATASOURCE_JSON, 0, -10, 0, 0, GROUP_AVERAGE, RRDR_OPTION_JSON_WRAP, 0, NULL);
+
+    query_cache_statistics(&before);
+    errors += test_query_cache_query(st, wb, buffer_tostring(expected), "first query");
+    errors += test_query_cache_query(st, wb, buffer_tostring(expected), "second query");
+    query_cache_statistics(&after);
+
+    if(after.misses - before.misses != 1 || after.hits - before.hits != 1) {
+        fprintf(stderr, "    expected 1 miss and 1 hit, got %llu misses and %llu hits, ### E R R O R ###\n", after.misses - before.misses, after.hits - before.hits);
+        errors++;
+    }
+
+    // a new value invalidates the cached result
+    rrdset_next_usec_unfiltered(st, USEC_PER_SEC);
+    rrddim_set_by_pointer(st, rd, c);
+    rrdset_done(st);
+
+    buffer_flush(expected);
+    rrd2format(st, expected, NULL, DATASOURCE_JSON, 0, -10, 0, 0, GROUP_AVERAGE, RRDR_OPTION_JSON_WRAP, 0, NULL);
+
+    query_cache_statistics(&before);
+    errors += test_query_cache_query(st, wb, buffer_tostring(expected), "query after update");
+    query_cache_statistics(&after);
+
+    if(after.misses - before.misses != 1) {
+        fprintf(stderr, "    the chart was updated, but the cached result was used, ### E R R O R ###\n");
+        errors++;
+    }
+
+    if(!errors)
+        fprintf(stderr, "    cached results of chart %s checked, OK\n", st->id);
+
+    buffer_free(expected);
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_query_stream_format(RRDSET *st, uint32_t format, long points, int group_method, uint32_t options, const char *what) {
+    BUFFER *expected = buffer_create(1), *wb = buffer_create(1), *part = buffer_create(1);
+    int errors = 0;
+    size_t parts = 1;
+
+    rrd2format(st, expected, NULL, format, points, 0, 0, 0, group_method, options, 0, NULL);
+
+    RRDR_STREAM *s = rrd2format_stream_create(st, wb, NULL, format, points, 0, 0, group_method, options, 4096);
+    if(!s) {
+        fprintf(stderr, "    %s: the query was not streamed, ### E R R O R ###\n", what);
+        errors++;
+    }
+    else {
+        int more;
+        do {
+            buffer_flush(part);
+            more = rrd2format_stream_next(s, part, 4096);
+            buffer_strcat(wb, buffer_tostring(part));
+            parts++;
+        } while(more);
+
+        rrd2format_stream_free(s);
+
+        if(strcmp(buffer_tostring(wb), buffer_tostring(expected)) != 0) {
+            fprintf(stderr, "    %s: the streamed result (%zu bytes in %zu parts) does not match rrd2format() (%zu bytes), ### E R R O R ###\n", what, buffer_strlen(wb), parts, buffer_strlen(expected));
+            errors++;
+        }
+        else
+            fprintf(stderr, "    %s: %zu bytes streamed in %zu parts, OK\n", what, buffer_strlen(wb), parts);
+    }
+
+    buffer_free(expected);
+    buffer_free(wb);
+    buffer_free(part);
+    return errors;
+}
+
+static int test_query_stream(void) {
+    fprintf(stderr, "\nRunning test 'streamed queries':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+
+    RRDSET *st = rrdset_create("netdata", "unittest-stream", NULL, "netdata", NULL, "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+
+    RRDDIM *rds[40];
+    long c, d;
+    for(d = 0; d < 40 ; d++) {
+        char id[20];
+        snprintfz(id, 19, "dim%ld", d);
+        rds[d] = rrddim_add(st, id, NULL, 1, 1, RRDDIM_ABSOLUTE);
+    }
+
+    for(c = 0; c < st->entries ; c++) {
+        if(c) rrdset_next_usec_unfiltered(st, USEC_PER_SEC);
+        for(d = 0; d < 40 ; d++)
+            rrddim_set_by_pointer(st, rds[d], c * d);
+        rrdset_done(st);
+    }
+
+    int errors = 0;
+    errors += test_query_stream_format(st, DATASOURCE_JSON, 0, GROUP_AVERAGE, RRDR_OPTION_SECONDS, "json, all points");
+    errors += test_query_stream_format(st, DATASOURCE_DATATABLE_JSON, 2000, GROUP_AVERAGE, 0, "datatable, grouped");
+    errors += test_query_stream_format(st, DATASOURCE_CSV, 0, GROUP_AVERAGE, 0, "csv");
+    errors += test_query_stream_format(st, DATASOURCE_CSV_JSON_ARRAY, 0, GROUP_AVERAGE, RRDR_OPTION_SECONDS, "csvjsonarray");
+    errors += test_query_stream_format(st, DATASOURCE_SSV, 0, GROUP_AVERAGE, RRDR_OPTION_MIN2MAX, "ssv");
+    errors += test_query_stream_format(st, DATASOURCE_CSV, 1800, GROUP_LTTB, 0, "csv, lttb");
+
+    return errors;
+}
+
+static uint32_t test_binary_u32(const char *s) {
+    return (uint32_t)(unsigned char)s[0] | (uint32_t)(unsigned char)s[1] << 8 | (uint32_t)(unsigned char)s[2] << 16 | (uint32_t)(unsigned char)s[3] << 24;
+}
+
+static calculated_number test_binary_value(const char *s, size_t value_size) {
+    uint64_t v = test_binary_u32(s);
+    if(value_size == sizeof(uint32_t)) {
+        uint32_t v32 = (uint32_t)v;
+        float f;
+        memcpy(&f, &v32, sizeof(f));
+        return f;
+    }
+
+    v |= (uint64_t)test_binary_u32(&s[4]) << 32;
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+// compare the binary output with the csv output of the same query
+static int test_query_binary_format(RRDSET *st, long points, uint32_t options, const char *what) {
+    BUFFER *csv = buffer_create(1), *wb = buffer_create(1);
+    int errors = 0;
+
+    rrd2format(st, csv, NULL, DATASOURCE_CSV, points, 0, 0, 0, GROUP_AVERAGE, (options & ~RRDR_OPTION_FLOAT32) | RRDR_OPTION_SECONDS, 0, NULL);
+    rrd2format(st, wb, NULL, DATASOURCE_BINARY, points, 0, 0, 0, GROUP_AVERAGE, options, 0, NULL);
+
+    const char *s = wb->buffer;
+    size_t value_size = (options & RRDR_OPTION_FLOAT32)?sizeof(float):sizeof(double);
+
+    if(wb->len < DATASOURCE_BINARY_HEADER_SIZE || memcmp(s, DATASOURCE_BINARY_MAGIC, 4) != 0 || (test_binary_u32(&s[4]) & 0xffff) != DATASOURCE_BINARY_VERSION || test_binary_u32(&s[4]) >> 16 != value_size) {
+        fprintf(stderr, "    %s: invalid header, ### E R R O R ###\n", what);
+        errors++;
+        goto cleanup;
+    }
+
+    uint32_t rows = test_binary_u32(&s[32]), dimensions = test_binary_u32(&s[36]), labels = test_binary_u32(&s[40]);
+    size_t flags = (dimensions + 7) & ~7UL, timestamps = (rows * sizeof(uint32_t) + 7) & ~7UL;
+
+    if(wb->len != DATASOURCE_BINARY_HEADER_SIZE + labels + flags + timestamps + rows * dimensions * value_size) {
+        fprintf(stderr, "    %s: the size of the output %zu does not match its header, ### E R R O R ###\n", what, wb->len);
+        errors++;
+        goto cleanup;
+    }
+
+    const char *label = &s[DATASOURCE_BINARY_HEADER_SIZE];
+    const char *ts = &label[labels + flags];
+    const char *values = &ts[timestamps];
+
+    // the header line of the csv
+    char *line = csv->buffer, *end = strstr(line, "\r\n");
+    uint32_t r, d;
+    for(d = 0; d < dimensions ; d++) {
+        size_t len = strlen(label);
+        char *comma = strchr(line, ',');
+        if(!comma || !end || strncmp(comma + 1, label, len) != 0) {
+            fprintf(stderr, "    %s: the label '%s' does not match the csv, ### E R R O R ###\n", what, label);
+            errors++;
+            goto cleanup;
+        }
+        line = comma + 1;
+        label += len + 1;
+    }
+
+    for(r = 0; r < rows ; r++) {
+        line = end + 2;
+        end = strstr(line, "\r\n");
+        if(!end) {
+            fprintf(stderr, "    %s: the csv has less rows than the %u of the binary, ### E R R O R ###\n", what, rows);
+            errors++;
+            goto cleanup;
+        }
+
+        char *e;
+        if(strtoul(line, &e, 10) != test_binary_u32(&ts[r * sizeof(uint32_t)])) {
+            fprintf(stderr, "    %s: row %u: the timestamp does not match the csv, ### E R R O R ###\n", what, r);
+            errors++;
+            goto cleanup;
+        }
+
+        for(d = 0; d < dimensions ; d++) {
+            calculated_number expected = strtold(e + 1, &e);
+            if(value_size == sizeof(float)) expected = (float)expected;
+            else expected = (double)expected;
+
+            calculated_number v = test_binary_value(&values[(d * rows + r) * value_size], value_size);
+            if(v != expected) {
+                fprintf(stderr, "    %s: row %u, dimension %u: value " CALCULATED_NUMBER_FORMAT " does not match the csv " CALCULATED_NUMBER_FORMAT ", ### E R R O R ###\n", what, r, d, v, expected);
+                errors++;
+                goto cleanup;
+            }
+        }
+    }
+
+    fprintf(stderr, "    %s: %u rows x %u dimensions in %zu bytes (csv %zu bytes), OK\n", what, rows, dimensions, wb->len, csv->len);
+
+cleanup:
+    buffer_free(csv);
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_query_binary(void) {
+    fprintf(stderr, "\nRunning test 'binary data format':\n");
+
+    RRDSET *st = rrdset_find("netdata.unittest-stream");
+    if(!st) {
+        fprintf(stderr, "    the chart of the streamed queries test is not found, ### E R R O R ###\n");
+        return 1;
+    }
+
+    int errors = 0;
+    errors += test_query_binary_format(st, 0, 0, "float64, all points");
+    errors += test_query_binary_format(st, 600, RRDR_OPTION_FLOAT32 | RRDR_OPTION_REVERSED, "float32, grouped, reversed");
+    errors += test_query_binary_format(st, 0, RRDR_OPTION_NONZERO, "nonzero");
+
+    return errors;
+}
+
+// decode the json delta output and compare it with the csv output of the same query
+static int test_query_json_delta_format(RRDSET *st, long points, uint32_t options, const char *what) {
+    BUFFER *csv = buffer_create(1), *wb = buffer_create(1);
+    int errors = 0;
+
+    rrd2format(st, csv, NULL, DATASOURCE_CSV, points, 0, 0, 0, GROUP_AVERAGE, options | RRDR_OPTION_SECONDS, 0, NULL);
+    rrd2format(st, wb, NULL, DATASOURCE_JSON_DELTA, points, 0, 0, 0, GROUP_AVERAGE, options, 0, NULL);
+
+    char *scale_s = strstr(wb->buffer, "\"scale\": "), *points_s = strstr(wb->buffer, "\"points\": "), *data = strstr(wb->buffer, "\"data\": [");
+    if(!scale_s || !points_s || !data || strstr(wb->buffer, "\"time\": ")) {
+        fprintf(stderr, "    %s: invalid output, ### E R R O R ###\n", what);
+        errors++;
+        goto cleanup;
+    }
+
+    calculated_number scale = strtold(&scale_s[9], NULL);
+    long rows = strtol(&points_s[10], NULL, 10), r, d, dimensions = 0;
+    char *s = &data[9];
+
+    // the values of the csv, row by row
+    char *header = strstr(csv->buffer, "\r\n"), *line;
+    for(line = csv->buffer; line < header ; line++)
+        if(*line == ',') dimensions++;
+
+    calculated_number *expected = callocz((size_t)(rows * dimensions + 1), sizeof(calculated_number));
+    line = header + 2;
+    for(r = 0; r < rows && *line ; r++) {
+        char *e;
+        strtoul(line, &e, 10);
+        for(d = 0; d < dimensions ; d++)
+            expected[r * dimensions + d] = roundl(strtold(e + 1, &e) * scale);
+        line = e + 2;
+    }
+
+    for(d = 0; d < dimensions && !errors ; d++) {
+        s = strchr(s, '[');
+        if(!s) break;
+        s++;
+
+        calculated_number value = 0;
+        for(r = 0; r < rows ; r++) {
+            value += strtold(s, &s);
+            if(value != expected[r * dimensions + d]) {
+                fprintf(stderr, "    %s: row %ld, dimension %ld: value " CALCULATED_NUMBER_FORMAT " does not match the csv " CALCULATED_NUMBER_FORMAT ", ### E R R O R ###\n", what, r, d, value, expected[r * dimensions + d]);
+                errors++;
+                break;
+            }
+            s++;
+        }
+    }
+
+    if(!errors && d != dimensions) {
+        fprintf(stderr, "    %s: %ld dimensions found, the csv has %ld, ### E R R O R ###\n", what, d, dimensions);
+        errors++;
+    }
+
+    if(!errors) {
+        BUFFER *json = buffer_create(1);
+        rrd2format(st, json, NULL, DATASOURCE_JSON, points, 0, 0, 0, GROUP_AVERAGE, options | RRDR_OPTION_SECONDS, 0, NULL);
+        fprintf(stderr, "    %s: %ld rows x %ld dimensions, scale %0.0Lf, in %zu bytes (json %zu bytes), OK\n", what, rows, dimensions, (long double)scale, wb->len, json->len);
+        buffer_free(json);
+    }
+
+    freez(expected);
+
+cleanup:
+    buffer_free(csv);
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_query_json_delta(void) {
+    fprintf(stderr, "\nRunning test 'json delta data format':\n");
+
+    RRDSET *st = rrdset_find("netdata.unittest-stream");
+    if(!st) {
+        fprintf(stderr, "    the chart of the streamed queries test is not found, ### E R R O R ###\n");
+        return 1;
+    }
+
+    int errors = 0;
+    errors += test_query_json_delta_format(st, 0, 0, "integers");
+    errors += test_query_json_delta_format(st, 600, RRDR_OPTION_PERCENTAGE | RRDR_OPTION_REVERSED, "percentages, grouped, reversed");
+
+    return errors;
+}
+
+static int test_percentile_compare(const void *a, const void *b) {
+    calculated_number x = *(const calculated_number *)a, y = *(const calculated_number *)b;
+    return (x < y)?-1:(x > y)?1:0;
+}
+
+// the percentile sketch is compared with the exact percentiles of random values
+static int test_percentile_sketch(void) {
+    fprintf(stderr, "\nRunning test 'percentile sketch':\n");
+
+    calculated_number percentiles[] = { 0.5, 0.95, 0.99 };
+    long counts[] = { 1, 4, 64, 100, 1000, 100000 };
+    calculated_number tolerance[] = { 0, 0, 0, 0.10, 0.02, 0.01 }; // of the range of the values
+    int errors = 0;
+    size_t p, n;
+
+    calculated_number *values = mallocz(100000 * sizeof(calculated_number));
+
+    for(n = 0; n < sizeof(counts) / sizeof(long) ; n++) {
+        for(p = 0; p < sizeof(percentiles) / sizeof(calculated_number) ; p++) {
+            PERCENTILE_SKETCH sketch;
+            percentile_sketch_reset(&sketch);
+
+            long i;
+            for(i = 0; i < counts[n] ; i++) {
+                values[i] = (calculated_number)(random() % 100000) / 100;
+                percentile_sketch_add(&sketch, percentiles[p], values[i]);
+            }
+
+            qsort(values, (size_t)counts[n], sizeof(calculated_number), test_percentile_compare);
+            calculated_number position = percentiles[p] * (counts[n] - 1);
+            i = (long)position;
+            calculated_number exact = (i >= counts[n] - 1)?values[i]:values[i] + (position - i) * (values[i + 1] - values[i]);
+            calculated_number estimated = percentile_sketch_value(&sketch, percentiles[p]);
+            calculated_number error = fabsl(estimated - exact) / 1000;
+
+            if(error > tolerance[n] + 0.0000001) {
+                fprintf(stderr, "    percentile %0.2Lf of %ld values: estimated " CALCULATED_NUMBER_FORMAT ", exact " CALCULATED_NUMBER_FORMAT ", error %0.4Lf%% of the range, ### E R R O R ###\n", (long double)percentiles[p], counts[n], estimated, exact, (long double)error * 100);
+                errors++;
+            }
+            else
+                fprintf(stderr, "    percentile %0.2Lf of %ld values: estimated " CALCULATED_NUMBER_FORMAT ", exact " CALCULATED_NUMBER_FORMAT ", error %0.4Lf%% of the range, OK\n", (long double)percentiles[p], counts[n], estimated, exact, (long double)error * 100);
+        }
+    }
+
+    freez(values);
+    return errors;
+}
+
+static unsigned long long test_percentile_query_time(RRDSET *st, BUFFER *wb, int group_method) {
+    usec_t started = now_realtime_usec();
+
+    int i;
+    for(i = 0; i < 10 ; i++) {
+        buffer_flush(wb);
+        rrd2format(st, wb, NULL, DATASOURCE_CSV, 60, 0, 0, 0, group_method, RRDR_OPTION_SECONDS, 0, NULL);
+    }
+
+    return now_realtime_usec() - started;
+}
+
+// the values of the chart grow linearly, so the median of each group is its average
+static int test_percentile_query(void) {
+    fprintf(stderr, "\nRunning test 'percentile grouping':\n");
+
+    RRDSET *st = rrdset_find("netdata.unittest-stream");
+    if(!st) {
+        fprintf(stderr, "    the chart of the streamed queries test is not found, ### E R R O R ###\n");
+        return 1;
+    }
+
+    int errors = 0;
+    BUFFER *average = buffer_create(1), *median = buffer_create(1);
+
+    rrd2format(st, average, NULL, DATASOURCE_CSV, 60, 0, 0, 0, GROUP_AVERAGE, RRDR_OPTION_SECONDS, 0, NULL);
+    rrd2format(st, median, NULL, DATASOURCE_CSV, 60, 0, 0, 0, GROUP_MEDIAN, RRDR_OPTION_SECONDS, 0, NULL);
+
+    if(strcmp(buffer_tostring(average), buffer_tostring(median)) != 0) {
+        char *a = average->buffer, *m = median->buffer;
+        while(*a && *a == *m) a++, m++;
+        while(a > average->buffer && a[-1] != '\n') a--, m--;
+        fprintf(stderr, "    the median of linear values does not match their average, ### E R R O R ###\n    average: %.200s\n    median : %.200s\n", a, m);
+        errors++;
+    }
+    else
+        fprintf(stderr, "    the median of linear values matches their average, OK\n");
+
+    unsigned long long average_time = test_percentile_query_time(st, average, GROUP_AVERAGE);
+    unsigned long long percentile_time = test_percentile_query_time(st, median, GROUP_PERCENTILE95);
+    fprintf(stderr, "    10 queries of %ld points: average %llu usec, percentile95 %llu usec\n", st->entries, average_time, percentile_time);
+
+    buffer_free(average);
+    buffer_free(median);
+    return errors;
+}
+
+// a chart with a spike and a line, grouped with LTTB and averages
+static int test_lttb(void) {
+    fprintf(stderr, "\nRunning test 'LTTB grouping':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+
+    RRDSET *st = rrdset_create("netdata", "unittest-lttb", NULL, "netdata", NULL, "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+    RRDDIM *spike = rrddim_add(st, "spike", NULL, 1, 1, RRDDIM_ABSOLUTE);
+    RRDDIM *line = rrddim_add(st, "line", NULL, 1, 1, RRDDIM_ABSOLUTE);
+
+    long c;
+    for(c = 0; c < st->entries ; c++) {
+        if(c) rrdset_next_usec_unfiltered(st, USEC_PER_SEC);
+        rrddim_set_by_pointer(st, spike, (c == st->entries / 3)?1000:0);
+        rrddim_set_by_pointer(st, line, c);
+        rrdset_done(st);
+    }
+
+    int errors = 0;
+    BUFFER *average = buffer_create(1), *lttb = buffer_create(1);
+    rrd2format(st, average, NULL, DATASOURCE_CSV, 60, 0, 0, 0, GROUP_AVERAGE, RRDR_OPTION_SECONDS, 0, NULL);
+    rrd2format(st, lttb, NULL, DATASOURCE_CSV, 60, 0, 0, 0, GROUP_LTTB, RRDR_OPTION_SECONDS, 0, NULL);
+
+    char *a = strstr(average->buffer, "\r\n"), *l = strstr(lttb->buffer, "\r\n");
+    long rows = 0;
+    calculated_number spike_average = 0, spike_lttb = 0;
+
+    while(a && l && a[2] && l[2]) {
+        char *ae, *le;
+        unsigned long at = strtoul(a + 2, &ae, 10), lt = strtoul(l + 2, &le, 10);
+        calculated_number as = strtold(ae + 1, &ae), ls = strtold(le + 1, &le);
+        calculated_number al = strtold(ae + 1, &ae), ll = strtold(le + 1, &le);
+
+        if(at != lt) {
+            fprintf(stderr, "    row %ld: timestamp %lu does not match the average %lu, ### E R R O R ###\n", rows, lt, at);
+            errors++;
+            break;
+        }
+
+        // the line has to be one of the points of the group
+        if(ll != roundl(ll) || fabsl(ll - al) > 30) {
+            fprintf(stderr, "    row %ld: line value " CALCULATED_NUMBER_FORMAT " is not a point of the group with average " CALCULATED_NUMBER_FORMAT ", ### E R R O R ###\n", rows, ll, al);
+            errors++;
+            break;
+        }
+
+        if(as > spike_average) spike_average = as;
+        if(ls > spike_lttb) spike_lttb = ls;
+
+        a = strstr(ae, "\r\n");
+        l = strstr(le, "\r\n");
+        rows++;
+    }
+
+    if(!errors && ((a && a[2]) || (l && l[2]))) {
+        fprintf(stderr, "    LTTB and average give a different number of rows, ### E R R O R ###\n");
+        errors++;
+    }
+
+    if(!errors && spike_lttb != 1000) {
+        fprintf(stderr, "    the spike is " CALCULATED_NUMBER_FORMAT " with LTTB, ### E R R O R ###\n", spike_lttb);
+        errors++;
+    }
+
+    if(!errors)
+        fprintf(stderr, "    %ld rows, the spike is " CALCULATED_NUMBER_FORMAT " with LTTB and " CALCULATED_NUMBER_FORMAT " with average, OK\n", rows, spike_lttb, spike_average);
+
+    buffer_free(average);
+    buffer_free(lttb);
+    return errors;
+}
+
+static void *test_rrdr_arena_thread(void *ptr) {
+    RRDSET *st = ptr;
+    BUFFER *wb = buffer_create(1);
+    calculated_number n;
+
+    rrd2value(st, wb, &n, NULL, 10, 0, 0, GROUP_AVERAGE, 0, NULL, NULL, NULL);
+
+    buffer_free(wb);
+    return NULL;
+}
+
+static int test_rrdr_arena(void) {
+    fprintf(stderr, "\nRunning test 'query arenas':\n");
+
+    RRDSET *st = rrdset_find("netdata.unittest-lttb");
+    if(!st) {
+        fprintf(stderr, "    chart netdata.unittest-lttb is not found, ### E R R O R ###\n");
+        return 1;
+    }
+
+    BUFFER *wb = buffer_create(1);
+    struct rrdr_arena_statistics before, after;
+    calculated_number n;
+    int errors = 0;
+
+    // the first query of this thread with this size may allocate memory
+    rrd2value(st, wb, &n, NULL, 10, 0, 0, GROUP_AVERAGE, 0, NULL, NULL, NULL);
+
+    rrdr_arena_statistics(&before);
+    rrd2value(st, wb, &n, NULL, 10, 0, 0, GROUP_AVERAGE, 0, NULL, NULL, NULL);
+    rrdr_arena_statistics(&after);
+
+    if(after.queries - before.queries != 1 || after.reused - before.reused != 1 || after.allocations != before.allocations) {
+        fprintf(stderr, "    the second query made %llu queries, reused %llu and allocated %llu arrays, ### E R R O R ###\n"
+                , after.queries - before.queries, after.reused - before.reused, after.allocations - before.allocations);
+        errors++;
+    }
+
+    // after a query of all the points, the smaller ones fit in the memory it grew
+    rrd2format(st, wb, NULL, DATASOURCE_CSV, 0, 0, 0, 0, GROUP_AVERAGE, 0, 0, NULL);
+
+    rrdr_arena_statistics(&before);
+    rrd2format(st, wb, NULL, DATASOURCE_CSV, 0, 0, 0, 0, GROUP_AVERAGE, 0, 0, NULL);
+    rrd2format(st, wb, NULL, DATASOURCE_CSV, 60, 0, 0, 0, GROUP_MAX, 0, 0, NULL);
+    rrd2value(st, wb, &n, NULL, 10, 0, 0, GROUP_AVERAGE, 0, NULL, NULL, NULL);
+    rrdr_arena_statistics(&after);
+
+    if(after.allocations != before.allocations) {
+        fprintf(stderr, "    queries up to the size of a previous one allocated %llu arrays, ### E R R O R ###\n", after.allocations - before.allocations);
+        errors++;
+    }
+
+    // the arena of a thread is freed when it exits
+    pthread_t thread;
+    rrdr_arena_statistics(&before);
+    if(pthread_create(&thread, NULL, test_rrdr_arena_thread, st) != 0) {
+        fprintf(stderr, "    cannot create thread, ### E R R O R ###\n");
+        errors++;
+    }
+    else {
+        pthread_join(thread, NULL);
+        rrdr_arena_statistics(&after);
+
+        if(after.queries - before.queries != 1 || after.memory != before.memory) {
+            fprintf(stderr, "    the thread made %llu queries and left %zd bytes in its arena, ### E R R O R ###\n"
+                    , after.queries - before.queries, (ssize_t)(after.memory - before.memory));
+            errors++;
+        }
+    }
+
+    if(!errors)
+        fprintf(stderr, "    %llu queries, %llu reused memory, %llu arrays allocated, %zu bytes kept, OK\n", after.queries, after.reused, after.allocations, after.memory);
+
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_dimensions_pattern_query(RRDSET *st, const char *dimensions, uint32_t options, const char *expected_header, const char *expected_row) {
+    BUFFER *wb = buffer_create(1), *dims = buffer_create(1);
+    int errors = 0;
+
+    buffer_strcat(dims, dimensions);
+    int ret = rrd2format(st, wb, dims, DATASOURCE_CSV, 1, -1, 0, 0, GROUP_AVERAGE, RRDR_OPTION_SECONDS | options, 0, NULL);
+
+    const char *s = buffer_tostring(wb);
+    char *row = strstr(s, "\r\n");
+    if(ret != 200 || !row || strncmp(s, expected_header, row - s) != 0 || strlen(expected_header) != (size_t)(row - s)) {
+        fprintf(stderr, "    dimensions '%s': expected header '%s', got '%s', ### E R R O R ###\n", dimensions, expected_header, s);
+        errors++;
+    }
+    else if(expected_row) {
+        row = strchr(row, ',');
+        if(!row || strncmp(row + 1, expected_row, strlen(expected_row)) != 0) {
+            fprintf(stderr, "    dimensions '%s': expected the values '%s', got '%s', ### E R R O R ###\n", dimensions, expected_row, s);
+            errors++;
+        }
+    }
+
+    buffer_free(wb);
+    buffer_free(dims);
+    return errors;
+}
+
+static int test_dimensions_pattern(void) {
+    fprintf(stderr, "\nRunning test 'dimensions selection':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+
+    RRDSET *st = rrdset_create("netdata", "unittest-dimensions", NULL, "netdata", NULL, "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+    RRDDIM *rd[8];
+    char id[10];
+
+    int i;
+    for(i = 0; i < 8 ; i++) {
+        snprintfz(id, 9, "d%d", i);
+        rd[i] = rrddim_add(st, id, NULL, 1, 1, RRDDIM_ABSOLUTE);
+    }
+    rrddim_set_name(st, rd[7], "last");
+    rrddim_set_name(st, rd[5], "d 5*");
+
+    long c;
+    for(c = 0; c < 10 ; c++) {
+        if(c) rrdset_next_usec_unfiltered(st, USEC_PER_SEC);
+        for(i = 0; i < 8 ; i++)
+            rrddim_set_by_pointer(st, rd[i], i + 1);
+        rrdset_done(st);
+    }
+
+    int errors = 0;
+    errors += test_dimensions_pattern_query(st, "d3", 0, "time,d3", "4\r\n");
+    errors += test_dimensions_pattern_query(st, "d1,last|d3", 0, "time,d1,d3,last", "2,4,8\r\n");
+    errors += test_dimensions_pattern_query(st, "d7", 0, "time,last", "8\r\n");
+    errors += test_dimensions_pattern_query(st, "d 5*|d4", 0, "time,d4,d 5*", "5,6\r\n");
+    errors += test_dimensions_pattern_query(st, "d*", 0, "", NULL);
+    errors += test_dimensions_pattern_query(st, "!d2", 0, "", NULL);
+    errors += test_dimensions_pattern_query(st, "nothing", 0, "", NULL);
+
+    // percentages are of the total of all the dimensions
+    errors += test_dimensions_pattern_query(st, "d3", RRDR_OPTION_PERCENTAGE, "time,d3", "11.11111\r\n");
+
+    if(!errors)
+        fprintf(stderr, "    the dimensions of chart %s selected, OK\n", st->id);
+
+    return errors;
+}
+
+static int test_context_query(const char *charts, const char *dimensions, int aggregate, const char *expected_header, const char *expected_values) {
+    BUFFER *wb = buffer_create(1);
+    int errors = 0;
+
+    int ret = rrd2context(wb, "unittest.context", charts, dimensions, DATASOURCE_CSV, 0, 0, 0, GROUP_AVERAGE, aggregate, 0);
+    const char *what = group_method2string(aggregate);
+
+    char *s = (char *)buffer_tostring(wb), *row = strstr(s, "\r\n");
+    if(ret != 200 || !row || (size_t)(row - s) != strlen(expected_header) || strncmp(s, expected_header, row - s) != 0) {
+        fprintf(stderr, "    %s: expected header '%s', got %d '%s', ### E R R O R ###\n", what, expected_header, ret, s);
+        buffer_free(wb);
+        return 1;
+    }
+
+    // the rows at the edges of the timeframe may have only some of the charts
+    long rows = 0, checked = 0;
+    while(row && row[2]) {
+        char *values = strchr(row + 2, ',');
+        char *next = strstr(row + 2, "\r\n");
+
+        if(rows > 2 && next && next[2] && strstr(next + 2, "\r\n") && strstr(strstr(next + 2, "\r\n") + 2, "\r\n")) {
+            if(!values || strncmp(values + 1, expected_values, strlen(expected_values)) != 0 || values + 1 + strlen(expected_values) != next) {
+                fprintf(stderr, "    %s: row %ld: expected '%s', got '%.*s', ### E R R O R ###\n", what, rows, expected_values, (int)(next - row - 2), row + 2);
+                errors++;
+                break;
+            }
+            checked++;
+        }
+
+        row = next;
+        rows++;
+    }
+
+    if(!errors && checked < 10) {
+        fprintf(stderr, "    %s: only %ld rows checked, ### E R R O R ###\n", what, checked);
+        errors++;
+    }
+
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_context(void) {
+    fprintf(stderr, "\nRunning test 'context queries':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+
+    // two charts of the context, collected at different frequencies, and one of another context
+    RRDSET *st1 = rrdset_create("netdata", "unittest-context1", NULL, "netdata", "unittest.context", "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+    RRDSET *st2 = rrdset_create("netdata", "unittest-context2", NULL, "netdata", "unittest.context", "Unit Testing", "a value", 1, 2, RRDSET_TYPE_LINE);
+    RRDSET *st3 = rrdset_create("netdata", "unittest-context3", NULL, "netdata", "unittest.other", "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+
+    RRDDIM *in1 = rrddim_add(st1, "in", NULL, 1, 1, RRDDIM_ABSOLUTE), *out1 = rrddim_add(st1, "out", NULL, 1, 1, RRDDIM_ABSOLUTE);
+    RRDDIM *in2 = rrddim_add(st2, "in", NULL, 1, 1, RRDDIM_ABSOLUTE), *out2 = rrddim_add(st2, "out", NULL, 1, 1, RRDDIM_ABSOLUTE);
+    RRDDIM *in3 = rrddim_add(st3, "in", NULL, 1, 1, RRDDIM_ABSOLUTE);
+
+    long c;
+    for(c = 0; c < 60 ; c++) {
+        if(c) {
+            rrdset_next_usec_unfiltered(st1, USEC_PER_SEC);
+            rrdset_next_usec_unfiltered(st3, USEC_PER_SEC);
+        }
+        rrddim_set_by_pointer(st1, in1, 1);
+        rrddim_set_by_pointer(st1, out1, 2);
+        rrdset_done(st1);
+
+        rrddim_set_by_pointer(st3, in3, 100);
+        rrdset_done(st3);
+
+        if(c % 2 == 0) {
+            if(c) rrdset_next_usec_unfiltered(st2, 2 * USEC_PER_SEC);
+            rrddim_set_by_pointer(st2, in2, 10);
+            rrddim_set_by_pointer(st2, out2, 20);
+            rrdset_done(st2);
+        }
+    }
+
+    int errors = 0;
+    errors += test_context_query(NULL, NULL, GROUP_SUM, "time,in,out", "11,22");
+    errors += test_context_query(NULL, NULL, GROUP_AVERAGE, "time,in,out", "5.5,11");
+    errors += test_context_query(NULL, NULL, GROUP_MIN, "time,in,out", "1,2");
+    errors += test_context_query(NULL, NULL, GROUP_MAX, "time,in,out", "10,20");
+    errors += test_context_query("netdata.unittest-context1", NULL, GROUP_SUM, "time,in,out", "1,2");
+    errors += test_context_query(NULL, "out", GROUP_SUM, "time,out", "22");
+
+    if(!errors)
+        fprintf(stderr, "    the charts of context unittest.context aggregated, OK\n");
+
+    return errors;
+}
+
+static int test_top_query(RRDSET *st, long top, uint32_t options, const char *expected_header, const char *expected_row) {
+    BUFFER *wb = buffer_create(1);
+    int errors = 0;
+
+    int ret = rrd2format(st, wb, NULL, DATASOURCE_CSV, 1, -1, 0, 0, GROUP_AVERAGE, RRDR_OPTION_SECONDS | options, top, NULL);
+
+    const char *s = buffer_tostring(wb);
+    char *row = strstr(s, "\r\n");
+    if(ret != 200 || !row || strncmp(s, expected_header, row - s) != 0 || strlen(expected_header) != (size_t)(row - s)) {
+        fprintf(stderr, "    top %ld: expected header '%s', got '%s', ### E R R O R ###\n", top, expected_header, s);
+        errors++;
+    }
+    else {
+        row = strchr(row, ',');
+        if(!row || strncmp(row + 1, expected_row, strlen(expected_row)) != 0) {
+            fprintf(stderr, "    top %ld: expected the values '%s', got '%s', ### E R R O R ###\n", top, expected_row, s);
+            errors++;
+        }
+    }
+
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_top(void) {
+    fprintf(stderr, "\nRunning test 'top dimensions':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+
+    RRDSET *st = rrdset_create("netdata", "unittest-top", NULL, "netdata", NULL, "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+    RRDDIM *rd[7];
+    char id[10];
+
+    int i;
+    for(i = 0; i < 7 ; i++) {
+        snprintfz(id, 9, "d%d", i);
+        rd[i] = rrddim_add(st, id, NULL, 1, 1, RRDDIM_ABSOLUTE);
+    }
+
+    // d0 is ranked by its absolute value, d6 is zero
+    long c;
+    for(c = 0; c < 10 ; c++) {
+        if(c) rrdset_next_usec_unfiltered(st, USEC_PER_SEC);
+        rrddim_set_by_pointer(st, rd[0], -8);
+        for(i = 1; i < 6 ; i++)
+            rrddim_set_by_pointer(st, rd[i], i);
+        rrddim_set_by_pointer(st, rd[6], 0);
+        rrdset_done(st);
+    }
+
+    int errors = 0;
+    errors += test_top_query(st, 3, 0, "time,d0,d5,d4", "-8,5,4\r\n");
+    errors += test_top_query(st, 1, 0, "time,d0", "-8\r\n");
+    errors += test_top_query(st, 7, 0, "time,d0,d1,d2,d3,d4,d5,d6", "-8,1,2,3,4,5,0\r\n");
+    errors += test_top_query(st, 3, RRDR_OPTION_OTHERS, "time,d0,d5,d4,others", "-8,5,4,6\r\n");
+    errors += test_top_query(st, 5, RRDR_OPTION_OTHERS | RRDR_OPTION_NONZERO, "time,d0,d5,d4,d3,d2,others", "-8,5,4,3,2,1\r\n");
+
+    // the percentages are of the total of all the dimensions, with or without others
+    errors += test_top_query(st, 3, RRDR_OPTION_PERCENTAGE | RRDR_OPTION_ABSOLUTE, "time,d0,d5,d4", "34.78261,21.73913,17.3913\r\n");
+    errors += test_top_query(st, 3, RRDR_OPTION_PERCENTAGE | RRDR_OPTION_ABSOLUTE | RRDR_OPTION_OTHERS, "time,d0,d5,d4,others", "34.78261,21.73913,17.3913,26.08696\r\n");
+
+    if(!errors)
+        fprintf(stderr, "    the top dimensions of chart %s selected, OK\n", st->id);
+
+    return errors;
+}
+
+static int test_query_cost_run(RRDSET *st, struct query_cost *qc, int expected, const char *what) {
+    BUFFER *wb = buffer_create(1);
+
+    query_cost_reset(qc);
+    query_cost_attach(qc);
+    int ret = rrd2format(st, wb, NULL, DATASOURCE_CSV, 0, 0, 0, 0, GROUP_AVERAGE, 0, 0, NULL);
+    query_cost_detach(qc);
+
+    buffer_free(wb);
+
+    if(ret != expected) {
+        fprintf(stderr, "    %s: expected %d, got %d, ### E R R O R ###\n", what, expected, ret);
+        return 1;
+    }
+
+    fprintf(stderr, "    %s: %d, %zu queries, %zu dimensions, %zu slots, OK\n", what, ret, qc->queries, qc->dimensions, qc->slots);
+    return 0;
+}
+
+static int test_query_cost(void) {
+    fprintf(stderr, "\nRunning test 'query cost':\n");
+
+    RRDSET *st = rrdset_find("netdata.unittest-stream");
+    if(!st) {
+        fprintf(stderr, "    cannot find chart netdata.unittest-stream, ### E R R O R ###\n");
+        return 1;
+    }
+
+    int errors = 0;
+    struct query_cost qc1, qc2;
+
+    config_set_number("global", "web api expensive query slots", 1000);
+    config_set_number("global", "web api max concurrent expensive queries", 1);
+    config_set_number("global", "web api expensive query queue ms", 100);
+    config_set_number("global", "web api max query slots", 0);
+    query_cost_init();
+
+    errors += test_query_cost_run(st, &qc1, 200, "accounted");
+    if(!errors && (qc1.queries != 1 || qc1.dimensions != 40 || qc1.slots < (size_t)(st->entries - 1) * 40)) {
+        fprintf(stderr, "    expected 1 query of 40 dimensions and %ld slots, ### E R R O R ###\n", (st->entries - 1) * 40);
+        errors++;
+    }
+
+    // a streamed query keeps its turn until it is freed
+    BUFFER *wb = buffer_create(1);
+    query_cost_reset(&qc1);
+    query_cost_attach(&qc1);
+    RRDR_STREAM *s = rrd2format_stream_create(st, wb, NULL, DATASOURCE_CSV, 0, 0, 0, GROUP_AVERAGE, 0, 4096);
+    query_cost_detach(&qc1);
+
+    if(!s) {
+        fprintf(stderr, "    the query was not streamed, ### E R R O R ###\n");
+        errors++;
+    }
+    else {
+        errors += test_query_cost_run(st, &qc2, 503, "rejected after waiting its turn");
+        rrd2format_stream_free(s);
+        errors += test_query_cost_run(st, &qc2, 200, "admitted when the other has finished");
+    }
+    buffer_free(wb);
+
+    config_set_number("global", "web api max query slots", 10000);
+    query_cost_init();
+    errors += test_query_cost_run(st, &qc2, 400, "rejected over the budget");
+
+    struct query_cost_statistics qcs;
+    query_cost_statistics(&qcs);
+    if(qcs.running != 0) {
+        fprintf(stderr, "    %zu expensive queries are still running, ### E R R O R ###\n", qcs.running);
+        errors++;
+    }
+
+    config_set_number("global", "web api max query slots", 0);
+    config_set_number("global", "web api max concurrent expensive queries", 0);
+    query_cost_init();
+
+    return errors;
+}
+
+// the chart has 2 dimensions and the queries group 6 points per row
+static int test_since_query(RRDSET *st, int group_method, long rows) {
+    BUFFER *full = buffer_create(1), *wb = buffer_create(1);
+    const char *what = group_method2string(group_method);
+    int errors = 0;
+
+    rrd2format(st, full, NULL, DATASOURCE_CSV, 10, -60, 0, 0, group_method, RRDR_OPTION_SECONDS, 0, NULL);
+
+    // the header and the first rows (the newest) of the full query
+    const char *s = buffer_tostring(full), *e = s;
+    long i;
+    for(i = 0; i <= rows && e ; i++) {
+        e = strstr(e, "\r\n");
+        if(e) e += 2;
+    }
+
+    if(!e) {
+        fprintf(stderr, "    %s: the full query has less than %ld rows, ### E R R O R ###\n", what, rows);
+        errors++;
+        goto cleanup;
+    }
+
+    // the timestamp of the last of them
+    const char *last = e - 2;
+    while(last > s && *(last - 1) != '\n') last--;
+    long long since = strtoll(last, NULL, 10);
+
+    struct query_cost qc;
+    query_cost_reset(&qc);
+    query_cost_attach(&qc);
+    rrd2format(st, wb, NULL, DATASOURCE_CSV, 10, -60, 0, since, group_method, RRDR_OPTION_SECONDS, 0, NULL);
+    query_cost_detach(&qc);
+
+    if(buffer_strlen(wb) != (size_t)(e - s) || strncmp(buffer_tostring(wb), s, e - s) != 0) {
+        fprintf(stderr, "    %s: since %lld, expected '%.*s', got '%s', ### E R R O R ###\n", what, since, (int)(e - s), s, buffer_tostring(wb));
+        errors++;
+    }
+    else if(qc.slots > (size_t)(rows * 6 * 2)) {
+        fprintf(stderr, "    %s: since %lld scanned %zu slots, expected at most %ld, ### E R R O R ###\n", what, since, qc.slots, rows * 6 * 2);
+        errors++;
+    }
+    else
+        fprintf(stderr, "    %s: since %lld, %ld rows, %zu slots scanned, OK\n", what, since, rows, qc.slots);
+
+cleanup:
+    buffer_free(full);
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_since(void) {
+    fprintf(stderr, "\nRunning test 'incremental queries':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+
+    RRDSET *st = rrdset_create("netdata", "unittest-since", NULL, "netdata", NULL, "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+    RRDDIM *rd1 = rrddim_add(st, "dim1", NULL, 1, 1, RRDDIM_ABSOLUTE);
+    RRDDIM *rd2 = rrddim_add(st, "dim2", NULL, 1, 1, RRDDIM_ABSOLUTE);
+
+    long c;
+    for(c = 0; c < 100 ; c++) {
+        if(c) rrdset_next_usec_unfiltered(st, USEC_PER_SEC);
+        rrddim_set_by_pointer(st, rd1, c);
+        rrddim_set_by_pointer(st, rd2, c * c);
+        rrdset_done(st);
+    }
+
+    int errors = 0;
+    errors += test_since_query(st, GROUP_AVERAGE, 1);
+    errors += test_since_query(st, GROUP_AVERAGE, 3);
+    errors += test_since_query(st, GROUP_MAX, 2);
+    errors += test_since_query(st, GROUP_INCREMENTAL_SUM, 4);
+
+    return errors;
+}
+
+static int test_parallel_query_run(RRDSET *st, BUFFER *expected, long points, long long after, long long before, int group_method, uint32_t options) {
+    BUFFER *wb = buffer_create(1);
+    const char *what = group_method2string(group_method);
+    int errors = 0;
+
+    // each partition is a result of its own
+    struct rrdr_arena_statistics ras1, ras2;
+    rrdr_arena_statistics(&ras1);
+    int ret = rrd2format(st, wb, NULL, DATASOURCE_CSV, points, after, before, 0, group_method, options, 0, NULL);
+    rrdr_arena_statistics(&ras2);
+
+    if(ret != 200 || strcmp(buffer_tostring(wb), buffer_tostring(expected)) != 0) {
+        fprintf(stderr, "    %s, %ld points, %lld to %lld: the partitioned query differs from the serial one, ### E R R O R ###\n", what, points, after, before);
+        errors++;
+    }
+    else if(ras2.queries - ras1.queries < 2) {
+        fprintf(stderr, "    %s, %ld points, %lld to %lld: the query was not partitioned, ### E R R O R ###\n", what, points, after, before);
+        errors++;
+    }
+    else
+        fprintf(stderr, "    %s, %ld points, %lld to %lld: %llu partitions, same as serial, OK\n", what, points, after, before, ras2.queries - ras1.queries - 1);
+
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_parallel_query(void) {
+    fprintf(stderr, "\nRunning test 'partitioned queries':\n");
+
+    RRDSET *st = rrdset_find("netdata.unittest-stream");
+    if(!st) {
+        fprintf(stderr, "    cannot find chart netdata.unittest-stream, ### E R R O R ###\n");
+        return 1;
+    }
+
+    struct {
+        long points;
+        long long after;
+        long long before;
+        int group_method;
+        uint32_t options;
+        BUFFER *wb;
+    } queries[] = {
+            { 0,    0,     0,   GROUP_AVERAGE,      0,                                            NULL },
+            { 700,  0,     0,   GROUP_MAX,          RRDR_OPTION_SECONDS,                          NULL },
+            { 7,    -3000, -17, GROUP_SUM,          RRDR_OPTION_SECONDS | RRDR_OPTION_NOT_ALIGNED, NULL },
+            { 333,  -3500, 0,   GROUP_MIN,          RRDR_OPTION_SECONDS | RRDR_OPTION_NONZERO,    NULL },
+            { 100,  0,     0,   GROUP_PERCENTILE95, RRDR_OPTION_SECONDS,                          NULL },
+    };
+    size_t i, count = sizeof(queries) / sizeof(queries[0]);
+
+    // the serial results, before the query pool is started
+    for(i = 0; i < count ; i++) {
+        queries[i].wb = buffer_create(1);
+        rrd2format(st, queries[i].wb, NULL, DATASOURCE_CSV, queries[i].points, queries[i].after, queries[i].before, 0, queries[i].group_method, queries[i].options, 0, NULL);
+    }
+
+    config_set_number("global", "web api query threads", 2);
+    config_set_number("global", "web api parallel query slots", 10000);
+    query_pool_init();
+
+    int errors = 0;
+    for(i = 0; i < count ; i++) {
+        errors += test_parallel_query_run(st, queries[i].wb, queries[i].points, queries[i].after, queries[i].before, queries[i].group_method, queries[i].options);
+        buffer_free(queries[i].wb);
+    }
+
+    return errors;
+}
+
+static int test_single_value_query(RRDSET *st, const char *dimensions, long long after, int group_method, uint32_t options) {
+    BUFFER *wb = buffer_create(1), *expected = buffer_create(1), *dims = buffer_create(1);
+    const char *what = group_method2string(group_method);
+    int errors = 0;
+
+    // the ssv output of the query has the same value
+    if(dimensions) buffer_strcat(dims, dimensions);
+    rrd2format(st, expected, (dimensions)?dims:NULL, DATASOURCE_SSV, 1, after, 0, 0, group_method, options, 0, NULL);
+
+    // without an RRDR
+    struct rrdr_arena_statistics ras1, ras2;
+    calculated_number n = 0;
+    int value_is_null = 1;
+
+    rrdr_arena_statistics(&ras1);
+    int ret = rrd2value(st, wb, &n, dimensions, 1, after, 0, group_method, options, NULL, NULL, &value_is_null);
+    rrdr_arena_statistics(&ras2);
+
+    buffer_flush(wb);
+    if(value_is_null) buffer_strcat(wb, "null");
+    else buffer_rrd_value(wb, n);
+
+    if(ret != 200 || strcmp(buffer_tostring(wb), buffer_tostring(expected)) != 0) {
+        fprintf(stderr, "    %s, %lld, options 0x%08x: expected %s, got %d %s, ### E R R O R ###\n", what, after, options, buffer_tostring(expected), ret, buffer_tostring(wb));
+        errors++;
+    }
+    else if(ras2.queries != ras1.queries) {
+        fprintf(stderr, "    %s, %lld, options 0x%08x: the value was calculated with an RRDR, ### E R R O R ###\n", what, after, options);
+        errors++;
+    }
+    else
+        fprintf(stderr, "    %s, %lld, options 0x%08x: %s, OK\n", what, after, options, buffer_tostring(wb));
+
+    buffer_free(wb);
+    buffer_free(expected);
+    buffer_free(dims);
+    return errors;
+}
+
+static int test_single_value(void) {
+    fprintf(stderr, "\nRunning test 'single value queries':\n");
+
+    RRDSET *st = rrdset_find("netdata.unittest-since");
+    if(!st) {
+        fprintf(stderr, "    cannot find chart netdata.unittest-since, ### E R R O R ###\n");
+        return 1;
+    }
+
+    int errors = 0;
+    errors += test_single_value_query(st, NULL, -10, GROUP_AVERAGE, 0);
+    errors += test_single_value_query(st, NULL, -30, GROUP_MAX, RRDR_OPTION_ABSOLUTE | RRDR_OPTION_PERCENTAGE);
+    errors += test_single_value_query(st, NULL, -20, GROUP_SUM, RRDR_OPTION_MIN2MAX);
+    errors += test_single_value_query(st, NULL, -6, GROUP_INCREMENTAL_SUM, 0);
+    errors += test_single_value_query(st, NULL, -60, GROUP_PERCENTILE95, RRDR_OPTION_NOT_ALIGNED);
+    errors += test_single_value_query(st, "dim2", -10, GROUP_MIN, 0);
+    errors += test_single_value_query(st, "dim1", -10, GROUP_AVERAGE, RRDR_OPTION_PERCENTAGE);
+
+    return errors;
+}
+
+// a query of all the rows, or of a single value when 'value' is set
+static int test_query_cancel_run(RRDSET *st, int fd, usec_t deadline, int value, int expected, const char *what) {
+    BUFFER *wb = buffer_create(1);
+    struct query_cost qc;
+    struct query_cost_statistics qcs1, qcs2;
+    calculated_number n;
+    int ret;
+
+    query_cost_statistics(&qcs1);
+
+    query_cost_reset(&qc);
+    query_cost_watch(&qc, fd, deadline);
+    query_cost_attach(&qc);
+    if(value) ret = rrd2value(st, wb, &n, NULL, 1, 0, 0, GROUP_AVERAGE, RRDR_OPTION_NOT_ALIGNED, NULL, NULL, NULL);
+    else ret = rrd2format(st, wb, NULL, DATASOURCE_CSV, 0, 0, 0, 0, GROUP_AVERAGE, 0, 0, NULL);
+    query_cost_detach(&qc);
+
+    query_cost_statistics(&qcs2);
+    buffer_free(wb);
+
+    if(ret != expected) {
+        fprintf(stderr, "    %s: expected %d, got %d, ### E R R O R ###\n", what, expected, ret);
+        return 1;
+    }
+
+    if(expected != 200 && (qcs2.cancelled == qcs1.cancelled || qcs2.saved == qcs1.saved)) {
+        fprintf(stderr, "    %s: the cancelled query was not counted, ### E R R O R ###\n", what);
+        return 1;
+    }
+
+    fprintf(stderr, "    %s: %d, %llu slots saved, OK\n", what, ret, qcs2.saved - qcs1.saved);
+    return 0;
+}
+
+static int test_query_cancel(void) {
+    fprintf(stderr, "\nRunning test 'query cancellation':\n");
+
+    RRDSET *st = rrdset_find("netdata.unittest-stream");
+    if(!st) {
+        fprintf(stderr, "    cannot find chart netdata.unittest-stream, ### E R R O R ###\n");
+        return 1;
+    }
+
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        fprintf(stderr, "    cannot create a socket pair, ### E R R O R ###\n");
+        return 1;
+    }
+
+    int errors = 0;
+    errors += test_query_cancel_run(st, fds[0], 0, 0, 200, "connected client");
+    errors += test_query_cancel_run(st, fds[0], 1, 0, 503, "deadline passed");
+    errors += test_query_cancel_run(st, fds[0], 0, 1, 200, "single value, connected client");
+    errors += test_query_cancel_run(st, fds[0], 1, 1, 503, "single value, deadline passed");
+
+    // a streamed query stops between its parts
+    BUFFER *wb = buffer_create(1);
+    struct query_cost qc;
+    query_cost_reset(&qc);
+    query_cost_watch(&qc, fds[0], 0);
+    query_cost_attach(&qc);
+
+    RRDR_STREAM *s = rrd2format_stream_create(st, wb, NULL, DATASOURCE_CSV, 0, 0, 0, GROUP_AVERAGE, 0, 4096);
+    int ret = (s)?rrd2format_stream_next(s, wb, 4096):0;
+
+    close(fds[1]);
+
+    while(ret == 1) {
+        buffer_flush(wb);
+        ret = rrd2format_stream_next(s, wb, 4096);
+    }
+    if(s) rrd2format_stream_free(s);
+    query_cost_detach(&qc);
+    buffer_free(wb);
+
+    if(ret != -1 || qc.cancelled != 499) {
+        fprintf(stderr, "    streamed query, disconnected client: expected -1 and 499, got %d and %d, ### E R R O R ###\n", ret, qc.cancelled);
+        errors++;
+    }
+    else
+        fprintf(stderr, "    streamed query, disconnected client: %d, OK\n", qc.cancelled);
+
+    errors += test_query_cancel_run(st, fds[0], 0, 0, 499, "disconnected client");
+    errors += test_query_cancel_run(st, fds[0], 0, 1, 499, "single value, disconnected client");
+    close(fds[0]);
+
+    return errors;
+}
+
+static int test_correlations_run(const char *what, long long baseline_after, long long baseline_before, int group_method, long top, int expected, const char *first, const char *second, long results) {
+    BUFFER *wb = buffer_create(1);
+    int errors = 0;
+
+    int ret = rrd2correlations(wb, "netdata.unittest-correlations-*", baseline_after, baseline_before, -60, 0, group_method, top);
+    const char *s = buffer_tostring(wb);
+
+    long found = 0;
+    const char *t;
+    for(t = strstr(s, "\"chart\":"); t ; t = strstr(t + 1, "\"chart\":")) found++;
+
+    const char *f = (first)?strstr(s, first):NULL, *n = (second)?strstr(s, second):NULL;
+
+    if(ret != expected) {
+        fprintf(stderr, "    %s: expected %d, got %d %s, ### E R R O R ###\n", what, expected, ret, s);
+        errors++;
+    }
+    else if(ret == 200 && (found != results || (first && !f) || (second && (!n || n < f)))) {
+        fprintf(stderr, "    %s: expected %ld dimensions, %s first, got %s, ### E R R O R ###\n", what, results, first, s);
+        errors++;
+    }
+    else
+        fprintf(stderr, "    %s: %d, %ld dimensions, OK\n", what, ret, found);
+
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_correlations(void) {
+    fprintf(stderr, "\nRunning test 'metric correlations':\n");
+
+    rrd_memory_mode = RRD_MEMORY_MODE_RAM;
+
+    RRDSET *st[3];
+    RRDDIM *rd[3][3];
+    long i, j, c;
+
+    for(i = 0; i < 3 ; i++) {
+        char id[RRD_ID_LENGTH_MAX + 1];
+        snprintfz(id, RRD_ID_LENGTH_MAX, "unittest-correlations-%ld", i + 1);
+
+        st[i] = rrdset_create("netdata", id, NULL, "netdata", NULL, "Unit Testing", "a value", 1, 1, RRDSET_TYPE_LINE);
+        for(j = 0; j < 3 ; j++) {
+            snprintfz(id, RRD_ID_LENGTH_MAX, "d%ld", j + 1);
+            rd[i][j] = rrddim_add(st[i], id, NULL, 1, 1, RRDDIM_ABSOLUTE);
+        }
+    }
+
+    // in the last 60 seconds, d1 of the second chart jumps from 10 to 100
+    // and d2 of the third from 50 to 60 - all the others do not change
+    for(c = 0; c < 200 ; c++) {
+        for(i = 0; i < 3 ; i++) {
+            if(c) rrdset_next_usec_unfiltered(st[i], USEC_PER_SEC);
+
+            for(j = 0; j < 3 ; j++) {
+                collected_number v = (j == 1)?50:10;
+
+                if(c >= 140 && i == 1 && j == 0) v = 100;
+                if(c >= 140 && i == 2 && j == 1) v = 60;
+
+                rrddim_set_by_pointer(st[i], rd[i][j], v);
+            }
+
+            rrdset_done(st[i]);
+        }
+    }
+
+    const char *first = "\"chart\": \"netdata.unittest-correlations-2\", \"dimension\": \"d1\"";
+    const char *second = "\"chart\": \"netdata.unittest-correlations-3\", \"dimension\": \"d2\"";
+
+    int errors = 0;
+    errors += test_correlations_run("average", 0, 0, GROUP_AVERAGE, 0, 200, first, second, 2);
+    errors += test_correlations_run("max, top 1", -120, 0, GROUP_MAX, 1, 200, first, NULL, 1);
+    errors += test_correlations_run("median", 0, -30, GROUP_MEDIAN, 0, 200, first, second, 2);
+    errors += test_correlations_run("baseline overlapping", 0, 30, GROUP_AVERAGE, 0, 400, NULL, NULL, 0);
+    errors += test_correlations_run("lttb", 0, 0, GROUP_LTTB, 0, 400, NULL, NULL, 0);
+
+    return errors;
+}
+
+static int test_allmetrics_snapshot_format(int format, const char *what, const char *metric) {
+    BUFFER *expected = buffer_create(1), *wb = buffer_create(1);
+    struct allmetrics_snapshot_statistics ass1, ass2;
+    int errors = 0, i;
+
+    if(format == ALLMETRICS_PROMETHEUS) rrd_stats_api_v1_charts_allmetrics_prometheus(expected);
+    else rrd_stats_api_v1_charts_allmetrics_shell(expected);
+
+    if(!strstr(buffer_tostring(expected), metric)) {
+        fprintf(stderr, "    %s: metric '%s' is not in the output, ### E R R O R ###\n", what, metric);
+        errors++;
+        goto cleanup;
+    }
+
+    // the first request renders the snapshot, the second one reuses it
+    allmetrics_snapshot_statistics(&ass1);
+    for(i = 0; i < 2 ; i++) {
+        buffer_flush(wb);
+        int gzipped = allmetrics_snapshot(wb, format, 0);
+
+        if(gzipped || strcmp(buffer_tostring(wb), buffer_tostring(expected)) != 0) {
+            fprintf(stderr, "    %s: request %d, the snapshot differs from the output, ### E R R O R ###\n", what, i + 1);
+            errors++;
+            goto cleanup;
+        }
+    }
+    allmetrics_snapshot_statistics(&ass2);
+
+    if(ass2.renders - ass1.renders != 1 || ass2.hits - ass1.hits != 1) {
+        fprintf(stderr, "    %s: expected 1 render and 1 hit, got %llu renders and %llu hits, ### E R R O R ###\n", what, ass2.renders - ass1.renders, ass2.hits - ass1.hits);
+        errors++;
+        goto cleanup;
+    }
+
+#ifdef NETDATA_WITH_ZLIB
+    // the gzipped copy of the snapshot
+    buffer_flush(wb);
+    if(allmetrics_snapshot(wb, format, 1) != 1) {
+        fprintf(stderr, "    %s: the snapshot has no gzipped copy, ### E R R O R ###\n", what);
+        errors++;
+        goto cleanup;
+    }
+
+    size_t size = buffer_strlen(expected) + 1;
+    char *data = mallocz(size);
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(z_stream));
+    inflateInit2(&zs, 15 + 16);
+    zs.next_in = (Bytef *)wb->buffer;
+    zs.avail_in = (uInt)wb->len;
+    zs.next_out = (Bytef *)data;
+    zs.avail_out = (uInt)size;
+    int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+
+    if(ret != Z_STREAM_END || zs.total_out != buffer_strlen(expected) || memcmp(data, buffer_tostring(expected), zs.total_out) != 0) {
+        fprintf(stderr, "    %s: the gzipped snapshot differs from the output, ### E R R O R ###\n", what);
+        errors++;
+    }
+    freez(data);
+    if(errors) goto cleanup;
+
+    fprintf(stderr, "    %s: %zu bytes, %zu gzipped, 1 render for 3 requests, OK\n", what, buffer_strlen(expected), wb->len);
+#else
+    fprintf(stderr, "    %s: %zu bytes, 1 render for 2 requests, OK\n", what, buffer_strlen(expected));
+#endif
+
+cleanup:
+    buffer_free(expected);
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_allmetrics_snapshot(void) {
+    fprintf(stderr, "\nRunning test 'allmetrics snapshots':\n");
+
+    // a tick that does not end while the test runs
+    config_set_number("global", "web api allmetrics snapshot seconds", 1000000000);
+    allmetrics_snapshot_init();
+
+    int errors = 0;
+    errors += test_allmetrics_snapshot_format(ALLMETRICS_PROMETHEUS, "prometheus", "\nnetdata_unittest_since_dim2{instance=");
+    errors += test_allmetrics_snapshot_format(ALLMETRICS_SHELL, "shell", "\nNETDATA_NETDATA_UNITTEST_SINCE_DIM2=\"");
+
+    config_set_number("global", "web api allmetrics snapshot seconds", 0);
+    allmetrics_snapshot_init();
+
+    return errors;
+}
+
+// the /api/v1/charts output, rendered without the cache
+static void test_charts_cache_expected(BUFFER *wb) {
+    size_t c = 0, dimensions = 0, memory = 0, alarms = 0;
+    RRDSET *st;
+    RRDDIM *rd;
+    RRDCALC *rc;
+
+    buffer_sprintf(wb, "{\n\t\"hostname\": \"%s\",\n\t\"version\": \"%s\",\n\t\"os\": \"%s\",\n\t\"update_every\": %d,\n\t\"history\": %d,\n\t\"charts\": {"
+                   , localhost.hostname, program_version, os_type, rrd_update_every, rrd_default_history_entries);
+
+    for(st = localhost.rrdset_root; st ; st = st->next) {
+        if(!st->enabled || !st->dimensions) continue;
+
+        buffer_sprintf(wb, "%s\n\t\t\"%s\": ", c?",":"", st->id);
+        rrd_stats_api_v1_chart(st, wb);
+
+        memory += st->memsize;
+        for(rd = st->dimensions; rd ; rd = rd->next) {
+            if(rd->flags & RRDDIM_FLAG_HIDDEN) continue;
+            memory += rd->memsize;
+            dimensions++;
+        }
+        c++;
+    }
+
+    for(rc = localhost.alarms; rc ; rc = rc->next)
+        if(rc->rrdset) alarms++;
+
+    buffer_sprintf(wb, "\n\t},\n\t\"charts_count\": %zu,\n\t\"dimensions_count\": %zu,\n\t\"alarms_count\": %zu,\n\t\"rrd_memory_bytes\": %zu\n}\n"
+                   , c, dimensions, alarms, memory);
+}
+
+static int test_charts_cache_check(const char *what, RRDSET *changed, RRDSET *unchanged, unsigned long unchanged_generation) {
+    BUFFER *expected = buffer_create(1), *wb = buffer_create(1);
+    int errors = 0;
+
+    test_charts_cache_expected(expected);
+    rrd_stats_api_v1_charts(wb);
+
+    if(strcmp(buffer_tostring(wb), buffer_tostring(expected)) != 0) {
+        fprintf(stderr, "    %s: the output differs from the uncached one, ### E R R O R ###\n", what);
+        errors++;
+    }
+    else if(!changed->charts_json || changed->charts_json->generation != changed->generation) {
+        fprintf(stderr, "    %s: the JSON of chart '%s' has not been rendered again, ### E R R O R ###\n", what, changed->id);
+        errors++;
+    }
+    else if(!unchanged->charts_json || unchanged->charts_json->generation != unchanged_generation) {
+        fprintf(stderr, "    %s: the JSON of chart '%s' has been rendered again, ### E R R O R ###\n", what, unchanged->id);
+        errors++;
+    }
+    else
+        fprintf(stderr, "    %s: %zu bytes, OK\n", what, buffer_strlen(wb));
+
+    buffer_free(expected);
+    buffer_free(wb);
+    return errors;
+}
+
+static int test_charts_cache(void) {
+    fprintf(stderr, "\nRunning test '/api/v1/charts cache':\n");
+
+    RRDSET *st1 = rrdset_find("netdata.unittest-correlations-1");
+    RRDSET *st2 = rrdset_find("netdata.unittest-correlations-2");
+    if(!st1 || !st2) {
+        fprintf(stderr, "    the charts of the test are missing, ### E R R O R ###\n");
+        return 1;
+    }
+
+    BUFFER *wb = buffer_create(1);
+    rrd_stats_api_v1_charts(wb);
+    buffer_free(wb);
+
+    int errors = 0;
+    errors += test_charts_cache_check("cached", st1, st2, st2->generation);
+
+    rrddim_hide(st1, "d3");
+    errors += test_charts_cache_check("hidden dimension", st1, st2, st2->generation);
+
+    rrddim_unhide(st1, "d3");
+    errors += test_charts_cache_check("visible dimension", st1, st2, st2->generation);
+
+    unsigned long generation = st1->generation;
+    RRDDIM *rd = rrddim_find(st2, "d1");
+    rrddim_set_name(st2, rd, "renamed");
+    errors += test_charts_cache_check("renamed dimension", st2, st1, generation);
+
+    rrddim_set_name(st2, rd, "d1");
+    errors += test_charts_cache_check("restored dimension", st2, st1, generation);
+
+    // the memory of dimensions in memory mode ram grows as they are collected
+    rd->memsize += 4096;
+    errors += test_charts_cache_check("grown dimension", st1, st2, st2->generation);
+    rd->memsize -= 4096;
+
+    return errors;
+}
+
+int run_all_mockup_tests(void)
+{
+    if(!test_variable_renames())
+        return 1;
+
+    if(test_storage_engine_wide())
+        return 1;
+
+    if(test_query_cache())
+        return 1;
+
+    if(test_query_stream())
+        return 1;
+
+    if(test_query_binary())
+        return 1;
+
+    if(test_query_json_delta())
+        return 1;
+
+    if(test_percentile_sketch())
+        return 1;
+
+    if(test_percentile_query())
+        return 1;
+
+    if(test_lttb())
+        return 1;
+
+    if(test_rrdr_arena())
+        return 1;
+
+    if(test_dimensions_pattern())
+        return 1;
+
+    if(test_context())
+        return 1;
+
+    if(test_top())
+        return 1;
+
+    if(test_query_cost())
+        return 1;
+
+    if(test_since())
+        return 1;
+
+    if(test_parallel_query())
+        return 1;
+
+    if(test_single_value())
+        return 1;
+
+    if(test_query_cancel())
+        return 1;
+
+    if(test_correlations())
+        return 1;
+
+    if(test_allmetrics_snapshot())
+        return 1;
+
+    if(test_charts_cache())
         return 1;
 
     if(run_test(&test1))
@@ -1146,15 +2895,14 @@ int unit_test(long delay, long shift)
     fprintf(stderr, "\n\nORIGINAL INCREMENT: %lu, INCREMENT %ld, DELAY %ld, SHIFT %ld\n", oincrement * 10, increment * 10, delay, shift);
 
     int ret = 0;
-    storage_number sn;
+    uint32_t flags;
     calculated_number cn, v;
     for(c = 0 ; c < st->counter ; c++) {
         fprintf(stderr, "\nPOSITION: c = %lu, EXPECTED VALUE %lu\n", c, (oincrement + c * increment + increment * (1000000 - shift) / 1000000 )* 10);
 
         for(rd = st->dimensions ; rd ; rd = rd->next) {
-            sn = rd->values[c];
-            cn = unpack_storage_number(sn);
-            fprintf(stderr, "\t %s " CALCULATED_NUMBER_FORMAT " (PACKED AS " STORAGE_NUMBER_FORMAT ")   ->   ", rd->id, cn, sn);
+            flags = unit_test_stored_value(rd, c, &cn);
+            fprintf(stderr, "\t %s " CALCULATED_NUMBER_FORMAT " (FLAGS 0x%08x)   ->   ", rd->id, cn, flags);
 
             if(rd == rdabs) v =
                 (     oincrement
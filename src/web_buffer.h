@@ -54,6 +54,7 @@ extern void buffer_reset(BUFFER *wb);
 
 extern void buffer_strcat(BUFFER *wb, const char *txt);
 extern void buffer_rrd_value(BUFFER *wb, calculated_number value);
+extern void buffer_rrd_value_decimals(BUFFER *wb, calculated_number value, int decimals);
 
 extern void buffer_date(BUFFER *wb, int year, int month, int day, int hours, int minutes, int seconds);
 extern void buffer_jsdate(BUFFER *wb, int year, int month, int day, int hours, int minutes, int seconds);
@@ -66,12 +67,18 @@ extern void buffer_snprintf(BUFFER *wb, size_t len, const char *fmt, ...) PRINTF
 extern void buffer_vsprintf(BUFFER *wb, const char *fmt, va_list args);
 extern void buffer_sprintf(BUFFER *wb, const char *fmt, ...) PRINTFLIKE(2,3);
 extern void buffer_strcat_htmlescape(BUFFER *wb, const char *txt);
+extern void buffer_strcat_jsonescape(BUFFER *wb, const char *txt);
 
 extern void buffer_char_replace(BUFFER *wb, char from, char to);
 
-extern char *print_number_lu_r(char *str, unsigned long uvalue);
-extern char *print_number_llu_r(char *str, unsigned long long uvalue);
+// the digits of 00 to 99, to print numbers two digits at a time
+extern const char digit_pairs[201];
+
+// they return the length of the string printed
+extern int print_number_llu(char *str, unsigned long long uvalue);
+extern int print_number_ll(char *str, long long value);
 
 extern void buffer_print_llu(BUFFER *wb, unsigned long long uvalue);
+extern void buffer_print_ll(BUFFER *wb, long long value);
 
 #endif /* NETDATA_WEB_BUFFER_H */
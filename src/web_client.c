@@ -3,6 +3,7 @@
 #define INITIAL_WEB_DATA_LENGTH 16384
 #define WEB_REQUEST_LENGTH 16384
 #define TOO_BIG_REQUEST 16384
+#define WEB_CLIENT_STREAM_PART_SIZE 65536
 
 int web_client_timeout = DEFAULT_DISCONNECT_IDLE_WEB_CLIENTS_AFTER_SECONDS;
 int web_donotrack_comply = 0;
@@ -14,6 +15,25 @@ int web_enable_gzip = 1, web_gzip_level = 3, web_gzip_strategy = Z_DEFAULT_STRAT
 struct web_client *web_clients = NULL;
 unsigned long long web_clients_count = 0;
 
+// send the response data as they are, without compressing them
+static inline void web_client_disable_deflate(struct web_client *w) {
+    w->response.zoutput = 0;
+
+#ifdef NETDATA_WITH_ZLIB
+    if(w->response.zinitialized) {
+        debug(D_DEFLATE, "%llu: Freeing compression resources.", w->id);
+        deflateEnd(&w->response.zstream);
+        w->response.zsent = 0;
+        w->response.zhave = 0;
+        w->response.zstream.avail_in = 0;
+        w->response.zstream.avail_out = 0;
+        w->response.zstream.total_in = 0;
+        w->response.zstream.total_out = 0;
+        w->response.zinitialized = 0;
+    }
+#endif // NETDATA_WITH_ZLIB
+}
+
 static inline int web_client_crock_socket(struct web_client *w) {
 #ifdef TCP_CORK
     if(likely(!w->tcp_cork && w->ofd != -1)) {
@@ -123,11 +143,18 @@ void web_client_reset(struct web_client *w) {
 
     debug(D_WEB_CLIENT, "%llu: Resetting client.", w->id);
 
+    // if we had a streamed query, release it
+    // it is accounted to the request
+    if(unlikely(w->response.stream)) {
+        rrd2format_stream_free(w->response.stream);
+        w->response.stream = NULL;
+    }
+
     if(likely(w->last_url[0])) {
         struct timeval tv;
         now_realtime_timeval(&tv);
 
-        size_t size = (w->mode == WEB_CLIENT_MODE_FILECOPY)?w->response.rlen:w->response.data->len;
+        size_t size = (w->mode == WEB_CLIENT_MODE_FILECOPY)?w->response.rlen:w->response.data->len + w->response.streamed;
         size_t sent = size;
 #ifdef NETDATA_WITH_ZLIB
         if(likely(w->response.zoutput)) sent = (size_t)w->response.zstream.total_out;
@@ -145,16 +172,25 @@ void web_client_reset(struct web_client *w) {
         w->stats_received_bytes = 0;
         w->stats_sent_bytes = 0;
 
+        // the cost of the queries of the request
+        char cost[200] = "";
+        if(w->query_cost.queries) {
+            query_cost_finished(&w->query_cost, size);
+            snprintfz(cost, 199, ", queries/dimensions/slots = %zu/%zu/%zu, cpu = %0.2f ms",
+                      w->query_cost.queries, w->query_cost.dimensions, w->query_cost.slots, w->query_cost.cpu_usec / 1000.0);
+        }
+
 
         // --------------------------------------------------------------------
         // access log
 
-        log_access("%llu: (sent/all = %zu/%zu bytes %0.0f%%, prep/sent/total = %0.2f/%0.2f/%0.2f ms) %s: %d '%s'",
+        log_access("%llu: (sent/all = %zu/%zu bytes %0.0f%%, prep/sent/total = %0.2f/%0.2f/%0.2f ms%s) %s: %d '%s'",
                    w->id,
                    sent, size, -((size > 0) ? ((size - sent) / (double) size * 100.0) : 0.0),
                    dt_usec(&w->tv_ready, &w->tv_in) / 1000.0,
                    dt_usec(&tv, &w->tv_ready) / 1000.0,
                    dt_usec(&tv, &w->tv_in) / 1000.0,
+                   cost,
                    (w->mode == WEB_CLIENT_MODE_FILECOPY) ? "filecopy" : ((w->mode == WEB_CLIENT_MODE_OPTIONS)
                                                                          ? "options" : "data"),
                    w->response.code,
@@ -175,6 +211,8 @@ void web_client_reset(struct web_client *w) {
     w->cookie2[0] = '\0';
     w->origin[0] = '*';
     w->origin[1] = '\0';
+    w->if_none_match[0] = '\0';
+    w->if_modified_since = 0;
 
     w->mode = WEB_CLIENT_MODE_NORMAL;
 
@@ -190,26 +228,45 @@ void web_client_reset(struct web_client *w) {
     w->response.rlen = 0;
     w->response.sent = 0;
     w->response.code = 0;
+    w->response.etag[0] = '\0';
+    w->response.last_modified = 0;
 
     w->wait_receive = 1;
     w->wait_send = 0;
 
-    w->response.zoutput = 0;
+    w->response.streamed = 0;
+    w->response.chunked = 0;
 
     // if we had enabled compression, release it
-#ifdef NETDATA_WITH_ZLIB
-    if(w->response.zinitialized) {
-        debug(D_DEFLATE, "%llu: Freeing compression resources.", w->id);
-        deflateEnd(&w->response.zstream);
-        w->response.zsent = 0;
-        w->response.zhave = 0;
-        w->response.zstream.avail_in = 0;
-        w->response.zstream.avail_out = 0;
-        w->response.zstream.total_in = 0;
-        w->response.zstream.total_out = 0;
-        w->response.zinitialized = 0;
+    web_client_disable_deflate(w);
+}
+
+// replace the data of the response with the next non-empty part of a streamed query
+// the data are left empty when the query has no more parts
+static void web_client_stream_next(struct web_client *w) {
+    w->response.streamed += w->response.data->len;
+    buffer_flush(w->response.data);
+    w->response.sent = 0;
+
+    // the parts after the first are generated while the response is sent
+    int attach = (query_cost_get() != &w->query_cost);
+    if(attach) query_cost_attach(&w->query_cost);
+
+    while(w->response.stream && !w->response.data->len) {
+        int ret = rrd2format_stream_next(w->response.stream, w->response.data, WEB_CLIENT_STREAM_PART_SIZE);
+        if(ret <= 0) {
+            rrd2format_stream_free(w->response.stream);
+            w->response.stream = NULL;
+        }
+
+        // the response of a cancelled query is not completed, the connection is closed
+        if(unlikely(ret < 0)) {
+            buffer_flush(w->response.data);
+            WEB_CLIENT_IS_DEAD(w);
+        }
     }
-#endif // NETDATA_WITH_ZLIB
+
+    if(attach) query_cost_detach(&w->query_cost);
 }
 
 struct web_client *web_client_free(struct web_client *w) {
@@ -529,6 +586,16 @@ void buffer_data_options2string(BUFFER *wb, uint32_t options) {
         if(count++) buffer_strcat(wb, " ");
         buffer_strcat(wb, "unaligned");
     }
+
+    if(options & RRDR_OPTION_FLOAT32) {
+        if(count++) buffer_strcat(wb, " ");
+        buffer_strcat(wb, "float32");
+    }
+
+    if(options & RRDR_OPTION_OTHERS) {
+        if(count++) buffer_strcat(wb, " ");
+        buffer_strcat(wb, "others");
+    }
 }
 
 uint32_t web_client_api_request_v1_data_options(char *o)
@@ -563,6 +630,10 @@ uint32_t web_client_api_request_v1_data_options(char *o)
             ret |= RRDR_OPTION_PERCENTAGE;
         else if(!strcmp(tok, "unaligned"))
             ret |= RRDR_OPTION_NOT_ALIGNED;
+        else if(!strcmp(tok, "float32"))
+            ret |= RRDR_OPTION_FLOAT32;
+        else if(!strcmp(tok, "others"))
+            ret |= RRDR_OPTION_OTHERS;
     }
 
     return ret;
@@ -603,6 +674,12 @@ uint32_t web_client_api_request_v1_data_format(char *name)
     else if(!strcmp(name, DATASOURCE_FORMAT_CSV_JSON_ARRAY)) // csvjsonarray
         return DATASOURCE_CSV_JSON_ARRAY;
 
+    else if(!strcmp(name, DATASOURCE_FORMAT_BINARY)) // binary
+        return DATASOURCE_BINARY;
+
+    else if(!strcmp(name, DATASOURCE_FORMAT_JSON_DELTA)) // jsondelta
+        return DATASOURCE_JSON_DELTA;
+
     return DATASOURCE_JSON;
 }
 
@@ -643,6 +720,18 @@ const char *group_method2string(int group) {
         case GROUP_INCREMENTAL_SUM:
             return "incremental-sum";
 
+        case GROUP_MEDIAN:
+            return "median";
+
+        case GROUP_PERCENTILE95:
+            return "percentile95";
+
+        case GROUP_PERCENTILE99:
+            return "percentile99";
+
+        case GROUP_LTTB:
+            return "lttb";
+
         default:
             return "unknown-group-method";
     }
@@ -665,9 +754,82 @@ int web_client_api_request_v1_data_group(char *name, int def)
     else if(!strcmp(name, "incremental-sum"))
         return GROUP_INCREMENTAL_SUM;
 
+    else if(!strcmp(name, "median"))
+        return GROUP_MEDIAN;
+
+    else if(!strcmp(name, "percentile95"))
+        return GROUP_PERCENTILE95;
+
+    else if(!strcmp(name, "percentile99"))
+        return GROUP_PERCENTILE99;
+
+    else if(!strcmp(name, "lttb"))
+        return GROUP_LTTB;
+
     return def;
 }
 
+// ----------------------------------------------------------------------------
+// HTTP conditional requests
+//
+// the API responses that are derived from counters of the charts, the host
+// or the alarm log, get an ETag and a Last-Modified date from them.
+// The ETag includes the time netdata started, since these counters start
+// from zero on every start.
+
+static time_t web_client_etag_epoch = 0;
+
+// does the If-None-Match of the request include the etag? (weak comparison)
+static inline int web_client_etag_matches(const char *if_none_match, const char *etag) {
+    if(!strncmp(etag, "W/", 2)) etag += 2;
+    size_t len = strlen(etag);
+
+    const char *s = if_none_match;
+    while(*s) {
+        while(*s == ' ' || *s == ',') s++;
+        if(*s == '*') return 1;
+        if(!strncmp(s, "W/", 2)) s += 2;
+
+        if(!strncmp(s, etag, len) && (s[len] == ',' || s[len] == ' ' || s[len] == '\0'))
+            return 1;
+
+        while(*s && *s != ',') s++;
+    }
+
+    return 0;
+}
+
+// set the validators of the response - a weak ETag is used for responses that
+// have also a few fields changing on every update, which are not significant
+// returns 1 when the client already has the response, 0 otherwise
+static int web_client_not_modified(struct web_client *w, int weak, char type, unsigned long long a, unsigned long long b, time_t last_modified) {
+    snprintfz(w->response.etag, ETAG_MAX, "%s\"%c%lx-%llx-%llx%s\""
+              , weak?"W/":""
+              , type
+              , (unsigned long)web_client_etag_epoch
+              , a
+              , b
+              , w->response.zoutput?"-gzip":""
+              );
+
+    w->response.last_modified = last_modified;
+
+    int not_modified;
+    if(w->if_none_match[0])
+        not_modified = web_client_etag_matches(w->if_none_match, w->response.etag);
+    else
+        not_modified = (w->if_modified_since && last_modified && last_modified <= w->if_modified_since);
+
+    if(not_modified) {
+        debug(D_WEB_CLIENT, "%llu: The response with ETag %s is not modified.", w->id, w->response.etag);
+
+        buffer_flush(w->response.data);
+        web_client_disable_deflate(w);
+    }
+
+    return not_modified;
+}
+
 int web_client_api_request_v1_alarms(struct web_client *w, char *url)
 {
     int all = 0;
@@ -680,6 +842,17 @@ int web_client_api_request_v1_alarms(struct web_client *w, char *url)
         else if(!strcmp(value, "active")) all = 0;
     }
 
+    // the alarms change status only with a new entry in the alarm log
+    pthread_rwlock_rdlock(&localhost.health_log.alarm_log_rwlock);
+    uint32_t next_log_id = localhost.health_log.next_log_id;
+    time_t last_modified = (localhost.health_log.alarms)?localhost.health_log.alarms->when:0;
+    pthread_rwlock_unlock(&localhost.health_log.alarm_log_rwlock);
+
+    if(last_modified < localhost.generation_t) last_modified = localhost.generation_t;
+
+    if(web_client_not_modified(w, 1, 'a', next_log_id, localhost.generation, last_modified))
+        return 304;
+
     buffer_flush(w->response.data);
     w->response.data->contenttype = CT_APPLICATION_JSON;
     health_alarms2json(&localhost, w->response.data, all);
@@ -707,7 +880,7 @@ int web_client_api_request_v1_alarm_log(struct web_client *w, char *url)
     return 200;
 }
 
-int web_client_api_request_single_chart(struct web_client *w, char *url, void callback(RRDSET *st, BUFFER *buf))
+int web_client_api_request_single_chart(struct web_client *w, char *url, void callback(RRDSET *st, BUFFER *buf), int conditional)
 {
     int ret = 400;
     char *chart = NULL;
@@ -746,6 +919,9 @@ int web_client_api_request_single_chart(struct web_client *w, char *url, void ca
         goto cleanup;
     }
 
+    if(conditional && web_client_not_modified(w, 1, 'c', st->generation, 0, st->generation_t))
+        return 304;
+
     w->response.data->contenttype = CT_APPLICATION_JSON;
     callback(st, w->response.data);
     return 200;
@@ -756,13 +932,16 @@ int web_client_api_request_single_chart(struct web_client *w, char *url, void ca
 
 int web_client_api_request_v1_alarm_variables(struct web_client *w, char *url)
 {
-    return web_client_api_request_single_chart(w, url, health_api_v1_chart_variables2json);
+    return web_client_api_request_single_chart(w, url, health_api_v1_chart_variables2json, 0);
 }
 
 int web_client_api_request_v1_charts(struct web_client *w, char *url)
 {
     (void)url;
 
+    if(web_client_not_modified(w, 1, 'h', localhost.generation, 0, localhost.generation_t))
+        return 304;
+
     buffer_flush(w->response.data);
     w->response.data->contenttype = CT_APPLICATION_JSON;
     rrd_stats_api_v1_charts(w->response.data);
@@ -796,13 +975,14 @@ int web_client_api_request_v1_allmetrics(struct web_client *w, char *url)
 
     switch(format) {
         case ALLMETRICS_SHELL:
-            w->response.data->contenttype = CT_TEXT_PLAIN;
-            rrd_stats_api_v1_charts_allmetrics_shell(w->response.data);
-            return 200;
-
         case ALLMETRICS_PROMETHEUS:
-            w->response.data->contenttype = CT_PROMETHEUS;
-            rrd_stats_api_v1_charts_allmetrics_prometheus(w->response.data);
+            w->response.data->contenttype = (format == ALLMETRICS_SHELL)?CT_TEXT_PLAIN:CT_PROMETHEUS;
+
+            // the snapshot is already gzipped, it is sent as it is
+            if(allmetrics_snapshot(w->response.data, format, w->response.zoutput)) {
+                web_client_disable_deflate(w);
+                buffer_strcat(w->response.header, "Content-Encoding: gzip\r\n");
+            }
             return 200;
 
         default:
@@ -814,7 +994,7 @@ int web_client_api_request_v1_allmetrics(struct web_client *w, char *url)
 
 int web_client_api_request_v1_chart(struct web_client *w, char *url)
 {
-    return web_client_api_request_single_chart(w, url, rrd_stats_api_v1_chart);
+    return web_client_api_request_single_chart(w, url, rrd_stats_api_v1_chart, 1);
 }
 
 int web_client_api_request_v1_badge(struct web_client *w, char *url) {
@@ -1071,15 +1251,18 @@ cleanup:
 }
 
 // returns the HTTP code
-int web_client_api_request_v1_data(struct web_client *w, char *url)
+// execute the data query described by the parameters in url
+// the result is appended to wb
+// extra response headers are appended to header, if it is given
+// large queries are streamed, if stream is given: wb gets the first part
+// of the result and *stream is set to generate the rest
+static int web_client_api_request_v1_data_query(unsigned long long id, BUFFER *wb, BUFFER *header, char *url, RRDR_STREAM **stream)
 {
-    debug(D_WEB_CLIENT, "%llu: API v1 data with URL '%s'", w->id, url);
+    debug(D_WEB_CLIENT, "%llu: API v1 data with URL '%s'", id, url);
 
     int ret = 400;
     BUFFER *dimensions = NULL;
 
-    buffer_flush(w->response.data);
-
     char    *google_version = "0.6",
             *google_reqId = "0",
             *google_sig = "0",
@@ -1092,7 +1275,9 @@ int web_client_api_request_v1_data(struct web_client *w, char *url)
     char *chart = NULL
             , *before_str = NULL
             , *after_str = NULL
-            , *points_str = NULL;
+            , *points_str = NULL
+            , *top_str = NULL
+            , *since_str = NULL;
 
     int group = GROUP_AVERAGE;
     uint32_t format = DATASOURCE_JSON;
@@ -1106,7 +1291,7 @@ int web_client_api_request_v1_data(struct web_client *w, char *url)
         if(!name || !*name) continue;
         if(!value || !*value) continue;
 
-        debug(D_WEB_CLIENT, "%llu: API v1 data query param '%s' with value '%s'", w->id, name, value);
+        debug(D_WEB_CLIENT, "%llu: API v1 data query param '%s' with value '%s'", id, name, value);
 
         // name and value are now the parameters
         // they are not null and not empty
@@ -1120,6 +1305,8 @@ int web_client_api_request_v1_data(struct web_client *w, char *url)
         else if(!strcmp(name, "after")) after_str = value;
         else if(!strcmp(name, "before")) before_str = value;
         else if(!strcmp(name, "points")) points_str = value;
+        else if(!strcmp(name, "top")) top_str = value;
+        else if(!strcmp(name, "since")) since_str = value;
         else if(!strcmp(name, "group")) {
             group = web_client_api_request_v1_data_group(value, GROUP_AVERAGE);
         }
@@ -1169,15 +1356,15 @@ int web_client_api_request_v1_data(struct web_client *w, char *url)
     }
 
     if(!chart || !*chart) {
-        buffer_sprintf(w->response.data, "No chart id is given at the request.");
+        buffer_sprintf(wb, "No chart id is given at the request.");
         goto cleanup;
     }
 
     RRDSET *st = rrdset_find(chart);
     if(!st) st = rrdset_find_byname(chart);
     if(!st) {
-        buffer_strcat(w->response.data, "Chart is not found: ");
-        buffer_strcat_htmlescape(w->response.data, chart);
+        buffer_strcat(wb, "Chart is not found: ");
+        buffer_strcat_htmlescape(wb, chart);
         ret = 404;
         goto cleanup;
     }
@@ -1185,22 +1372,26 @@ int web_client_api_request_v1_data(struct web_client *w, char *url)
     long long before = (before_str && *before_str)?str2l(before_str):0;
     long long after  = (after_str  && *after_str) ?str2l(after_str):0;
     int       points = (points_str && *points_str)?str2i(points_str):0;
+    long      top    = (top_str    && *top_str)   ?str2l(top_str):0;
+    long long since  = (since_str  && *since_str) ?str2l(since_str):0;
 
-    debug(D_WEB_CLIENT, "%llu: API command 'data' for chart '%s', dimensions '%s', after '%lld', before '%lld', points '%d', group '%d', format '%u', options '0x%08x'"
-            , w->id
+    debug(D_WEB_CLIENT, "%llu: API command 'data' for chart '%s', dimensions '%s', after '%lld', before '%lld', since '%lld', points '%d', group '%d', format '%u', options '0x%08x', top '%ld'"
+            , id
             , chart
             , (dimensions)?buffer_tostring(dimensions):""
             , after
             , before
+            , since
             , points
             , group
             , format
             , options
+            , top
             );
 
-    if(outFileName && *outFileName) {
-        buffer_sprintf(w->response.header, "Content-Disposition: attachment; filename=\"%s\"\r\n", outFileName);
-        debug(D_WEB_CLIENT, "%llu: generating outfilename header: '%s'", w->id, outFileName);
+    if(header && outFileName && *outFileName) {
+        buffer_sprintf(header, "Content-Disposition: attachment; filename=\"%s\"\r\n", outFileName);
+        debug(D_WEB_CLIENT, "%llu: generating outfilename header: '%s'", id, outFileName);
     }
 
     if(format == DATASOURCE_DATATABLE_JSONP) {
@@ -1208,10 +1399,10 @@ int web_client_api_request_v1_data(struct web_client *w, char *url)
             responseHandler = "google.visualization.Query.setResponse";
 
         debug(D_WEB_CLIENT_ACCESS, "%llu: GOOGLE JSON/JSONP: version = '%s', reqId = '%s', sig = '%s', out = '%s', responseHandler = '%s', outFileName = '%s'",
-                w->id, google_version, google_reqId, google_sig, google_out, responseHandler, outFileName
+                id, google_version, google_reqId, google_sig, google_out, responseHandler, outFileName
             );
 
-        buffer_sprintf(w->response.data,
+        buffer_sprintf(wb,
             "%s({version:'%s',reqId:'%s',status:'ok',sig:'%ld',table:",
             responseHandler, google_version, google_reqId, st->last_updated.tv_sec);
     }
@@ -1219,32 +1410,345 @@ int web_client_api_request_v1_data(struct web_client *w, char *url)
         if(responseHandler == NULL)
             responseHandler = "callback";
 
-        buffer_strcat(w->response.data, responseHandler);
-        buffer_strcat(w->response.data, "(");
+        buffer_strcat(wb, responseHandler);
+        buffer_strcat(wb, "(");
     }
 
-    ret = rrd2format(st, w->response.data, dimensions, format, points, after, before, group, options, &last_timestamp_in_data);
+    // the top dimensions are ranked on all the rows
+    // incremental queries are small
+    if(stream && top <= 0 && since <= 0)
+        *stream = rrd2format_stream_create(st, wb, dimensions, format, points, after, before, group, options, WEB_CLIENT_STREAM_PART_SIZE);
+
+    if(stream && *stream)
+        ret = 200;
+    else if(stream && (ret = query_cost_rejected())) {
+        buffer_flush(wb);
+        buffer_strcat(wb, (query_cost_cancelled())?"The query has been cancelled.":"The query is too expensive to run now.");
+        goto cleanup;
+    }
+    else
+        ret = query_cache_rrd2format(st, wb, dimensions, format, points, after, before, since, group, options, top, &last_timestamp_in_data);
 
     if(format == DATASOURCE_DATATABLE_JSONP) {
         if(google_timestamp < last_timestamp_in_data)
-            buffer_strcat(w->response.data, "});");
+            buffer_strcat(wb, "});");
 
         else {
             // the client already has the latest data
-            buffer_flush(w->response.data);
-            buffer_sprintf(w->response.data,
+            buffer_flush(wb);
+            buffer_sprintf(wb,
                 "%s({version:'%s',reqId:'%s',status:'error',errors:[{reason:'not_modified',message:'Data not modified'}]});",
                 responseHandler, google_version, google_reqId);
         }
     }
     else if(format == DATASOURCE_JSONP)
-        buffer_strcat(w->response.data, ");");
+        buffer_strcat(wb, ");");
 
 cleanup:
     if(dimensions) buffer_free(dimensions);
     return ret;
 }
 
+// find the chart of a data query, without modifying its url
+static RRDSET *web_client_api_request_v1_data_chart(const char *url) {
+    char buf[URL_MAX + 1], *s = buf;
+    strncpyz(buf, url, URL_MAX);
+
+    while(s) {
+        char *value = mystrsep(&s, "?&");
+        if(!value || !*value) continue;
+
+        char *name = mystrsep(&value, "=");
+        if(!name || !*name) continue;
+        if(!value || !*value) continue;
+
+        if(!strcmp(name, "chart")) {
+            RRDSET *st = rrdset_find(value);
+            if(!st) st = rrdset_find_byname(value);
+            return st;
+        }
+    }
+
+    return NULL;
+}
+
+int web_client_api_request_v1_data(struct web_client *w, char *url)
+{
+    // the same query on the same version of the chart gives the same response
+    RRDSET *st = web_client_api_request_v1_data_chart(url);
+    if(st) {
+        time_t last_modified = st->last_updated.tv_sec;
+        if(last_modified < st->generation_t) last_modified = st->generation_t;
+
+        if(web_client_not_modified(w, 0, 'd', st->version, st->generation, last_modified))
+            return 304;
+    }
+
+    buffer_flush(w->response.data);
+    return web_client_api_request_v1_data_query(w->id, w->response.data, w->response.header, url, &w->response.stream);
+}
+
+// ----------------------------------------------------------------------------
+// context queries
+//
+// /api/v1/context?context=disk.io&aggregate=sum&after=-600&points=100
+//
+// aggregates all the charts of a context, or the ones matching the 'charts'
+// pattern, per dimension name.
+
+int web_client_api_request_v1_context(struct web_client *w, char *url)
+{
+    debug(D_WEB_CLIENT, "%llu: API v1 context with URL '%s'", w->id, url);
+
+    BUFFER *wb = w->response.data;
+    buffer_flush(wb);
+
+    BUFFER *dimensions = NULL;
+
+    char *context = NULL
+            , *charts = NULL
+            , *before_str = NULL
+            , *after_str = NULL
+            , *points_str = NULL;
+
+    int group = GROUP_AVERAGE, aggregate = GROUP_SUM;
+    uint32_t format = DATASOURCE_JSON;
+    uint32_t options = 0x00000000;
+    int ret = 400;
+
+    while(url) {
+        char *value = mystrsep(&url, "?&");
+        if(!value || !*value) continue;
+
+        char *name = mystrsep(&value, "=");
+        if(!name || !*name) continue;
+        if(!value || !*value) continue;
+
+        debug(D_WEB_CLIENT, "%llu: API v1 context query param '%s' with value '%s'", w->id, name, value);
+
+        if(!strcmp(name, "context")) context = value;
+        else if(!strcmp(name, "charts")) charts = value;
+        else if(!strcmp(name, "dimension") || !strcmp(name, "dim") || !strcmp(name, "dimensions") || !strcmp(name, "dims")) {
+            if(!dimensions) dimensions = buffer_create(100);
+            buffer_strcat(dimensions, "|");
+            buffer_strcat(dimensions, value);
+        }
+        else if(!strcmp(name, "after")) after_str = value;
+        else if(!strcmp(name, "before")) before_str = value;
+        else if(!strcmp(name, "points")) points_str = value;
+        else if(!strcmp(name, "group")) group = web_client_api_request_v1_data_group(value, GROUP_AVERAGE);
+        else if(!strcmp(name, "aggregate")) {
+            aggregate = web_client_api_request_v1_data_group(value, GROUP_UNDEFINED);
+            if(aggregate != GROUP_SUM && aggregate != GROUP_AVERAGE && aggregate != GROUP_MIN && aggregate != GROUP_MAX) {
+                buffer_strcat(wb, "Unsupported aggregate method: ");
+                buffer_strcat_htmlescape(wb, value);
+                goto cleanup;
+            }
+        }
+        else if(!strcmp(name, "format")) {
+            format = (!strcmp(value, DATASOURCE_FORMAT_CSV))?DATASOURCE_CSV:DATASOURCE_JSON;
+        }
+        else if(!strcmp(name, "options")) {
+            options |= web_client_api_request_v1_data_options(value);
+        }
+    }
+
+    if(!context || !*context) {
+        buffer_strcat(wb, "No context is given at the request.");
+        goto cleanup;
+    }
+
+    long long before = (before_str && *before_str)?str2l(before_str):0;
+    long long after  = (after_str  && *after_str) ?str2l(after_str):0;
+    int       points = (points_str && *points_str)?str2i(points_str):0;
+
+    ret = rrd2context(wb, context, charts, (dimensions)?buffer_tostring(dimensions):NULL, format, points, after, before, group, aggregate, options);
+
+cleanup:
+    if(dimensions) buffer_free(dimensions);
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+// metric correlations
+//
+// /api/v1/correlations?after=-300&baseline_after=-1500&top=20
+//
+// ranks the dimensions of all the charts by how much their value in the
+// highlighted timeframe (after, before) differs from their value in the
+// baseline timeframe (baseline_after, baseline_before).
+
+#define API_V1_CORRELATIONS_TOP 50
+
+int web_client_api_request_v1_correlations(struct web_client *w, char *url)
+{
+    debug(D_WEB_CLIENT, "%llu: API v1 correlations with URL '%s'", w->id, url);
+
+    BUFFER *wb = w->response.data;
+    buffer_flush(wb);
+
+    char *charts = NULL
+            , *before_str = NULL
+            , *after_str = NULL
+            , *baseline_before_str = NULL
+            , *baseline_after_str = NULL
+            , *top_str = NULL;
+
+    int group = GROUP_AVERAGE;
+
+    while(url) {
+        char *value = mystrsep(&url, "?&");
+        if(!value || !*value) continue;
+
+        char *name = mystrsep(&value, "=");
+        if(!name || !*name) continue;
+        if(!value || !*value) continue;
+
+        debug(D_WEB_CLIENT, "%llu: API v1 correlations query param '%s' with value '%s'", w->id, name, value);
+
+        if(!strcmp(name, "charts")) charts = value;
+        else if(!strcmp(name, "after")) after_str = value;
+        else if(!strcmp(name, "before")) before_str = value;
+        else if(!strcmp(name, "baseline_after")) baseline_after_str = value;
+        else if(!strcmp(name, "baseline_before")) baseline_before_str = value;
+        else if(!strcmp(name, "top")) top_str = value;
+        else if(!strcmp(name, "group")) group = web_client_api_request_v1_data_group(value, GROUP_AVERAGE);
+    }
+
+    long long before          = (before_str && *before_str)?str2l(before_str):0;
+    long long after           = (after_str  && *after_str) ?str2l(after_str):0;
+    long long baseline_before = (baseline_before_str && *baseline_before_str)?str2l(baseline_before_str):0;
+    long long baseline_after  = (baseline_after_str  && *baseline_after_str) ?str2l(baseline_after_str):0;
+    long      top             = (top_str && *top_str)?str2l(top_str):API_V1_CORRELATIONS_TOP;
+
+    return rrd2correlations(wb, charts, baseline_after, baseline_before, after, before, group, top);
+}
+
+// ----------------------------------------------------------------------------
+// batch data queries
+//
+// /api/v1/batch?after=-600&chart=system.cpu&points=100&chart=system.load
+//
+// every 'chart' parameter starts a new query and the parameters following it
+// belong to it. The parameters given before the first 'chart' apply to all
+// the queries. The queries are executed in parallel by the query pool and
+// their results are returned in a JSON array, in the order they were given.
+
+#define API_V1_BATCH_MAX_QUERIES 500
+
+struct api_v1_batch_query {
+    unsigned long long id;
+    const char *chart;
+    BUFFER *url;                                    // the parameters of this query
+    BUFFER *wb;                                     // the result of this query
+    int ret;
+
+    struct query_cost cost;                         // the cost of this query, on the thread that ran it
+};
+
+static void web_client_api_request_v1_batch_execute(void *item) {
+    struct api_v1_batch_query *q = item;
+
+    // the cpu time of the thread of the request is accounted to the request
+    int worker = (query_cost_get() == NULL);
+
+    query_cost_attach(&q->cost);
+    q->ret = web_client_api_request_v1_data_query(q->id, q->wb, NULL, q->url->buffer, NULL);
+    query_cost_detach(&q->cost);
+
+    if(!worker) q->cost.cpu_usec = 0;
+}
+
+int web_client_api_request_v1_batch(struct web_client *w, char *url)
+{
+    debug(D_WEB_CLIENT, "%llu: API v1 batch with URL '%s'", w->id, url);
+
+    int ret = 400;
+    size_t count = 0, i;
+    struct api_v1_batch_query *queries = NULL;
+    BUFFER *common = buffer_create(100);
+    BUFFER *wb = w->response.data;
+
+    buffer_flush(wb);
+
+    while(url) {
+        char *value = mystrsep(&url, "?&");
+        if(!value || !*value) continue;
+
+        char *name = mystrsep(&value, "=");
+        if(!name || !*name) continue;
+        if(!value || !*value) continue;
+
+        if(!strcmp(name, "chart")) {
+            if(count == API_V1_BATCH_MAX_QUERIES) {
+                buffer_sprintf(wb, "Too many queries in the batch request. The maximum is %d.", API_V1_BATCH_MAX_QUERIES);
+                goto cleanup;
+            }
+
+            queries = reallocz(queries, (count + 1) * sizeof(struct api_v1_batch_query));
+
+            struct api_v1_batch_query *q = &queries[count++];
+            q->id = w->id;
+            q->chart = value;
+            q->url = buffer_create(100);
+            q->wb = buffer_create(1024);
+            q->ret = 400;
+            query_cost_reset(&q->cost);
+            query_cost_watch(&q->cost, w->query_cost.fd, w->query_cost.deadline);
+
+            buffer_strcat(q->url, buffer_tostring(common));
+        }
+
+        BUFFER *b = (count)?queries[count - 1].url:common;
+        buffer_strcat(b, "&");
+        buffer_strcat(b, name);
+        buffer_strcat(b, "=");
+        buffer_strcat(b, value);
+    }
+
+    if(!count) {
+        buffer_sprintf(wb, "No chart is given at the batch request.");
+        goto cleanup;
+    }
+
+    query_pool_run(web_client_api_request_v1_batch_execute, queries, sizeof(struct api_v1_batch_query), count);
+
+    wb->contenttype = CT_APPLICATION_JSON;
+    buffer_no_cacheable(wb);
+
+    buffer_strcat(wb, "{\n\t\"results\": [");
+    for(i = 0; i < count ; i++) {
+        struct api_v1_batch_query *q = &queries[i];
+        query_cost_merge(&w->query_cost, &q->cost);
+
+        buffer_strcat(wb, (i)?",\n\t\t{\n\t\t\t\"chart\": \"":"\n\t\t{\n\t\t\t\"chart\": \"");
+        buffer_strcat_jsonescape(wb, q->chart);
+
+        if(q->ret == 200 && q->wb->contenttype == CT_APPLICATION_JSON) {
+            buffer_sprintf(wb, "\",\n\t\t\t\"status\": %d,\n\t\t\t\"result\": ", q->ret);
+            buffer_strcat(wb, buffer_tostring(q->wb));
+        }
+        else {
+            // only the formats giving JSON can be embedded in the response
+            buffer_sprintf(wb, "\",\n\t\t\t\"status\": %d,\n\t\t\t\"error\": \"", (q->ret == 200)?400:q->ret);
+            buffer_strcat_jsonescape(wb, (q->ret == 200)?"This format is not supported in batch requests.":buffer_tostring(q->wb));
+            buffer_strcat(wb, "\"");
+        }
+
+        buffer_strcat(wb, "\n\t\t}");
+    }
+    buffer_strcat(wb, "\n\t]\n}\n");
+    ret = 200;
+
+cleanup:
+    for(i = 0; i < count ; i++) {
+        buffer_free(queries[i].url);
+        buffer_free(queries[i].wb);
+    }
+    freez(queries);
+    buffer_free(common);
+    return ret;
+}
 
 int web_client_api_request_v1_registry(struct web_client *w, char *url)
 {
@@ -1410,10 +1914,15 @@ int web_client_api_request_v1_registry(struct web_client *w, char *url)
 }
 
 int web_client_api_request_v1(struct web_client *w, char *url) {
-    static uint32_t hash_data = 0, hash_chart = 0, hash_charts = 0, hash_registry = 0, hash_badge = 0, hash_alarms = 0, hash_alarm_log = 0, hash_alarm_variables = 0, hash_raw = 0;
+    static uint32_t hash_data = 0, hash_batch = 0, hash_context = 0, hash_correlations = 0, hash_chart = 0, hash_charts = 0, hash_registry = 0, hash_badge = 0, hash_alarms = 0, hash_alarm_log = 0, hash_alarm_variables = 0, hash_raw = 0;
 
     if(unlikely(hash_data == 0)) {
+        web_client_etag_epoch = now_realtime_sec();
+
         hash_data = simple_hash("data");
+        hash_batch = simple_hash("batch");
+        hash_context = simple_hash("context");
+        hash_correlations = simple_hash("correlations");
         hash_chart = simple_hash("chart");
         hash_charts = simple_hash("charts");
         hash_registry = simple_hash("registry");
@@ -1433,6 +1942,15 @@ int web_client_api_request_v1(struct web_client *w, char *url) {
         if(hash == hash_data && !strcmp(tok, "data"))
             return web_client_api_request_v1_data(w, url);
 
+        else if(hash == hash_batch && !strcmp(tok, "batch"))
+            return web_client_api_request_v1_batch(w, url);
+
+        else if(hash == hash_context && !strcmp(tok, "context"))
+            return web_client_api_request_v1_context(w, url);
+
+        else if(hash == hash_correlations && !strcmp(tok, "correlations"))
+            return web_client_api_request_v1_correlations(w, url);
+
         else if(hash == hash_chart && !strcmp(tok, "chart"))
             return web_client_api_request_v1_chart(w, url);
 
@@ -1743,6 +2261,9 @@ const char *web_response_code_to_string(int code) {
         case 200:
             return "OK";
 
+        case 304:
+            return "Not Modified";
+
         case 307:
             return "Temporary Redirect";
 
@@ -1758,6 +2279,12 @@ const char *web_response_code_to_string(int code) {
         case 412:
             return "Preconditions Failed";
 
+        case 499:
+            return "Client Closed Request";
+
+        case 503:
+            return "Service Unavailable";
+
         default:
             if(code >= 100 && code < 200)
                 return "Informational";
@@ -1779,13 +2306,16 @@ const char *web_response_code_to_string(int code) {
 }
 
 static inline char *http_header_parse(struct web_client *w, char *s) {
-    static uint32_t hash_origin = 0, hash_connection = 0, hash_accept_encoding = 0, hash_donottrack = 0;
+    static uint32_t hash_origin = 0, hash_connection = 0, hash_accept_encoding = 0, hash_donottrack = 0,
+            hash_if_none_match = 0, hash_if_modified_since = 0;
 
     if(unlikely(!hash_origin)) {
         hash_origin = simple_uhash("Origin");
         hash_connection = simple_uhash("Connection");
         hash_accept_encoding = simple_uhash("Accept-Encoding");
         hash_donottrack = simple_uhash("DNT");
+        hash_if_none_match = simple_uhash("If-None-Match");
+        hash_if_modified_since = simple_uhash("If-Modified-Since");
     }
 
     char *e = s;
@@ -1828,6 +2358,16 @@ static inline char *http_header_parse(struct web_client *w, char *s) {
         if(*v == '0') w->donottrack = 0;
         else if(*v == '1') w->donottrack = 1;
     }
+    else if(hash == hash_if_none_match && !strcasecmp(s, "If-None-Match"))
+        strncpyz(w->if_none_match, v, IF_NONE_MATCH_MAX);
+
+    else if(hash == hash_if_modified_since && !strcasecmp(s, "If-Modified-Since")) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(struct tm));
+
+        char *end = strptime(v, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if(end && !*end) w->if_modified_since = timegm(&tm);
+    }
 #ifdef NETDATA_WITH_ZLIB
     else if(hash == hash_accept_encoding && !strcasecmp(s, "Accept-Encoding")) {
         if(web_enable_gzip) {
@@ -1926,7 +2466,7 @@ static inline int http_request_validate(struct web_client *w) {
     return -3;
 }
 
-void web_client_process(struct web_client *w) {
+static void web_client_process_request(struct web_client *w) {
     static uint32_t
             hash_api = 0,
             hash_netdata_conf = 0,
@@ -2171,6 +2711,10 @@ void web_client_process(struct web_client *w) {
             w->response.data->expires = w->tv_ready.tv_sec + 86400;
     }
 
+    // a streamed response starts with its first non-empty part
+    if(unlikely(w->response.stream && !w->response.data->len))
+        web_client_stream_next(w);
+
     // prepare the HTTP response header
     debug(D_WEB_CLIENT, "%llu: Generating HTTP header with response %d.", w->id, code);
 
@@ -2245,6 +2789,17 @@ void web_client_process(struct web_client *w) {
             "Expires: %s\r\n",
             (w->response.data->options & WB_CONTENT_NO_CACHEABLE)?"no-cache":"public",
             edate);
+
+        // the validators of the response
+        if(w->response.etag[0])
+            buffer_sprintf(w->response.header_output, "ETag: %s\r\n", w->response.etag);
+
+        if(w->response.last_modified) {
+            char ldate[32];
+            struct tm tmbuf, *tm = gmtime_r(&w->response.last_modified, &tmbuf);
+            strftime(ldate, sizeof(ldate), "%a, %d %b %Y %H:%M:%S GMT", tm);
+            buffer_sprintf(w->response.header_output, "Last-Modified: %s\r\n", ldate);
+        }
     }
 
     // copy a possibly available custom header
@@ -2258,6 +2813,15 @@ void web_client_process(struct web_client *w) {
             "Transfer-Encoding: chunked\r\n"
             );
     }
+    else if(unlikely(w->response.stream)) {
+        // we don't know the content length, but more parts will follow
+        buffer_strcat(w->response.header_output, "Transfer-Encoding: chunked\r\n");
+        w->response.chunked = 1;
+    }
+    else if(unlikely(code == 304)) {
+        // 304 responses do not have a body
+        ;
+    }
     else {
         if(likely((w->response.data->len || w->response.rlen))) {
             // we know the content length, put it
@@ -2297,6 +2861,19 @@ void web_client_process(struct web_client *w) {
     else 
         w->stats_sent_bytes += bytes;
 
+    // a 304 response is complete with its header
+    if(unlikely(code == 304)) {
+        debug(D_WEB_CLIENT, "%llu: Done sending the Not Modified response.", w->id);
+
+        if(unlikely(!w->keepalive)) WEB_CLIENT_IS_DEAD(w);
+        else web_client_reset(w);
+        return;
+    }
+
+    // open the first chunk
+    if(unlikely(w->response.chunked) && web_client_send_chunk_header(w, w->response.data->len) < 0)
+        return;
+
     // enable sending immediately if we have data
     if(w->response.data->len) w->wait_send = 1;
     else w->wait_send = 0;
@@ -2339,6 +2916,18 @@ void web_client_process(struct web_client *w) {
     }
 }
 
+void web_client_process(struct web_client *w) {
+    // the queries of the request are accounted while it is processed
+    // and they stop when the client disconnects, or at the deadline of the request
+    query_cost_reset(&w->query_cost);
+    query_cost_watch(&w->query_cost, w->ifd, query_cost_deadline());
+    query_cost_attach(&w->query_cost);
+
+    web_client_process_request(w);
+
+    query_cost_detach(&w->query_cost);
+}
+
 ssize_t web_client_send_chunk_header(struct web_client *w, size_t len)
 {
     debug(D_DEFLATE, "%llu: OPEN CHUNK of %zu bytes (hex: %zx).", w->id, len, len);
@@ -2418,13 +3007,13 @@ ssize_t web_client_send_deflate(struct web_client *w)
     debug(D_DEFLATE, "%llu: web_client_send_deflate(): w->response.data->len = %zu, w->response.sent = %zu, w->response.zhave = %zu, w->response.zsent = %zu, w->response.zstream.avail_in = %u, w->response.zstream.avail_out = %u, w->response.zstream.total_in = %lu, w->response.zstream.total_out = %lu.",
         w->id, w->response.data->len, w->response.sent, w->response.zhave, w->response.zsent, w->response.zstream.avail_in, w->response.zstream.avail_out, w->response.zstream.total_in, w->response.zstream.total_out);
 
-    if(w->response.data->len - w->response.sent == 0 && w->response.zstream.avail_in == 0 && w->response.zhave == w->response.zsent && w->response.zstream.avail_out != 0) {
+    if(w->response.data->len - w->response.sent == 0 && w->response.zstream.avail_in == 0 && w->response.zhave == w->response.zsent && w->response.zstream.avail_out != 0 && !w->response.stream) {
         // there is nothing to send
 
         debug(D_WEB_CLIENT, "%llu: Out of output data.", w->id);
 
         // finalize the chunk
-        if(w->response.sent != 0) {
+        if(w->response.sent != 0 || w->response.streamed != 0) {
             t = web_client_send_chunk_finalize(w);
             if(t < 0) return t;
         }
@@ -2452,11 +3041,17 @@ ssize_t web_client_send_deflate(struct web_client *w)
         // compress more input data
 
         // close the previous open chunk
-        if(w->response.sent != 0) {
+        if(w->response.sent != 0 || w->response.streamed != 0) {
             t = web_client_send_chunk_close(w);
             if(t < 0) return t;
         }
 
+        // all the data have been compressed, get the next part of a streamed query
+        if(unlikely(w->response.stream && w->response.data->len == w->response.sent && w->response.zstream.avail_in == 0)) {
+            web_client_stream_next(w);
+            if(unlikely(w->dead)) return -1;
+        }
+
         debug(D_DEFLATE, "%llu: Compressing %zu new bytes starting from %zu (and %u left behind).", w->id, (w->response.data->len - w->response.sent), w->response.sent, w->response.zstream.avail_in);
 
         // give the compressor all the data not passed through the compressor yet
@@ -2471,7 +3066,7 @@ ssize_t web_client_send_deflate(struct web_client *w)
 
         // ask for FINISH if we have all the input
         int flush = Z_SYNC_FLUSH;
-        if(w->mode == WEB_CLIENT_MODE_NORMAL
+        if((w->mode == WEB_CLIENT_MODE_NORMAL && !w->response.stream)
             || (w->mode == WEB_CLIENT_MODE_FILECOPY && !w->wait_receive && w->response.data->len == w->response.rlen)) {
             flush = Z_FINISH;
             debug(D_DEFLATE, "%llu: Requesting Z_FINISH, if possible.", w->id);
@@ -2532,6 +3127,25 @@ ssize_t web_client_send(struct web_client *w) {
 
     ssize_t bytes;
 
+    if(unlikely(w->response.data->len - w->response.sent == 0 && w->response.chunked)) {
+        // the current chunk has been sent, open the next one
+        web_client_stream_next(w);
+        if(unlikely(w->dead)) return -1;
+
+        if(w->response.data->len) {
+            bytes = web_client_send_chunk_close(w);
+            if(bytes < 0) return bytes;
+
+            ssize_t t = web_client_send_chunk_header(w, w->response.data->len);
+            if(t < 0) return t;
+            return bytes + t;
+        }
+
+        w->response.chunked = 0;
+        bytes = web_client_send_chunk_finalize(w);
+        if(bytes < 0) return bytes;
+    }
+
     if(unlikely(w->response.data->len - w->response.sent == 0)) {
         // there is nothing to send
 
@@ -17,6 +17,8 @@ extern int web_enable_gzip, web_gzip_level, web_gzip_strategy, web_donotrack_com
 #define HTTP_RESPONSE_HEADER_SIZE 4096
 #define COOKIE_MAX 1024
 #define ORIGIN_MAX 1024
+#define ETAG_MAX 100
+#define IF_NONE_MATCH_MAX 1024
 
 struct response {
     BUFFER *header;                 // our response header
@@ -25,9 +27,16 @@ struct response {
 
     int code;                       // the HTTP response code
 
+    char etag[ETAG_MAX+1];          // the ETag of the response, empty when it has none
+    time_t last_modified;           // the Last-Modified time of the response, 0 when it has none
+
     size_t rlen;                    // if non-zero, the excepted size of ifd (input of firecopy)
     size_t sent;                    // current data length sent to output
 
+    RRDR_STREAM *stream;            // a streamed query, while it has more parts to send
+    size_t streamed;                // the bytes of the parts of the streamed query already sent
+    int chunked;                    // if set to 1, web_client_send() will send the data in chunks
+
     int zoutput;                    // if set to 1, web_client_send() will send compressed data
 #ifdef NETDATA_WITH_ZLIB
     z_stream zstream;               // zlib stream for sending compressed output to client
@@ -75,14 +84,28 @@ struct web_client {
     char cookie2[COOKIE_MAX+1];
     char origin[ORIGIN_MAX+1];
 
+    char if_none_match[IF_NONE_MATCH_MAX+1];    // the If-None-Match header of the request
+    time_t if_modified_since;                   // the If-Modified-Since header of the request, 0 when it has none
+
     struct sockaddr_storage clientaddr;
     struct response response;
 
     size_t stats_received_bytes;
     size_t stats_sent_bytes;
 
+    struct query_cost query_cost;   // the cost of the queries of the current request
+
     pthread_t thread;               // the thread servicing this client
 
+    // the epoll web server
+    struct web_server_io *io;       // the I/O thread servicing this client
+    int io_job;                     // the work the worker threads have to do for this client
+    int io_registered;              // 1 = the socket of the client has been added to the epoll of its I/O thread
+    time_t io_expires;              // the time the client will be disconnected, if it is idle
+    struct web_client *io_timer_prev;   // the clients of the same slot of the timer wheel
+    struct web_client *io_timer_next;
+    struct web_client *io_next;     // the clients of the same worker queue, or handed to the same I/O thread
+
     struct web_client *prev;
     struct web_client *next;
 };
@@ -97,6 +120,9 @@ extern uid_t web_files_gid(void);
 extern struct web_client *web_client_create(int listener);
 extern struct web_client *web_client_free(struct web_client *w);
 extern ssize_t web_client_send(struct web_client *w);
+extern ssize_t web_client_send_chunk_header(struct web_client *w, size_t len);
+extern ssize_t web_client_send_chunk_close(struct web_client *w);
+extern ssize_t web_client_send_chunk_finalize(struct web_client *w);
 extern ssize_t web_client_receive(struct web_client *w);
 extern void web_client_process(struct web_client *w);
 extern void web_client_reset(struct web_client *w);
@@ -104,6 +130,9 @@ extern void web_client_reset(struct web_client *w);
 extern void *web_client_main(void *ptr);
 
 extern int web_client_api_request_v1_data_group(char *name, int def);
+extern int web_client_api_request_v1_batch(struct web_client *w, char *url);
+extern int web_client_api_request_v1_context(struct web_client *w, char *url);
+extern int web_client_api_request_v1_correlations(struct web_client *w, char *url);
 extern const char *group_method2string(int group);
 
 extern void buffer_data_options2string(BUFFER *wb, uint32_t options);
@@ -46,6 +46,36 @@ static void log_allocations(void)
 }
 #endif /* NETDATA_INTERNAL_CHECKS */
 
+int web_server_mode_id(const char *mode) {
+    if(!strcmp(mode, WEB_SERVER_MODE_MULTI_THREADED_NAME))
+        return WEB_SERVER_MODE_MULTI_THREADED;
+
+    else if(!strcmp(mode, WEB_SERVER_MODE_SINGLE_THREADED_NAME))
+        return WEB_SERVER_MODE_SINGLE_THREADED;
+
+#ifdef HAVE_SYS_EPOLL_H
+    else if(!strcmp(mode, WEB_SERVER_MODE_EPOLL_NAME))
+        return WEB_SERVER_MODE_EPOLL;
+#endif /* HAVE_SYS_EPOLL_H */
+
+    error("Invalid web server mode '%s'. Using '%s'.", mode, web_server_mode_name(WEB_SERVER_MODE_DEFAULT));
+    return WEB_SERVER_MODE_DEFAULT;
+}
+
+const char *web_server_mode_name(int id) {
+    switch(id) {
+        case WEB_SERVER_MODE_SINGLE_THREADED:
+            return WEB_SERVER_MODE_SINGLE_THREADED_NAME;
+
+        case WEB_SERVER_MODE_EPOLL:
+            return WEB_SERVER_MODE_EPOLL_NAME;
+
+        default:
+        case WEB_SERVER_MODE_MULTI_THREADED:
+            return WEB_SERVER_MODE_MULTI_THREADED_NAME;
+    }
+}
+
 #ifndef HAVE_ACCEPT4
 int accept4(int sock, struct sockaddr *addr, socklen_t *addrlen, int flags) {
     int fd = accept(sock, addr, addrlen);
@@ -646,3 +676,497 @@ void *socket_listen_main_single_threaded(void *ptr) {
     pthread_exit(NULL);
     return NULL;
 }
+
+#ifdef HAVE_SYS_EPOLL_H
+// --------------------------------------------------------------------------------------
+// the epoll web server
+//
+// 1. the listener accepts new connections and hands them to the I/O threads, round robin
+// 2. each I/O thread multiplexes its connections with epoll, receives their requests
+//    and sends their responses, and disconnects the idle ones using a timer wheel
+// 3. the requests received, and the parts of streamed queries, are processed by the
+//    worker threads, that hand the clients back to their I/O threads when they are done
+//
+// the socket of a client is registered to epoll with EPOLLONESHOT, so that only one
+// thread works on a client at any time - it is re-armed by its I/O thread when the
+// client needs to wait for more input or output.
+
+#define WEB_SERVER_IO_EVENTS 100
+#define WEB_SERVER_TIMER_WHEEL_SLOTS 256
+
+#define WEB_SERVER_JOB_PROCESS 1                    // process the request received
+#define WEB_SERVER_JOB_SEND 2                       // generate the next part of a streamed query and send it
+
+struct web_server_io {
+    int id;
+
+    int efd;                                        // the epoll of the thread
+    int wakeup_fd;                                  // an eventfd, to wake up the thread when clients are handed to it
+
+    pthread_mutex_t mutex;                          // protects the handoff list
+    struct web_client *handoff;                     // the new clients, and the clients returned by the workers
+
+    time_t now;                                     // the last second the timer wheel has been checked
+    struct web_client *wheel[WEB_SERVER_TIMER_WHEEL_SLOTS];
+};
+
+static struct web_server_epoll {
+    int io_threads;
+    struct web_server_io *io;
+
+    int worker_threads;
+    struct web_client *first;                       // the queue of the clients waiting for a worker
+    struct web_client *last;
+} web_server_epoll = {
+        .io_threads = 0,
+        .io = NULL,
+        .worker_threads = 0,
+        .first = NULL,
+        .last = NULL
+};
+
+static pthread_mutex_t web_server_workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t web_server_workers_cond = PTHREAD_COND_INITIALIZER;
+
+// ----------------------------------------------------------------------------
+// handing clients to the I/O threads
+
+static inline void web_server_io_handoff(struct web_server_io *io, struct web_client *w) {
+    pthread_mutex_lock(&io->mutex);
+    w->io_next = io->handoff;
+    io->handoff = w;
+    pthread_mutex_unlock(&io->mutex);
+
+    uint64_t one = 1;
+    if(write(io->wakeup_fd, &one, sizeof(one)) != sizeof(one))
+        error("I/O THREAD %d: cannot wake up the thread.", io->id);
+}
+
+// ----------------------------------------------------------------------------
+// the worker threads
+
+static inline void web_server_workers_enqueue(struct web_client *w, int job) {
+    w->io_job = job;
+    w->io_next = NULL;
+
+    pthread_mutex_lock(&web_server_workers_mutex);
+    if(web_server_epoll.last) web_server_epoll.last->io_next = w;
+    else web_server_epoll.first = w;
+    web_server_epoll.last = w;
+    pthread_cond_signal(&web_server_workers_cond);
+    pthread_mutex_unlock(&web_server_workers_mutex);
+}
+
+static void *web_server_worker_main(void *ptr) {
+    (void)ptr;
+
+    info("WEB SERVER: worker thread created with task id %d", gettid());
+
+    if(pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL) != 0)
+        error("Cannot set pthread cancel type to DEFERRED.");
+
+    if(pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) != 0)
+        error("Cannot set pthread cancel state to ENABLE.");
+
+    for(;;) {
+        pthread_mutex_lock(&web_server_workers_mutex);
+        while(!web_server_epoll.first)
+            pthread_cond_wait(&web_server_workers_cond, &web_server_workers_mutex);
+
+        struct web_client *w = web_server_epoll.first;
+        web_server_epoll.first = w->io_next;
+        if(!web_server_epoll.first) web_server_epoll.last = NULL;
+        pthread_mutex_unlock(&web_server_workers_mutex);
+
+        switch(w->io_job) {
+            case WEB_SERVER_JOB_PROCESS:
+                debug(D_WEB_CLIENT, "%llu: Processing received data.", w->id);
+                web_client_process(w);
+                break;
+
+            case WEB_SERVER_JOB_SEND:
+                if(web_client_send(w) < 0) {
+                    debug(D_WEB_CLIENT, "%llu: Cannot send data to client. Closing client.", w->id);
+                    WEB_CLIENT_IS_DEAD(w);
+                }
+                break;
+
+            default:
+                error("%llu: INTERNAL ERROR: unknown web server job %d.", w->id, w->io_job);
+                break;
+        }
+
+        w->io_job = 0;
+        web_server_io_handoff(w->io, w);
+    }
+
+    // never reached
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// the timer wheel of the idle clients of each I/O thread
+// each slot has the clients expiring on the seconds that fall on it
+
+static inline void web_server_io_timer_del(struct web_server_io *io, struct web_client *w) {
+    if(!w->io_expires) return;
+
+    size_t slot = (size_t)w->io_expires % WEB_SERVER_TIMER_WHEEL_SLOTS;
+
+    if(w->io_timer_prev) w->io_timer_prev->io_timer_next = w->io_timer_next;
+    else io->wheel[slot] = w->io_timer_next;
+    if(w->io_timer_next) w->io_timer_next->io_timer_prev = w->io_timer_prev;
+
+    w->io_timer_prev = w->io_timer_next = NULL;
+    w->io_expires = 0;
+}
+
+static inline void web_server_io_timer_add(struct web_server_io *io, struct web_client *w, time_t now) {
+    web_server_io_timer_del(io, w);
+
+    w->io_expires = now + ((web_client_timeout > 0)?web_client_timeout:1);
+
+    size_t slot = (size_t)w->io_expires % WEB_SERVER_TIMER_WHEEL_SLOTS;
+    w->io_timer_prev = NULL;
+    w->io_timer_next = io->wheel[slot];
+    if(w->io_timer_next) w->io_timer_next->io_timer_prev = w;
+    io->wheel[slot] = w;
+}
+
+// ----------------------------------------------------------------------------
+// the I/O threads
+
+static void web_server_io_close(struct web_server_io *io, struct web_client *w) {
+    web_server_io_timer_del(io, w);
+
+    if(w->io_registered && epoll_ctl(io->efd, EPOLL_CTL_DEL, w->ofd, NULL) == -1)
+        error("%llu: cannot remove the socket %d from the epoll of I/O thread %d.", w->id, w->ofd, io->id);
+
+    web_client_reset(w);
+
+    log_access("%llu: %s port %s disconnected from I/O thread %d", w->id, w->client_ip, w->client_port, io->id);
+    debug(D_WEB_CLIENT, "%llu: done...", w->id);
+
+    // close the sockets/files now
+    // to free file descriptors
+    if(w->ifd == w->ofd) {
+        if(w->ifd != -1) close(w->ifd);
+    }
+    else {
+        if(w->ifd != -1) close(w->ifd);
+        if(w->ofd != -1) close(w->ofd);
+    }
+    w->ifd = -1;
+    w->ofd = -1;
+
+    // the listener will free it
+    w->obsolete = 1;
+}
+
+// watch the client for the input or the output it waits for
+// returns -1 when the client has nothing to wait for, and should be closed
+static int web_server_io_arm(struct web_server_io *io, struct web_client *w, time_t now) {
+    if(unlikely(w->dead || w->ofd < 0))
+        return -1;
+
+    // a file copied to the client is read when the client is handled - reading files does not block
+    if(unlikely(w->mode == WEB_CLIENT_MODE_FILECOPY && w->wait_receive && w->ifd != w->ofd)) {
+        if(web_client_receive(w) < 0) {
+            debug(D_WEB_CLIENT, "%llu: Cannot read the file to be sent. Closing client.", w->id);
+            return -1;
+        }
+    }
+
+    struct epoll_event ev = { .events = EPOLLONESHOT, .data.ptr = w };
+    if(w->wait_receive && w->mode != WEB_CLIENT_MODE_FILECOPY) ev.events |= EPOLLIN;
+    if(w->wait_send) ev.events |= EPOLLOUT;
+
+    if(unlikely(!(ev.events & (EPOLLIN | EPOLLOUT)))) {
+        debug(D_WEB_CLIENT, "%llu: client is not set for neither receiving nor sending data.", w->id);
+        return -1;
+    }
+
+    if(epoll_ctl(io->efd, (w->io_registered)?EPOLL_CTL_MOD:EPOLL_CTL_ADD, w->ofd, &ev) == -1) {
+        error("%llu: cannot add the socket %d to the epoll of I/O thread %d.", w->id, w->ofd, io->id);
+        return -1;
+    }
+    w->io_registered = 1;
+
+    web_server_io_timer_add(io, w, now);
+    return 0;
+}
+
+static void web_server_io_event(struct web_server_io *io, struct web_client *w, uint32_t events, time_t now) {
+    // the client is not idle
+    web_server_io_timer_del(io, w);
+
+    if(unlikely((events & (EPOLLERR | EPOLLHUP)) && !(events & (EPOLLIN | EPOLLOUT)))) {
+        debug(D_WEB_CLIENT_ACCESS, "%llu: Received error on socket.", w->id);
+        web_server_io_close(io, w);
+        return;
+    }
+
+    if(w->wait_send && events & EPOLLOUT) {
+        // the next part of a streamed query is generated by the workers
+        if(unlikely(w->response.stream && w->response.sent == w->response.data->len)) {
+            web_server_workers_enqueue(w, WEB_SERVER_JOB_SEND);
+            return;
+        }
+
+        if(web_client_send(w) < 0) {
+            debug(D_WEB_CLIENT, "%llu: Cannot send data to client. Closing client.", w->id);
+            web_server_io_close(io, w);
+            return;
+        }
+    }
+
+    if(w->wait_receive && w->mode != WEB_CLIENT_MODE_FILECOPY && events & EPOLLIN) {
+        if(web_client_receive(w) < 0) {
+            debug(D_WEB_CLIENT, "%llu: Cannot receive data from client. Closing client.", w->id);
+            web_server_io_close(io, w);
+            return;
+        }
+
+        if(w->mode == WEB_CLIENT_MODE_NORMAL) {
+            web_server_workers_enqueue(w, WEB_SERVER_JOB_PROCESS);
+            return;
+        }
+    }
+
+    if(web_server_io_arm(io, w, now) == -1)
+        web_server_io_close(io, w);
+}
+
+// the clients handed to the thread: the new ones and the ones the workers are done with
+static void web_server_io_handoffs(struct web_server_io *io, time_t now) {
+    uint64_t count;
+    if(read(io->wakeup_fd, &count, sizeof(count)) != sizeof(count))
+        error("I/O THREAD %d: cannot read its eventfd.", io->id);
+
+    pthread_mutex_lock(&io->mutex);
+    struct web_client *w = io->handoff;
+    io->handoff = NULL;
+    pthread_mutex_unlock(&io->mutex);
+
+    while(w) {
+        struct web_client *next = w->io_next;
+        w->io_next = NULL;
+
+        if(unlikely(!w->io_registered))
+            log_access("%llu: %s port %s connected on I/O thread %d", w->id, w->client_ip, w->client_port, io->id);
+
+        if(web_server_io_arm(io, w, now) == -1)
+            web_server_io_close(io, w);
+
+        w = next;
+    }
+}
+
+// disconnect the clients that have been idle for web_client_timeout seconds
+static void web_server_io_timeouts(struct web_server_io *io, time_t now) {
+    if(unlikely(!io->now || now - io->now >= WEB_SERVER_TIMER_WHEEL_SLOTS))
+        io->now = now - WEB_SERVER_TIMER_WHEEL_SLOTS;
+
+    for(; io->now < now ; io->now++) {
+        size_t slot = (size_t)(io->now + 1) % WEB_SERVER_TIMER_WHEEL_SLOTS;
+
+        struct web_client *w = io->wheel[slot];
+        while(w) {
+            struct web_client *next = w->io_timer_next;
+
+            if(w->io_expires <= now) {
+                debug(D_WEB_CLIENT, "%llu: Timeout while waiting socket async I/O for %s %s", w->id, w->wait_receive?"INPUT":"", w->wait_send?"OUTPUT":"");
+                web_server_io_close(io, w);
+            }
+
+            w = next;
+        }
+    }
+}
+
+static void *web_server_io_main(void *ptr) {
+    struct web_server_io *io = (struct web_server_io *)ptr;
+
+    info("WEB SERVER: I/O thread %d created with task id %d", io->id, gettid());
+
+    if(pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL) != 0)
+        error("Cannot set pthread cancel type to DEFERRED.");
+
+    if(pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) != 0)
+        error("Cannot set pthread cancel state to ENABLE.");
+
+    struct epoll_event events[WEB_SERVER_IO_EVENTS];
+
+    for(;;) {
+        int i, n = epoll_wait(io->efd, events, WEB_SERVER_IO_EVENTS, 1000);
+
+        if(unlikely(n == -1)) {
+            if(errno != EINTR)
+                error("I/O THREAD %d: epoll_wait() failed.", io->id);
+            continue;
+        }
+
+        time_t now = now_monotonic_sec();
+
+        for(i = 0; i < n ; i++) {
+            if(events[i].data.ptr)
+                web_server_io_event(io, (struct web_client *)events[i].data.ptr, events[i].events, now);
+            else
+                web_server_io_handoffs(io, now);
+        }
+
+        web_server_io_timeouts(io, now);
+    }
+
+    // never reached
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// the listener
+
+static inline int web_server_epoll_threads(const char *option, int def) {
+    int n = (int)config_get_number("global", option, def);
+    if(n < 1) {
+        error("Invalid %s %d. Using %d.", option, n, def);
+        n = def;
+    }
+    return n;
+}
+
+static void web_server_epoll_init(void) {
+    int i;
+
+    web_server_epoll.io_threads = web_server_epoll_threads("web server io threads", (processors > 1)?2:1);
+    web_server_epoll.io = callocz((size_t)web_server_epoll.io_threads, sizeof(struct web_server_io));
+
+    for(i = 0; i < web_server_epoll.io_threads ; i++) {
+        struct web_server_io *io = &web_server_epoll.io[i];
+        io->id = i + 1;
+
+        if(pthread_mutex_init(&io->mutex, NULL) != 0)
+            fatal("I/O THREAD %d: cannot initialize its mutex.", io->id);
+
+        io->efd = epoll_create1(EPOLL_CLOEXEC);
+        if(io->efd == -1)
+            fatal("I/O THREAD %d: cannot create its epoll.", io->id);
+
+        io->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(io->wakeup_fd == -1)
+            fatal("I/O THREAD %d: cannot create its eventfd.", io->id);
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+        if(epoll_ctl(io->efd, EPOLL_CTL_ADD, io->wakeup_fd, &ev) == -1)
+            fatal("I/O THREAD %d: cannot add its eventfd to its epoll.", io->id);
+
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, web_server_io_main, io) != 0)
+            fatal("I/O THREAD %d: failed to create the thread.", io->id);
+
+        if(pthread_detach(thread) != 0)
+            error("I/O THREAD %d: cannot detach the thread.", io->id);
+    }
+
+    int workers = web_server_epoll_threads("web server worker threads", processors);
+    for(i = 0; i < workers ; i++) {
+        pthread_t thread;
+
+        if(pthread_create(&thread, NULL, web_server_worker_main, NULL) != 0) {
+            error("WEB SERVER: failed to create worker thread No %d.", i + 1);
+            break;
+        }
+
+        if(pthread_detach(thread) != 0)
+            error("WEB SERVER: cannot detach worker thread No %d.", i + 1);
+    }
+
+    if(!i) fatal("WEB SERVER: no worker threads could be created.");
+    web_server_epoll.worker_threads = i;
+
+    info("WEB SERVER: %d I/O threads and %d worker threads started.", web_server_epoll.io_threads, web_server_epoll.worker_threads);
+}
+
+void *socket_listen_main_epoll(void *ptr) {
+    struct netdata_static_thread *static_thread = (struct netdata_static_thread *)ptr;
+
+    web_server_mode = WEB_SERVER_MODE_EPOLL;
+    info("epoll WEB SERVER thread created with task id %d", gettid());
+
+    struct web_client *w;
+    int retval, counter = 0;
+    size_t next_io = 0;
+
+    if(pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL) != 0)
+        error("Cannot set pthread cancel type to DEFERRED.");
+
+    if(pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) != 0)
+        error("Cannot set pthread cancel state to ENABLE.");
+
+    if(!listen_fds_count)
+        fatal("LISTENER: No sockets to listen to.");
+
+    web_server_epoll_init();
+
+    struct pollfd *fds = callocz(sizeof(struct pollfd), listen_fds_count);
+
+    size_t i;
+    for(i = 0; i < listen_fds_count ;i++) {
+        fds[i].fd = listen_fds[i];
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+
+        info("Listening on '%s'", (listen_fds_names[i])?listen_fds_names[i]:"UNKNOWN");
+    }
+
+    int timeout = 10 * 1000;
+
+    for(;;) {
+        retval = poll(fds, listen_fds_count, timeout);
+
+        if(unlikely(retval == -1)) {
+            error("LISTENER: poll() failed.");
+            continue;
+        }
+        else if(unlikely(!retval)) {
+            debug(D_WEB_CLIENT, "LISTENER: poll() timeout.");
+            counter = 0;
+            cleanup_web_clients();
+            continue;
+        }
+
+        for(i = 0 ; i < listen_fds_count ; i++) {
+            short int revents = fds[i].revents;
+
+            // check for new incoming connections
+            if(revents & POLLIN || revents & POLLPRI) {
+                fds[i].revents = 0;
+
+                w = web_client_create(fds[i].fd);
+                if(unlikely(!w)) {
+                    // no need for error log - web_client_create already logged the error
+                    continue;
+                }
+
+                w->io = &web_server_epoll.io[next_io++ % web_server_epoll.io_threads];
+                web_server_io_handoff(w->io, w);
+            }
+        }
+
+        // cleanup unused clients
+        counter++;
+        if(counter >= CLEANUP_EVERY_EVENTS) {
+            counter = 0;
+            cleanup_web_clients();
+        }
+    }
+
+    debug(D_WEB_CLIENT, "LISTENER: exit!");
+    close_listen_sockets();
+
+    freez(fds);
+
+    static_thread->enabled = 0;
+    pthread_exit(NULL);
+    return NULL;
+}
+#endif /* HAVE_SYS_EPOLL_H */
@@ -15,10 +15,31 @@
 
 #define WEB_SERVER_MODE_MULTI_THREADED 0
 #define WEB_SERVER_MODE_SINGLE_THREADED 1
+#define WEB_SERVER_MODE_EPOLL 2
 extern int web_server_mode;
 
+#define WEB_SERVER_MODE_MULTI_THREADED_NAME "multi-threaded"
+#define WEB_SERVER_MODE_SINGLE_THREADED_NAME "single-threaded"
+#define WEB_SERVER_MODE_EPOLL_NAME "epoll"
+
+extern int web_server_mode_id(const char *mode);
+extern const char *web_server_mode_name(int id);
+
 extern void *socket_listen_main_multi_threaded(void *ptr);
 extern void *socket_listen_main_single_threaded(void *ptr);
+
+// the mode used when neither 'web server mode' nor 'multi threaded web server'
+// is set - 'multi threaded web server = yes' selects the multi threaded mode
+#ifdef HAVE_SYS_EPOLL_H
+#define WEB_SERVER_MODE_DEFAULT WEB_SERVER_MODE_EPOLL
+
+// the epoll web server
+// the connections are multiplexed on 'web server io threads' threads
+// and their requests are processed by 'web server worker threads' threads
+extern void *socket_listen_main_epoll(void *ptr);
+#else
+#define WEB_SERVER_MODE_DEFAULT WEB_SERVER_MODE_MULTI_THREADED
+#endif /* HAVE_SYS_EPOLL_H */
 extern int create_listen_sockets(void);
 extern int is_listen_socket(int fd);
 